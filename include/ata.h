@@ -57,6 +57,7 @@
 #define ATA_DEV_SATAPI 0x04
 
 #define ATAPI_SECTOR_SIZE 2048
+#define ATA_SECTOR_SIZE   512
 
 /*
 ** Types
@@ -78,8 +79,10 @@ typedef struct ata_device{
 */
 
 int32_t detect_device_ATA(ata_device_t *dev);
-int32_t read_sectors_ATA_PIO(uint32_t lba, uint8_t buffer, ata_device_t *dev);
-int32_t write_sectors_ATA_PIO(uint32_t lba, uint8_t sector_count, uint32_t *bytes);
+int32_t read_sectors_ATA_PIO(uint32_t lba, uint8_t *buffer, ata_device_t *dev);
+uint32_t size_ATA(ata_device_t *dev);
+int32_t read_disk_ATA_PIO(uint32_t lba, uint8_t sector_count, uint8_t *buffer, ata_device_t *dev);
+int32_t write_disk_ATA_PIO(uint32_t lba, uint8_t sector_count, const uint8_t *buffer, ata_device_t *dev);
 
 #endif
 /* SP_ASM_SRC */
@@ -32,6 +32,11 @@
 #define	GDT_DATA	0x0018		/* All of memory, R/W */
 #define	GDT_STACK	0x0020		/* All of memory, R/W */
 
+	/* task state segments, added by the kernel (see paging.c) */
+#define	GDT_TSS		0x0028		/* the kernel's own task */
+#define	GDT_PF_TSS	0x0030		/* the page fault task */
+#define	GDT_CPU_TSS	0x0010		/* each other CPU's pair follows */
+
 /*
 ** The Interrupt Descriptor Table (0000:2500 - 0000:2D00)
 */
@@ -65,6 +65,16 @@ extern queue_t _sleeping;
 */
 void _clk_init( void );
 
+/**
+** Name:  _clk_tick
+**
+** The part of a clock tick each CPU does for itself:  aging its
+** ready queue and charging its current process for the tick.  The
+** PIT interrupt does this for the bootstrap CPU, and the local APIC
+** timer (see smp.c) for the others.
+*/
+void _clk_tick( void );
+
 #endif
 /* SP_ASM_SRC */
 
@@ -37,6 +37,11 @@
 #define CHAN_CIO    0
 #define CHAN_SIO    1
 
+// mmap() protection flags
+
+#define PROT_READ   0x1
+#define PROT_WRITE  0x2
+
 // maximum number of processes in the system
 
 #define N_PROCS     25
@@ -105,12 +110,13 @@ enum state_e {
 
 typedef uint8_t state_t;
 
-// Process priorities (visible to user code)
+// Process priorities (visible to user code):  N_PRIOS levels, with
+// 0 the highest; the named ones are the usual choices
+
+#define N_PRIOS     32
 
 enum prio_e {
-    System = 0, User, Deferred,
-    // sentinel
-    N_PRIOS
+    System = 0, User = N_PRIOS / 2, Deferred = N_PRIOS - 1
 };
 
 #define PRIO_HIGH   System
@@ -145,6 +151,7 @@ typedef int status_t;
 #define E_NOT_FOUND     (-8)
 #define E_NO_CHILDREN   (-9)
 #define E_KILLED        (-10)
+#define E_OVERLOAD      (-11)
 
 /*
 ** Additional OS-only or user-only things
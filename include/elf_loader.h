@@ -80,17 +80,24 @@ typedef struct {
 #define PT_TLS		7		/* Thread-local storage segment */
 #define	PT_NUM		8		/* Number of defined types */
 
+#define PF_X		0x1		/* Segment is executable */
+#define PF_W		0x2		/* Segment is writable */
+#define PF_R		0x4		/* Segment is readable */
+
 
 /**
-** _elf_load_program(address)
+** _elf_load_program(address,areas)
 **
 ** Loads ELF binary stored in physical memory. Returns entry point on success.
+** The segments are not copied here; each one is added to the area list,
+** and its pages are filled in from the binary when first touched.
 **
 ** @param address	Location in physical memory to read from
+** @param areas		Area list of the address space to load into
 **
 ** @return The entry point of the program or zero on failure. 
 */
-uint32_t _elf_load_program(uint32_t address);
+uint32_t _elf_load_program(uint32_t address, struct vm_area_s **areas);
 
 #endif /* SP_ASM_SRC */
 #endif /* ELF_H_ */
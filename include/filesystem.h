@@ -127,12 +127,32 @@ typedef struct FAT32_struct {
     uint32_t data_begin_sector;
     uint32_t FAT_begin_sector;
     uint32_t current_cluster_pos;
+    // the FAT sector last read by _fat_next, and its number
+    uint32_t FAT_cache[SECTOR_SIZE / sizeof(uint32_t)];
+    uint32_t FAT_cache_sector;
+    // where file_read_page last was in a cluster chain: the
+    // chain's first cluster, how far along it, and the cluster there
+    uint32_t chain_first;
+    uint32_t chain_index;
+    uint32_t chain_cluster;
 } f32_t;
 
+/*
+** What's needed to read a file: its first cluster (which also
+** identifies it) and its size
+*/
+typedef struct file_s {
+    uint32_t cluster;
+    uint32_t size;
+} file_t;
+
 /*
 ** Globals
 */
 
+// the filesystem, if make_Filesystem() could set it up
+extern f32_t *_filesystem;
+
 /*
 ** Prototypes
 */
@@ -155,6 +175,10 @@ directory_t *create_dir(f32_t *filesystem, uint32_t cluster);
 
 void rm_dir(f32_t *filesystem);
 
+int file_lookup(f32_t *filesystem, const char *filename, file_t *file);
+
+int file_read_page(f32_t *filesystem, file_t *file, uint32_t index, uint8_t *buffer);
+
 #endif
 /* SP_ASM_SRC */
 
@@ -46,7 +46,7 @@ extern char b512[512];
 
 // Other system variables (see kernel.c for possible names)
 
-// A separate stack for the OS itself
+// A separate stack for the OS itself (the bootstrap CPU's)
 // (NOTE: this assumes the OS is not reentrant!)
 extern stack_t *_system_stack;
 extern uint32_t *_system_esp;
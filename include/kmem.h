@@ -97,33 +97,50 @@ void *_km_page_alloc( uint32_t count );
 /**
 ** Name:    _km_page_free
 **
-** Returns a memory block to the list of available blocks,
-** combining it with adjacent blocks if they're present.
+** Returns a memory block to the free pool, combining it with
+** its buddies if they're free.
 **
-** CRITICAL ASSUMPTION:  multi-page blocks will be freed one page
-** at a time!
+** The whole block obtained from _km_page_alloc() is released.
 **
-** @param block   Pointer to the page to be returned to the free list
+** @param block   Pointer to the block to be returned to the free pool
 */
 void _km_page_free( void *block );
 
+/**
+** Name:    kmalloc
+**
+** Allocate a block of memory of (at least) the requested size.
+** Requests of up to 2KB come from power-of-two size classes;
+** larger ones are given whole pages.
+**
+** @param size  Number of bytes desired
+**
+** @return a pointer to the memory, or NULL if none is available
+*/
+void *kmalloc( uint32_t size );
+
+/**
+** Name:    kfree
+**
+** Return a block obtained from kmalloc().
+**
+** @param ptr  The block, or NULL
+*/
+void kfree( void *ptr );
+
 /**
 ** Name:    _km_slice_alloc
 **
-** Dynamically allocates a slice (1/4 of a page).  If no
-** memory is available, we panic.
+** Dynamically allocates a slice (1/4 of a page).
 **
-** @return a pointer to the allocated slice
+** @return a pointer to the allocated slice, or NULL
 */
 void *_km_slice_alloc( void );
 
 /**
 ** Name:    _km_slice_free
 **
-** Returns a slice to the list of available slices.
-**
-** We make no attempt to merge slices, as they are independent
-** blocks of memory (unlike pages).
+** Returns a slice to the pool of available slices.
 **
 ** @param block  Pointer to the slice (1/4 page) to be freed
 */
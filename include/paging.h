@@ -9,6 +9,30 @@
 #define PAGE_TABLE_INDEX(x) (((x) >> 12) & 0x3ff)
 #define PAGE_GET_PHYSICAL_ADDRESS(x) (*x & ~0xfff)
 
+// Size of a PSE large page
+#define SZ_LARGE_PAGE 0x400000
+
+// Physical memory below this address is identity mapped (with 4MB pages)
+// in every page directory. Memory above it is not used by the kernel.
+#define IDENT_MAP_LIMIT 0x10000000
+
+// User program images live between these addresses. Pages in this
+// range are shared copy-on-write between a parent and its forked child.
+#define USER_VIRT_BASE  IDENT_MAP_LIMIT
+#define USER_VIRT_LIMIT 0xc0000000
+
+// Page fault error code bits
+#define PF_PRESENT  0x1     // fault on a present page (protection)
+#define PF_WRITE    0x2     // faulting access was a write
+#define PF_USER     0x4     // fault happened in user mode
+
+// Attributes for the range functions (map_range etc.)
+#define MAP_WRITE   0x1     // pages may be written
+#define MAP_USER    0x2     // pages may be used from user mode
+#define MAP_COW     0x4     // read-only until written, then copied
+#define MAP_SHARED  0x8     // stays shared (not copy-on-write) across fork
+#define MAP_NOCACHE 0x10    // device memory; not cached
+
 typedef uint32_t pte_t;
 typedef uint32_t pde_t;
 typedef uint32_t phys_addr;
@@ -35,6 +59,9 @@ enum PAGE_PTE_FLAGS {
     I86_PTE_PAT = 0x80,            // 0000000000000000000000010000000
     I86_PTE_CPU_GLOBAL = 0x100,    // 0000000000000000000000100000000
     I86_PTE_LV4_GLOBAL = 0x200,    // 0000000000000000000001000000000
+    I86_PTE_COW = 0x400,           // 0000000000000000000010000000000 (OS use)
+    I86_PTE_SHARED = 0x800,        // 0000000000000000000100000000000 (OS use)
+    I86_PTE_SWAPPED = 0x200,       // 0000000000000000000001000000000 (OS use, not-present ptes)
     I86_PTE_FRAME = 0x7FFFF000     // 1111111111111111111000000000000
 };
 
@@ -157,6 +184,16 @@ void pde_set_frame(pde_t * pde, phys_addr phys);
 */
 phys_addr pde_get_frame(pde_t * pde);
 /**
+** Name:    pde_is_large
+**
+** Tests whether a pde maps a 4MB page rather than a page table
+**
+** @param pde   A pointer to the pde
+**
+** @return true if the pde is a present 4MB mapping
+*/
+bool_t pde_is_large(pde_t * pde);
+/**
 ** Name:    alloc_page
 **
 ** Allocate a frame, set the pte to use the frame, mark as present 
@@ -215,8 +252,8 @@ struct page_directory * get_kernel_pg_dir(void);
 /**
 ** Name:    set_page_directory
 **
-**  Set cr3 to use the passed page directory
-** Also enable the paging bit in cr0
+**  Set cr3 to use the passed page directory, unless it is already
+**  in use
 **
 ** @param pg_dir the page directory to use
 */
@@ -250,11 +287,71 @@ void map_virt_page_to_phys_pg_dir(struct page_directory * pg_dir, virt_addr virt
 */
 void unmap_virt(struct page_directory * pg_dir, virt_addr virt);
 /**
+** Name:    map_range
+**
+** Map a range of virtual addresses to physically contiguous frames,
+** looking up each page table once and invalidating the TLB once
+**
+** @param pg_dir the page directory to use
+** @param virt the first virtual address (page-aligned)
+** @param phys the first frame
+** @param size the size of the range, in bytes
+** @param flags MAP_* flags for every page
+**
+** @return false if a page table could not be allocated
+*/
+bool_t map_range(struct page_directory * pg_dir, virt_addr virt, phys_addr phys, uint32_t size, uint32_t flags);
+/**
+** Name:    unmap_range
+**
+** Unmap a range of virtual addresses. The frames are not freed.
+**
+** @param pg_dir the page directory to use
+** @param virt the first virtual address (page-aligned)
+** @param size the size of the range, in bytes
+*/
+void unmap_range(struct page_directory * pg_dir, virt_addr virt, uint32_t size);
+/**
+** Name:    release_range
+**
+** Unmap a range of virtual addresses, and drop a reference to each
+** frame that was mapped there
+**
+** @param pg_dir the page directory to use
+** @param virt the first virtual address (page-aligned)
+** @param size the size of the range, in bytes
+*/
+void release_range(struct page_directory * pg_dir, virt_addr virt, uint32_t size);
+/**
+** Name:    protect_range
+**
+** Change the access allowed to the present pages in a range
+**
+** @param pg_dir the page directory to use
+** @param virt the first virtual address (page-aligned)
+** @param size the size of the range, in bytes
+** @param flags the new MAP_* flags
+*/
+void protect_range(struct page_directory * pg_dir, virt_addr virt, uint32_t size, uint32_t flags);
+/**
+** Name:    alloc_range
+**
+** Give every unmapped page in a range a new, zeroed frame
+**
+** @param pg_dir the page directory to use
+** @param virt the first virtual address (page-aligned)
+** @param size the size of the range, in bytes
+** @param flags MAP_* flags for the new pages
+**
+** @return false if memory ran out
+*/
+bool_t alloc_range(struct page_directory * pg_dir, virt_addr virt, uint32_t size, uint32_t flags);
+/**
 ** Name:    get_base_pg_dir
 **
 **  Get a basic page directory that will be used for the kernel.
-**  Identity maps the bottom 600KB.
-**  Maps the bottom 1MB to 0xc0000000
+**  Identity maps all memory below IDENT_MAP_LIMIT using 4MB pages.
+**  Maps the bottom 4MB to 0xc0000000
 **
 ** @return a pointer to the base page directory
 */
@@ -262,8 +359,11 @@ struct page_directory * get_base_pg_dir(void);
 /**
 ** Name:    copy_pg_dir
 **
-** Copies a page directory. Each page table uses a different frame,
-** but each pte uses the same frame.
+** Copies a page directory. The kernel half (from USER_VIRT_LIMIT up)
+** shares its page tables with every other directory. Below that, each
+** page table uses a different frame, but each pte uses the same frame.
+** Writable user pages are made read-only and copy-on-write in both
+** directories.
 **
 ** @param pg_dir the page directory to copy
 **
@@ -274,12 +374,117 @@ struct page_directory * copy_pg_dir(struct page_directory * pg_dir);
 ** Name:    delete_pg_dir
 **
 ** This just clears the page tables of a page directory.
-** Something else is repsonsible for freeing the backing frames for each pte
+** Something else is repsonsible for freeing the backing frames for each pte.
+** The shared kernel page tables are left alone.
 **
 ** @param pg_dir the page directory to delete
 */
 void delete_pg_dir(struct page_directory * pg_dir);
 /**
+** Name:    release_user_pages
+**
+** Unmap every user page (see USER_VIRT_BASE) in a page directory,
+** dropping the references to their frames, and free the page tables
+** which held them.
+**
+** @param pg_dir the page directory to strip
+*/
+void release_user_pages(struct page_directory * pg_dir);
+/**
+** Name:    cow_break
+**
+** Give a page directory its own writable copy of a copy-on-write page.
+** Does nothing if the page is not copy-on-write.
+**
+** @param pg_dir the page directory to use
+** @param virt the address within the page
+**
+** @return false if the page is copy-on-write and could not be copied
+*/
+bool_t cow_break(struct page_directory * pg_dir, virt_addr virt);
+/**
+** Name:    find_pte
+**
+** Find the pte for an address, if it has a page table
+**
+** @param pg_dir the page directory to search
+** @param virt the virtual address
+**
+** @return the pte, or NULL if the address has no page table
+*/
+pte_t * find_pte(struct page_directory * pg_dir, virt_addr virt);
+/**
+** Name:    flush_page
+**
+** Throw away the TLB entry for a page whose pte was changed, if the
+** page directory is the current one
+**
+** @param pg_dir the page directory that was changed
+** @param virt an address within the page
+*/
+void flush_page(struct page_directory * pg_dir, virt_addr virt);
+/**
+** Name:    kmap
+**
+** Get a kernel address for a frame, which must be released with
+** kunmap(). Frames in the identity map cost nothing; others use a
+** small window of temporary mappings.
+**
+** @param frame the frame to map
+**
+** @return the kernel address of the frame
+*/
+void * kmap(phys_addr frame);
+/**
+** Name:    kunmap
+**
+** Release an address obtained from kmap
+**
+** @param addr the address kmap returned
+*/
+void kunmap(void * addr);
+/**
+** Name:    pg_dir_ptr
+**
+** Get a kernel pointer to memory in another address space. The page
+** must already be present and writable; the pointer is only good
+** until the next call to kmap.
+**
+** @param pg_dir the page directory to use
+** @param virt the address
+**
+** @return the pointer, or NULL if the page was not writable
+*/
+void * pg_dir_ptr(struct page_directory * pg_dir, virt_addr virt);
+/**
+** Name:    copy_to_pg_dir
+**
+** Copy data into memory in another address space. The destination
+** must already be present and writable.
+**
+** @param pg_dir the page directory of the destination
+** @param virt the destination address
+** @param src the data to copy
+** @param len the number of bytes to copy
+**
+** @return false if some of the destination was not writable
+*/
+bool_t copy_to_pg_dir(struct page_directory * pg_dir, virt_addr virt, const void * src, uint32_t len);
+/**
+** Name:    map_page
+**
+** Map a frame at a virtual address in a page directory, allocating a
+** page table if need be.
+**
+** @param pg_dir the page directory to use
+** @param virt the wanted virtual address
+** @param phys the backing frame address
+** @param writable whether the page may be written
+**
+** @return false if a page table could not be allocated
+*/
+bool_t map_page(struct page_directory * pg_dir, virt_addr virt, phys_addr phys, bool_t writable);
+/**
 ** Name:    alloc_page_at
 **
 ** Allocate a new page at a given virtual address.
@@ -302,6 +507,17 @@ bool_t alloc_page_at(struct page_directory * pg_dir, virt_addr virt);
 */
 bool_t is_mapped(struct page_directory * pg_dir, virt_addr virt);
 /**
+** Name:    is_writable
+**
+** Test if an address is mapped and may be written
+**
+** @param pg_dir the page directory to use
+** @param virt the address to check
+**
+** @return true if a write to the address would not fault
+*/
+bool_t is_writable(struct page_directory * pg_dir, virt_addr virt);
+/**
 ** Name:    free_frame_at
 **
 ** Free the frame at a given virtual address. 
@@ -318,6 +534,30 @@ void free_frame_at(struct page_directory * pg_dir, virt_addr virt);
 */
 void _paging_init(void);
 /**
+** Name:    _paging_cpu_init
+**
+** Sets up paging on an application processor, which is already
+** using the kernel's page directory (see smp_boot.S)
+**
+** @param pf_stack the top of a stack for its page fault task
+** @param idt its IDT, which gets a page fault task gate
+*/
+void _paging_cpu_init(uint32_t * pf_stack, void * idt);
+/**
+** Name:    _paging_enter
+**
+** Catch up with changes to kernel mappings made on other CPUs since
+** this one was last in the kernel. Called each time a CPU takes the
+** kernel lock (see _smp_enter).
+*/
+void _paging_enter(void);
+/**
+** Name:    _paging_dump
+**
+** Print the TLB maintenance counters
+*/
+void _paging_dump(void);
+/**
 ** Name:    is_paging_init
 **
 ** Tests if paging is initialized
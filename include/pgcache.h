@@ -0,0 +1,75 @@
+/*
+** @file pgcache.h
+**
+** @author CSCI-452 class of 20215
+**
+** Page cache module declarations
+*/
+
+#ifndef PGCACHE_H_
+#define PGCACHE_H_
+
+/*
+** General (C and/or assembly) definitions
+*/
+
+#ifndef SP_ASM_SRC
+
+/*
+** Start of C-only definitions
+*/
+
+#include "common.h"
+
+#include "paging.h"
+#include "filesystem.h"
+
+/*
+** Types
+*/
+
+/*
+** Globals
+*/
+
+/*
+** Prototypes
+*/
+
+/**
+** _pgc_init() - initialize the page cache module
+**
+** Dependencies:
+**    Cannot be called before kmem is initialized
+**    Must be called before any file can be mapped
+*/
+void _pgc_init( void );
+
+/**
+** _pgc_get() - find the frame holding a page of a file
+**
+** The page is read in from the filesystem if it isn't in the cache.
+**
+** @param file     The file
+** @param index    Which page of the file
+**
+** @return the frame, with a reference for the caller, or 0
+*/
+phys_addr _pgc_get( file_t *file, uint32_t index );
+
+/**
+** _pgc_reclaim() - drop a cached page which nothing maps
+**
+** @return true if a frame was freed
+*/
+bool_t _pgc_reclaim( void );
+
+/**
+** _pgc_dump() - print the page cache statistics on the console
+*/
+void _pgc_dump( void );
+
+#endif
+/* SP_ASM_SRC */
+
+#endif
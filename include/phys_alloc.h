@@ -7,11 +7,43 @@
 #include "paging.h"
 #include "lib.h"
 
-// Allocate us a frame. 
+// Allocator statistics, in frames
+typedef struct phys_stats_s {
+    uint32_t pool_frames;   // size of the bitmap pool
+    uint32_t pool_free;     // unallocated frames in the pool
+    uint32_t zeroed;        // cleared frames waiting to be handed out
+    uint32_t kmem_frames;   // frames borrowed from kmem
+    uint32_t in_use;        // allocated and not yet freed
+    uint32_t shared;        // frames with more than one reference
+    uint32_t allocs;        // allocated since boot
+    uint32_t frees;         // freed since boot
+} phys_stats_t;
+
+// Allocate us a frame.
 phys_addr alloc_frame(void);
 // Free us a frame
 void free_frame(phys_addr addr);
+// Allocate us a frame that is filled with zeroes
+phys_addr alloc_zeroed_frame(void);
+// Zero up to batch frames for alloc_zeroed_frame. Returns how many more are wanted
+uint32_t _phys_zero_fill(uint32_t batch);
+// Allocate count physically contiguous frames. Returns 0 on failure
+phys_addr alloc_frames(uint32_t count);
+// Free count contiguous frames starting at addr
+void free_frames(phys_addr addr, uint32_t count);
+// Add a reference to a frame that is being shared
+void ref_frame(phys_addr addr);
+// Drop a reference to a frame. The last reference frees it
+void unref_frame(phys_addr addr);
+// Number of references to a frame
+uint32_t frame_refs(phys_addr addr);
+// Create the frame reference counts. Needs kmem, so runs after _phys_alloc_init
+void _phys_refs_init(uint32_t frames);
+// Fill in the allocator statistics
+void _phys_stats(phys_stats_t *st);
+// Print the allocator statistics on the console
+void _phys_dump(void);
 // Initialize the physical allocator. Give a address for us to store frames and a number of frames we can use
 void _phys_alloc_init(phys_addr addr, uint32_t  num_frames);
 #endif
-#endif
\ No newline at end of file
+#endif
@@ -27,13 +27,17 @@
 
 #include "common.h"
 
+// Every process' stack (and so its context) is at the same address in
+// its own address space, so these go through _pcb_word() to find the
+// word in whichever address space it actually lives in.
+
 // REG(pcb,x) -- access a specific register in a process context
 
-#define REG(pcb,x)  ((pcb)->context->x)
+#define REG(pcb,x)  (*_pcb_word( (pcb), &(pcb)->context->x ))
 
 // RET(pcb) -- access return value register in a process context
 
-#define RET(pcb)    ((pcb)->context->eax)
+#define RET(pcb)    REG(pcb,eax)
 
 // ARG(pcb,n) -- access argument #n from the indicated process
 //
@@ -45,7 +49,8 @@
 // ASSUMES THE STANDARD 32-BIT ABI, WITH PARAMETERS PUSHED ONTO THE
 // STACK.  IF THE PARAMETER PASSING MECHANISM CHANGES, SO MUST THIS!
 
-#define ARG(pcb,n)  ( ( (uint32_t *) (((pcb)->context) + 1) ) [(n)] )
+#define ARG(pcb,n)  (*_pcb_word( (pcb), \
+                        ( (uint32_t *) (((pcb)->context) + 1) ) + (n) ))
 
 /*
 ** Types
@@ -90,6 +95,24 @@ typedef struct context {
 // needs to know what a context_t looks like.  Bleh.
 #include "stacks.h"
 #include "paging.h"
+#include "filesystem.h"
+
+// number of files a process can have open at once
+#define N_FILES     8
+
+// real-time (EDF) parameters of a process, in ticks; a process is
+// only real-time if its runtime is non-zero
+typedef struct rt_s {
+    uint32_t runtime;       // CPU time wanted in each period
+    uint32_t period;        // how often it is wanted
+    uint32_t deadline;      // when, after each period starts, it is due
+    uint32_t util;          // runtime / deadline, in thousandths
+    time_t release;         // start of the current period
+    time_t due;             // end of the current job's window
+    uint32_t budget;        // CPU time left in this period
+    uint32_t misses;        // deadlines missed
+} rt_t;
+
 // the process control block
 //
 // fields are ordered by size to avoid padding
@@ -112,7 +135,7 @@ typedef struct pcb_s {
 
     // one-byte values
     state_t state;          // current state (see common.h)
-    prio_t priority;        // process priority (MLQ queue level)
+    prio_t priority;        // current priority (ready queue level)
 
     uint8_t quantum;        // quantum for this process
     uint8_t ticks;          // ticks remaining in current slice
@@ -121,6 +144,19 @@ typedef struct pcb_s {
     // adjust this as fields are added/removed/changed
     // uint8_t filler[4];
     struct page_directory * pg_dir;    
+    struct vm_area_s * vm;  // parts of the address space filled on demand
+    uint32_t heap;          // start of the heap
+    uint32_t brk;           // end of the heap (the "break")
+    file_t files[N_FILES];  // open files; a zero cluster marks a free slot
+    struct pcb_s *rq_next;  // ready queue links (see scheduler.c)
+    struct pcb_s *rq_prev;
+    time_t rq_time;         // when it was put on the ready queue
+    uint32_t rq_index;      // position in the fair class heap
+    uint64_t vruntime;      // weighted CPU time used (fair class)
+    rt_t rt;                // real-time parameters (EDF class)
+    prio_t base;            // priority given at creation or exec
+    uint8_t cpu;            // CPU whose ready queue it goes on
+    uint32_t shm;           // shm handles it holds, one bit each
 } pcb_t;
 
 /*
@@ -147,7 +183,7 @@ extern pcb_t *_processes[N_PROCS];
 /**
 ** _pcb_init() - initialize the process module
 **
-** Allocates an initial set of PCBs, does whatever else is
+** Creates the PCB cache, does whatever else is
 ** needed to make it possible to create processes
 **
 ** Dependencies:
@@ -170,10 +206,20 @@ pcb_t *_pcb_alloc( void );
 /**
 ** _pcb_free() - free a PCB
 **
-** @param pcb   The PCB to be returned to the free list
+** @param pcb   The PCB to be returned to its cache
 */
 void _pcb_free( pcb_t *pcb );
 
+/**
+** _pcb_word(pcb,addr) - find a word on a process' stack
+**
+** @param pcb   The process
+** @param addr  Address of the word in the process' address space
+**
+** @return a pointer the kernel can use to read or write the word
+*/
+uint32_t *_pcb_word( pcb_t *pcb, uint32_t *addr );
+
 /*
 ** Debugging/tracing routines
 */
@@ -16,9 +16,6 @@
 ** used in either C or assembly-language source code.
 */
 
-// initial number of queues to create
-#define N_QUEUES    5
-
 #ifndef SP_ASM_SRC
 
 /*
@@ -63,11 +60,11 @@ typedef uint32_t key_t;
 queue_t _queue_create( int (*order)(const key_t, const key_t) );
 
 /**
-** _queue_delete() - return a queue to the free list
+** _queue_delete() - return a queue to its cache
 **
 ** Deallocates the supplied queue
 **
-** @param q   The queue to be put on the free list
+** @param q   The queue to be freed
 */
 void _queue_delete( queue_t q );
 
@@ -27,8 +27,25 @@
 ** the C compiler should be put here.
 */
 
-// standard process quantum
+// quantum for the highest priority levels; each band of Q_BAND levels
+// below them gets twice the quantum of the band above
 #define Q_DEFAULT       5
+#define Q_BAND          8
+
+// fair class:  every runnable process should get a slice within
+// FAIR_LATENCY ticks, but no slice is shorter than FAIR_MIN_SLICE
+#define FAIR_LATENCY    20
+#define FAIR_MIN_SLICE  2
+
+// EDF class:  the most of the CPU (in thousandths) real-time processes
+// may be promised, and the longest period they may ask for
+#define RT_MAX_UTIL     900
+#define RT_MAX_PERIOD   SEC_TO_TICKS(10)
+
+// how often (in ticks) the ready queue is aged, and how long a process
+// must have been waiting to be moved up a level
+#define AGE_INTERVAL    50
+#define AGE_WAIT        100
 
 /*
 ** Types
@@ -38,12 +55,15 @@
 ** Globals
 */
 
-// the ready queue:  a MLQ with one level per priority value
-extern queue_t _ready[N_PRIOS];
-
-// the current user process
+// the current user process (of the CPU running the kernel; see smp.h)
 extern pcb_t *_current;
 
+// the quantum for each priority level
+extern uint8_t _quanta[N_PRIOS];
+
+// is the fair class in use?
+extern bool_t _sched_fair;
+
 /*
 ** Prototypes
 */
@@ -51,14 +71,25 @@ extern pcb_t *_current;
 /**
 ** _sched_init() - initialize the scheduler module
 **
-** Allocates the ready queues and resets the "current process" pointer
+** Empties the ready queue and resets the "current process" pointer.
+** The fair class is used if SCHED_FAIR is defined.
 **
 ** Dependencies:
-**    Cannot be called before queues are initialized
 **    Must be called before any process scheduling can be done
 */
 void _sched_init( void );
 
+/**
+** _sched_cpu_init() - give a CPU its idle process
+**
+** The idle process runs when the CPU has nothing else to do, and is
+** never on the ready queue.
+**
+** @param id    The CPU
+** @param idle  Its idle process
+*/
+void _sched_cpu_init( uint32_t id, pcb_t *idle );
+
 /**
 ** _schedule() - add a process to the ready queue
 **
@@ -68,6 +99,99 @@ void _sched_init( void );
 */
 void _schedule( pcb_t *pcb );
 
+/**
+** _sched_remove() - take a process off the ready queue
+**
+** @param pcb   The process, which must be in the Ready state
+*/
+void _sched_remove( pcb_t *pcb );
+
+/**
+** _sched_exit() - note that a process is exiting
+**
+** @param pcb   The process
+*/
+void _sched_exit( pcb_t *pcb );
+
+/**
+** _sched_set_fair() - choose the scheduling class
+**
+** Processes already on the ready queue are moved over.
+**
+** @param fair  true for the fair class, false for the MLFQ
+*/
+void _sched_set_fair( bool_t fair );
+
+/**
+** _sched_set_rt() - make a process real-time, or not
+**
+** The process will be given 'runtime' ticks of CPU time within
+** 'deadline' ticks of the start of every 'period', ahead of all other
+** processes, as long as it doesn't ask for more than that.  A runtime
+** of 0 makes it an ordinary process again.
+**
+** @param pcb       The process, which must not be on the ready queue
+** @param runtime   CPU time wanted in each period
+** @param period    Length of a period
+** @param deadline  When the CPU time is wanted by (0 for the period)
+**
+** @return E_SUCCESS, E_BAD_PARAM, or E_OVERLOAD if the CPU can't
+**         promise that much time
+*/
+status_t _sched_set_rt( pcb_t *pcb, uint32_t runtime, uint32_t period,
+                        uint32_t deadline );
+
+/**
+** _sched_rt_tick() - enforce real-time budgets and deadlines
+**
+** Called from the clock ISR on every tick.
+**
+** @return true if the current process has lost the CPU
+*/
+bool_t _sched_rt_tick( void );
+
+/**
+** _sched_expired() - note that a process used up its time slice
+**
+** It is moved down a level, and will get a longer slice next time.
+**
+** @param pcb   The process
+*/
+void _sched_expired( pcb_t *pcb );
+
+/**
+** _sched_blocked() - note that a process blocked before its time
+**                    slice was used up
+**
+** It is moved up a level, but not above its base priority.
+**
+** @param pcb   The process
+*/
+void _sched_blocked( pcb_t *pcb );
+
+/**
+** _sched_age() - move processes which have waited too long up a level
+*/
+void _sched_age( void );
+
+/**
+** _sched_length() - number of processes ready at a priority level
+**
+** @param prio  The priority level
+**
+** @return the number of processes
+*/
+uint32_t _sched_length( prio_t prio );
+
+/**
+** _sched_dump() - dump the ready queue to the console
+**
+** Only the non-empty levels are shown.
+**
+** @param msg  Optional message to print
+*/
+void _sched_dump( const char *msg );
+
 /**
 ** _dispatch() - select a new "current" process
 **
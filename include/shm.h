@@ -0,0 +1,136 @@
+/*
+** @file shm.h
+**
+** @author CSCI-452 class of 20215
+**
+** Shared memory segment module declarations
+*/
+
+#ifndef SHM_H_
+#define SHM_H_
+
+/*
+** General (C and/or assembly) definitions
+*/
+
+// number of shared memory segments in the system (at most 32, as a
+// process keeps one bit per segment whose handle it holds)
+#define N_SHM       16
+
+// largest segment
+#define SHM_MAX     0x01000000
+
+#ifndef SP_ASM_SRC
+
+/*
+** Start of C-only definitions
+*/
+
+#include "common.h"
+
+#include "paging.h"
+
+/*
+** Types
+*/
+
+/*
+** A shared memory segment.  Its frames are allocated (zeroed) when
+** first touched by any process mapping it, and the segment keeps one
+** reference to each of them; each mapping of a page holds another.
+** It lasts as long as some area maps it or some process holds its
+** handle.
+*/
+
+typedef struct shm_s {
+    uint32_t key;               // what processes know it by
+    uint32_t size;              // in bytes, a multiple of SZ_PAGE
+    uint32_t maps;              // number of areas mapping it
+    uint32_t holders;           // number of processes holding its handle
+    phys_addr *frames;          // one per page, 0 until touched
+} shm_t;
+
+/*
+** Globals
+*/
+
+/*
+** Prototypes
+*/
+
+/**
+** _shm_init() - initialize the shared memory module
+*/
+void _shm_init( void );
+
+/**
+** _shm_create() - find or create the segment with a key
+**
+** @param key      The segment's key
+** @param size     The size needed, in bytes
+** @param held     The caller's set of held handles, which gets this one
+**
+** @return the segment's handle, or an error code
+*/
+int _shm_create( uint32_t key, uint32_t size, uint32_t *held );
+
+/**
+** _shm_dup() - note another process holding a set of handles
+**
+** @param held     The handles (one bit each)
+*/
+void _shm_dup( uint32_t held );
+
+/**
+** _shm_drop() - give up a set of handles
+**
+** Segments that are neither held nor mapped any more go away.
+**
+** @param held     The handles (one bit each); emptied
+*/
+void _shm_drop( uint32_t *held );
+
+/**
+** _shm_get() - find the segment for a handle
+**
+** @param handle   The handle
+**
+** @return the segment, or NULL
+*/
+shm_t *_shm_get( int handle );
+
+/**
+** _shm_hold() - note another area mapping a segment
+**
+** @param shm      The segment
+*/
+void _shm_hold( shm_t *shm );
+
+/**
+** _shm_release() - note an area no longer mapping a segment
+**
+** The segment goes away when nothing maps or holds it any more.
+**
+** @param shm      The segment
+*/
+void _shm_release( shm_t *shm );
+
+/**
+** _shm_frame() - find the frame holding a page of a segment
+**
+** @param shm      The segment
+** @param index    Which page of the segment
+**
+** @return the frame, with a reference for the caller, or 0
+*/
+phys_addr _shm_frame( shm_t *shm, uint32_t index );
+
+/**
+** _shm_dump() - print the segments on the console
+*/
+void _shm_dump( void );
+
+#endif
+/* SP_ASM_SRC */
+
+#endif
@@ -0,0 +1,108 @@
+/*
+** @file slab.h
+**
+** @author CSCI-452 class of 20215
+**
+** Slab allocator declarations
+*/
+
+#ifndef SLAB_H_
+#define SLAB_H_
+
+/*
+** General (C and/or assembly) definitions
+*/
+
+// maximum number of object caches in the system
+#define N_SLAB_CACHES   16
+
+// number of empty slabs a cache holds onto before
+// returning them to the page allocator
+#define SLAB_KEEP_EMPTY 1
+
+#ifndef SP_ASM_SRC
+
+/*
+** Start of C-only definitions
+*/
+
+#include "common.h"
+
+/*
+** Types
+*/
+
+/*
+** An object cache.  Like queue_t, this is an opaque type; the outside
+** world only sees a pointer to it.
+*/
+
+typedef struct slab_cache_s *slab_cache_t;
+
+/*
+** Globals
+*/
+
+/*
+** Prototypes
+*/
+
+/**
+** _slab_create() - create an object cache
+**
+** Objects are carved from single pages ("slabs").  When a slab is
+** created, each of its objects is cleared and then handed to the
+** constructor (if there is one); objects must be returned to that
+** constructed state before they are freed.
+**
+** @param name   Name of the cache (for debugging)
+** @param size   Size of each object, in bytes
+** @param ctor   Object constructor, or NULL
+**
+** @return the new cache, or NULL
+*/
+slab_cache_t _slab_create( const char *name, uint32_t size,
+                           void (*ctor)(void *) );
+
+/**
+** _slab_alloc() - allocate an object from a cache
+**
+** @param cache  The cache to allocate from
+**
+** @return a pointer to the object, or NULL
+*/
+void *_slab_alloc( slab_cache_t cache );
+
+/**
+** _slab_free() - return an object to its cache
+**
+** @param cache  The cache the object came from
+** @param obj    The object
+*/
+void _slab_free( slab_cache_t cache, void *obj );
+
+/**
+** _slab_cache_of() - find the cache an object belongs to
+**
+** @param obj    The object
+**
+** @return the cache it was allocated from
+*/
+slab_cache_t _slab_cache_of( void *obj );
+
+/**
+** _slab_reap() - release every empty slab in every cache
+**
+** @return the number of pages returned to the page allocator
+*/
+uint32_t _slab_reap( void );
+
+/**
+** _slab_dump() - dump the state of every cache to the console
+*/
+void _slab_dump( void );
+
+#endif
+/* SP_ASM_SRC */
+
+#endif
@@ -0,0 +1,135 @@
+/*
+** @file smp.h
+**
+** @author CSCI-452 class of 20215
+**
+** Multiprocessor support declarations
+*/
+
+#ifndef SMP_H_
+#define SMP_H_
+
+/*
+** General (C and/or assembly) definitions
+*/
+
+// most CPUs we will use
+#define N_CPUS          8
+
+// offsets of the fields of a cpu_t used by isr_stubs.S
+#define CPU_CURRENT     0
+#define CPU_ESP         4
+
+// local APIC ID register, and where its ID is in it
+#define LAPIC_ID        0x020
+#define LAPIC_ID_SHIFT  24
+
+// where the application processors start (a page below 1MB; the
+// bootstrap's stack was here, and nothing else uses it afterward)
+#define AP_BOOT_ADDRESS 0x8000
+
+// vectors for the local APIC timer and spurious interrupts
+#define INT_VEC_LAPIC_TIMER     0xf0
+#define INT_VEC_LAPIC_SPURIOUS  0xff
+
+#ifndef SP_ASM_SRC
+
+/*
+** Start of C-only definitions
+*/
+
+#include "common.h"
+
+/*
+** Types
+*/
+
+// what each CPU has of its own
+typedef struct cpu_s {
+    // these two first, for easy access in assembly
+    pcb_t *current;         // process running on this CPU
+    uint32_t *system_esp;   // initial ESP for its system stack
+    stack_t *system_stack;  // the stack its ISRs run on
+    uint32_t id;            // index into _cpus (0 is the bootstrap CPU)
+    uint32_t apic_id;       // local APIC ID
+    void *idt;              // its interrupt descriptor table
+    uint32_t ticks;         // clock ticks it has taken
+    volatile bool_t started;    // it is up and running
+} cpu_t;
+
+/*
+** Globals
+*/
+
+// every CPU, and how many of them are running
+extern cpu_t _cpus[N_CPUS];
+extern uint32_t _n_cpus;
+
+// the CPU running the kernel (the one holding the kernel lock)
+extern cpu_t *_cpu;
+
+// CPUs by local APIC ID
+extern cpu_t *_cpu_map[256];
+
+// local APIC registers, or NULL if only one CPU is in use
+extern volatile uint32_t *_lapic;
+
+/*
+** Prototypes
+*/
+
+/**
+** _smp_init() - find and start the other CPUs
+**
+** Uses the MP configuration table left by the BIOS.  With no table,
+** or only one usable CPU, nothing changes.
+**
+** Dependencies:
+**    Cannot be called before the paging, stack, scheduler, and
+**    process modules are initialized
+*/
+void _smp_init( void );
+
+/**
+** _smp_cpu() - find the CPU we are running on
+**
+** @return its cpu_t
+*/
+cpu_t *_smp_cpu( void );
+
+/**
+** _smp_enter() - take the kernel lock
+**
+** Called on the way into the kernel (see isr_stubs.S).  A CPU which
+** already holds the lock just goes one level deeper.
+**
+** @param cpu   The CPU we are running on
+*/
+void _smp_enter( cpu_t *cpu );
+
+/**
+** _smp_leave() - release the kernel lock
+**
+** Called on the way out of the kernel (see isr_stubs.S).
+**
+** @return the process this CPU is going back to
+*/
+pcb_t *_smp_leave( void );
+
+/**
+** _smp_ap_main() - where an application processor goes once it has
+**                  paging and a stack (see smp_boot.S)
+**
+** @param cpu   The CPU
+*/
+void _smp_ap_main( cpu_t *cpu );
+
+/**
+** _smp_dump() - dump the CPUs to the console
+*/
+void _smp_dump( void );
+
+#endif
+/* SP_ASM_SRC */
+
+#endif
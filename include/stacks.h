@@ -30,12 +30,16 @@
 //
 // for simplicity, our stack is a multiple of the page size (4KB)
 
-// four pages (16KB) per stack
+// four pages (16KB) per stack, at most
 #define STACK_PAGES      4
 
 #define SZ_STACK        (SZ_PAGE * STACK_PAGES)
 #define STACK_WORDS     (SZ_STACK / sizeof(uint32_t))
 
+// every process' stack is here, at the top of the user part of its own
+// address space; the page below it is never mapped, as a guard
+#define USER_STACK      (USER_VIRT_LIMIT - SZ_STACK)
+
 /*
 ** Types
 */
@@ -46,6 +50,9 @@
 
 typedef uint32_t stack_t[STACK_WORDS];
 
+// process.h includes us before it defines the PCB
+struct pcb_s;
+
 /*
 ** Globals
 */
@@ -67,29 +74,78 @@ typedef uint32_t stack_t[STACK_WORDS];
 void _stk_init( void );
 
 /**
-** _stk_alloc() - allocate a stack
+** _stk_alloc() - allocate a kernel stack
+**
+** Kernel stacks (e.g., the system stack) are mapped in every address
+** space, and are entirely present.
 **
 ** @return pointer to the allocated stack, or NULL
 */
-stack_t *_stk_alloc( struct page_directory * pg_dir );
+stack_t *_stk_alloc( void );
 
 /**
-** _stk_free() - free a stack
+** _stk_free() - free a kernel stack
 **
 ** @param stk   The stack to be returned to the free list
 */
 void _stk_free( stack_t *stk );
 
+/**
+** _stk_area() - give a process its stack
+**
+** The stack is an area at USER_STACK in the process' address space,
+** filled in as it is touched.
+**
+** @param pcb    The process
+**
+** @return status of the operation
+*/
+status_t _stk_area( struct pcb_s *pcb );
+
+/**
+** _stk_ready() - make sure a process can take an interrupt
+**
+** The pages its next interrupt frame will be pushed onto are made
+** present and writable (not copy-on-write).
+**
+** @param pcb    The process
+**
+** @return true if the process can be run
+*/
+bool_t _stk_ready( struct pcb_s *pcb );
+
+/**
+** _stk_contains() - test whether an address is in a stack or its
+**                   guard page
+**
+** @param stk    The stack
+** @param virt   The address
+**
+** @return true if the address belongs to the stack
+*/
+bool_t _stk_contains( stack_t *stk, uint32_t virt );
+
+/**
+** _stk_args() - duplicate an argument vector
+**
+** @param args   The vector to copy
+**
+** @return the copy (free it with kfree()), or NULL
+*/
+char **_stk_args( char *args[] );
+
 /**
 ** _stk_setup - set up the stack for a new process
 **
-** @param stk    - The stack to be set up
+** The process' address space must be the current one.
+**
+** @param pcb    - The process whose stack is to be set up
 ** @param entry  - Entry point for the new process
 ** @param args   - Argument vector to be put in place
 **
 ** @return A pointer to the context_t on the stack, or NULL
 */
-context_t *_stk_setup( stack_t *stk, uint32_t entry, char *args[] );
+context_t *_stk_setup( struct pcb_s *pcb, uint32_t entry, char *args[] );
 
 /*
 ** Debugging/tracing routines
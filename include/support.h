@@ -15,6 +15,31 @@
 
 #define	IDT_PADDR	0x2400
 
+/*
+** Name:	tss_t
+**
+** Description:	Format of a 32-bit task state segment.
+*/
+typedef struct {
+	unsigned short	link, _rsvd0;
+	unsigned int	esp0;
+	unsigned short	ss0, _rsvd1;
+	unsigned int	esp1;
+	unsigned short	ss1, _rsvd2;
+	unsigned int	esp2;
+	unsigned short	ss2, _rsvd3;
+	unsigned int	cr3, eip, eflags;
+	unsigned int	eax, ecx, edx, ebx, esp, ebp, esi, edi;
+	unsigned short	es, _rsvd4;
+	unsigned short	cs, _rsvd5;
+	unsigned short	ss, _rsvd6;
+	unsigned short	ds, _rsvd7;
+	unsigned short	fs, _rsvd8;
+	unsigned short	gs, _rsvd9;
+	unsigned short	ldt, _rsvd10;
+	unsigned short	trap, iomap;
+} tss_t;
+
 /*
 ** Name:	__panic
 **
@@ -47,6 +72,44 @@ void __init_interrupts( void );
 */
 void ( *__install_isr( int vector, void ( *handler )( int vector, int code ) ) )( int vector, int code );
 
+/*
+** Name:	__install_tss
+**
+** Description:	Create the GDT descriptor for a task state segment.
+** Arguments:	The selector to use, and the TSS
+*/
+void __install_tss( int selector, tss_t *tss );
+
+/*
+** Name:	__install_task_gate
+**
+** Description:	Make an interrupt switch to another task (described by
+**		a TSS installed with __install_tss) instead of calling
+**		an ISR stub.
+** Arguments:	The interrupt vector number, and the selector of the
+**		task's TSS
+*/
+void __install_task_gate( int vector, int selector );
+
+/*
+** Name:	__install_task_gate_in
+**
+** Description:	Like __install_task_gate, but in an IDT other than the
+**		one at IDT_ADDRESS (e.g., one made by __copy_idt).
+** Arguments:	The IDT, the interrupt vector number, and the selector
+**		of the task's TSS
+*/
+void __install_task_gate_in( void *idt, int vector, int selector );
+
+/*
+** Name:	__copy_idt
+**
+** Description:	Copy the IDT, so that another CPU can use it.  Every
+**		vector goes to the same stub as in the original.
+** Arguments:	Where to put the copy (2048 bytes)
+*/
+void __copy_idt( void *idt );
+
 /*
 ** Name:	__delay
 **
@@ -0,0 +1,117 @@
+/*
+** @file swap.h
+**
+** @author CSCI-452 class of 20215
+**
+** Swap module declarations
+*/
+
+#ifndef SWAP_H_
+#define SWAP_H_
+
+/*
+** General (C and/or assembly) definitions
+*/
+
+// most swap slots we will use (16MB worth of pages)
+#define SWAP_SLOTS      4096
+
+// no swap slot
+#define SWAP_NONE       0xffffffff
+
+#ifndef SP_ASM_SRC
+
+/*
+** Start of C-only definitions
+*/
+
+#include "common.h"
+
+#include "paging.h"
+
+// A paged-out page has a not-present pte holding its swap slot
+#define PTE_IS_SWAPPED(pte) (((pte) & (I86_PTE_PRESENT | I86_PTE_SWAPPED)) == I86_PTE_SWAPPED)
+#define PTE_SWAP_SLOT(pte)  ((pte) >> 12)
+#define SWAP_PTE(slot)      (((slot) << 12) | I86_PTE_SWAPPED)
+
+/*
+** Types
+*/
+
+/*
+** Globals
+*/
+
+/*
+** Prototypes
+*/
+
+/**
+** _swap_init() - initialize the swap module
+**
+** Uses the disk on the primary slave position, if there is one.
+**
+** Dependencies:
+**    Cannot be called before kmem is initialized
+*/
+void _swap_init( void );
+
+/**
+** _swap_reclaim() - page out one page to free a frame
+**
+** @return true if a frame was freed
+*/
+bool_t _swap_reclaim( void );
+
+/**
+** _swap_has() - check for a paged-out page
+**
+** @param pg_dir   The page directory
+** @param virt     The (page-aligned) address
+**
+** @return true if the page is in swap
+*/
+bool_t _swap_has( struct page_directory *pg_dir, virt_addr virt );
+
+/**
+** _swap_in() - bring a paged-out page back into memory
+**
+** @param pg_dir   The page directory
+** @param virt     The (page-aligned) address
+** @param writable Whether the page may be written
+**
+** @return true if the page is now present
+*/
+bool_t _swap_in( struct page_directory *pg_dir, virt_addr virt,
+                 bool_t writable );
+
+/**
+** _swap_dup() - note another pte referring to a swap slot
+**
+** @param pte      The (paged-out) pte being copied
+*/
+void _swap_dup( pte_t pte );
+
+/**
+** _swap_free() - note a pte no longer referring to a swap slot
+**
+** @param pte      The (paged-out) pte being discarded
+*/
+void _swap_free( pte_t pte );
+
+/**
+** _swap_forget() - note that a frame is being freed
+**
+** @param frame    The frame
+*/
+void _swap_forget( phys_addr frame );
+
+/**
+** _swap_dump() - print the swap statistics on the console
+*/
+void _swap_dump( void );
+
+#endif
+/* SP_ASM_SRC */
+
+#endif
@@ -34,9 +34,20 @@
 #define SYS_getppid     10
 #define SYS_gettime     11
 #define SYS_getprio     12
+#define SYS_prezero     13
+#define SYS_brk         14
+#define SYS_open        15
+#define SYS_close       16
+#define SYS_mmap        17
+#define SYS_munmap      18
+#define SYS_shm_create  19
+#define SYS_shm_map     20
+#define SYS_setrt       21
+#define SYS_rtmisses    22
+#define SYS_pread       23
 
 // UPDATE THIS DEFINITION IF MORE SYSCALLS ARE ADDED!
-#define N_SYSCALLS      13
+#define N_SYSCALLS      24
 
 // dummy system call code for testing our ISR
 #define SYS_bogus       0xbad
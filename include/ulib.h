@@ -188,6 +188,163 @@ time_t gettime( void );
 */
 prio_t getprio( void );
 
+/**
+** prezero - clear a batch of free frames for the kernel to hand out
+**
+** usage:   n = prezero();
+**
+** Intended for the idle process, which has nothing better to do.
+**
+** @returns The number of frames the kernel would still like cleared
+*/
+int32_t prezero( void );
+
+/**
+** brk - move the end of this process' heap
+**
+** usage:   end = brk(addr);
+**
+** The heap begins right after the program image, and is empty when
+** the program starts.  Memory added to it is zero-filled.
+**
+** @param addr  The new end of the heap, or NULL to just ask for it
+**
+** @returns The end of the heap (unchanged if it couldn't be moved)
+*/
+void *brk( void *addr );
+
+/**
+** open - open a file in the root directory of the filesystem
+**
+** usage:   fd = open(name);
+**
+** @param name  The file's name, e.g. "DATA.TXT"
+**
+** @returns A file descriptor, or an error code
+*/
+int open( const char *name );
+
+/**
+** close - close a file
+**
+** usage:   status = close(fd);
+**
+** Anything mapped from the file stays mapped.
+**
+** @param fd    The file descriptor
+**
+** @returns The status of the operation
+*/
+int close( int fd );
+
+/**
+** mmap - map part of an open file into memory
+**
+** usage:   addr = mmap(fd,offset,len,prot);
+**
+** Pages are read from the file when first touched, and are shared
+** with every other process mapping the same pages.  If PROT_WRITE is
+** given, writes go to this process' own copy of the page; the file
+** itself is never changed.  Bytes past the end of the file read as 0.
+**
+** @param fd      The file descriptor
+** @param offset  Where in the file to start; must be a multiple of 4096
+** @param len     How many bytes to map
+** @param prot    PROT_READ, optionally with PROT_WRITE
+**
+** @returns The address of the mapping, or NULL
+*/
+void *mmap( int fd, uint32_t offset, uint32_t len, int prot );
+
+/**
+** munmap - remove a mapping made by mmap()
+**
+** usage:   status = munmap(addr);
+**
+** @param addr  The address mmap() returned
+**
+** @returns The status of the operation
+*/
+int munmap( void *addr );
+
+/**
+** pread - read part of an open file
+**
+** usage:   n = pread(fd,buf,len,offset);
+**
+** The data comes straight from the disk, not through the pages
+** mmap() uses.
+**
+** @param fd      The file descriptor
+** @param buf     Where to put the data
+** @param len     How many bytes to read
+** @param offset  Where in the file to start
+**
+** @returns The number of bytes read (0 at the end of the file), or an
+**          error code
+*/
+int32_t pread( int fd, void *buf, uint32_t len, uint32_t offset );
+
+/**
+** shm_create - find or create a shared memory segment
+**
+** usage:   handle = shm_create(key,size);
+**
+** Every process asking for the same key gets the same segment, which
+** is created (zero-filled) by the first one.  The segment goes away
+** once every process that asked for it or mapped it has exited (or
+** exec'd) and every mapping of it is gone.
+**
+** @param key   What the processes sharing the segment know it by
+** @param size  How many bytes are needed
+**
+** @returns A handle for the segment, or an error code
+*/
+int shm_create( uint32_t key, uint32_t size );
+
+/**
+** shm_map - map a shared memory segment into memory
+**
+** usage:   addr = shm_map(handle);
+**
+** Writes through the mapping are seen by every process mapping the
+** segment, including children forked after it was mapped.
+**
+** @param handle  The handle from shm_create() in this process (or
+**                one inherited through fork())
+**
+** @returns The address of the mapping, or NULL
+*/
+void *shm_map( int handle );
+
+/**
+** setrt - make this process real-time, or not
+**
+** usage:   status = setrt(runtime,period,deadline);
+**
+** The process is promised 'runtime' ms of CPU time within 'deadline'
+** ms of the start of every 'period' ms, ahead of every ordinary
+** process.  If it wants more than that, it waits for its next period.
+** A runtime of 0 makes it an ordinary process again.
+**
+** @param runtime   CPU time wanted in each period, in ms
+** @param period    Length of a period, in ms
+** @param deadline  When the time is wanted by, in ms (0 for the period)
+**
+** @returns E_SUCCESS, E_BAD_PARAM, or E_OVERLOAD if the CPU has
+**          already been promised to others
+*/
+int setrt( uint32_t runtime, uint32_t period, uint32_t deadline );
+
+/**
+** rtmisses - retrieve the number of deadlines this process missed
+**
+** usage:   n = rtmisses();
+**
+** @returns The number of deadlines missed while still wanting the CPU
+*/
+uint32_t rtmisses( void );
+
 /**
 ** bogus - a bogus system call, for testing our syscall ISR
 **
@@ -287,6 +444,47 @@ int32_t swrites( const char *str );
 */
 int32_t swrite( const char *buf, uint32_t leng );
 
+/**
+** shm_unmap(addr) - remove a mapping made by shm_map()
+**
+** @param addr  The address shm_map() returned
+**
+** @returns The return value from calling munmap()
+*/
+int shm_unmap( void *addr );
+
+/*
+**********************************************
+** MEMORY ALLOCATION
+**********************************************
+*/
+
+/**
+** sbrk(incr) - grow (or shrink) the heap
+**
+** @param incr  Number of bytes to add to the heap (may be negative)
+**
+** @returns The old end of the heap (i.e., the start of the new
+**          memory), or NULL on failure
+*/
+void *sbrk( int32_t incr );
+
+/**
+** malloc(size) - allocate memory from the heap
+**
+** @param size  Number of bytes wanted
+**
+** @returns A pointer to the memory (8-byte aligned), or NULL
+*/
+void *malloc( uint32_t size );
+
+/**
+** free(ptr) - give back memory obtained from malloc()
+**
+** @param ptr   The memory to free (may be NULL)
+*/
+void free( void *ptr );
+
 /*
 **********************************************
 ** STRING MANIPULATION FUNCTIONS
@@ -113,26 +113,33 @@
 // of 42.
 //
 
-#define BIN_IDLE  0x23000
-#define BIN_MAIN1 0x27000
-#define BIN_MAIN2 0x2b000
-#define BIN_MAIN3 0x2f000
-#define BIN_MAIN4 0x33000
-#define BIN_MAIN5 0x37000
-#define BIN_MAIN6 0x3b000
-
-#define BIN_USERH 0x3f000
-#define BIN_USERI 0x43000
-#define BIN_USERJ 0x47000
-#define BIN_USERP 0x4b000
-#define BIN_USERQ 0x4f000
-#define BIN_USERR 0x53000
-#define BIN_USERS 0x57000
-#define BIN_USERV 0x5b000
-#define BIN_USERW 0x5f000
-#define BIN_USERX 0x63000
-#define BIN_USERY 0x67000
-#define BIN_USERZ 0x6b000
+#define BIN_IDLE  0x40000
+#define BIN_MAIN1 0x44000
+#define BIN_MAIN2 0x48000
+#define BIN_MAIN3 0x4c000
+#define BIN_MAIN4 0x50000
+#define BIN_MAIN5 0x54000
+#define BIN_MAIN6 0x58000
+
+#define BIN_USERH 0x5c000
+#define BIN_USERI 0x60000
+#define BIN_USERJ 0x64000
+#define BIN_USERP 0x68000
+#define BIN_USERQ 0x6c000
+#define BIN_USERR 0x70000
+#define BIN_USERS 0x74000
+#define BIN_USERV 0x78000
+#define BIN_USERW 0x7c000
+#define BIN_USERX 0x80000
+#define BIN_USERY 0x84000
+#define BIN_USERZ 0x88000
+
+// the test programs are bigger, so they get 20K each (these must
+// match the Makefile, which checks that each image fits)
+#define BIN_TMALLOC 0x8c000
+#define BIN_TMMAP   0x91000
+#define BIN_TSHM    0x96000
+#define BIN_TRT     0x9b000
 
 #define SPAWN_A
 #define SPAWN_B
@@ -158,6 +165,22 @@
 // #define SPAWN_U
 // #define SPAWN_V
 
+//
+// The tests each check one feature and report PASS or FAIL.  Building
+// with -DSPAWN_TESTS (see the Makefile) starts all of them.
+//
+#ifdef SPAWN_TESTS
+#define SPAWN_TMALLOC
+#define SPAWN_TMMAP
+#define SPAWN_TSHM
+#define SPAWN_TRT
+#else
+// #define SPAWN_TMALLOC
+// #define SPAWN_TMMAP
+// #define SPAWN_TSHM
+// #define SPAWN_TRT
+#endif
+
 //
 // Users W-Z are spawned from other processes; they
 // should never be spawned directly by init().
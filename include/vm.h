@@ -0,0 +1,207 @@
+/*
+** @file vm.h
+**
+** @author CSCI-452 class of 20215
+**
+** Virtual memory area module declarations
+*/
+
+#ifndef VM_H_
+#define VM_H_
+
+/*
+** General (C and/or assembly) definitions
+*/
+
+// area flags
+#define VM_WRITE    0x00000001  // pages may be written
+
+// files are mapped between here and the stack
+#define VM_MAP_BASE 0x80000000
+
+#ifndef SP_ASM_SRC
+
+/*
+** Start of C-only definitions
+*/
+
+#include "common.h"
+
+#include "paging.h"
+#include "process.h"
+
+/*
+** Types
+*/
+
+/*
+** A range of a process' address space whose pages are filled in on
+** first touch rather than when the range is set up.  The first
+** 'src_len' bytes of the area are copied from 'src' (e.g., a program
+** segment in the loaded image); the rest of the area is zero-filled.
+**
+** An area may instead map part of a file, starting 'offset' bytes
+** into it; its pages come from the page cache.  Or it may map a
+** shared memory segment, whose frames every process mapping it shares.
+*/
+
+typedef struct vm_area_s {
+    struct vm_area_s *next;     // next area in this address space
+    virt_addr start;            // first byte of the area
+    virt_addr end;              // first byte past the area
+    phys_addr src;              // initial contents, or 0
+    uint32_t src_len;           // bytes of initial contents
+    uint32_t flags;             // VM_* flags
+    file_t file;                // mapped file (cluster 0 if none)
+    uint32_t offset;            // offset of 'start' in the file
+    struct shm_s *shm;          // mapped shared memory segment, or NULL
+} vm_area_t;
+
+/*
+** Globals
+*/
+
+/*
+** Prototypes
+*/
+
+/**
+** _vm_init() - initialize the VM area module
+**
+** Dependencies:
+**    Cannot be called before kmem is initialized
+**    Must be called before any process creation can be done
+*/
+void _vm_init( void );
+
+/**
+** _vm_add() - add a lazily populated area to an address space
+**
+** @param list     The address space's area list
+** @param start    First byte of the area
+** @param size     Size of the area, in bytes
+** @param src      Initial contents of the area, or 0
+** @param src_len  Bytes of initial contents (the rest is zero-filled)
+** @param flags    VM_* flags
+**
+** @return status of the operation
+*/
+status_t _vm_add( vm_area_t **list, virt_addr start, uint32_t size,
+                  phys_addr src, uint32_t src_len, uint32_t flags );
+
+/**
+** _vm_copy() - duplicate an area list (e.g., for fork)
+**
+** @param list     The list to copy
+** @param copy     The new list is returned here
+**
+** @return status of the operation
+*/
+status_t _vm_copy( vm_area_t *list, vm_area_t **copy );
+
+/**
+** _vm_free() - release every area in a list
+**
+** @param list     The list to release; it is left empty
+*/
+void _vm_free( vm_area_t **list );
+
+/**
+** _vm_heap() - set up an empty heap for a process
+**
+** The heap starts just above the process' existing areas.
+**
+** @param pcb      The process
+*/
+void _vm_heap( pcb_t *pcb );
+
+/**
+** _vm_brk() - move the end of a process' heap
+**
+** @param pcb      The process
+** @param brk      The new break
+**
+** @return status of the operation
+*/
+status_t _vm_brk( pcb_t *pcb, virt_addr brk );
+
+/**
+** _vm_map() - map part of a file into a process' address space
+**
+** @param pcb      The process
+** @param file     The file
+** @param offset   Where in the file to start (page-aligned)
+** @param len      How many bytes to map
+** @param flags    VM_* flags
+**
+** @return the address of the mapping, or 0
+*/
+virt_addr _vm_map( pcb_t *pcb, file_t *file, uint32_t offset,
+                   uint32_t len, uint32_t flags );
+
+/**
+** _vm_map_shm() - map a shared memory segment into a process'
+**                 address space
+**
+** @param pcb      The process
+** @param shm      The segment
+**
+** @return the address of the mapping, or 0
+*/
+virt_addr _vm_map_shm( pcb_t *pcb, struct shm_s *shm );
+
+/**
+** _vm_remove() - remove an area from a process' address space
+**
+** @param pcb      The process
+** @param start    First byte of the area
+**
+** @return status of the operation
+*/
+status_t _vm_remove( pcb_t *pcb, virt_addr start );
+
+/**
+** _vm_fault() - fill in a not-present page of the current process
+**
+** Called from the page fault handler.
+**
+** @param virt     The faulting address
+**
+** @return true if the page is now present
+*/
+bool_t _vm_fault( virt_addr virt );
+
+/**
+** _vm_touch() - make a range of a process' memory safe for the
+**               kernel to access
+**
+** The kernel must not take page faults, so before it reads or writes
+** user memory the pages involved are filled in, and (for writes)
+** given their own copy if they are shared copy-on-write.  A range
+** outside the user part of the address space (other than init's own
+** memory in the kernel image) is refused, so a system call given a
+** pointer into the kernel fails instead of using it.
+**
+** @param pcb      The process
+** @param virt     Start of the range
+** @param len      Length of the range, in bytes
+** @param write    Whether the kernel will be writing to the range
+**
+** @return true if the whole range is accessible
+*/
+bool_t _vm_touch( pcb_t *pcb, virt_addr virt, uint32_t len, bool_t write );
+
+/**
+** _vm_touch_str() - _vm_touch() a NUL-terminated string for reading
+**
+** @param pcb      The process
+** @param str      The string
+**
+** @return true if the whole string is accessible
+*/
+bool_t _vm_touch_str( pcb_t *pcb, const char *str );
+
+#endif
+/* SP_ASM_SRC */
+
+#endif
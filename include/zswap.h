@@ -0,0 +1,109 @@
+/*
+** @file zswap.h
+**
+** @author CSCI-452 class of 20215
+**
+** Compressed swap module declarations
+*/
+
+#ifndef ZSWAP_H_
+#define ZSWAP_H_
+
+/*
+** General (C and/or assembly) definitions
+*/
+
+// swap slot numbers at or above this are compressed pages
+#define ZS_SLOT         0x80000
+
+// number of compressed pages we can hold
+#define ZS_OBJS         4096
+
+// number of frames the compressed pages can be packed into
+#define ZS_PAGES        512
+
+#ifndef SP_ASM_SRC
+
+/*
+** Start of C-only definitions
+*/
+
+#include "common.h"
+
+#include "paging.h"
+
+/*
+** Types
+*/
+
+/*
+** Globals
+*/
+
+/*
+** Prototypes
+*/
+
+/**
+** _zs_init() - initialize the compressed swap module
+**
+** Dependencies:
+**    Cannot be called before kmem is initialized
+*/
+void _zs_init( void );
+
+/**
+** _zs_enabled() - check whether compressed swap can be used
+**
+** @return true if it can
+*/
+bool_t _zs_enabled( void );
+
+/**
+** _zs_store() - compress a page
+**
+** If there is no room for it, the frame itself may become the home of
+** its compressed contents (and those of pages compressed later).
+**
+** @param frame    The frame holding the page
+** @param kept     Set to true if the frame was kept to hold the data
+**
+** @return the swap slot number for the page, or SWAP_NONE
+*/
+uint32_t _zs_store( phys_addr frame, bool_t *kept );
+
+/**
+** _zs_load() - decompress a page
+**
+** @param slot     The page's swap slot number
+** @param frame    The frame to decompress it into
+**
+** @return true if the page was decompressed
+*/
+bool_t _zs_load( uint32_t slot, phys_addr frame );
+
+/**
+** _zs_dup() - add a reference to a compressed page
+**
+** @param slot     The page's swap slot number
+*/
+void _zs_dup( uint32_t slot );
+
+/**
+** _zs_put() - drop a reference to a compressed page
+**
+** The last reference frees it.
+**
+** @param slot     The page's swap slot number
+*/
+void _zs_put( uint32_t slot );
+
+/**
+** _zs_dump() - print the compressed swap statistics on the console
+*/
+void _zs_dump( void );
+
+#endif
+/* SP_ASM_SRC */
+
+#endif
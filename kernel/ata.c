@@ -21,6 +21,17 @@
 ** PRIVATE DEFINITIONS
 */
 
+// ATA commands for disks (as opposed to ATAPI packet devices)
+#define ATA_CMD_READ_PIO   0x20
+#define ATA_CMD_WRITE_PIO  0x30
+#define ATA_CMD_FLUSH      0xE7
+#define ATA_CMD_IDENTIFY   0xEC
+
+// status register bits
+#define ATA_SR_ERR  0x01
+#define ATA_SR_DRQ  0x08
+#define ATA_SR_BSY  0x80
+
 /*
 ** PRIVATE DATA TYPES
 */
@@ -102,11 +113,12 @@ int32_t detect_device_ATA(ata_device_t *dev){
 **
 ** @param lba    The logical base address where the sector is
 ** @param buffer A buffer to contain the information from the sector
+**               (ATAPI_SECTOR_SIZE bytes)
 ** @param dev    ATA device structure
 **
 ** @return Size
 */
-int32_t read_sectors_ATA_PIO(uint32_t lba, uint8_t buffer, ata_device_t *dev){
+int32_t read_sectors_ATA_PIO(uint32_t lba, uint8_t *buffer, ata_device_t *dev){
     uint8_t read_cmd[12] = { 0xA8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
 	uint8_t status;
 	int size;
@@ -155,3 +167,126 @@ int32_t read_sectors_ATA_PIO(uint32_t lba, uint8_t buffer, ata_device_t *dev){
     return size;
 }
 
+
+/**
+** Name:  ata_wait
+**
+** This function waits for a disk to finish what it was doing
+**
+** @param dev ATA device structure
+** @param drq Whether to also wait for the disk to want data moved
+**
+** @return 1 when ready, -1 if the disk reported an error
+*/
+static int32_t ata_wait(ata_device_t *dev, bool_t drq){
+    uint8_t status;
+
+    ata_delay(dev);
+    while (1) {
+        status = __inb(ATA_IO_REG_STATUS(dev->io_register));
+        if (status & ATA_SR_BSY) continue;
+        if (status & ATA_SR_ERR) return -1;
+        if (!drq || (status & ATA_SR_DRQ)) return 1;
+    }
+}
+
+/**
+** Name:  ata_select
+**
+** This function sets up a disk command on sectors in LBA28 mode
+**
+** @param dev          ATA device structure
+** @param lba          The first sector
+** @param sector_count The number of sectors
+** @param cmd          The command
+*/
+static void ata_select(ata_device_t *dev, uint32_t lba, uint8_t sector_count, uint8_t cmd){
+    __outb(ATA_IO_REG_DRV_SEL(dev->io_register), 0xE0 | dev->slavebit << 4 | ((lba >> 24) & 0x0F));
+    ata_delay(dev);
+    __outb(ATA_IO_REG_FEAT(dev->io_register), 0x00);
+    __outb(ATA_IO_REG_SECT_COUNT(dev->io_register), sector_count);
+    __outb(ATA_IO_REG_LBA0(dev->io_register), lba & 0xFF);
+    __outb(ATA_IO_REG_LBA1(dev->io_register), (lba >> 8) & 0xFF);
+    __outb(ATA_IO_REG_LBA2(dev->io_register), (lba >> 16) & 0xFF);
+    __outb(ATA_IO_REG_CMD(dev->io_register), cmd);
+}
+
+/**
+** Name:  size_ATA
+**
+** This function finds the size of a disk (not an ATAPI device)
+**
+** @param dev ATA device structure
+**
+** @return the number of ATA_SECTOR_SIZE sectors addressable in
+**         LBA28 mode, or 0 if the disk couldn't be identified
+*/
+uint32_t size_ATA(ata_device_t *dev){
+    uint16_t id[ATA_SECTOR_SIZE / sizeof(uint16_t)];
+
+    ata_select(dev, 0, 0, ATA_CMD_IDENTIFY);
+    uint8_t status = __inb(ATA_IO_REG_STATUS(dev->io_register));
+    if (status == 0 || status == 0xFF) return 0;
+    if (ata_wait(dev, true) < 0) return 0;
+
+    insw(dev->io_register, (uint8_t *) id, ATA_SECTOR_SIZE / 2);
+
+    // words 60 and 61 hold the number of LBA28 sectors
+    return ((uint32_t) id[61] << 16) | id[60];
+}
+
+/**
+** Name:  read_disk_ATA_PIO
+**
+** This function reads sectors from a disk (not an ATAPI device)
+**
+** @param lba          The first sector
+** @param sector_count The number of sectors (at least 1)
+** @param buffer       A buffer of sector_count * ATA_SECTOR_SIZE bytes
+** @param dev          ATA device structure
+**
+** @return 1 if the sectors were read, -1 if they couldn't be
+*/
+int32_t read_disk_ATA_PIO(uint32_t lba, uint8_t sector_count, uint8_t *buffer, ata_device_t *dev){
+    ata_select(dev, lba, sector_count, ATA_CMD_READ_PIO);
+
+    for (int i = 0; i < sector_count; i++) {
+        if (ata_wait(dev, true) < 0) return -1;
+        insw(dev->io_register, buffer, ATA_SECTOR_SIZE / 2);
+        buffer += ATA_SECTOR_SIZE;
+    }
+
+    return 1;
+}
+
+/**
+** Name:  write_disk_ATA_PIO
+**
+** This function writes sectors to a disk (not an ATAPI device), and
+** waits until they are on the disk
+**
+** @param lba          The first sector
+** @param sector_count The number of sectors (at least 1)
+** @param buffer       The sector_count * ATA_SECTOR_SIZE bytes to write
+** @param dev          ATA device structure
+**
+** @return 1 if the sectors were written, -1 if they couldn't be
+*/
+int32_t write_disk_ATA_PIO(uint32_t lba, uint8_t sector_count, const uint8_t *buffer, ata_device_t *dev){
+    const uint16_t *data = (const uint16_t *) buffer;
+
+    ata_select(dev, lba, sector_count, ATA_CMD_WRITE_PIO);
+
+    // one word at a time; the disk may not keep up with rep outsw
+    for (int i = 0; i < sector_count; i++) {
+        if (ata_wait(dev, true) < 0) return -1;
+        for (int j = 0; j < ATA_SECTOR_SIZE / 2; j++) {
+            __outw(dev->io_register, *data++);
+        }
+    }
+
+    __outb(ATA_IO_REG_CMD(dev->io_register), ATA_CMD_FLUSH);
+    if (ata_wait(dev, false) < 0) return -1;
+
+    return 1;
+}
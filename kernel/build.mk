@@ -14,10 +14,11 @@ KERNEL_OBJS = \
 
 OS_C_SRC = kernel/clock.c kernel/kernel.c kernel/kmem.c kernel/libc.c kernel/process.c kernel/queues.c kernel/scheduler.c \
 	   kernel/sio.c kernel/stacks.c kernel/syscalls.c kernel/paging.c kernel/phys_alloc.c kernel/elf_loader.c \
-	   kernel/ata.c kernel/filesystem.c
+	   kernel/ata.c kernel/filesystem.c kernel/slab.c kernel/vm.c kernel/pgcache.c kernel/shm.c kernel/swap.c kernel/zswap.c \
+	   kernel/smp.c
 OS_C_OBJ = $(patsubst %.c, $(BUILD_DIR)/%.o, $(OS_C_SRC))
 
-OS_S_SRC = kernel/libs.S
+OS_S_SRC = kernel/libs.S kernel/smp_boot.S
 OS_S_OBJ = $(patsubst %.S, $(BUILD_DIR)/%.o, $(OS_S_SRC))
 
 OS_SRCS  = $(OS_C_SRC) $(OS_S_SRC)
@@ -19,6 +19,7 @@
 #include "queues.h"
 #include "scheduler.h"
 #include "sio.h"
+#include "smp.h"
 
 /*
 ** PRIVATE DEFINITIONS
@@ -113,8 +114,8 @@ static void _clk_isr( int vector, int code ) {
             n, counts[New],      counts[Ready],   counts[Running],
                counts[Sleeping], counts[Blocked], counts[Waiting],
                counts[Killed],   counts[Zombie],
-            _queue_length(_ready[System]),  _queue_length(_ready[User]),
-            _queue_length(_ready[Deferred])
+            _sched_length(System),  _sched_length(User),
+            _sched_length(Deferred)
         );
         // _sio_dump( true );
         // _ptable_dump( "Ptbl", false );
@@ -153,15 +154,8 @@ static void _clk_isr( int vector, int code ) {
 
     } while( 1 );
 
-    // check the current process to see if its time slice has expired
-    _current->ticks -= 1;
-
-    if( _current->ticks < 1 ) {
-        // yes!  put it back on the ready queue
-        _schedule( _current );
-        // pick a new "current" process
-        _dispatch();
-    }
+    // the rest is the same for every CPU
+    _clk_tick();
 
     // tell the PIC we're done
     __outb( PIC_PRI_CMD_PORT, PIC_EOI );
@@ -171,6 +165,44 @@ static void _clk_isr( int vector, int code ) {
 ** PUBLIC FUNCTIONS
 */
 
+/**
+** Name:  _clk_tick
+**
+** The part of a clock tick each CPU does for itself
+*/
+void _clk_tick( void ) {
+
+    // another CPU may have killed the current process while it ran
+    if( _current->state == Killed ) {
+        _schedule( _current );
+        _dispatch();
+        return;
+    }
+
+    // move up anything that has been waiting too long
+    if( (++_cpu->ticks % AGE_INTERVAL) == 0 ) {
+        _sched_age();
+    }
+
+    // real-time budgets and deadlines come first; real-time
+    // processes don't have time slices
+    if( _sched_rt_tick() ) {
+        _dispatch();
+    } else if( _current->rt.runtime == 0 ) {
+
+        // check the current process to see if its time slice has expired
+        _current->ticks -= 1;
+
+        if( _current->ticks < 1 ) {
+            // yes!  put it back on the ready queue, a level lower
+            _sched_expired( _current );
+            _schedule( _current );
+            // pick a new "current" process
+            _dispatch();
+        }
+    }
+}
+
 /**
 ** Name:  _clk_init
 **
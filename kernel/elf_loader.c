@@ -12,41 +12,29 @@
 
 #include "elf_loader.h"
 #include "paging.h"
+#include "vm.h"
 
 /**
-**_elf_load_segment(addr,offset,vaddr,size)
+**_elf_load_segment(areas,addr,phdr)
 ** 
-** Loads a segment of the binary into memory.
+** Registers a segment of the binary as a lazily populated area.  The
+** first p_filesz bytes come from the binary; the remainder of p_memsz
+** (the bss) is zero-filled.
 **
+** @param areas     Area list to add the segment to
 ** @param addr      Physical address of binary in memory
-** @param offset    Offset of the segment into the binary
-** @param vaddr     Virtual address to map segment to
-** @param size      Size of the segment
+** @param phdr      The segment's program header
 */
-static bool_t _elf_load_segment(uint32_t addr, uint32_t offset, uint32_t vaddr, uint32_t size) {
-    uint32_t paddr = addr + offset;
-    uint32_t num_pages = (size / SZ_PAGE) + 1;
-    if(size % 4096 + vaddr % 4096 > 4096){
-        num_pages += 1;
-    }
-    uint32_t cur_vaddr = vaddr; 
-
-    if (!vaddr) return true;
-
-    while (num_pages) {
-        if(!is_mapped(get_current_pg_dir(), cur_vaddr)){
-            if (!alloc_page_at(get_current_pg_dir(), cur_vaddr)) {
-                return false;
-            }
-        }
+static bool_t _elf_load_segment(vm_area_t **areas, uint32_t addr, Elf32_Phdr *phdr) {
+    // skip segments not meant to be in the user's address space
+    if (!phdr->p_vaddr || !phdr->p_memsz) return true;
 
-        cur_vaddr += SZ_PAGE;
-        num_pages -= 1;
-    }
+    if (phdr->p_filesz > phdr->p_memsz) return false;
 
-    __memcpy((void*)vaddr, (void*)paddr, size);
+    uint32_t flags = (phdr->p_flags & PF_W) ? VM_WRITE : 0;
 
-    return true;
+    return _vm_add(areas, phdr->p_vaddr, phdr->p_memsz,
+                   addr + phdr->p_offset, phdr->p_filesz, flags) == E_SUCCESS;
 }
 
 /**
@@ -54,6 +42,7 @@ static bool_t _elf_load_segment(uint32_t addr, uint32_t offset, uint32_t vaddr,
 **
 ** Parses the ELF program headers and each segment described into memory.
 **
+** @param areas     Area list to add the segments to
 ** @param addr      Physical address of binary in memory
 ** @param phoff     Offset of program header into binary
 ** @param phentsiz  Size of each program header table entry
@@ -61,7 +50,7 @@ static bool_t _elf_load_segment(uint32_t addr, uint32_t offset, uint32_t vaddr,
 **
 ** @return True if successfully parsed program header, false if not
 */
-static bool_t _elf_read_phdrs(uint32_t addr, uint32_t phoff, uint16_t phentsize, uint16_t phnum) {
+static bool_t _elf_read_phdrs(vm_area_t **areas, uint32_t addr, uint32_t phoff, uint16_t phentsize, uint16_t phnum) {
     uint32_t phaddr = addr + phoff;
     Elf32_Phdr *curr;
 
@@ -69,7 +58,7 @@ static bool_t _elf_read_phdrs(uint32_t addr, uint32_t phoff, uint16_t phentsize,
         curr = (Elf32_Phdr *)(phaddr);
         
         if (curr->p_type == PT_LOAD) {
-            if (!_elf_load_segment(addr, curr->p_offset, curr->p_vaddr, curr->p_memsz)) {
+            if (!_elf_load_segment(areas, addr, curr)) {
                 return false;
             }
         }
@@ -100,15 +89,16 @@ static bool_t _elf_verify(Elf32_Ehdr *hdr) {
 }
 
 /**
-** _elf_load_program(address)
+** _elf_load_program(address,areas)
 **
 ** Loads ELF binary stored in physical memory. Returns entry point on success.
 **
 ** @param address	Location in physical memory to read from
+** @param areas		Area list of the address space to load into
 **
 ** @return The entry point of the program or zero on failure. 
 */
-uint32_t _elf_load_program(uint32_t addr) {
+uint32_t _elf_load_program(uint32_t addr, vm_area_t **areas) {
     Elf32_Ehdr *hdr = (Elf32_Ehdr*) addr;
 
     if (!_elf_verify(hdr)) {
@@ -117,7 +107,7 @@ uint32_t _elf_load_program(uint32_t addr) {
     }
 
     uint32_t entry = hdr->e_entry;
-    if (!_elf_read_phdrs(addr, hdr->e_phoff, hdr->e_phentsize, hdr->e_phnum)) {
+    if (!_elf_read_phdrs(areas, addr, hdr->e_phoff, hdr->e_phentsize, hdr->e_phnum)) {
         __cio_printf( "ELF: Error reading program headers!\n" );
         return 0;
     }
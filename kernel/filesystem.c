@@ -17,11 +17,22 @@
 #include "ata.h"
 #include "lib.h"
 #include "cio.h"
+#include "paging.h"
 
 /*
 ** PRIVATE DEFINITIONS
 */
 
+// FAT sectors in each ATAPI sector
+#define FAT_PER_ATAPI (ATAPI_SECTOR_SIZE / SECTOR_SIZE)
+
+// FAT entries in each sector of the FAT, and the bits of an entry used
+#define FAT_PER_SECTOR (SECTOR_SIZE / sizeof(uint32_t))
+#define FAT_MASK       0x0FFFFFFF
+
+// deleted directory entries start with this
+#define DIR_ENTRY_FREE 0xE5
+
 /*
 ** PRIVATE DATA TYPES
 */
@@ -30,6 +41,14 @@
 ** PRIVATE GLOBAL VARIABLES
 */
 
+// the filesystem structure make_Filesystem() fills in
+static f32_t _fs;
+
+// the drive is read a whole ATAPI sector at a time; the last
+// one read stays here (the drive is never written)
+static uint8_t _atapi_buf[ATAPI_SECTOR_SIZE];
+static uint32_t _atapi_lba = 0xFFFFFFFF;
+
 /*
 ** PUBLIC GLOBAL VARIABLES
 */
@@ -46,10 +65,76 @@ static ata_device_t ata_secondary_master = {.io_register = 0x170, .ctl_register
 static ata_device_t ata_secondary_slave = {.io_register = 0x170, .ctl_register = 0x376, .slavebit = 1};
 ata_device_t dev;
 
+// the filesystem, if make_Filesystem() could set it up
+f32_t *_filesystem;
+
 /*
 ** PRIVATE FUNCTIONS
 */
 
+/**
+** Name:  _fs_read_sector
+**
+** The drive has 2048-byte ATAPI sectors, but the filesystem is laid out
+** in SECTOR_SIZE sectors; this reads one of the latter. The drive is
+** only asked for the ATAPI sector if it isn't the one last read.
+**
+** @param lba    The filesystem sector to read
+** @param buffer A buffer of SECTOR_SIZE bytes for the data
+**
+** @return 1 if the sector was read, -1 if it couldn't be
+*/
+static int _fs_read_sector(uint32_t lba, uint8_t *buffer){
+    if(lba / FAT_PER_ATAPI != _atapi_lba){
+        if(read_sectors_ATA_PIO(lba / FAT_PER_ATAPI, _atapi_buf, &dev) < 0){
+            _atapi_lba = 0xFFFFFFFF;
+            return -1;
+        }
+        _atapi_lba = lba / FAT_PER_ATAPI;
+    }
+    __memcpy(buffer, &_atapi_buf[(lba % FAT_PER_ATAPI) * SECTOR_SIZE], SECTOR_SIZE);
+    return 1;
+}
+
+/**
+** Name:  _fat_next
+**
+** This function follows a cluster chain one step, reading the
+** FAT entry for the cluster from disk. The FAT sector read is
+** kept, as the entries of a chain are usually close together.
+**
+** @param filesystem The FAT32 filesystem
+** @param cluster    The current cluster
+**
+** @return the next cluster in the chain (FAT_EOC or above at the end)
+*/
+static uint32_t _fat_next(f32_t *filesystem, uint32_t cluster){
+    uint32_t sector = filesystem->FAT_begin_sector + cluster / FAT_PER_SECTOR;
+
+    if(sector != filesystem->FAT_cache_sector){
+        if(_fs_read_sector(sector, (uint8_t *) filesystem->FAT_cache) < 0){
+            filesystem->FAT_cache_sector = 0;
+            return FAT_EOC;
+        }
+        filesystem->FAT_cache_sector = sector;
+    }
+    return filesystem->FAT_cache[cluster % FAT_PER_SECTOR] & FAT_MASK;
+}
+
+/**
+** Name:  _cluster_sector
+**
+** This function finds the first sector of a cluster
+**
+** @param filesystem The FAT32 filesystem
+** @param cluster    The cluster
+**
+** @return the sector number
+*/
+static uint32_t _cluster_sector(f32_t *filesystem, uint32_t cluster){
+    return ((cluster - 2) * filesystem->bios_block.sectors_per_cluster) + filesystem->data_begin_sector;
+}
+
 /*
 ** PUBLIC FUNCTIONS
 */
@@ -71,40 +156,49 @@ int read_bpb(f32_t *filesystem, bpb_t *bios_block){
     __cio_puts("\nReading BIOS Parameter Block from disk...\n");
     // Finds and reads the sector where the Boot Record is from disk
     uint8_t sector0[SECTOR_SIZE];
-    read_sectors_ATA_PIO(0, (uint8_t *) sector0, &dev);
+    if(_fs_read_sector(0, sector0) < 0){
+        __cio_puts("\nError: Could not read the Boot Record. Abandoning File System set up\n");
+        return -1;
+    }
 
     // If the boot record is successfully found then the Bootable partition 
     // signature should be 0xAA55 at offset 0x1FE(510). 
-    if(sector0[510] != 0xAA55){
+    if(sector0[510] != 0x55 || sector0[511] != 0xAA){
         __cio_puts("\nError: Wrong Sector Found. Abandoning File System set up\n");
         return -1;
     }
 
     // BIOS Parameter Block
-    __memcpy(&bios_block->bytes_per_sector, &sector0[11], sizeof(sector0[11]));
-    __memcpy(&bios_block->sectors_per_cluster, &sector0[13], sizeof(sector0[13]));
-    __memcpy(&bios_block->reserved_sectors, &sector0[14], sizeof(sector0[14]));
-    __memcpy(&bios_block->num_FAT, &sector0[16], sizeof(sector0[16]));
-    __memcpy(&bios_block->num_root_dir, &sector0[17], sizeof(sector0[17]));
-    __memcpy(&bios_block->total_sectors, &sector0[19], sizeof(sector0[19])); 
-    __memcpy(&bios_block->media_descriptor_type, &sector0[21], sizeof(sector0[21]));
-    __memcpy(&bios_block->num_sectors_per_FAT, &sector0[22], sizeof(sector0[22])); 
-    __memcpy(&bios_block->num_sectors_per_track, &sector0[24], sizeof(sector0[24]));
-    __memcpy(&bios_block->num_heads_media, &sector0[26], sizeof(sector0[26]));
-    __memcpy(&bios_block->num_hidden_sectors, &sector0[28], sizeof(sector0[28]));
-    __memcpy(&bios_block->large_sector_count, &sector0[32], sizeof(sector0[32])); 
+    __memcpy(&bios_block->bytes_per_sector, &sector0[11], sizeof(bios_block->bytes_per_sector));
+    __memcpy(&bios_block->sectors_per_cluster, &sector0[13], sizeof(bios_block->sectors_per_cluster));
+    __memcpy(&bios_block->reserved_sectors, &sector0[14], sizeof(bios_block->reserved_sectors));
+    __memcpy(&bios_block->num_FAT, &sector0[16], sizeof(bios_block->num_FAT));
+    __memcpy(&bios_block->num_root_dir, &sector0[17], sizeof(bios_block->num_root_dir));
+    __memcpy(&bios_block->total_sectors, &sector0[19], sizeof(bios_block->total_sectors)); 
+    __memcpy(&bios_block->media_descriptor_type, &sector0[21], sizeof(bios_block->media_descriptor_type));
+    __memcpy(&bios_block->num_sectors_per_FAT, &sector0[22], sizeof(bios_block->num_sectors_per_FAT)); 
+    __memcpy(&bios_block->num_sectors_per_track, &sector0[24], sizeof(bios_block->num_sectors_per_track));
+    __memcpy(&bios_block->num_heads_media, &sector0[26], sizeof(bios_block->num_heads_media));
+    __memcpy(&bios_block->num_hidden_sectors, &sector0[28], sizeof(bios_block->num_hidden_sectors));
+    __memcpy(&bios_block->large_sector_count, &sector0[32], sizeof(bios_block->large_sector_count)); 
 
     // Extended Boot Record for FAT32
-    __memcpy(&bios_block->sectors_per_FAT32, &sector0[36], sizeof(sector0[36]));
-    __memcpy(&bios_block->flags, &sector0[40], sizeof(sector0[40]));
-    __memcpy(&bios_block->FAT_version_num, &sector0[42], sizeof(sector0[42]));
-    __memcpy(&bios_block->root_dir_cluster_num, &sector0[44], sizeof(sector0[44]));
-    __memcpy(&bios_block->sector_num_FSInfo, &sector0[48], sizeof(sector0[48]));
-    __memcpy(&bios_block->sector_num_backup, &sector0[50], sizeof(sector0[50]));
-    __memcpy(&bios_block->drive_num, &sector0[64], sizeof(sector0[64]));
-    __memcpy(&bios_block->windows_flags, &sector0[65], sizeof(sector0[65]));
-    __memcpy(&bios_block->signature, &sector0[66], sizeof(sector0[66]));
-    __memcpy(&bios_block->volume_id, &sector0[67], sizeof(sector0[67]));
+    __memcpy(&bios_block->sectors_per_FAT32, &sector0[36], sizeof(bios_block->sectors_per_FAT32));
+    __memcpy(&bios_block->flags, &sector0[40], sizeof(bios_block->flags));
+    __memcpy(&bios_block->FAT_version_num, &sector0[42], sizeof(bios_block->FAT_version_num));
+    __memcpy(&bios_block->root_dir_cluster_num, &sector0[44], sizeof(bios_block->root_dir_cluster_num));
+    __memcpy(&bios_block->sector_num_FSInfo, &sector0[48], sizeof(bios_block->sector_num_FSInfo));
+    __memcpy(&bios_block->sector_num_backup, &sector0[50], sizeof(bios_block->sector_num_backup));
+    __memcpy(&bios_block->drive_num, &sector0[64], sizeof(bios_block->drive_num));
+    __memcpy(&bios_block->windows_flags, &sector0[65], sizeof(bios_block->windows_flags));
+    __memcpy(&bios_block->signature, &sector0[66], sizeof(bios_block->signature));
+    __memcpy(&bios_block->volume_id, &sector0[67], sizeof(bios_block->volume_id));
+
+    // Everything else assumes this sector size
+    if(bios_block->bytes_per_sector != SECTOR_SIZE || bios_block->sectors_per_cluster == 0){
+        __cio_puts("\nError: Unsupported sector or cluster size. Abandoning File System set up\n");
+        return -1;
+    }
 
     return 1;
 }
@@ -121,7 +215,7 @@ int read_bpb(f32_t *filesystem, bpb_t *bios_block){
 ** @return The set up FAT32 filesystem structure
 */
 f32_t *make_Filesystem(){
-    f32_t *filesystem;
+    f32_t *filesystem = &_fs;
 
     __cio_puts("Identifying ATA Drive...\n");
 
@@ -143,6 +237,10 @@ f32_t *make_Filesystem(){
         dev = ata_secondary_slave;
         __cio_puts("ATA Drive Identified: Secondary Slave\n");
     }
+    else {
+        __cio_puts("No ATAPI Drive Found\n");
+        return NULL;
+    }
 
     // Get information about BPB, if it can't cancel the filesystem set up
     if(read_bpb(filesystem, &filesystem->bios_block) == -1){
@@ -154,20 +252,17 @@ f32_t *make_Filesystem(){
     filesystem->data_begin_sector = filesystem->bios_block.reserved_sectors + (filesystem->bios_block.num_FAT * filesystem->bios_block.sectors_per_FAT32);
     filesystem->current_cluster_pos = 0;
 
-    // Sets up the File Allocation Table by setting up   
-    // sectors within the FAT using data from disk
-    for(uint32_t sector_count = 0; sector_count < filesystem->bios_block.sectors_per_FAT32; sector_count++){
-        uint8_t this_sector[SECTOR_SIZE];
-        read_sectors_ATA_PIO(filesystem->FAT_begin_sector + sector_count, (uint8_t *) this_sector, &dev);
-        for (int i = 0; i < SECTOR_SIZE/4; i++){
-            filesystem->FAT[sector_count * (SECTOR_SIZE/4) + i] = this_sector[i * 4];
-        }
+    // Nothing is cached yet (sector 0 is the boot record, never a FAT
+    // sector, and no chain starts at cluster 0)
+    filesystem->FAT_cache_sector = 0;
+    filesystem->chain_first = 0;
 
-    }
-
-    // Creates the simulated root directory and adds it to the filesystem
-    filesystem->dir = create_dir(filesystem, filesystem->data_begin_sector);
+    // The File Allocation Table isn't kept in memory; entries
+    // are read from disk as cluster chains are followed (_fat_next)
+    filesystem->FAT = NULL;
+    filesystem->dir = NULL;
 
+    _filesystem = filesystem;
     return filesystem;
 }
 
@@ -391,3 +486,154 @@ void rm_dir(f32_t *filesystem){
 
     __memclr(filesystem->dir->entries, filesystem->dir->num_entries * sizeof(dir_entry_t));
 }
+
+/**
+** Name:  file_lookup
+**
+** This function looks for a file in the root directory, reading
+** the directory from disk
+**
+** @param filesystem The FAT32 filesystem
+** @param filename   The name of the file, as "NAME.EXT"
+** @param file       Where to put what's needed to read the file
+**
+** @return 1 if the file was found, -1 if it wasn't
+*/
+int file_lookup(f32_t *filesystem, const char *filename, file_t *file){
+    char name[MAX_FILENAME + MAX_FILETYPE];
+    dir_entry_t entries[SECTOR_SIZE / sizeof(dir_entry_t)];
+
+    if(filesystem == NULL){
+        return -1;
+    }
+
+    // Directory entries hold the name and type in upper case,
+    // padded with spaces, without the '.'
+    __memset(name, sizeof(name), ' ');
+    int len = 0;
+    int limit = MAX_FILENAME;
+    for(const char *ch = filename; *ch; ch++){
+        if(*ch == '.' && limit == MAX_FILENAME){
+            len = MAX_FILENAME;
+            limit = MAX_FILENAME + MAX_FILETYPE;
+            continue;
+        }
+        if(len >= limit){
+            return -1;
+        }
+        name[len++] = (*ch >= 'a' && *ch <= 'z') ? *ch - 'a' + 'A' : *ch;
+    }
+
+    // Looks through the cluster chain of the root directory
+    uint32_t cluster = filesystem->bios_block.root_dir_cluster_num;
+    while(cluster >= 2 && cluster < FAT_BAD_CLUSTER){
+        uint32_t first_sector = _cluster_sector(filesystem, cluster);
+        for(uint32_t i = 0; i < filesystem->bios_block.sectors_per_cluster; i++){
+            if(_fs_read_sector(first_sector + i, (uint8_t *) entries) < 0){
+                return -1;
+            }
+            for(uint32_t j = 0; j < sizeof(entries) / sizeof(dir_entry_t); j++){
+                dir_entry_t *entry = &entries[j];
+                // If the first byte is 0 there are no more entries
+                if(entry->name[0] == 0){
+                    return -1;
+                }
+                if((uint8_t) entry->name[0] == DIR_ENTRY_FREE ||
+                        (entry->attributes & (DIR_ENTRY_DIRECTORY | DIR_ENTRY_VOLUME_ID))){
+                    continue;
+                }
+                // the name and extension are the first 11 bytes
+                uint32_t k = 0;
+                while(k < sizeof(name) && ((const char *) entry)[k] == name[k]){
+                    k++;
+                }
+                if(k == sizeof(name)){
+                    file->cluster = ((uint32_t) entry->first_cluster_high_bytes << 16) | entry->first_cluster_low_bytes;
+                    file->size = entry->file_size;
+                    return 1;
+                }
+            }
+        }
+        cluster = _fat_next(filesystem, cluster);
+    }
+    return -1;
+}
+
+/**
+** Name:  file_read_page
+**
+** This function reads one page of a file. Whatever part of the page
+** lies beyond the end of the file is zero if the buffer was zeroed.
+**
+** @param filesystem The FAT32 filesystem
+** @param file       The file
+** @param index      Which page of the file to read
+** @param buffer     A page-sized buffer for the data
+**
+** @return 1 if the page was read, -1 if it couldn't be
+*/
+int file_read_page(f32_t *filesystem, file_t *file, uint32_t index, uint8_t *buffer){
+    uint32_t cluster_size = filesystem->bios_block.sectors_per_cluster * SECTOR_SIZE;
+    uint32_t offset = index * SZ_PAGE;
+
+    if(offset >= file->size){
+        return 1;
+    }
+
+    // Walks the cluster chain to the cluster holding the page, from
+    // where the last call stopped if that was in this file short of it
+    uint32_t want = offset / cluster_size;
+    uint32_t n = 0;
+    uint32_t cluster = file->cluster;
+    if(filesystem->chain_first == file->cluster && filesystem->chain_index <= want){
+        n = filesystem->chain_index;
+        cluster = filesystem->chain_cluster;
+    }
+    for(; n < want; n++){
+        cluster = _fat_next(filesystem, cluster);
+        if(cluster < 2 || cluster >= FAT_BAD_CLUSTER){
+            filesystem->chain_first = 0;
+            return -1;
+        }
+    }
+
+    // Reads the page, moving along the chain whenever a cluster
+    // boundary is crossed; whole ATAPI sectors go straight into the
+    // buffer, anything smaller comes through _fs_read_sector
+    uint32_t done = 0;
+    while(done < SZ_PAGE && offset + done < file->size){
+        uint32_t in_cluster = (offset + done) % cluster_size;
+        if(done > 0 && in_cluster == 0){
+            cluster = _fat_next(filesystem, cluster);
+            if(cluster < 2 || cluster >= FAT_BAD_CLUSTER){
+                filesystem->chain_first = 0;
+                return -1;
+            }
+            n++;
+        }
+        uint32_t sector = _cluster_sector(filesystem, cluster) + in_cluster / SECTOR_SIZE;
+        if(sector % FAT_PER_ATAPI == 0 && cluster_size - in_cluster >= ATAPI_SECTOR_SIZE &&
+           SZ_PAGE - done >= ATAPI_SECTOR_SIZE){
+            if(read_sectors_ATA_PIO(sector / FAT_PER_ATAPI, buffer + done, &dev) < 0){
+                return -1;
+            }
+            done += ATAPI_SECTOR_SIZE;
+        } else {
+            if(_fs_read_sector(sector, buffer + done) < 0){
+                return -1;
+            }
+            done += SECTOR_SIZE;
+        }
+    }
+
+    filesystem->chain_first = file->cluster;
+    filesystem->chain_index = n;
+    filesystem->chain_cluster = cluster;
+
+    // The last sectors read may have leftovers past the end of the file
+    if(file->size - offset < SZ_PAGE){
+        uint32_t end = file->size - offset;
+        __memclr(buffer + end, done - end);
+    }
+    return 1;
+}
@@ -12,6 +12,7 @@
 
 #include "kernel.h"
 #include "kmem.h"
+#include "slab.h"
 #include "queues.h"
 #include "clock.h"
 #include "process.h"
@@ -22,7 +23,14 @@
 #include "scheduler.h"
 #include "support.h"
 #include "paging.h"
+#include "phys_alloc.h"
+#include "vm.h"
 #include "filesystem.h"
+#include "pgcache.h"
+#include "shm.h"
+#include "swap.h"
+#include "zswap.h"
+#include "smp.h"
 
 // need addresses of some user functions
 #include "users.h"
@@ -62,7 +70,8 @@ char b512[512];
 //     OS stack & stack pointer
 //
 
-// A separate stack for the OS itself
+// A separate stack for the OS itself (the bootstrap CPU's; each
+// other CPU has its own - see smp.c)
 // (NOTE:  this assumes the OS is not reentrant!)
 stack_t *_system_stack;
 uint32_t *_system_esp;
@@ -163,16 +172,25 @@ void _kinit( void ) {
     // other module initialization calls here
     _queue_init();  // MUST BE SECOND
     _pcb_init();
+    _vm_init();
     _stk_init();
     _sys_init();
     _sched_init();
     _clk_init();
     _sio_init();
 
+    _pgc_init();
+    _shm_init();
+    _swap_init();
+    _zs_init();
+    _smp_init();    // after everything an AP might use
+
     __cio_puts("\nFile System set up starting.\n");
-    f32_t *new_fs = make_Filesystem();
-    __cio_puts("\nFile System set up failed.\n");
-    //__cio_puts("\nFile System set up completed.\n");
+    if( make_Filesystem() == NULL ) {
+        __cio_puts("\nFile System set up failed.\n");
+    } else {
+        __cio_puts("\nFile System set up completed.\n");
+    }
 
     __cio_puts( "\nModule initialization complete.\n" );
     __cio_puts( "-------------------------------\n" );
@@ -188,21 +206,26 @@ void _kinit( void ) {
     pcb_t *new = _pcb_alloc();
     assert( new != NULL );
     // _current = new;
-    new->stack = _stk_alloc(NULL);
-    assert( new->stack != NULL );
 
     // fill in the necessary fields
     new->pid = new->ppid = PID_INIT;
     new->state = New;
     new->quantum = Q_DEFAULT;
-    new->priority = System;
+    new->priority = new->base = System;
 
     // command-line arguments
     char *args[2] = { "init", NULL };
 
-    // set up the stack
-    new->context = _stk_setup( new->stack, (uint32_t) init, args );
+    // give it an address space and a stack in it, and set up the stack
     new->pg_dir = copy_pg_dir(get_current_pg_dir());
+    assert( new->pg_dir != NULL );
+    _vm_heap( new );
+    if( _stk_area(new) != E_SUCCESS ) {
+        PANIC( 0, "no memory for init's stack" );
+    }
+    set_page_directory( new->pg_dir );
+    new->context = _stk_setup( new, (uint32_t) init, args );
+    assert( new->context != NULL );
     // add to the process table
     _processes[0] = new;
     _n_procs = 1;
@@ -249,15 +272,30 @@ void _kshell( int ch ) {
         // code to dump out any/all queues
         _queue_dump( "Sleep queue", _sleeping );
         _queue_dump( "Read queue", _reading );
-        _queue_dump( "Ready queue[System]", _ready[System] );
-        _queue_dump( "Ready queue[User]", _ready[User] );
-        _queue_dump( "Ready queue[Deferred]", _ready[Deferred] );
+        _sched_dump( "Ready queue" );
+        _smp_dump();
         break;
 
     case 'a':  // dump the active table
         _ptable_dump( "\nActive processes", false );
         break;
 
+    case 'f':  // switch between the fair class and the MLFQ
+        _sched_set_fair( !_sched_fair );
+        __cio_printf( "\nscheduler: %s\n", _sched_fair ? "fair" : "MLFQ" );
+        break;
+
+    case 'm':  // dump memory and paging statistics
+        _km_dump();
+        _slab_dump();
+        _phys_dump();
+        _paging_dump();
+        _pgc_dump();
+        _shm_dump();
+        _swap_dump();
+        _zs_dump();
+        break;
+
     case 'p':  // dump the active table and all PCBs
         _ptable_dump( "\nActive processes", true );
         break;
@@ -272,8 +310,19 @@ void _kshell( int ch ) {
             pcb_t *pcb = _processes[i];
             if( pcb != NULL && pcb->state != Free ) {
                 __cio_printf( "pid %5d: ", pcb->pid );
-                __cio_printf( "EIP %08x, ", pcb->context->eip );
+                __cio_printf( "EIP %08x, ", REG(pcb,eip) );
+                // every stack is at the same address, in its own
+                // address space, so look at it through that one
+                virt_addr top = (virt_addr) (pcb->stack + 1);
+                if( !_vm_touch(pcb, top - 12 * sizeof(uint32_t),
+                               12 * sizeof(uint32_t), false) ) {
+                    __cio_puts( "no stack\n" );
+                    continue;
+                }
+                struct page_directory *dir = get_current_pg_dir();
+                set_page_directory( pcb->pg_dir );
                 _stk_dump( NULL, pcb->stack, 12 );
+                set_page_directory( dir );
             }
         }
         break;
@@ -286,7 +335,9 @@ void _kshell( int ch ) {
         __cio_puts( "\nCommands:\n" );
         __cio_puts( "   a  -- dump the active table\n" );
         __cio_puts( "   c  -- dump contexts for active processes\n" );
+        __cio_puts( "   f  -- switch between fair and MLFQ scheduling\n" );
         __cio_puts( "   h  -- this message\n" );
+        __cio_puts( "   m  -- dump memory and paging statistics\n" );
         __cio_puts( "   p  -- dump the active table and all PCBs\n" );
         __cio_puts( "   q  -- dump the queues\n" );
         __cio_puts( "   s  -- dump stacks for active processes\n" );
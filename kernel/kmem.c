@@ -12,35 +12,35 @@
 ** This allocator functions as a simple "slab" allocator; it allows
 ** allocation of either 4096-byte ("page") or 1024-byte ("slice")
 ** chunks of memory from the free pool.  The free pool is initialized
-** using the memory map provided by the BIOS during the boot sequence,
-** and contains a series of blocks which are multiples of 4K bytes and
-** which are aligned at 4K boundaries; they are held in the free list
-** in order by base address.
-**
-** The "page" allocator allows allocation of one or more 4K blocks
-** at a time.  Requests are made for a specific number of 4K pages;
-** the allocator locates the first free list entry that contains at
-** least the requested amount of space.  If that entry is the exact
-** size requested, it is unlinked and returned; otherwise, the entry
-** is split into a chunk of the requested size and the remainder.
-** The chunk is returned, and the remainder replaces the original
-** block in the free list.  On deallocation, the block is inserted
-** at the appropriate place in the free list, and physically adjacent
-** blocks are coalesced into single, larger blocks.  If a multi-page
-** block is allocated, it should be deallocated one page at a time,
-** because there is no record of the size of the original allocation -
-** all we know is that it is N*4K bytes in length, so it's up to the
-** requesting code to figure this out.
-**
-** The "slice" allocator operates by taking blocks from the "page"
-** allocator and splitting them into four 1K slices, which it then
-** manages.  Requests are made for slices one at a time.  If the free
-** list contains an available slice, it is unlinked and returned;
-** otherwise, a page is requested from the page allocator, split into
-** slices, and the slices are added to the free list, after which the
-** first one is returned.  The slice free list is a simple linked list
-** of these 1K blocks; because they are all the same size, no ordering
-** is done on the free list, and no coalescing is performed.
+** using the memory map provided by the BIOS during the boot sequence.
+**
+** The "page" allocator is a binary buddy system.  Free memory is kept
+** as blocks of 2^k pages (an "order k" block) which are aligned on a
+** 2^k page boundary, with a separate free list for each order.  A
+** request for N pages is satisfied from the smallest order that can
+** hold it; larger blocks are split in half as needed, and any pages
+** beyond the N requested are given back immediately, so exactly N
+** pages are consumed.  On deallocation, each block is merged with its
+** "buddy" (the other half of the block it was split from) for as long
+** as that buddy is also free.  Both operations take time bounded by
+** the number of orders, no matter how many blocks are free.
+**
+** The allocator never writes into the memory it manages.  Instead, a
+** table with one descriptor per page (carved from the start of the
+** largest usable region) records which pages head free blocks, the
+** free list links, and the length of each allocation; this is what
+** allows a multi-page block to be freed with a single call.
+**
+** The general-purpose allocator (kmalloc/kfree) is layered on top of
+** these.  Requests of up to 2KB are rounded up to a power-of-two size
+** class (16 bytes through 2KB), each of which is a slab cache with its
+** own free objects; larger requests are given whole pages from the
+** buddy allocator.  Because slab objects never begin on a page boundary
+** and page allocations always do, kfree() can tell the two apart from
+** the pointer alone, and neither needs a size header.
+**
+** The "slice" interface (fixed 1KB chunks) is kept for compatibility;
+** slices now come from the 1KB kmalloc size class.
 **
 */
 
@@ -56,6 +56,8 @@
 #include "kmem.h"
 #include "paging.h"
 #include "phys_alloc.h"
+#include "slab.h"
+
 /*
 ** PRIVATE DEFINITIONS
 */
@@ -74,30 +76,80 @@
 #define P2B(x)   ((x) << LOG2_OF_PAGE_SIZE)
 #define B2P(x)   ((x) >> LOG2_OF_PAGE_SIZE)
 
+// largest block the buddy allocator manages: 2^10 pages (4MB)
+
+#define MAX_ORDER   10
+
+// maximum number of usable BIOS memory regions we will manage
+
+#define MAX_REGIONS 8
+
+// pages given to the paging frame allocator to start with (it gets
+// more from us once we're up; see _fallback_alloc)
+
+#define PAGING_POOL 16
+
+// "no page" marker for the free list links
+
+#define NO_PFN      0xffffffff
+
+// page states recorded in the page descriptor table
+
+#define PG_RESERVED 0   // not managed by the allocator (or not a block head)
+#define PG_FREE     1   // head of a free block
+#define PG_USED     2   // head of an allocated block
+
+// converters:  addresses to page frame numbers and back
+
+#define A2PFN(a)    ((uint32_t) (a) >> LOG2_OF_PAGE_SIZE)
+#define PFN2A(n)    ((void *) P2B(n))
+
+// the buddy of the order k block starting at page frame n
+
+#define BUDDY(n,k)  ((n) ^ (1U << (k)))
+
+// kmalloc size classes: 2^KM_MIN_SHIFT through 2^KM_MAX_SHIFT bytes
+
+#define KM_MIN_SHIFT    4
+#define KM_MAX_SHIFT    11
+#define KM_CLASSES      (KM_MAX_SHIFT - KM_MIN_SHIFT + 1)
+#define KM_MAX_SIZE     (1U << KM_MAX_SHIFT)
+
 /*
-** Name:    adjacent
-**
-** Arguments:   addresses of two blocks
-**
-** Description: Determines whether the second block immediately
-**      follows the first one.
+** PRIVATE DATA TYPES
 */
-#define adjacent(first,second)  \
-    ( (void *) (first) + P2B((first)->pages) == (void *) (second) )
 
 /*
-** PRIVATE DATA TYPES
+** This structure describes a single page of managed memory.  Only the
+** descriptor of the first page in a block is meaningful; the others
+** are left as PG_RESERVED.  Free blocks are linked through the
+** descriptors by page frame number, so the pages themselves are never
+** touched by the allocator.
 */
 
+typedef struct pginfo_s {
+    uint8_t  state;           // PG_RESERVED, PG_FREE, or PG_USED
+    uint8_t  order;           // order of the block, if it's free
+    uint16_t unused;
+    union {
+        struct {
+            uint32_t next;    // next free block of this order
+            uint32_t prev;    // previous free block of this order
+        } link;
+        uint32_t pages;       // length of the allocation, if it's used
+    } u;
+} Pageinfo;
+
 /*
-** This structure keeps track of a single block of memory.  All blocks
-** are multiples of the base size (currently, 4KB).
+** A usable region of memory reported by the BIOS, recorded while
+** the memory map is scanned and handed to the buddy allocator once
+** the whole map has been seen.
 */
 
-typedef struct blkinfo_s {
-    uint32_t pages;           // length of this block, in pages
-    struct   blkinfo_s *next; // pointer to the next free block
-} Blockinfo;
+typedef struct range_s {
+    uint32_t first;           // first page frame number
+    uint32_t pages;           // length, in pages
+} Range;
 
 /*
 ** Memory region information returned by the BIOS
@@ -157,8 +209,27 @@ typedef struct memregion_s {
 */
 
 // freespace pools
-static Blockinfo *_free_pages;
-static Blockinfo *_free_slices;
+static uint32_t _free_area[MAX_ORDER + 1];
+
+// one slab cache per kmalloc size class
+static slab_cache_t _km_caches[KM_CLASSES];
+
+static const char *_km_class_names[KM_CLASSES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1k", "kmalloc-2k"
+};
+
+// page descriptor table, covering frames _first_pfn through _last_pfn
+static Pageinfo *_pginfo;
+static uint32_t _first_pfn;
+static uint32_t _last_pfn;
+
+// number of free pages in the buddy allocator
+static uint32_t _free_count;
+
+// usable regions found in the memory map
+static Range _regions[MAX_REGIONS];
+static int _n_regions;
 
 // initialization status
 static int _km_initialized = 0;
@@ -177,105 +248,216 @@ extern int _end;    // end of the BSS section - provided by the linker
 ** FREE LIST MANAGEMENT
 */
 
+// descriptor for page frame n
+#define PG(n)   (&_pginfo[(n) - _first_pfn])
+
+/**
+** Name:    _list_add
+**
+** Add a block to the front of the free list for its order
+**
+** @param pfn    Page frame number of the first page in the block
+** @param order  Order of the block
+*/
+static void _list_add( uint32_t pfn, uint32_t order ) {
+    Pageinfo *pg = PG(pfn);
+
+    pg->state = PG_FREE;
+    pg->order = order;
+    pg->u.link.prev = NO_PFN;
+    pg->u.link.next = _free_area[order];
+
+    if( _free_area[order] != NO_PFN ) {
+        PG(_free_area[order])->u.link.prev = pfn;
+    }
+    _free_area[order] = pfn;
+}
+
+/**
+** Name:    _list_del
+**
+** Remove a block from the free list for its order
+**
+** @param pfn    Page frame number of the first page in the block
+** @param order  Order of the block
+*/
+static void _list_del( uint32_t pfn, uint32_t order ) {
+    Pageinfo *pg = PG(pfn);
+
+    if( pg->u.link.prev != NO_PFN ) {
+        PG(pg->u.link.prev)->u.link.next = pg->u.link.next;
+    } else {
+        _free_area[order] = pg->u.link.next;
+    }
+
+    if( pg->u.link.next != NO_PFN ) {
+        PG(pg->u.link.next)->u.link.prev = pg->u.link.prev;
+    }
+
+    pg->state = PG_RESERVED;
+}
+
+/**
+** Name:    _free_block
+**
+** Return an aligned block to the free lists, merging it with
+** its buddy for as long as the buddy is also free.
+**
+** @param pfn    Page frame number of the first page in the block
+** @param order  Order of the block
+*/
+static void _free_block( uint32_t pfn, uint32_t order ) {
+
+    _free_count += 1U << order;
+
+    while( order < MAX_ORDER ) {
+        uint32_t buddy = BUDDY( pfn, order );
+
+        if( buddy < _first_pfn || buddy > _last_pfn ) {
+            break;
+        }
+
+        Pageinfo *pg = PG(buddy);
+        if( pg->state != PG_FREE || pg->order != order ) {
+            break;
+        }
+
+        // merge: the combined block starts at the lower of the two
+        _list_del( buddy, order );
+        pfn &= ~(1U << order);
+        ++order;
+    }
+
+    _list_add( pfn, order );
+}
+
+/**
+** Name:    _free_range
+**
+** Return an arbitrary run of pages to the free lists by splitting
+** it into the largest aligned blocks possible.
+**
+** @param pfn    Page frame number of the first page in the run
+** @param pages  Length of the run, in pages
+*/
+static void _free_range( uint32_t pfn, uint32_t pages ) {
+
+    while( pages > 0 ) {
+        uint32_t order = MAX_ORDER;
+
+        // shrink until the block is aligned and fits in the run
+        while( (pfn & ((1U << order) - 1)) != 0 || (1U << order) > pages ) {
+            --order;
+        }
+
+        _free_block( pfn, order );
+        pfn += 1U << order;
+        pages -= 1U << order;
+    }
+}
+
 /**
 ** Name:    _add_block
 **
-** Add a block to the free list
+** Add a block to the free pool
+**
+** The paging frame allocator gets the first PAGING_POOL pages of the
+** first block; the rest of it, and the other blocks, are recorded,
+** and become part of the free pool when _buddy_init() runs.
 **
 ** @param base   Base address of the block
 ** @param length Block length, in bytes
 */
 static void _add_block( uint32_t base, uint32_t length) {
-    Blockinfo *block;
 
+    // only want whole 4K pages; trim the ends to 4K boundaries
+    if( (base & 0xfff) != 0 ) {
+        uint32_t loss = SZ_PAGE - (base & 0xfff);
+        if( length <= loss ) {
+            return;
+        }
+        base += loss;
+        length -= loss;
+    }
+    length &= 0xfffff000;
 
     if(!is_paging_init()){
-        uint8_t num_pages=10;
-        if(length >= num_pages * SZ_PAGE){
-            _phys_alloc_init(base, length/SZ_PAGE);
+        if(length >= PAGING_POOL * SZ_PAGE){
+            // all of it is covered by the kernel's identity map
+            _phys_alloc_init(base, PAGING_POOL);
             _paging_init();
-            for(int i = 0; i < length/SZ_PAGE * SZ_PAGE; i+=SZ_PAGE){
-                map_virt_page_to_phys(base + i, base + i);
-            }
-            return;
-            // base += num_pages* SZ_PAGE;
-            // length -= num_pages * SZ_PAGE;
+            base += PAGING_POOL * SZ_PAGE;
+            length -= PAGING_POOL * SZ_PAGE;
         }else{
             PANIC(0, "Not enough mem for paging - fix this.");
         }
     }
+
     // don't add it if it isn't at least 4K
     if( length < SZ_PAGE ) {
         return;
     }
 
-    // only want to add multiples of 4K; check the lower bits
-    if( (length & 0xfff) != 0 ) {
-        // round it down to 4K
-        length &= 0xfffff000;
-    }
-    if(!is_paging_init()){
-        PANIC(0, "Paging is not initialized :(");
+    if( _n_regions >= MAX_REGIONS ) {
+        WARNING( "too many memory regions, ignoring one" );
+        return;
     }
 
-    // create the "block"
-
-    block = (Blockinfo *) base;
-    uint32_t virt = 0+base;
-    // let's identity map this block for now
-    map_virt_page_to_phys(virt,base);
-
-    // block = base +
-    block = (Blockinfo *) virt;
+    _regions[_n_regions].first = A2PFN(base);
+    _regions[_n_regions].pages = B2P(length);
+    ++_n_regions;
+}
 
-    block->pages = B2P(length);
-    block->next = NULL;
+/**
+** Name:    _buddy_init
+**
+** Build the page descriptor table and place every recorded
+** region in the free pool.
+*/
+static void _buddy_init( void ) {
+    Range *table_rgn = NULL;
 
-    /*
-    ** We maintain the free list in order by address, to simplify
-    ** coalescing adjacent free blocks.
-    **
-    ** Handle the easiest case first.
-    */
+    for( int i = 0; i < MAX_ORDER + 1; ++i ) {
+        _free_area[i] = NO_PFN;
+    }
+    _free_count = 0;
 
-    if( _free_pages == NULL ) {
-        _free_pages = block;
+    if( _n_regions < 1 ) {
         return;
     }
 
-    /*
-    ** Unfortunately, it's not always that easy....
-    **
-    ** Find the correct insertion spot.
-    */
-
-    Blockinfo *prev, *curr;
-
-    prev = NULL;
-    curr = _free_pages;
+    // find the span of frames we manage, and the largest region
+    _first_pfn = _regions[0].first;
+    _last_pfn = 0;
+    for( int i = 0; i < _n_regions; ++i ) {
+        Range *r = &_regions[i];
+        if( r->first < _first_pfn ) {
+            _first_pfn = r->first;
+        }
+        if( r->first + r->pages - 1 > _last_pfn ) {
+            _last_pfn = r->first + r->pages - 1;
+        }
+        if( table_rgn == NULL || r->pages > table_rgn->pages ) {
+            table_rgn = r;
+        }
+    }
 
-    while( curr && curr < block ) {
-        prev = curr;
-        map_virt_page_to_phys(curr,curr);
-        curr = curr->next;
+    // the descriptor table comes off the front of the largest region
+    uint32_t size = (_last_pfn - _first_pfn + 1) * sizeof(Pageinfo);
+    uint32_t table_pages = B2P( size + SZ_PAGE - 1 );
+    if( table_pages >= table_rgn->pages ) {
+        PANIC( 0, "no room for the page descriptor table" );
     }
 
-    // the new block always points to its successor
-    block->next = curr;
+    _pginfo = (Pageinfo *) PFN2A( table_rgn->first );
+    __memclr( (void *) _pginfo, size );
 
-    /*
-    ** If prev is NULL, we're adding at the front; otherwise,
-    ** we're adding after some other entry (middle or end).
-    */
+    table_rgn->first += table_pages;
+    table_rgn->pages -= table_pages;
 
-    if( prev == NULL ) {
-        // sanity check - both pointers can't be NULL
-        assert( curr );
-        // add at the beginning
-        _free_pages = block;
-    } else {
-        // inserting in the middle or at the end
-        prev->next = block;
+    // now, everything else is free
+    for( int i = 0; i < _n_regions; ++i ) {
+        _free_range( _regions[i].first, _regions[i].pages );
     }
 }
 
@@ -298,8 +480,7 @@ void _km_init( void ) {
     __cio_puts( " Kmem:" );
 
     // initially, nothing in the free lists
-    _free_slices = NULL;
-    _free_pages = NULL;
+    _n_regions = 0;
 
     /*
     ** We ignore all memory below the end of our OS.  In theory,
@@ -309,7 +490,10 @@ void _km_init( void ) {
 
     // set our cutoff point as the end of the BSS section
     // cutoff = (uint32_t) (&_end + 0x10000);
-    cutoff = (uint32_t) (0x6b000);
+    // (the user program images are loaded from 0x40000 upward, and
+    // the kernel reads their segments from there every time a page
+    // is loaded, so none of the memory below 640K is given away)
+    cutoff = (uint32_t) (0xa0000);
 
     // round it up to the next multiple of 4K (0x1000)
     if( cutoff & 0xfffLL ) {
@@ -377,7 +561,7 @@ void _km_init( void ) {
         if( base < cutoff ) {
 
             // is the whole thing too low, or just part?
-            if( (base + length) < cutoff ) {
+            if( (base + length) <= cutoff ) {
                 // it's all below the cutoff!
                 continue;
             }
@@ -401,6 +585,16 @@ void _km_init( void ) {
             length -= loss;
         }
 
+        // we only use memory which the kernel has identity mapped
+
+        if( base >= IDENT_MAP_LIMIT ) {
+            continue;
+        }
+
+        if( (base + length) > IDENT_MAP_LIMIT ) {
+            length = IDENT_MAP_LIMIT - base;
+        }
+
         // we survived the gauntlet - add the new block
 
         uint32_t b32 = base   & ADDR_LOW_HALF;
@@ -411,9 +605,22 @@ void _km_init( void ) {
         _add_block( b32, l32 );
     }
 
+    // build the buddy lists from what we found
+    _buddy_init();
+
     // record the initialization
     _km_initialized = 1;
 
+    // create the kmalloc size classes; they get pages on demand
+    for( int i = 0; i < KM_CLASSES; ++i ) {
+        _km_caches[i] = _slab_create( _km_class_names[i],
+                                      1U << (KM_MIN_SHIFT + i), NULL );
+        assert( _km_caches[i] != NULL );
+    }
+
+    // reference counts for frames shared between address spaces
+    _phys_refs_init( _last_pfn + 1 );
+
     // announce that we have completed initialization
     __cio_puts( " done" );
 }
@@ -424,20 +631,24 @@ bool_t km_is_init(void){
 /**
 ** Name:    _km_dump
 **
-** Dump the current contents of the free list to the console
+** Dump the current contents of the free lists to the console
 */
 void _km_dump( void ) {
-    Blockinfo *block;
 
-    __cio_printf( "&_free_pages=%08x\n", &_free_pages );
+    __cio_printf( "free pages: %d (frames 0x%x-0x%x)\n",
+                  _free_count, _first_pfn, _last_pfn );
 
-    for( block = _free_pages; block != NULL; block = block->next ) {
-        __cio_printf(
-            "block @ 0x%08x 0x%08x pages (ends at 0x%08x) next @ 0x%08x\n",
-                block, block->pages, P2B(block->pages) + (uint32_t) block,
-                block->next );
+    for( int order = 0; order <= MAX_ORDER; ++order ) {
+        int n = 0;
+        for( uint32_t pfn = _free_area[order]; pfn != NO_PFN;
+                pfn = PG(pfn)->u.link.next ) {
+            ++n;
+        }
+        if( n > 0 ) {
+            __cio_printf( "order %2d (%4d pages): %d blocks\n",
+                          order, 1 << order, n );
+        }
     }
-
 }
 
 /*
@@ -459,81 +670,60 @@ void *_km_page_alloc( uint32_t count ) {
     assert( _km_initialized );
 
     // make sure we actually need to do something!
-    if( count < 1 ) {
+    if( count < 1 || count > (1U << MAX_ORDER) ) {
         return( NULL );
     }
 
-    /*
-    ** Look for the first entry that is large enough.
-    */
-
-    // pointer to the current block
-    Blockinfo *block = _free_pages;
-
-    // pointer to where the pointer to the current block is
-    Blockinfo **pointer = &_free_pages;
+    // smallest order which holds the request
+    uint32_t order = 0;
+    while( (1U << order) < count ) {
+        ++order;
+    }
 
-    while( block != NULL && block->pages < count ){
-        pointer = &block->next;
-        block = *pointer;
+    // find the smallest free block at least that large
+    uint32_t avail = order;
+    while( avail <= MAX_ORDER && _free_area[avail] == NO_PFN ) {
+        ++avail;
     }
 
-    // did we find a big enough block?
-    if( block == NULL ){
+    if( avail > MAX_ORDER ) {
         // nope!
         return( NULL );
     }
 
-    // found one!  check the length
-
-    if( block->pages == count ) {
+    uint32_t pfn = _free_area[avail];
+    _list_del( pfn, avail );
+    _free_count -= 1U << avail;
 
-        // exactly the right size - unlink it from the list
-
-        *pointer = block->next;
-
-    } else {
-
-        // bigger than we need - carve the amount we need off
-        // the beginning of this block
-
-        // remember where this chunk begins
-        Blockinfo *chunk = block;
-
-        // how much space will be left over?
-        int excess = block->pages - count;
-
-        // find the start of the new fragment
-        Blockinfo *fragment = (Blockinfo *) ( (uint8_t *) block + P2B(count) );
+    // split it, keeping the lower half each time
+    while( avail > order ) {
+        --avail;
+        _list_add( pfn + (1U << avail), avail );
+        _free_count += 1U << avail;
+    }
 
-        // set the length and link for the new fragment
-        fragment->pages = excess;
-        fragment->next  = block->next;
+    // give back whatever is beyond the requested length
+    if( count < (1U << order) ) {
+        _free_range( pfn + count, (1U << order) - count );
+    }
 
-        // replace this chunk with the fragment
-        *pointer = fragment;
+    PG(pfn)->state = PG_USED;
+    PG(pfn)->u.pages = count;
 
-        // return this chunk
-        block = chunk;
-    }
-    return( block );
+    return( PFN2A(pfn) );
 }
 
 /**
 ** Name:    _km_page_free
 **
-** Returns a memory block to the list of available blocks,
-** combining it with adjacent blocks if they're present.
+** Returns a memory block to the free pool, combining it with
+** its buddies if they're free.
 **
-** CRITICAL ASSUMPTION:  multi-page blocks will be freed one page
-** at a time!
+** The whole block obtained from _km_page_alloc() is released.
 **
-** @param block   Pointer to the page to be returned to the free list
+** @param block   Pointer to the block to be returned to the free pool
 */
 void _km_page_free( void *block ){
-    Blockinfo *used;
-    Blockinfo *prev;
-    Blockinfo *curr;
 
     assert( _km_initialized );
 
@@ -544,102 +734,72 @@ void _km_page_free( void *block ){
         return;
     }
 
-    used = (Blockinfo *) block;
-
-    /*
-    ** CRITICAL ASSUMPTION
-    **
-    ** We assume that any multi-page block that is being freed will
-    ** be freed one page at a time.  We make this assumption because we
-    ** don't track allocation sizes.  We can't use the simple "allocate
-    ** four extra bytes before the returned pointer" scheme to do this
-    ** because we're managing pages, and the pointers we return must point
-    ** to page boundaries, so we would wind up allocating an extra page
-    ** for each allocation.
-    **
-    ** Alternatively, we could keep an array of addresses and block
-    ** sizes ourselves, but that feels clunky, and would risk running out
-    ** of table entries if there are lots of allocations (assuming we use
-    ** a 4KB page to hold the table, at eight bytes per entry we would have
-    ** 512 entries per page).
-    **
-    ** IF THIS ASSUMPTION CHANGES, THIS CODE MUST BE FIXED!!!
-    */
-
-    used->pages = 1;
-
-    /*
-    ** Advance through the list until current and previous
-    ** straddle the place where the new block should be inserted.
-    */
-    prev = NULL;
-    curr = _free_pages;
+    uint32_t pfn = A2PFN( block );
+    assert( pfn >= _first_pfn && pfn <= _last_pfn );
 
-    while( curr != NULL && curr < used ){
-        prev = curr;
-        curr = curr->next;
+    Pageinfo *pg = PG(pfn);
+    if( pg->state != PG_USED ) {
+        WARNING( "freeing a block which was not allocated" );
+        return;
     }
 
-    /*
-    ** At this point, we have the following list structure:
-    **
-    **   ....    BLOCK       BLOCK      ....
-    **          (*prev)  ^  (*curr)
-    **                   |
-    **                "used" goes here
-    **
-    ** We may need to merge the inserted block with either its
-    ** predecessor or its successor (or both).
-    */
-
-    /*
-    ** If this is not the first block in the resulting list,
-    ** we may need to merge it with its predecessor.
-    */
-    if( prev != NULL ){
-
-        // There is a predecessor.  Check to see if we need to merge.
-        if( adjacent( prev, used ) ){
-
-            // yes - merge them
-            prev->pages += used->pages;
-
-            // the predecessor becomes the "newly inserted" block,
-            // because we still need to check to see if we should
-            // merge with the successor
-            used = prev;
+    pg->state = PG_RESERVED;
+    _free_range( pfn, pg->u.pages );
+}
 
-        } else {
+/*
+** GENERAL-PURPOSE ALLOCATION
+*/
 
-            // Not adjacent - just insert the new block
-            // between the predecessor and the successor.
-            used->next = prev->next;
-            prev->next = used;
+/**
+** Name:    kmalloc
+**
+** Allocate a block of memory of (at least) the requested size.
+**
+** @param size  Number of bytes desired
+**
+** @return a pointer to the memory, or NULL if none is available
+*/
+void *kmalloc( uint32_t size ) {
 
-        }
+    assert( _km_initialized );
 
-    } else {
+    if( size == 0 ) {
+        return( NULL );
+    }
 
-        // Yes, it is first.  Update the list pointer to insert it.
-        used->next = _free_pages;
-        _free_pages = used;
+    // large requests get whole pages
+    if( size > KM_MAX_SIZE ) {
+        return( _km_page_alloc( B2P(size + SZ_PAGE - 1) ) );
+    }
 
+    // everything else comes from the smallest class that fits
+    int i = 0;
+    while( (1U << (KM_MIN_SHIFT + i)) < size ) {
+        ++i;
     }
 
-    /*
-    ** If this is not the last block in the resulting list,
-    ** we may (also) need to merge it with its successor.
-    */
-    if( curr != NULL ){
+    return( _slab_alloc(_km_caches[i]) );
+}
 
-        // No.  Check to see if it should be merged with the successor.
-        if( adjacent( used, curr ) ){
+/**
+** Name:    kfree
+**
+** Return a block obtained from kmalloc().
+**
+** @param ptr  The block, or NULL
+*/
+void kfree( void *ptr ) {
 
-            // Yes, combine them.
-            used->next = curr->next;
-            used->pages += curr->pages;
+    if( ptr == NULL ) {
+        return;
+    }
 
-        }
+    // only page allocations begin on a page boundary
+    if( ((uint32_t) ptr & (SZ_PAGE - 1)) == 0 ) {
+        _km_page_free( ptr );
+    } else {
+        _slab_free( _slab_cache_of(ptr), ptr );
     }
 }
 
@@ -647,67 +807,21 @@ void _km_page_free( void *block ){
 ** SLICE MANAGEMENT
 */
 
-/*
-** Slices are 1024-byte fragments from pages.  We maintain a free list of
-** slices for those parts of the OS which don't need full 4096-byte chunks
-** of space (e.g., the QNode and Queue allocators).
-*/
-
-/**
-** Name:        _carve_slices
-**
-** Allocate a page and split it into four slices;  If no
-**              memory is available, we panic.
-*/
-static void _carve_slices( void ) {
-    void *page;
-
-    // get a page
-    page = _km_page_alloc( 1 );
-    
-    uint32_t virt = 0+page;
-    // let's identity map this block for now
-    map_virt_page_to_phys(virt,virt);
-    
-
-    // allocation failure is a show-stopping problem
-    assert( page );
-
-    // we have the page; create the four slices from it
-    uint8_t *ptr = (uint8_t *) page;
-    for( int i = 0; i < 4; ++i ) {
-        _km_slice_free( (void *) ptr );
-        ptr += SZ_SLICE;
-    }
-}
-
 /**
 ** Name:        _km_slice_alloc
 **
-** Dynamically allocates a slice (1/4 of a page).  If no
-** memory is available, we panic.
+** Dynamically allocates a slice (1/4 of a page).
 **
-** @return a pointer to the allocated slice
+** @return a pointer to the allocated slice, or NULL
 */
 void *_km_slice_alloc( void ) {
-    Blockinfo *slice;
-
-    assert( _km_initialized );
-
-    // if we are out of slices, create a few more
-    if( _free_slices == NULL ) {
-        _carve_slices();
-    }
 
-    // take the first one from the free list
-    slice = _free_slices;
-    assert( slice);
-
-    // unlink it
-    _free_slices = slice->next;
+    void *slice = kmalloc( SZ_SLICE );
 
     // make it nice and shiny for the caller
-    __memclr( (void *) slice, SZ_SLICE );
+    if( slice != NULL ) {
+        __memclr( slice, SZ_SLICE );
+    }
 
     return( slice );
 }
@@ -715,20 +829,10 @@ void *_km_slice_alloc( void ) {
 /**
 ** Name:        _km_slice_free
 **
-** Returns a slice to the list of available slices.
-**
-** We make no attempt to merge slices, as they are independent
-** blocks of memory (unlike pages).
+** Returns a slice to the pool of available slices.
 **
 ** @param block  Pointer to the slice (1/4 page) to be freed
 */
 void _km_slice_free( void *block ) {
-    Blockinfo *slice = (Blockinfo *) block;
-
-    assert( _km_initialized );
-
-    // just add it to the front of the free list
-    slice->pages = SZ_SLICE;
-    slice->next = _free_slices;
-    _free_slices = slice;
+    kfree( block );
 }
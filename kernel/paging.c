@@ -4,29 +4,212 @@
 #include "lib.h"
 #include "phys_alloc.h"
 #include "x86arch.h"
+#include "vm.h"
+#include "clock.h"
+#include "bootstrap.h"
+#include "stacks.h"
+#include "scheduler.h"
+#include "syscalls.h"
+#include "swap.h"
+#include "smp.h"
 
 #define KERNEL_START 0
 
 // Whether the module is initialized
 uint8_t paging_init;
-// The current pg_dir. Can be found in cr3
-struct page_directory * current_pg_dir;
 // The pg_dir for the kernel.
 struct page_directory * kernel_pg_dir;
 
+// Page directory slots which hold user program pages
+#define USER_PDE_FIRST PAGE_DIRECTORY_INDEX(USER_VIRT_BASE)
+#define USER_PDE_LAST  PAGE_DIRECTORY_INDEX(USER_VIRT_LIMIT - 1)
+
+// Page directory slots for the kernel half of the address space. The
+// page tables behind these are shared by every page directory.
+#define KERNEL_PDE_FIRST PAGE_DIRECTORY_INDEX(USER_VIRT_LIMIT)
+#define KERNEL_PDES      (1024 - KERNEL_PDE_FIRST)
+
+// The slots which have a shared kernel page table, in creation order
+static uint16_t _kernel_tbls[KERNEL_PDES];
+static uint32_t _n_kernel_tbls;
+
+// Temporary kernel mappings (see kmap). The window is one page table
+// at the top of the kernel half; each CPU has KMAP_SLOTS of it.
+#define KMAP_BASE   0xffc00000
+#define KMAP_SLOTS  64
+
+// kmap slot states
+#define KMAP_FREE   0   // unused, and no translation is cached
+#define KMAP_USED   1   // mapped
+#define KMAP_STALE  2   // unmapped, but the TLB may still hold it
+
+static pte_t * _kmap_ptes;
+
+// Ranges changing more pages than this are invalidated with one full
+// flush rather than an invlpg per page
+#define INVLPG_MAX  16
+
+// The bootstrap CPU's page fault task stack (see _paging_init)
+static uint32_t _pf_stack[SZ_PAGE / sizeof(uint32_t)];
+
+// What each CPU has of its own:  the pg_dir in its cr3; the TSS of the
+// task page faults interrupt (which the kernel and every process
+// share), and the page fault task's TSS; its part of the kmap window;
+// and the last kernel mapping change it has caught up with.
+typedef struct paging_cpu_s {
+    struct page_directory * pg_dir;
+    tss_t kernel_tss;
+    tss_t pf_tss;
+    uint8_t kmap_state[KMAP_SLOTS];
+    uint32_t kmap_next;
+    uint32_t kernel_gen;
+} paging_cpu_t;
+
+static paging_cpu_t _paging_cpus[N_CPUS];
+
+// the CPU running the kernel
+#define PCPU (&_paging_cpus[_cpu->id])
+
+// Counts kernel mappings which were changed or removed. A CPU whose
+// count is behind may still have the old ones in its TLB.
+static uint32_t _kernel_gen;
+
+// the page fault task's entry point, and where it sends the task it
+// interrupted when a process has to be killed (isr_stubs.S)
+void __pf_task(void);
+void __pf_kill(void);
+
+// TLB maintenance counters
+static uint32_t _cr3_loads;     // address space switches
+static uint32_t _cr3_skips;     // switches skipped (same directory)
+static uint32_t _tlb_flushes;   // other full (non-global) flushes
+static uint32_t _tlb_invlpgs;   // single page invalidations
+
+/**
+** Name:    _flush_tlb
+**
+** Throw away every non-global TLB entry by reloading cr3
+*/
+static inline void _flush_tlb(void){
+    ++_tlb_flushes;
+    uint32_t cr3;
+    __asm__ __volatile__("mov %%cr3, %0": "=r"(cr3));
+    __asm__ __volatile__("mov %0, %%cr3":: "r"(cr3) : "memory");
+}
+
+/**
+** Name:    _flush_tlb_global
+**
+** Throw away every TLB entry, global ones included, by toggling
+** CR4.PGE
+*/
+static inline void _flush_tlb_global(void){
+    ++_tlb_flushes;
+    uint32_t cr4;
+    __asm__ __volatile__("mov %%cr4, %0": "=r"(cr4));
+    __asm__ __volatile__("mov %0, %%cr4":: "r"(cr4 & ~CR4_PGE) : "memory");
+    __asm__ __volatile__("mov %0, %%cr4":: "r"(cr4) : "memory");
+}
+
+/**
+** Name:    _invlpg
+**
+** Throw away the TLB entry for a single page, even a global one
+**
+** @param virt an address within the page
+*/
+static inline void _invlpg(virt_addr virt){
+    ++_tlb_invlpgs;
+    __asm__ __volatile__("invlpg (%0)":: "r"(virt) : "memory");
+}
+
+/**
+** Name:    _find_pte
+**
+** Find the pte for an address, if it has a page table
+**
+** @param pg_dir the page directory to search
+** @param virt the virtual address
+**
+** @return the pte, or NULL if the address has no page table
+*/
+static pte_t * _find_pte(struct page_directory * pg_dir, virt_addr virt){
+    pde_t * pd_entry = &pg_dir->entry[PAGE_DIRECTORY_INDEX(virt)];
+    if((*pd_entry & I86_PDE_PRESENT) != I86_PDE_PRESENT || pde_is_large(pd_entry)){
+        return NULL;
+    }
+    struct page_table * tbl = (struct page_table *) pde_get_frame(pd_entry);
+    return &tbl->entry[PAGE_TABLE_INDEX(virt)];
+}
+
+/**
+** Name:    _get_kernel_tbl
+**
+** Find the shared page table for a kernel-half address, creating it
+** if need be. The kernel directory holds the master copy of every
+** kernel pde; the given directory (and the current one) are brought
+** up to date here, and any others when they are next switched to.
+**
+** @param pg_dir the page directory being changed
+** @param virt the kernel-half virtual address
+**
+** @return the page table, or NULL if no memory is available
+*/
+static struct page_table * _get_kernel_tbl(struct page_directory * pg_dir, virt_addr virt){
+    struct page_directory * master = kernel_pg_dir ? kernel_pg_dir : pg_dir;
+    uint32_t i = PAGE_DIRECTORY_INDEX(virt);
+    pde_t * pd_entry = &master->entry[i];
+
+    if((*pd_entry & I86_PDE_PRESENT) != I86_PDE_PRESENT){
+        struct page_table * new_table = alloc_pg_tbl();
+        if(!new_table){
+            return NULL;
+        }
+        pde_set_attr(pd_entry, I86_PDE_PRESENT);
+        pde_set_attr(pd_entry, I86_PDE_WRITABLE);
+        pde_set_frame(pd_entry, (phys_addr) new_table);
+        _kernel_tbls[_n_kernel_tbls++] = i;
+    }
+
+    pg_dir->entry[i] = *pd_entry;
+    // every CPU's current directory gets it now; the rest get it when
+    // they are next loaded (_sync_kernel_pdes)
+    for(uint32_t n = 0; n < _n_cpus; n++){
+        if(_paging_cpus[n].pg_dir){
+            _paging_cpus[n].pg_dir->entry[i] = *pd_entry;
+        }
+    }
+    return (struct page_table *) pde_get_frame(pd_entry);
+}
+
+/**
+** Name:    _sync_kernel_pdes
+**
+** Give a page directory any shared kernel page tables which were
+** created after it was
+**
+** @param pg_dir the page directory to update
+*/
+static void _sync_kernel_pdes(struct page_directory * pg_dir){
+    if(!kernel_pg_dir || pg_dir == kernel_pg_dir){
+        return;
+    }
+    for(uint32_t n = 0; n < _n_kernel_tbls; n++){
+        uint32_t i = _kernel_tbls[n];
+        pg_dir->entry[i] = kernel_pg_dir->entry[i];
+    }
+}
+
 
 /**
 ** Name:    alloc_pg_tbl
 **
-** Alloc a page table
+** Alloc a page table. The table comes back with every entry clear.
 ** @return a pointer to a page table or NULL if no memory is available
 **
 */
 struct page_table * alloc_pg_tbl(){
-    struct page_table * pg_tbl = (struct page_table *) alloc_frame();
-    __memset(pg_tbl, sizeof(pg_tbl->entry), 0);
-
-    return pg_tbl;
+    return (struct page_table *) alloc_zeroed_frame();
 }
 
 /**
@@ -43,14 +226,12 @@ void free_pg_tbl(struct page_table * tbl){
 /**
 ** Name:    alloc_pg_dir
 **
-** Alloc a page directory
+** Alloc a page directory. The directory comes back with every entry clear.
 ** @return a pointer to a page directory or NULL if no memory is available
 **
 */
 struct page_directory * alloc_pg_dir(){
-    struct page_directory * pg_dir = (struct page_directory *) alloc_frame();
-    __memset(pg_dir, sizeof(*pg_dir), 0);
-    return pg_dir;
+    return (struct page_directory *) alloc_zeroed_frame();
 }
 
 /**
@@ -160,6 +341,19 @@ phys_addr pde_get_frame(pde_t * pde){
     return *pde & I86_PDE_FRAME;
 }
 
+/**
+** Name:    pde_is_large
+**
+** Tests whether a pde maps a 4MB page rather than a page table
+**
+** @param pde   A pointer to the pde
+**
+** @return true if the pde is a present 4MB mapping
+*/
+bool_t pde_is_large(pde_t * pde) {
+    return (*pde & (I86_PDE_PRESENT | I86_PDE_4MB)) == (I86_PDE_PRESENT | I86_PDE_4MB);
+}
+
 /**
 ** Name:    alloc_page
 **
@@ -237,7 +431,7 @@ pde_t * find_pde_entry(struct page_directory * pg_dir, virt_addr addr){
 ** @return A pointer to the current pg_dir
 */
 struct page_directory * get_current_pg_dir(){
-    return current_pg_dir;
+    return PCPU->pg_dir;
 }
 
 /**
@@ -254,20 +448,24 @@ struct page_directory * get_kernel_pg_dir(){
 /**
 ** Name:    set_page_directory
 **
-**  Set cr3 to use the passed page directory
-** Also enable the paging bit in cr0
+**  Set cr3 to use the passed page directory. Nothing is done if it
+**  is already in use, so the TLB survives. Kernel mappings are global,
+**  so they survive a switch either way.
 **
 ** @param pg_dir the page directory to use
 */
 void set_page_directory(struct page_directory * pg_dir){
-    current_pg_dir = pg_dir;
+    _sync_kernel_pdes(pg_dir);
+    if(pg_dir == PCPU->pg_dir && paging_init){
+        ++_cr3_skips;
+        return;
+    }
+    PCPU->pg_dir = pg_dir;
+    ++_cr3_loads;
+    // a task switch loads cr3 from the TSS being switched to
+    PCPU->kernel_tss.cr3 = PCPU->pf_tss.cr3 = (uint32_t) &pg_dir->entry;
     // set cr3 to page directory
-    __asm__ volatile("mov %0, %%cr3":: "r"(&pg_dir->entry));
-    // Toggle paging bit in cr0
-    uint32_t cr0;
-    __asm__ volatile("mov %%cr0, %0": "=r"(cr0));
-    cr0 |= 0x80000000; 
-    __asm__ volatile("mov %0, %%cr0":: "r"(cr0));
+    __asm__ volatile("mov %0, %%cr3":: "r"(&pg_dir->entry) : "memory");
 }
 
 /**
@@ -279,27 +477,7 @@ void set_page_directory(struct page_directory * pg_dir){
 ** @param phys the backing frame address
 */
 void map_virt_page_to_phys(virt_addr virt, phys_addr phys){
-    struct page_directory * pg_dir = current_pg_dir;
-    pde_t * pd_entry = &pg_dir->entry[PAGE_DIRECTORY_INDEX(virt)];
-    
-    // Check if pde is present already. If not, we alloc a new frame for one.
-    if((*pd_entry & I86_PDE_PRESENT) != I86_PDE_PRESENT){
-        // make a frame. use that as our new page table
-        struct page_table * new_table = alloc_pg_tbl();
-        
-        pde_set_attr(pd_entry, I86_PDE_PRESENT);
-        pde_set_attr(pd_entry, I86_PDE_WRITABLE);
-        pde_set_frame(pd_entry, (phys_addr) new_table);
-    }
-    // We now have a present pde. So we just need to set the relevant pte bits.
-    struct page_table * tbl = (struct page_table *) PAGE_GET_PHYSICAL_ADDRESS(pd_entry);
-    // let's assume we have idenitiy mapping at the bottom
-    pte_t * pt_entry = &tbl->entry[PAGE_TABLE_INDEX(virt)];
-
-    //Set the frame and mark present
-    pte_set_frame(pt_entry, phys);
-    pte_set_attr(pt_entry, I86_PTE_PRESENT);
-    pte_set_attr(pt_entry, I86_PTE_WRITABLE);
+    map_virt_page_to_phys_pg_dir(PCPU->pg_dir, virt, phys);
 }
 
 /**
@@ -312,26 +490,8 @@ void map_virt_page_to_phys(virt_addr virt, phys_addr phys){
 ** @param phys the backing frame address
 */
 void map_virt_page_to_phys_pg_dir(struct page_directory * pg_dir, virt_addr virt, phys_addr phys){
-    pde_t * pd_entry = &pg_dir->entry[PAGE_DIRECTORY_INDEX(virt)];
-    
-    // Check if pde is present already. If not, we alloc a new frame for one.
-    if((*pd_entry & I86_PDE_PRESENT) != I86_PDE_PRESENT){
-        // make a frame. use that as our new page table
-        struct page_table * new_table = alloc_pg_tbl();
-        
-        pde_set_attr(pd_entry, I86_PDE_PRESENT);
-        pde_set_attr(pd_entry, I86_PDE_WRITABLE);
-        pde_set_frame(pd_entry, (phys_addr) new_table);
-    }
-    // We now have a present pde. So we just need to set the relevant pte bits.
-    struct page_table * tbl = (struct page_table *) PAGE_GET_PHYSICAL_ADDRESS(pd_entry);
-    // let's assume we have idenitiy mapping at the bottom
-    pte_t * pt_entry = &tbl->entry[PAGE_TABLE_INDEX(virt)];
-
-    //Set the frame and mark present
-    pte_set_frame(pt_entry, phys);
-    pte_set_attr(pt_entry, I86_PTE_PRESENT);
-    pte_set_attr(pt_entry, I86_PTE_WRITABLE);
+    bool_t ok = map_range(pg_dir, virt, phys, SZ_PAGE, MAP_WRITE);
+    assert(ok);
 }
 
 /**
@@ -343,63 +503,412 @@ void map_virt_page_to_phys_pg_dir(struct page_directory * pg_dir, virt_addr virt
 ** @param virt the virtual address to unmap
 */
 void unmap_virt(struct page_directory * pg_dir, virt_addr virt){
+    unmap_range(pg_dir, virt, SZ_PAGE);
+}
+
+/**
+** Name:    _range_tbl
+**
+** Find the page table covering an address for one of the range
+** functions, optionally creating it
+**
+** @param pg_dir the page directory to use
+** @param virt the virtual address
+** @param create whether to create a missing table
+** @param flags MAP_* flags for a new table
+**
+** @return the page table, or NULL if there is none (or it is a 4MB page)
+*/
+static struct page_table * _range_tbl(struct page_directory * pg_dir, virt_addr virt, bool_t create, uint32_t flags){
     pde_t * pd_entry = &pg_dir->entry[PAGE_DIRECTORY_INDEX(virt)];
-    
-    // We now have a present pde. So we just need to set the relevant pte bits.
-    struct page_table * tbl = (struct page_table *) PAGE_GET_PHYSICAL_ADDRESS(pd_entry);
-    if(tbl){
-    // let's assume we have idenitiy mapping at the bottom
-        pte_t * pt_entry = &tbl->entry[PAGE_TABLE_INDEX(virt)];
-        *pt_entry = 0;
+
+    if(pde_is_large(pd_entry)){
+        return NULL;
+    }
+    if((*pd_entry & I86_PDE_PRESENT) == I86_PDE_PRESENT){
+        if(flags & MAP_USER){
+            pde_set_attr(pd_entry, I86_PDE_USER);
+        }
+        return (struct page_table *) pde_get_frame(pd_entry);
     }
+    if(!create){
+        return NULL;
+    }
+
+    // Kernel mappings go in the shared tables
+    if(virt >= USER_VIRT_LIMIT){
+        return _get_kernel_tbl(pg_dir, virt);
+    }
+
+    struct page_table * new_table = alloc_pg_tbl();
+    if(!new_table){
+        return NULL;
+    }
+    pde_set_attr(pd_entry, I86_PDE_PRESENT);
+    pde_set_attr(pd_entry, I86_PDE_WRITABLE);
+    if(flags & MAP_USER){
+        pde_set_attr(pd_entry, I86_PDE_USER);
+    }
+    pde_set_frame(pd_entry, (phys_addr) new_table);
+    return new_table;
 }
 
 /**
-** Name:    get_base_pg_dir
+** Name:    _range_pages
 **
-**  Get a basic page directory that will be used for the kernel.
-**  Identity maps the bottom 600KB.
-**  Maps the bottom 1MB to 0xc0000000
+** The number of pages from an address to the end of its page table,
+** or to the end of a range, whichever comes first
 **
-** @return a pointer to the base page directory
+** @param virt the (page-aligned) address
+** @param end the end of the range
+**
+** @return the number of pages
 */
-struct page_directory * get_base_pg_dir(){
-    struct page_table * ident_tbl = alloc_pg_tbl();
-    // Identity map the first bit (0 - 100*1024)
-    for(int i = 0, addr = 0; i < 600; i++, addr+= 4096){
-        pte_t pte = 0;
+static uint32_t _range_pages(virt_addr virt, virt_addr end){
+    uint32_t pages = 1024 - PAGE_TABLE_INDEX(virt);
+    uint32_t left = (end - virt) / SZ_PAGE;
+    return left < pages ? left : pages;
+}
 
-        pte_set_attr(&pte, I86_PTE_PRESENT);
-        pte_set_attr(&pte, I86_PTE_WRITABLE);
+/**
+** Name:    _range_pte
+**
+** Build a pte for one of the range functions
+**
+** @param virt the virtual address being mapped
+** @param phys the backing frame address
+** @param flags MAP_* flags
+**
+** @return the pte
+*/
+static pte_t _range_pte(virt_addr virt, phys_addr phys, uint32_t flags){
+    pte_t pte = (phys & I86_PTE_FRAME) | I86_PTE_PRESENT;
+    if(virt < USER_VIRT_LIMIT){
+        // a user page is mapped because it is about to be used, so
+        // the swap clock should pass it over once
+        pte |= I86_PTE_ACCESSED;
+    }
+    if(flags & MAP_COW){
+        pte |= I86_PTE_COW;
+    }else if(flags & MAP_WRITE){
+        pte |= I86_PTE_WRITABLE;
+    }
+    if(flags & MAP_SHARED){
+        pte |= I86_PTE_SHARED;
+    }
+    if(flags & MAP_USER){
+        pte |= I86_PTE_USER;
+    }
+    if(flags & MAP_NOCACHE){
+        pte |= I86_PTE_NOT_CACHEABLE;
+    }
+    if(virt >= USER_VIRT_LIMIT){
+        // the same in every address space
+        pte |= I86_PTE_CPU_GLOBAL;
+    }
+    return pte;
+}
+
+/**
+** Name:    _range_invalidate
+**
+** Invalidate whatever the TLB may hold for part of a range that was
+** changed, with one flush if it is large
+**
+** @param pg_dir the page directory that was changed
+** @param first the first changed page
+** @param last the last changed page
+*/
+static void _range_invalidate(struct page_directory * pg_dir, virt_addr first, virt_addr last){
+    // kernel tables are shared, so the current directory sees those changes too
+    if(pg_dir != PCPU->pg_dir && last < USER_VIRT_LIMIT){
+        return;
+    }
+    // the other CPUs catch up the next time they enter the kernel
+    if(last >= USER_VIRT_LIMIT){
+        PCPU->kernel_gen = ++_kernel_gen;
+    }
+    if((last - first) / SZ_PAGE < INVLPG_MAX){
+        for(virt_addr virt = first; ; virt += SZ_PAGE){
+            _invlpg(virt);
+            if(virt == last){
+                break;
+            }
+        }
+    }else if(last >= USER_VIRT_LIMIT){
+        _flush_tlb_global();
+    }else{
+        _flush_tlb();
+    }
+}
+
+/**
+** Name:    map_range
+**
+** Map a range of virtual addresses to physically contiguous frames.
+** Each page table is looked up once, and the TLB is invalidated once
+** for the whole range. Addresses covered by a 4MB page are already
+** identity mapped and are skipped.
+**
+** @param pg_dir the page directory to use
+** @param virt the first virtual address (page-aligned)
+** @param phys the first frame
+** @param size the size of the range, in bytes
+** @param flags MAP_* flags for every page
+**
+** @return false if a page table could not be allocated; the pages
+**         before the failure are left mapped
+*/
+bool_t map_range(struct page_directory * pg_dir, virt_addr virt, phys_addr phys, uint32_t size, uint32_t flags){
+    virt_addr end = virt + ((size + SZ_PAGE - 1) & ~(SZ_PAGE - 1));
+    virt_addr first = 0, last = 0;
+    bool_t changed = false;
+    bool_t ok = true;
 
-        pte_set_frame(&pte, addr);
+    while(virt != end){
+        uint32_t pages = _range_pages(virt, end);
+        struct page_table * tbl = _range_tbl(pg_dir, virt, true, flags);
 
-        ident_tbl->entry[PAGE_TABLE_INDEX(addr)] = pte;
+        if(!tbl){
+            if(!pde_is_large(&pg_dir->entry[PAGE_DIRECTORY_INDEX(virt)])){
+                ok = false;
+                break;
+            }
+            assert(virt == phys);
+        }else{
+            pte_t * pt_entry = &tbl->entry[PAGE_TABLE_INDEX(virt)];
+            for(uint32_t i = 0; i < pages; i++){
+                virt_addr page = virt + i * SZ_PAGE;
+                if(pt_entry[i] & I86_PTE_PRESENT){
+                    if(!changed){
+                        first = page;
+                        changed = true;
+                    }
+                    last = page;
+                }
+                pt_entry[i] = _range_pte(page, phys + i * SZ_PAGE, flags);
+            }
+        }
+        virt += pages * SZ_PAGE;
+        phys += pages * SZ_PAGE;
+    }
+
+    // only entries which were present can be cached
+    if(changed){
+        _range_invalidate(pg_dir, first, last);
     }
-    virt_addr virt = 0xc0000000;
-    phys_addr phys = KERNEL_START;
-    struct page_table * highmem_tbl = alloc_pg_tbl();
-    for(int i =0; i < 1024; i++, virt+=4096, phys+=4096){
-        pte_t pte = 0;
+    return ok;
+}
+
+/**
+** Name:    _unmap_range
+**
+** Unmap a range of virtual addresses, dropping a reference to each
+** frame if asked to
+**
+** @param pg_dir the page directory to use
+** @param virt the first virtual address (page-aligned)
+** @param size the size of the range, in bytes
+** @param release whether to drop the references to the frames
+*/
+static void _unmap_range(struct page_directory * pg_dir, virt_addr virt, uint32_t size, bool_t release){
+    virt_addr end = virt + ((size + SZ_PAGE - 1) & ~(SZ_PAGE - 1));
+    virt_addr first = 0, last = 0;
+    bool_t changed = false;
+
+    while(virt != end){
+        uint32_t pages = _range_pages(virt, end);
+        struct page_table * tbl = _range_tbl(pg_dir, virt, false, 0);
+
+        // 4MB kernel mappings are never taken apart
+        if(tbl){
+            pte_t * pt_entry = &tbl->entry[PAGE_TABLE_INDEX(virt)];
+            for(uint32_t i = 0; i < pages; i++){
+                if(pt_entry[i] & I86_PTE_PRESENT){
+                    if(!changed){
+                        first = virt + i * SZ_PAGE;
+                        changed = true;
+                    }
+                    last = virt + i * SZ_PAGE;
+                    // nothing can reuse the frame before the
+                    // invalidation below
+                    if(release){
+                        unref_frame(pte_get_frame(&pt_entry[i]));
+                    }
+                }else if(PTE_IS_SWAPPED(pt_entry[i])){
+                    _swap_free(pt_entry[i]);
+                }
+                pt_entry[i] = 0;
+            }
+        }
+        virt += pages * SZ_PAGE;
+    }
+
+    if(changed){
+        _range_invalidate(pg_dir, first, last);
+    }
+}
+
+/**
+** Name:    unmap_range
+**
+** Unmap a range of virtual addresses. The frames are not freed.
+**
+** @param pg_dir the page directory to use
+** @param virt the first virtual address (page-aligned)
+** @param size the size of the range, in bytes
+*/
+void unmap_range(struct page_directory * pg_dir, virt_addr virt, uint32_t size){
+    _unmap_range(pg_dir, virt, size, false);
+}
+
+/**
+** Name:    release_range
+**
+** Unmap a range of virtual addresses, and drop a reference to each
+** frame that was mapped there (freeing frames nobody else shares)
+**
+** @param pg_dir the page directory to use
+** @param virt the first virtual address (page-aligned)
+** @param size the size of the range, in bytes
+*/
+void release_range(struct page_directory * pg_dir, virt_addr virt, uint32_t size){
+    _unmap_range(pg_dir, virt, size, true);
+}
 
-        pte_set_attr(&pte, I86_PTE_PRESENT);
-        pte_set_attr(&pte, I86_PTE_WRITABLE);
+/**
+** Name:    protect_range
+**
+** Change the access allowed to the present pages in a range. A
+** copy-on-write page stays read-only until it is written; taking away
+** write access also ends its copy-on-write status.
+**
+** @param pg_dir the page directory to use
+** @param virt the first virtual address (page-aligned)
+** @param size the size of the range, in bytes
+** @param flags the new MAP_* flags
+*/
+void protect_range(struct page_directory * pg_dir, virt_addr virt, uint32_t size, uint32_t flags){
+    virt_addr end = virt + ((size + SZ_PAGE - 1) & ~(SZ_PAGE - 1));
+    virt_addr first = 0, last = 0;
+    bool_t changed = false;
 
-        pte_set_frame(&pte, phys);
+    while(virt != end){
+        uint32_t pages = _range_pages(virt, end);
+        struct page_table * tbl = _range_tbl(pg_dir, virt, false, flags);
 
-        highmem_tbl->entry[PAGE_TABLE_INDEX(virt)] = pte;
+        if(tbl){
+            pte_t * pt_entry = &tbl->entry[PAGE_TABLE_INDEX(virt)];
+            for(uint32_t i = 0; i < pages; i++){
+                pte_t old = pt_entry[i];
+                if(!(old & I86_PTE_PRESENT)){
+                    continue;
+                }
+                pte_t pte = old & ~(I86_PTE_WRITABLE | I86_PTE_USER);
+                if(!(flags & MAP_WRITE)){
+                    pte &= ~I86_PTE_COW;
+                }else if(!(pte & I86_PTE_COW)){
+                    pte |= I86_PTE_WRITABLE;
+                }
+                if(flags & MAP_USER){
+                    pte |= I86_PTE_USER;
+                }
+                if(pte != old){
+                    pt_entry[i] = pte;
+                    if(!changed){
+                        first = virt + i * SZ_PAGE;
+                        changed = true;
+                    }
+                    last = virt + i * SZ_PAGE;
+                }
+            }
+        }
+        virt += pages * SZ_PAGE;
     }
 
+    if(changed){
+        _range_invalidate(pg_dir, first, last);
+    }
+}
+
+/**
+** Name:    alloc_range
+**
+** Give every unmapped page in a range a new, zeroed frame. Pages
+** which are already mapped are left alone, so nothing needs to be
+** invalidated.
+**
+** @param pg_dir the page directory to use
+** @param virt the first virtual address (page-aligned)
+** @param size the size of the range, in bytes
+** @param flags MAP_* flags for the new pages
+**
+** @return false if memory ran out; the pages allocated before that
+**         are left mapped
+*/
+bool_t alloc_range(struct page_directory * pg_dir, virt_addr virt, uint32_t size, uint32_t flags){
+    virt_addr end = virt + ((size + SZ_PAGE - 1) & ~(SZ_PAGE - 1));
+
+    while(virt != end){
+        uint32_t pages = _range_pages(virt, end);
+        struct page_table * tbl = _range_tbl(pg_dir, virt, true, flags);
+
+        if(!tbl){
+            // already mapped by a 4MB page
+            if(pde_is_large(&pg_dir->entry[PAGE_DIRECTORY_INDEX(virt)])){
+                virt += pages * SZ_PAGE;
+                continue;
+            }
+            return false;
+        }
+
+        pte_t * pt_entry = &tbl->entry[PAGE_TABLE_INDEX(virt)];
+        for(uint32_t i = 0; i < pages; i++){
+            if(pt_entry[i] & I86_PTE_PRESENT){
+                continue;
+            }
+            phys_addr frame = alloc_zeroed_frame();
+            if(!frame){
+                return false;
+            }
+            pt_entry[i] = _range_pte(virt + i * SZ_PAGE, frame, flags);
+        }
+        virt += pages * SZ_PAGE;
+    }
+    return true;
+}
+
+/**
+** Name:    get_base_pg_dir
+**
+**  Get a basic page directory that will be used for the kernel.
+**  Identity maps all memory below IDENT_MAP_LIMIT using 4MB pages.
+**  Maps the bottom 4MB to 0xc0000000
+**
+** @return a pointer to the base page directory
+*/
+struct page_directory * get_base_pg_dir(){
     struct page_directory * pg_dir = alloc_pg_dir();
-    pde_t * ident_de = &pg_dir->entry[PAGE_DIRECTORY_INDEX(0x0)];
-    pde_set_attr(ident_de, I86_PDE_PRESENT);
-    pde_set_attr(ident_de, I86_PDE_WRITABLE);
-    pde_set_frame(ident_de, (phys_addr) ident_tbl);
+    if(!pg_dir){
+        return NULL;
+    }
+
+    // Identity map everything the kernel manages; no page tables needed
+    for(phys_addr addr = 0; addr < IDENT_MAP_LIMIT; addr += SZ_LARGE_PAGE){
+        pde_t * ident_de = &pg_dir->entry[PAGE_DIRECTORY_INDEX(addr)];
+        pde_set_attr(ident_de, I86_PDE_PRESENT);
+        pde_set_attr(ident_de, I86_PDE_WRITABLE);
+        pde_set_attr(ident_de, I86_PDE_4MB);
+        pde_set_attr(ident_de, I86_PDE_CPU_GLOBAL);
+        pde_set_frame(ident_de, addr);
+    }
 
     pde_t * highmem_de = &pg_dir->entry[PAGE_DIRECTORY_INDEX(0xc0000000)];
     pde_set_attr(highmem_de, I86_PDE_PRESENT);
     pde_set_attr(highmem_de, I86_PDE_WRITABLE);
-    pde_set_frame(highmem_de, (phys_addr) highmem_tbl);
+    pde_set_attr(highmem_de, I86_PDE_4MB);
+    pde_set_attr(highmem_de, I86_PDE_CPU_GLOBAL);
+    pde_set_frame(highmem_de, KERNEL_START);
 
     return pg_dir;
 }
@@ -407,28 +916,70 @@ struct page_directory * get_base_pg_dir(){
 /**
 ** Name:    copy_pg_dir
 **
-** Copies a page directory. Each page table uses a different frame,
-** but each pte uses the same frame.
+** Copies a page directory. The kernel half of the directory points at
+** the same (shared) page tables as every other directory. Below that,
+** each page table uses a different frame, but each pte uses the same
+** frame. Writable user pages are made read-only and copy-on-write in
+** both directories; the first write to one of them (by either side)
+** gets the writer its own copy. Shared memory pages (I86_PTE_SHARED)
+** stay writable and shared by both.
 **
 ** @param pg_dir the page directory to copy
 **
-** @return a pointer to a page directory that is a copy
+** @return a pointer to a page directory that is a copy, or NULL
 */
 struct page_directory * copy_pg_dir(struct page_directory * pg_dir){
     struct page_directory * pg_cpy = alloc_pg_dir();
-    for(int i = 0; i < 1024; i++){
+    if(!pg_cpy){
+        return NULL;
+    }
+    for(int i = 0; i < KERNEL_PDE_FIRST; i++){
         pde_t * old_dir_entry = &pg_dir->entry[i];
-        if(*old_dir_entry){
+        if(pde_is_large(old_dir_entry)){
+            // 4MB mappings have no table to copy
+            pg_cpy->entry[i] = *old_dir_entry;
+        }else if(*old_dir_entry){
             struct page_table * old_pg_tbl = (struct page_table *) pde_get_frame(old_dir_entry);
             struct page_table * new_pg_tbl = alloc_pg_tbl();
+            if(!new_pg_tbl){
+                release_user_pages(pg_cpy);
+                delete_pg_dir(pg_cpy);
+                return NULL;
+            }
+            bool_t user = i >= USER_PDE_FIRST && i <= USER_PDE_LAST;
             for(int j = 0; j < 1024; j++){
-                new_pg_tbl->entry[j] = old_pg_tbl->entry[j];
+                pte_t * old_pt_entry = &old_pg_tbl->entry[j];
+                if(user && (*old_pt_entry & I86_PTE_PRESENT)){
+                    // shared memory stays shared; everything else is copied on write
+                    if((*old_pt_entry & (I86_PTE_WRITABLE | I86_PTE_SHARED)) == I86_PTE_WRITABLE){
+                        pte_del_attr(old_pt_entry, I86_PTE_WRITABLE);
+                        pte_set_attr(old_pt_entry, I86_PTE_COW);
+                    }
+                    ref_frame(pte_get_frame(old_pt_entry));
+                }else if(user && PTE_IS_SWAPPED(*old_pt_entry)){
+                    // both copies refer to the same swap slot
+                    _swap_dup(*old_pt_entry);
+                }
+                new_pg_tbl->entry[j] = *old_pt_entry;
             }
             pde_t * new_dir_entry = &pg_cpy->entry[i];
             *new_dir_entry = *old_dir_entry;
             pde_set_frame(new_dir_entry, (phys_addr) new_pg_tbl);
         }
     }
+
+    // The kernel half is shared, not copied. Take it from the master
+    // copy, which is never out of date.
+    struct page_directory * master = kernel_pg_dir ? kernel_pg_dir : pg_dir;
+    for(int i = KERNEL_PDE_FIRST; i < 1024; i++){
+        pg_cpy->entry[i] = master->entry[i];
+    }
+
+    // The parent may have writable translations cached for pages
+    // which are now copy-on-write
+    if(pg_dir == PCPU->pg_dir){
+        _flush_tlb();
+    }
     return pg_cpy;
 }
 
@@ -436,20 +987,311 @@ struct page_directory * copy_pg_dir(struct page_directory * pg_dir){
 ** Name:    delete_pg_dir
 **
 ** This just clears the page tables of a page directory.
-** Something else is repsonsible for freeing the backing frames for each pte
+** Something else is repsonsible for freeing the backing frames for each pte.
+** The shared kernel page tables are left alone.
 **
 ** @param pg_dir the page directory to delete
 */
 void delete_pg_dir(struct page_directory * pg_dir){
-    for(int i = 0; i < 1024; i++){
+    // the kernel half's tables are shared, so they stay
+    for(int i = 0; i < KERNEL_PDE_FIRST; i++){
         pde_t * old_dir_entry = &pg_dir->entry[i];
-        if(*old_dir_entry){
+        if(*old_dir_entry && !pde_is_large(old_dir_entry)){
             free_pg_tbl((struct page_table * )pde_get_frame(old_dir_entry));
         }
     }
     free_pg_dir(pg_dir);
 }
 
+/**
+** Name:    release_user_pages
+**
+** Unmap every user page (see USER_VIRT_BASE) in a page directory,
+** dropping the references to their frames, and free the page tables
+** which held them.
+**
+** @param pg_dir the page directory to strip
+*/
+void release_user_pages(struct page_directory * pg_dir){
+    for(int i = USER_PDE_FIRST; i <= USER_PDE_LAST; i++){
+        pde_t * pd_entry = &pg_dir->entry[i];
+        if(!(*pd_entry) || pde_is_large(pd_entry)){
+            continue;
+        }
+        struct page_table * tbl = (struct page_table *) pde_get_frame(pd_entry);
+        for(int j = 0; j < 1024; j++){
+            if(tbl->entry[j] & I86_PTE_PRESENT){
+                unref_frame(pte_get_frame(&tbl->entry[j]));
+            }else if(PTE_IS_SWAPPED(tbl->entry[j])){
+                _swap_free(tbl->entry[j]);
+            }
+        }
+        free_pg_tbl(tbl);
+        *pd_entry = 0;
+    }
+
+    if(pg_dir == PCPU->pg_dir){
+        _flush_tlb();
+    }
+}
+
+/**
+** Name:    cow_break
+**
+** Give a page directory its own writable copy of a copy-on-write page.
+** If nobody else still refers to the frame, it is simply made writable.
+** Does nothing if the page is not copy-on-write.
+**
+** @param pg_dir the page directory to use
+** @param virt the address within the page
+**
+** @return false if the page is copy-on-write and could not be copied
+*/
+bool_t cow_break(struct page_directory * pg_dir, virt_addr virt){
+    pte_t * pt_entry = _find_pte(pg_dir, virt);
+    if(!pt_entry || (*pt_entry & (I86_PTE_PRESENT | I86_PTE_COW)) != (I86_PTE_PRESENT | I86_PTE_COW)){
+        return true;
+    }
+
+    phys_addr frame = pte_get_frame(pt_entry);
+    if(frame_refs(frame) > 1){
+        phys_addr copy = alloc_frame();
+        if(!copy){
+            return false;
+        }
+        void * to = kmap(copy);
+        void * from = kmap(frame);
+        __memcpy(to, from, SZ_PAGE);
+        kunmap(from);
+        kunmap(to);
+        pte_set_frame(pt_entry, copy);
+        unref_frame(frame);
+    }
+    pte_del_attr(pt_entry, I86_PTE_COW);
+    pte_set_attr(pt_entry, I86_PTE_WRITABLE);
+
+    if(pg_dir == PCPU->pg_dir){
+        _invlpg(virt);
+    }
+    return true;
+}
+
+/**
+** Name:    find_pte
+**
+** Find the pte for an address, if it has a page table
+**
+** @param pg_dir the page directory to search
+** @param virt the virtual address
+**
+** @return the pte, or NULL if the address has no page table
+*/
+pte_t * find_pte(struct page_directory * pg_dir, virt_addr virt){
+    return _find_pte(pg_dir, virt);
+}
+
+/**
+** Name:    flush_page
+**
+** Throw away the TLB entry for a page whose pte was changed, if the
+** page directory is the current one
+**
+** @param pg_dir the page directory that was changed
+** @param virt an address within the page
+*/
+void flush_page(struct page_directory * pg_dir, virt_addr virt){
+    if(pg_dir == PCPU->pg_dir){
+        _invlpg(virt);
+    }
+}
+
+/**
+** Name:    _kmap_flush
+**
+** Clear every stale kmap slot of this CPU, and invalidate all of them
+** with a single flush. kmap ptes are not global, so reloading cr3 does
+** it. No other CPU ever uses these slots, so none of them can have
+** them cached.
+*/
+static void _kmap_flush(void){
+    paging_cpu_t * pc = PCPU;
+    pte_t * ptes = _kmap_ptes + _cpu->id * KMAP_SLOTS;
+    for(uint32_t i = 0; i < KMAP_SLOTS; i++){
+        if(pc->kmap_state[i] == KMAP_STALE){
+            ptes[i] = 0;
+            pc->kmap_state[i] = KMAP_FREE;
+        }
+    }
+    _flush_tlb();
+    pc->kmap_next = 0;
+}
+
+/**
+** Name:    kmap
+**
+** Get a kernel address for a frame. Frames below IDENT_MAP_LIMIT are
+** already identity mapped; anything else gets a slot in the kmap
+** window. Slots are handed out in order and not invalidated when
+** they are released; once the window is used up, all of the released
+** slots are invalidated at once.
+**
+** @param frame the frame to map
+**
+** @return the kernel address of the frame
+*/
+void * kmap(phys_addr frame){
+    if(frame < IDENT_MAP_LIMIT){
+        return (void *) frame;
+    }
+
+    paging_cpu_t * pc = PCPU;
+    uint32_t first = _cpu->id * KMAP_SLOTS;
+    for(int pass = 0; pass < 2; pass++){
+        for(; pc->kmap_next < KMAP_SLOTS; pc->kmap_next++){
+            if(pc->kmap_state[pc->kmap_next] == KMAP_FREE){
+                uint32_t slot = pc->kmap_next++;
+                _kmap_ptes[first + slot] = (frame & I86_PTE_FRAME) | I86_PTE_PRESENT | I86_PTE_WRITABLE;
+                pc->kmap_state[slot] = KMAP_USED;
+                return (void *) (KMAP_BASE + (first + slot) * SZ_PAGE);
+            }
+        }
+        _kmap_flush();
+    }
+
+    PANIC( 0, "kmap window exhausted" );
+    return NULL;
+}
+
+/**
+** Name:    kunmap
+**
+** Release an address obtained from kmap
+**
+** @param addr the address kmap returned
+*/
+void kunmap(void * addr){
+    virt_addr virt = (virt_addr) addr;
+
+    // identity mapped, so there's nothing to release
+    if(virt < KMAP_BASE){
+        return;
+    }
+
+    uint32_t slot = (virt - KMAP_BASE) / SZ_PAGE - _cpu->id * KMAP_SLOTS;
+    assert(slot < KMAP_SLOTS && PCPU->kmap_state[slot] == KMAP_USED);
+    PCPU->kmap_state[slot] = KMAP_STALE;
+}
+
+/**
+** Name:    _writable_frame
+**
+** Find the frame behind a present, writable page
+**
+** @param pg_dir the page directory to use
+** @param virt the address within the page
+**
+** @return the frame, or 0 if the page is not present and writable
+*/
+static phys_addr _writable_frame(struct page_directory * pg_dir, virt_addr virt){
+    pde_t * pd_entry = &pg_dir->entry[PAGE_DIRECTORY_INDEX(virt)];
+    if(pde_is_large(pd_entry)){
+        return pde_get_frame(pd_entry) + ((virt & (SZ_LARGE_PAGE - 1)) & ~(SZ_PAGE - 1));
+    }
+
+    pte_t * pt_entry = _find_pte(pg_dir, virt);
+    if(!pt_entry || (*pt_entry & (I86_PTE_PRESENT | I86_PTE_WRITABLE)) != (I86_PTE_PRESENT | I86_PTE_WRITABLE)){
+        return 0;
+    }
+    // the write won't go through this pte, so mark it for the swap code
+    pte_set_attr(pt_entry, I86_PTE_DIRTY);
+    return pte_get_frame(pt_entry);
+}
+
+/**
+** Name:    pg_dir_ptr
+**
+** Get a kernel pointer to memory in another address space. The page
+** must already be present and writable (see _vm_touch). The pointer
+** is only good until the next call to kmap, so it is meant for a
+** single access, e.g. to a word on another process' stack.
+**
+** @param pg_dir the page directory to use
+** @param virt the address
+**
+** @return the pointer, or NULL if the page was not writable
+*/
+void * pg_dir_ptr(struct page_directory * pg_dir, virt_addr virt){
+    phys_addr frame = _writable_frame(pg_dir, virt);
+    if(!frame){
+        return NULL;
+    }
+
+    // a released kmap slot stays mapped until kmap runs out of slots
+    uint8_t * page = (uint8_t *) kmap(frame);
+    kunmap(page);
+    return page + (virt & (SZ_PAGE - 1));
+}
+
+/**
+** Name:    copy_to_pg_dir
+**
+** Copy data into memory in another address space, such as a status
+** or buffer belonging to a process which isn't the current one. The
+** destination must already be present and writable (see _vm_touch).
+**
+** @param pg_dir the page directory of the destination
+** @param virt the destination address
+** @param src the data to copy
+** @param len the number of bytes to copy
+**
+** @return false if some of the destination was not writable
+*/
+bool_t copy_to_pg_dir(struct page_directory * pg_dir, virt_addr virt, const void * src, uint32_t len){
+    const uint8_t * from = (const uint8_t *) src;
+
+    while(len > 0){
+        uint32_t off = virt & (SZ_PAGE - 1);
+        uint32_t n = SZ_PAGE - off;
+        if(n > len){
+            n = len;
+        }
+
+        phys_addr frame = _writable_frame(pg_dir, virt);
+        if(!frame){
+            return false;
+        }
+
+        uint8_t * dst = (uint8_t *) kmap(frame);
+        __memcpy(dst + off, from, n);
+        kunmap(dst);
+
+        virt += n;
+        from += n;
+        len -= n;
+    }
+    return true;
+}
+
+/**
+** Name:    map_page
+**
+** Map a frame at a virtual address in a page directory, allocating a
+** page table if need be.
+**
+** @param pg_dir the page directory to use
+** @param virt the wanted virtual address
+** @param phys the backing frame address
+** @param writable whether the page may be written
+**
+** @return false if a page table could not be allocated
+*/
+bool_t map_page(struct page_directory * pg_dir, virt_addr virt, phys_addr phys, bool_t writable){
+    // Large pages are only used for the kernel's identity map
+    assert(!pde_is_large(&pg_dir->entry[PAGE_DIRECTORY_INDEX(virt)]));
+
+    return map_range(pg_dir, virt, phys, SZ_PAGE, writable ? MAP_WRITE : 0);
+}
+
 /**
 ** Name:    alloc_page_at
 **
@@ -462,7 +1304,12 @@ void delete_pg_dir(struct page_directory * pg_dir){
 */
 bool_t alloc_page_at(struct page_directory * pg_dir, virt_addr virt){
     pde_t * pd_entry = &pg_dir->entry[PAGE_DIRECTORY_INDEX(virt)];
-    
+
+    // Already mapped by a 4MB page
+    if(pde_is_large(pd_entry)){
+        return false;
+    }
+
     // Check if pde is present already. If not, we alloc a new frame for one.
     if((*pd_entry & I86_PDE_PRESENT) != I86_PDE_PRESENT){
         // make a frame. use that as our new page table
@@ -506,6 +1353,9 @@ bool_t is_mapped(struct page_directory * pg_dir, virt_addr virt){
     if((*pd_entry & I86_PDE_PRESENT) != I86_PDE_PRESENT){
         return false;
     }
+    if(pde_is_large(pd_entry)){
+        return true;
+    }
     // We now have a present pde. So we just need to set the relevant pte bits.
     struct page_table * tbl = (struct page_table *) PAGE_GET_PHYSICAL_ADDRESS(pd_entry);
     
@@ -518,6 +1368,28 @@ bool_t is_mapped(struct page_directory * pg_dir, virt_addr virt){
     return true;
 }
 
+/**
+** Name:    is_writable
+**
+** Test if an address is mapped and may be written
+**
+** @param pg_dir the page directory to use
+** @param virt the address to check
+**
+** @return true if a write to the address would not fault
+*/
+bool_t is_writable(struct page_directory * pg_dir, virt_addr virt){
+    pde_t * pd_entry = &pg_dir->entry[PAGE_DIRECTORY_INDEX(virt)];
+    if(pde_is_large(pd_entry)){
+        return (*pd_entry & I86_PDE_WRITABLE) != 0;
+    }
+    pte_t * pt_entry = _find_pte(pg_dir, virt);
+    if(!pt_entry){
+        return false;
+    }
+    return (*pt_entry & (I86_PTE_PRESENT | I86_PTE_WRITABLE)) == (I86_PTE_PRESENT | I86_PTE_WRITABLE);
+}
+
 /**
 ** Name:    free_frame_at
 **
@@ -532,7 +1404,7 @@ void free_frame_at(struct page_directory * pg_dir, virt_addr virt){
     if(!(*pd_entry)){
         return;
     }
-    if(pde_get_frame(pd_entry) == 0){
+    if(pde_get_frame(pd_entry) == 0 || pde_is_large(pd_entry)){
         return;
     }
     struct page_table * tbl = (struct page_table *) PAGE_GET_PHYSICAL_ADDRESS(pd_entry);
@@ -542,19 +1414,28 @@ void free_frame_at(struct page_directory * pg_dir, virt_addr virt){
     pte_t * pt_entry = &tbl->entry[PAGE_TABLE_INDEX(virt)];
     phys_addr frame = pte_get_frame(pt_entry);
     *pt_entry = 0;
+    if(pg_dir == PCPU->pg_dir){
+        _invlpg(virt);
+    }
     free_frame(frame);    
 }
 
 /**
-** Name:    _page_fault_isr
+** Name:    _page_fault
 **
-** The isr handler that runs when a page fault is received.
-** Prints what address the page fault occured at
+** Pages of the current process which haven't been touched yet
+** (including those its stack grows into) are filled in, and writes
+** to copy-on-write pages are
+** resolved by copying the page. A process which faults any other way
+** (e.g., by running into the guard page below its stack) is killed;
+** a fault anywhere else is fatal.
 **
-** @param vector the interrupt vector
-** @param code the interrupt code
+** @param code the page fault error code
+**
+** @return true if the interrupted task can carry on, false if it
+**         has been sent to __pf_kill
 */
-static void _page_fault_isr( int vector, int code ) {
+static bool_t _page_fault( int code ) {
     uint32_t cr2;
     __asm__ __volatile__ (
         "mov %%cr2, %%eax\n\t"
@@ -562,7 +1443,117 @@ static void _page_fault_isr( int vector, int code ) {
     : "=m"(cr2)
     :
     : "%eax");
-    __cio_printf("We got a page fault at %x\n", cr2);
+
+    if(!(code & PF_PRESENT)){
+        if(_vm_fault(cr2)){
+            return true;
+        }
+    }
+
+    if((code & (PF_PRESENT | PF_WRITE)) == (PF_PRESENT | PF_WRITE)){
+        pte_t * pt_entry = _find_pte(PCPU->pg_dir, cr2);
+        if(pt_entry && (*pt_entry & I86_PTE_COW) && cow_break(PCPU->pg_dir, cr2)){
+            return true;
+        }
+    }
+
+    // A fault on the current process' stack came from the process (or
+    // from saving its context), so only the process has to go. The
+    // interrupted task resumes in __pf_kill, on the system stack.
+    if(_current && _current->pg_dir == PCPU->pg_dir &&
+            _stk_contains(_current->stack, PCPU->kernel_tss.esp)){
+        __cio_printf("pid %d: page fault at %x, eip %x, code %x; killed\n",
+                     _current->pid, cr2, PCPU->kernel_tss.eip, code);
+        PCPU->kernel_tss.eip = (uint32_t) __pf_kill;
+        PCPU->kernel_tss.esp = (uint32_t) _cpu->system_esp;
+        PCPU->kernel_tss.eflags = EFLAGS_MB1;
+        return false;
+    }
+
+    __cio_printf("We got a page fault at %x, eip %x, code %x\n", cr2, PCPU->kernel_tss.eip, code);
+    PANIC( 0, "unhandled page fault" );
+    return false;
+}
+
+/**
+** Name:    _page_fault_task
+**
+** Runs in the page fault task (see __pf_task) for each page fault.
+** The kernel may be running on another CPU, so this takes the kernel
+** lock first; if the faulting process is killed, it is released on
+** the way out of __pf_kill instead.
+**
+** @param code the page fault error code
+*/
+void _page_fault_task( int code ) {
+    _smp_enter( _smp_cpu() );
+    if(_page_fault( code )){
+        _smp_leave();
+    }
+}
+
+/**
+** Name:    _page_fault_kill
+**
+** Kill the current process after a page fault it can't recover from.
+** Runs in the kernel's task, on the system stack (see __pf_kill).
+*/
+void _page_fault_kill( void ) {
+    _current->exit_status = E_KILLED;
+    _perform_exit( _current );
+    _dispatch();
+}
+
+/**
+** Name:    _no_fpu_isr
+**
+** Every task switch (so every page fault) sets CR0.TS, which makes the
+** next floating point instruction trap here. FPU state isn't saved
+** per process anyway, so just clear the flag and carry on.
+**
+** @param vector the interrupt vector
+** @param code the interrupt code
+*/
+static void _no_fpu_isr( int vector, int code ) {
+    __asm__ volatile("clts");
+}
+
+/**
+** Name:    _paging_tasks
+**
+** Page faults switch to a task of their own, so that they don't need
+** any room on the stack that was in use when they happened. The
+** processor saves the interrupted task's state in its TSS. Each CPU
+** has a pair of these tasks, with TSS selectors GDT_TSS and GDT_PF_TSS
+** plus GDT_CPU_TSS for each CPU before it.
+**
+** @param pf_stack the top of the page fault task's stack
+** @param idt the IDT to put the task gate in (NULL for the one at
+**        IDT_ADDRESS)
+*/
+static void _paging_tasks(uint32_t * pf_stack, void * idt) {
+    paging_cpu_t * pc = PCPU;
+    uint32_t sel = _cpu->id * GDT_CPU_TSS;
+
+    pc->kernel_tss.cr3 = (uint32_t) &pc->pg_dir->entry;
+    pc->kernel_tss.iomap = sizeof(tss_t);
+    __install_tss( GDT_TSS + sel, &pc->kernel_tss );
+    __asm__ volatile("ltr %0":: "r"((uint16_t) (GDT_TSS + sel)));
+
+    pc->pf_tss.cr3 = (uint32_t) &pc->pg_dir->entry;
+    pc->pf_tss.eip = (uint32_t) __pf_task;
+    pc->pf_tss.eflags = EFLAGS_MB1;    // with interrupts off
+    pc->pf_tss.esp = (uint32_t) pf_stack;
+    pc->pf_tss.cs = GDT_CODE;
+    pc->pf_tss.ss = GDT_STACK;
+    pc->pf_tss.ds = pc->pf_tss.es = pc->pf_tss.fs = pc->pf_tss.gs = GDT_DATA;
+    pc->pf_tss.iomap = sizeof(tss_t);
+    __install_tss( GDT_PF_TSS + sel, &pc->pf_tss );
+    if(idt){
+        __install_task_gate_in( idt, INT_VEC_PAGE_FAULT, GDT_PF_TSS + sel );
+    }else{
+        __install_task_gate( INT_VEC_PAGE_FAULT, GDT_PF_TSS + sel );
+    }
 }
 
 /**
@@ -573,16 +1564,90 @@ static void _page_fault_isr( int vector, int code ) {
 void _paging_init() {
     __cio_puts( " Paging:" );
 
+    // The kernel identity map uses 4MB pages
+    uint32_t cr4;
+    __asm__ volatile("mov %%cr4, %0": "=r"(cr4));
+    cr4 |= CR4_PSE;
+    __asm__ volatile("mov %0, %%cr4":: "r"(cr4));
+
     struct page_directory * pg_dir = get_base_pg_dir();
     kernel_pg_dir = pg_dir;
     set_page_directory(pg_dir);
 
+    // Turn paging on. Processes run in ring 0, so write protection
+    // must also apply to supervisor writes for copy-on-write pages
+    // to fault.
+    uint32_t cr0;
+    __asm__ volatile("mov %%cr0, %0": "=r"(cr0));
+    cr0 |= CR0_PG | CR0_WP;
+    __asm__ volatile("mov %0, %%cr0":: "r"(cr0));
+
+    // Kernel mappings are the same everywhere; keep them in the TLB
+    // across address space switches. This has to wait until paging
+    // is on.
+    __asm__ volatile("mov %%cr4, %0": "=r"(cr4));
+    cr4 |= CR4_PGE;
+    __asm__ volatile("mov %0, %%cr4":: "r"(cr4));
+
+    // Set up the kmap window's page table
+    struct page_table * kmap_tbl = _get_kernel_tbl(pg_dir, KMAP_BASE);
+    assert(kmap_tbl);
+    _kmap_ptes = &kmap_tbl->entry[PAGE_TABLE_INDEX(KMAP_BASE)];
+
     paging_init = 1;
-    __install_isr( INT_VEC_PAGE_FAULT, _page_fault_isr );
+
+    _paging_tasks( _pf_stack + SZ_PAGE / sizeof(uint32_t), NULL );
+    __install_isr( INT_VEC_DEVICE_NOT_AVAILABLE, _no_fpu_isr );
 
     __cio_puts( " done" );
 }
 
+/**
+** Name:    _paging_cpu_init
+**
+** Sets up paging on an application processor, which is already
+** using the kernel's page directory (see smp_boot.S)
+**
+** @param pf_stack the top of a stack for its page fault task
+** @param idt its IDT, which gets a page fault task gate
+*/
+void _paging_cpu_init(uint32_t * pf_stack, void * idt) {
+    PCPU->pg_dir = kernel_pg_dir;
+    PCPU->kernel_gen = _kernel_gen;
+    _paging_tasks( pf_stack, idt );
+}
+
+/**
+** Name:    _paging_enter
+**
+** Catch up with changes to kernel mappings made on other CPUs since
+** this one was last in the kernel, by dropping everything in its TLB.
+** Called each time a CPU takes the kernel lock (see _smp_enter).
+*/
+void _paging_enter(void) {
+    paging_cpu_t * pc = PCPU;
+    if(pc->kernel_gen != _kernel_gen){
+        pc->kernel_gen = _kernel_gen;
+        _flush_tlb_global();
+    }
+}
+
+/**
+** Name:    _paging_dump
+**
+** Print the TLB maintenance counters
+*/
+void _paging_dump(void){
+    uint32_t secs = TICKS_TO_SEC(_system_time);
+    if(secs == 0){
+        secs = 1;
+    }
+    __cio_printf("cr3 loads %d (%d/s), %d skipped; flushes %d (%d/s); invlpg %d (%d/s)\n",
+                 _cr3_loads, _cr3_loads / secs, _cr3_skips,
+                 _tlb_flushes, _tlb_flushes / secs,
+                 _tlb_invlpgs, _tlb_invlpgs / secs);
+}
+
 /**
 ** Name:    is_paging_init
 **
@@ -0,0 +1,195 @@
+/**
+** @file pgcache.c
+**
+** @author CSCI-452 class of 20215
+**
+** Page cache module implementation
+**
+** Pages of files are read from the filesystem once, into frames which
+** stay in the cache; the cache is keyed by the file (its first cluster)
+** and the index of the page in the file.  Every mapping of a page uses
+** the cache's frame, so processes mapping the same file share memory,
+** and the disk is read once per page no matter how many processes map
+** it.  The cache holds one reference to each frame, and each mapping
+** holds another, so a frame only goes away when the cache lets go of
+** it and nothing maps it any more.  The cache lets go of pages nobody
+** maps when memory runs short (see _pgc_reclaim).  The filesystem is
+** read-only, so cached pages are never written back.
+*/
+
+#define SP_KERNEL_SRC
+
+#include "common.h"
+
+#include "pgcache.h"
+#include "slab.h"
+#include "phys_alloc.h"
+
+/*
+** PRIVATE DEFINITIONS
+*/
+
+// number of hash chains (a power of two)
+#define PGC_BUCKETS     64
+
+// hash of a page of a file
+#define PGC_HASH(c,i)   ((((c) * 31) + (i)) & (PGC_BUCKETS - 1))
+
+/*
+** PRIVATE DATA TYPES
+*/
+
+// one cached page
+typedef struct pgc_entry_s {
+    struct pgc_entry_s *next;   // next entry on this hash chain
+    uint32_t cluster;           // the file
+    uint32_t index;             // the page of the file
+    phys_addr frame;            // the frame holding the page
+} pgc_entry_t;
+
+/*
+** PRIVATE GLOBAL VARIABLES
+*/
+
+// where entries come from
+static slab_cache_t _pgc_cache;
+
+// the hash chains
+static pgc_entry_t *_pgc_table[PGC_BUCKETS];
+
+// the chain _pgc_reclaim() looks at first
+static uint32_t _pgc_hand;
+
+// statistics
+static uint32_t _pgc_pages;
+static uint32_t _pgc_hits;
+static uint32_t _pgc_misses;
+static uint32_t _pgc_dropped;
+
+/*
+** PUBLIC GLOBAL VARIABLES
+*/
+
+/*
+** PRIVATE FUNCTIONS
+*/
+
+/*
+** PUBLIC FUNCTIONS
+*/
+
+/**
+** _pgc_init() - initialize the page cache module
+**
+** Dependencies:
+**    Cannot be called before kmem is initialized
+**    Must be called before any file can be mapped
+*/
+void _pgc_init( void ) {
+
+    __cio_puts( " Pgcache:" );
+
+    _pgc_cache = _slab_create( "pgcache", sizeof(pgc_entry_t), NULL );
+    assert( _pgc_cache != NULL );
+
+    __cio_puts( " done" );
+}
+
+/**
+** _pgc_get() - find the frame holding a page of a file
+**
+** @param file     The file
+** @param index    Which page of the file
+**
+** @return the frame, with a reference for the caller, or 0
+*/
+phys_addr _pgc_get( file_t *file, uint32_t index ) {
+    pgc_entry_t **chain = &_pgc_table[PGC_HASH(file->cluster, index)];
+
+    for( pgc_entry_t *e = *chain; e != NULL; e = e->next ) {
+        if( e->cluster == file->cluster && e->index == index ) {
+            ++_pgc_hits;
+            ref_frame( e->frame );
+            return( e->frame );
+        }
+    }
+
+    // not there, so read it in
+    ++_pgc_misses;
+
+    if( _filesystem == NULL ) {
+        return( 0 );
+    }
+
+    pgc_entry_t *e = (pgc_entry_t *) _slab_alloc( _pgc_cache );
+    if( e == NULL ) {
+        return( 0 );
+    }
+
+    phys_addr frame = alloc_zeroed_frame();
+    if( frame == 0 ) {
+        _slab_free( _pgc_cache, e );
+        return( 0 );
+    }
+
+    uint8_t *page = (uint8_t *) kmap( frame );
+    int status = file_read_page( _filesystem, file, index, page );
+    kunmap( page );
+
+    if( status < 0 ) {
+        free_frame( frame );
+        _slab_free( _pgc_cache, e );
+        return( 0 );
+    }
+
+    e->cluster = file->cluster;
+    e->index = index;
+    e->frame = frame;
+    e->next = *chain;
+    *chain = e;
+    ++_pgc_pages;
+
+    // one reference for the cache, and one for the caller
+    ref_frame( frame );
+    return( frame );
+}
+
+/**
+** _pgc_reclaim() - drop a cached page which nothing maps
+**
+** Such a page holds only the cache's reference to its frame, and is in
+** no page table, so the clock in _swap_reclaim() never comes across
+** it.  The chains are taken in turn, so the same few pages aren't the
+** only ones ever dropped.
+**
+** @return true if a frame was freed
+*/
+bool_t _pgc_reclaim( void ) {
+
+    for( uint32_t n = 0; n < PGC_BUCKETS; ++n ) {
+        pgc_entry_t **pp = &_pgc_table[_pgc_hand];
+        _pgc_hand = (_pgc_hand + 1) & (PGC_BUCKETS - 1);
+
+        for( ; *pp != NULL; pp = &(*pp)->next ) {
+            pgc_entry_t *e = *pp;
+            if( frame_refs(e->frame) == 1 ) {
+                *pp = e->next;
+                unref_frame( e->frame );
+                _slab_free( _pgc_cache, e );
+                --_pgc_pages;
+                ++_pgc_dropped;
+                return( true );
+            }
+        }
+    }
+
+    return( false );
+}
+
+/**
+** _pgc_dump() - print the page cache statistics on the console
+*/
+void _pgc_dump( void ) {
+    __cio_printf( "pgcache: %d pages, %d hits, %d misses, %d dropped\n",
+                  _pgc_pages, _pgc_hits, _pgc_misses, _pgc_dropped );
+}
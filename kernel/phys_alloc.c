@@ -1,50 +1,543 @@
+/**
+** @file phys_alloc.c
+**
+** Physical frame allocator used by the paging code.
+**
+** The allocator manages the first sizable region of usable memory
+** handed to it by the kmem module.  Each frame in that region is
+** represented by a single bit in a bitmap (1 = allocated); the bitmap
+** is scanned a word at a time, so a full word of allocated frames
+** costs a single comparison.  A hint remembers the lowest word that
+** may still contain a free frame, so the common single-frame case
+** does not rescan the start of the pool every time.
+**
+** When the pool is exhausted, requests fall back to the kmem page
+** allocator; those frames are handed back to kmem when freed.
+**
+** A small stock of frames which have already been cleared is kept for
+** callers (such as the page table code) which need zeroed memory.  The
+** idle process tops it up in the background via the prezero() system
+** call, so the clearing cost is usually paid when the CPU has nothing
+** better to do rather than on the fork/exec path.
+**
+** Once kmem is running, every frame also has a reference count, so a
+** frame can be mapped into several address spaces (e.g., shared
+** copy-on-write after a fork) and is only freed when the last mapping
+** of it goes away.
+*/
+
 #define SP_KERNEL_SRC
 
 #include "phys_alloc.h"
 #include "kmem.h"
+#include "swap.h"
+
+/*
+** PRIVATE DEFINITIONS
+*/
+
+// largest pool we will manage (32MB worth of 4KB frames)
+#define MAX_FRAMES      8192
+
+// bitmap geometry
+#define BITS_PER_WORD   32
+#define BITMAP_WORDS    (MAX_FRAMES / BITS_PER_WORD)
+#define WORD_FULL       0xffffffff
+
+// capacity of the pre-zeroed frame stock
+#define ZERO_POOL_SIZE  32
+
+// frame index <-> bitmap position
+#define WORD_OF(n)      ((n) / BITS_PER_WORD)
+#define BIT_OF(n)       (1U << ((n) % BITS_PER_WORD))
+
+/*
+** PRIVATE GLOBAL VARIABLES
+*/
+
+// base address of the pool and its size, in frames
+static phys_addr _pool_base;
+static uint32_t _num_frames;
+
+// number of unallocated frames in the pool
+static uint32_t _free_count;
+
+// one bit per frame; set bits are allocated
+static uint32_t _bitmap[BITMAP_WORDS];
+
+// lowest bitmap word which may contain a free frame
+static uint32_t _hint;
+
+// frames which have already been cleared, and how many there are
+static phys_addr _zero_pool[ZERO_POOL_SIZE];
+static uint32_t _zero_count;
+
+// per-frame reference counts, indexed by frame number, and their extent
+static uint16_t *_refs;
+static uint32_t _ref_frames;
+
+// frames currently borrowed from kmem, and totals since boot
+static uint32_t _kmem_frames;
+static uint32_t _allocs;
+static uint32_t _frees;
 
-struct phys_frame {
-    uint32_t frame_data[1024];
-};
+/*
+** PRIVATE FUNCTIONS
+*/
 
-uint32_t num_frames;
-struct phys_frame * frames;
-uint8_t is_alloced[8192];
+/**
+** Name:    _frame_is_free
+**
+** @param n  Index of the frame within the pool
+**
+** @return true if frame n is free
+*/
+static inline bool_t _frame_is_free( uint32_t n ) {
+    return (_bitmap[WORD_OF(n)] & BIT_OF(n)) == 0;
+}
 
+/**
+** Name:    _mark_frames
+**
+** Set or clear the allocation bits for a run of frames, keeping the
+** free count and the search hint up to date.
+**
+** @param first  Index of the first frame in the run
+** @param count  Number of frames in the run
+** @param used   true to mark them allocated, false to mark them free
+*/
+static void _mark_frames( uint32_t first, uint32_t count, bool_t used ) {
+    for( uint32_t n = first; n < first + count; ++n ) {
+        if( used ) {
+            _bitmap[WORD_OF(n)] |= BIT_OF(n);
+        } else {
+            _bitmap[WORD_OF(n)] &= ~BIT_OF(n);
+        }
+    }
 
-phys_addr alloc_frame(){
-    for(int i = 0; i < num_frames; i++){
-        if(!is_alloced[i]){
-            is_alloced[i] = true;
-            return (phys_addr) &frames[i];
+    if( used ) {
+        _free_count -= count;
+    } else {
+        _free_count += count;
+        if( WORD_OF(first) < _hint ) {
+            _hint = WORD_OF(first);
         }
     }
+}
 
-    if(km_is_init()){
-        //Should never happen. Also we can actually make this work by just id mapping the page returned.
-        // PANIC(0, "Not enough paging mem. This could be fixed, but we haven't run into it yet");
-        phys_addr addr = (phys_addr) _km_page_alloc(1);
-        map_virt_page_to_phys(addr, addr);
-        return addr;
+/**
+** Name:    _find_free
+**
+** Locate the first free frame at or after the search hint.
+**
+** @return the index of the frame, or _num_frames if there is none
+*/
+static uint32_t _find_free( void ) {
+    uint32_t words = (_num_frames + BITS_PER_WORD - 1) / BITS_PER_WORD;
+
+    for( uint32_t w = _hint; w < words; ++w ) {
+        if( _bitmap[w] != WORD_FULL ) {
+            _hint = w;
+            uint32_t n = w * BITS_PER_WORD + __builtin_ctz( ~_bitmap[w] );
+            return n < _num_frames ? n : _num_frames;
+        }
     }
-    
-    return 0;
+
+    _hint = words;
+    return _num_frames;
 }
 
-void free_frame(phys_addr addr) {
-    for(int i = 0; i< num_frames; i++){
-        if(&frames[i] == (void *) addr){
-            is_alloced[i] = false;
+/**
+** Name:    _find_run
+**
+** Locate the first run of free frames of the requested length.
+**
+** @param count  Number of contiguous frames desired
+**
+** @return the index of the first frame, or _num_frames if there is none
+*/
+static uint32_t _find_run( uint32_t count ) {
+    uint32_t n = _hint * BITS_PER_WORD;
+
+    while( n + count <= _num_frames ) {
+
+        // skip fully allocated words in one step
+        if( (n % BITS_PER_WORD) == 0 && _bitmap[WORD_OF(n)] == WORD_FULL ) {
+            n += BITS_PER_WORD;
+            continue;
+        }
+
+        uint32_t len = 0;
+        while( len < count && _frame_is_free(n + len) ) {
+            ++len;
+        }
+
+        if( len == count ) {
+            return n;
+        }
+
+        // restart the search just past the frame that blocked us
+        n += len + 1;
+    }
+
+    return _num_frames;
+}
+
+/**
+** Name:    _fallback_alloc
+**
+** Satisfy a request from the kmem page allocator once the pool has
+** been exhausted.  Like the pool, kmem memory is covered by the
+** kernel's identity map, so the caller can use it immediately.
+**
+** @param count  Number of contiguous frames desired
+**
+** @return the address of the first frame, or 0 if none are available
+*/
+static phys_addr _fallback_alloc( uint32_t count ) {
+    if( !km_is_init() ) {
+        return 0;
+    }
+
+    phys_addr addr = (phys_addr) _km_page_alloc( count );
+    if( addr != 0 ) {
+        _kmem_frames += count;
+    }
+    return addr;
+}
+
+/**
+** Name:    _set_refs
+**
+** Set the reference counts for a run of frames.  Frames allocated
+** before the count table exists are picked up by _phys_refs_init().
+**
+** @param addr   Address of the first frame in the run
+** @param count  Number of frames in the run
+** @param refs   The new reference count
+*/
+static void _set_refs( phys_addr addr, uint32_t count, uint16_t refs ) {
+    uint32_t n = addr / SZ_PAGE;
+
+    for( uint32_t i = 0; i < count && n + i < _ref_frames; ++i ) {
+        _refs[n + i] = refs;
+    }
+}
+
+/**
+** Name:    _clear_frame
+**
+** Zero a frame a word at a time.  The frame must be identity mapped.
+**
+** @param addr  Address of the frame
+*/
+static void _clear_frame( phys_addr addr ) {
+    uint32_t dst = addr;
+    uint32_t cnt = SZ_PAGE / sizeof(uint32_t);
+
+    __asm__ __volatile__( "cld; rep stosl"
+        : "+D"(dst), "+c"(cnt)
+        : "a"(0)
+        : "memory" );
+}
+
+/*
+** PUBLIC FUNCTIONS
+*/
+
+/**
+** Name:    alloc_frame
+**
+** Allocate a single physical frame, paging something out if there
+** is no free memory.  The zeroed stock is used before kmem or swap.
+**
+** @return the address of the frame, or 0 if no memory is available
+*/
+phys_addr alloc_frame( void ) {
+    phys_addr addr;
+
+    do {
+        uint32_t n = _free_count ? _find_free() : _num_frames;
+
+        if( n < _num_frames ) {
+            _mark_frames( n, 1, true );
+            addr = _pool_base + n * SZ_PAGE;
+        } else if( _zero_count > 0 ) {
+            // the zeroed stock is free memory, too; its frames were
+            // counted and given their reference when it was filled
+            return _zero_pool[--_zero_count];
+        } else {
+            addr = _fallback_alloc( 1 );
+        }
+
+        // out of memory, so page something out and try again
+    } while( addr == 0 && _swap_reclaim() );
+
+    if( addr != 0 ) {
+        _set_refs( addr, 1, 1 );
+        ++_allocs;
+    }
+    return addr;
+}
+
+/**
+** Name:    alloc_zeroed_frame
+**
+** Allocate a single physical frame which has been filled with zeroes.
+**
+** @return the address of the frame, or 0 if no memory is available
+*/
+phys_addr alloc_zeroed_frame( void ) {
+
+    if( _zero_count > 0 ) {
+        return _zero_pool[--_zero_count];
+    }
+
+    // none ready, so we have to pay for it now
+    phys_addr addr = alloc_frame();
+    if( addr != 0 ) {
+        _clear_frame( addr );
+    }
+
+    return addr;
+}
+
+/**
+** Name:    _phys_zero_fill
+**
+** Clear up to 'batch' frames and add them to the zeroed frame stock.
+** Only frames from our own pool are used; we don't go to kmem just
+** to have cleared memory on hand.
+**
+** @param batch  Maximum number of frames to clear
+**
+** @return the number of frames the stock is still short
+*/
+uint32_t _phys_zero_fill( uint32_t batch ) {
+
+    while( batch-- > 0 && _zero_count < ZERO_POOL_SIZE && _free_count > 0 ) {
+        uint32_t n = _find_free();
+        if( n >= _num_frames ) {
             break;
         }
+        _mark_frames( n, 1, true );
+        phys_addr addr = _pool_base + n * SZ_PAGE;
+        _set_refs( addr, 1, 1 );
+        ++_allocs;
+        _clear_frame( addr );
+        _zero_pool[_zero_count++] = addr;
+    }
+
+    // if the pool has run dry, there's no point in asking again
+    return _free_count > 0 ? ZERO_POOL_SIZE - _zero_count : 0;
+}
+
+/**
+** Name:    alloc_frames
+**
+** Allocate a run of physically contiguous frames.
+**
+** @param count  Number of frames desired
+**
+** @return the address of the first frame, or 0 if no memory is available
+*/
+phys_addr alloc_frames( uint32_t count ) {
+    if( count < 1 ) {
+        return 0;
+    }
+
+    uint32_t n = count <= _free_count ? _find_run( count ) : _num_frames;
+
+    phys_addr addr;
+    if( n < _num_frames ) {
+        _mark_frames( n, count, true );
+        addr = _pool_base + n * SZ_PAGE;
+    } else {
+        addr = _fallback_alloc( count );
+    }
+
+    if( addr != 0 ) {
+        _set_refs( addr, count, 1 );
+        _allocs += count;
+    }
+    return addr;
+}
+
+/**
+** Name:    free_frames
+**
+** Free a run of frames obtained from alloc_frames().  Runs which
+** came from kmem must be freed in the same length they were allocated.
+**
+** @param addr   Address of the first frame
+** @param count  Number of frames in the run
+*/
+void free_frames( phys_addr addr, uint32_t count ) {
+    if( addr == 0 ) {
+        return;
+    }
+
+    _set_refs( addr, count, 0 );
+    _frees += count;
+
+    // a copy in swap is of no more use
+    for( uint32_t i = 0; i < count; ++i ) {
+        _swap_forget( addr + i * SZ_PAGE );
+    }
+
+    if( addr >= _pool_base && addr < _pool_base + _num_frames * SZ_PAGE ) {
+        uint32_t first = (addr - _pool_base) / SZ_PAGE;
+        assert( first + count <= _num_frames );
+        _mark_frames( first, count, false );
+        return;
+    }
+
+    // not one of ours, so it must have come from kmem
+    assert( km_is_init() );
+    _kmem_frames -= count;
+    _km_page_free( (void *) addr );
+}
+
+/**
+** Name:    free_frame
+**
+** Free a single frame.
+**
+** @param addr  Address of the frame
+*/
+void free_frame( phys_addr addr ) {
+    free_frames( addr, 1 );
+}
+
+/**
+** Name:    ref_frame
+**
+** Add a reference to an allocated frame.
+**
+** @param addr  Address of the frame
+*/
+void ref_frame( phys_addr addr ) {
+    uint32_t n = addr / SZ_PAGE;
+
+    assert( n < _ref_frames && _refs[n] > 0 );
+    ++_refs[n];
+}
+
+/**
+** Name:    unref_frame
+**
+** Drop a reference to a frame, freeing it when the last one goes away.
+** Frames the count table doesn't cover have a single owner.
+**
+** @param addr  Address of the frame
+*/
+void unref_frame( phys_addr addr ) {
+    uint32_t n = addr / SZ_PAGE;
+
+    if( n < _ref_frames && _refs[n] > 1 ) {
+        --_refs[n];
+        return;
+    }
+
+    free_frame( addr );
+}
+
+/**
+** Name:    frame_refs
+**
+** @param addr  Address of the frame
+**
+** @return the number of references to the frame
+*/
+uint32_t frame_refs( phys_addr addr ) {
+    uint32_t n = addr / SZ_PAGE;
+
+    return n < _ref_frames ? _refs[n] : 1;
+}
+
+/**
+** Name:    _phys_stats
+**
+** Gather the allocator's statistics.  Frames are in use from when
+** they are allocated (including those waiting in the zeroed stock)
+** until their last reference is dropped.
+**
+** @param st  The statistics are returned here
+*/
+void _phys_stats( phys_stats_t *st ) {
+    st->pool_frames = _num_frames;
+    st->pool_free = _free_count;
+    st->zeroed = _zero_count;
+    st->kmem_frames = _kmem_frames;
+    st->in_use = _allocs - _frees;
+    st->allocs = _allocs;
+    st->frees = _frees;
+
+    st->shared = 0;
+    for( uint32_t n = 0; n < _ref_frames; ++n ) {
+        if( _refs[n] > 1 ) {
+            ++st->shared;
+        }
     }
-    
-    if(km_is_init()){
-        _km_page_free((void *) addr);
+}
+
+/**
+** Name:    _phys_dump
+**
+** Print the allocator's statistics on the console
+*/
+void _phys_dump( void ) {
+    phys_stats_t st;
+
+    _phys_stats( &st );
+    __cio_printf( "frames: pool %d (%d free, %d zeroed), kmem %d\n",
+                  st.pool_frames, st.pool_free, st.zeroed, st.kmem_frames );
+    __cio_printf( "        in use %d (%d shared), %d allocs, %d frees\n",
+                  st.in_use, st.shared, st.allocs, st.frees );
+}
+
+/**
+** Name:    _phys_refs_init
+**
+** Create the reference count table.  This needs kmem, so it happens
+** after the pool is set up; pool frames which were handed out before
+** then are given their single reference here.
+**
+** @param frames  Number of frames (from address 0) to track
+*/
+void _phys_refs_init( uint32_t frames ) {
+    _refs = (uint16_t *) kmalloc( frames * sizeof(uint16_t) );
+    if( _refs == NULL ) {
+        WARNING( "no memory for frame reference counts" );
+        return;
+    }
+    __memclr( _refs, frames * sizeof(uint16_t) );
+    _ref_frames = frames;
+
+    for( uint32_t i = 0; i < _num_frames; ++i ) {
+        if( !_frame_is_free(i) ) {
+            _set_refs( _pool_base + i * SZ_PAGE, 1, 1 );
+        }
     }
 }
 
-void _phys_alloc_init(phys_addr addr, uint32_t num_f){
-    frames = (struct phys_frame *)addr;
-    num_frames = num_f;
-}
\ No newline at end of file
+/**
+** Name:    _phys_alloc_init
+**
+** Initialize the physical allocator.
+**
+** @param addr    Address of the first frame in the pool
+** @param num_f   Number of frames in the pool
+*/
+void _phys_alloc_init( phys_addr addr, uint32_t num_f ) {
+    if( num_f > MAX_FRAMES ) {
+        num_f = MAX_FRAMES;
+    }
+
+    _pool_base = addr;
+    _num_frames = num_f;
+    _free_count = num_f;
+    _hint = 0;
+    _zero_count = 0;
+    __memclr( _bitmap, sizeof(_bitmap) );
+}
@@ -16,6 +16,9 @@
 #include "process.h"
 #include "scheduler.h"
 #include "stacks.h"
+#include "slab.h"
+#include "vm.h"
+#include "shm.h"
 #include "cio.h"
 
 /*
@@ -31,7 +34,7 @@
 */
 
 // PCB management
-static pcb_t *_pcb_list;
+static slab_cache_t _pcb_cache;
 
 /*
 ** PUBLIC GLOBAL VARIABLES
@@ -50,38 +53,6 @@ pcb_t *_processes[N_PROCS];
 ** PRIVATE FUNCTIONS
 */
 
-/**
-** _pcb_add() - allocate a slice and carve it into PCBs
-**
-** @param critical  Should we panic on allocation failure?
-**
-** @return the number of PCBs added to the pool
-*/
-static int _pcb_add( void ) {
-
-    // start by carving off a slice of memory
-    pcb_t *new = (pcb_t *) _km_slice_alloc();
-
-    // NULL slice is a problem
-    if( new == NULL ) {
-        return( false );
-    }
-
-    // clear out the allocated space
-    __memclr( new, SZ_SLICE );
-
-    for( int i = 0; i < (SZ_SLICE / sizeof(pcb_t)); ++i ) {
-        _pcb_free( &new[i] );
-    }
-
-#if TRACING_PCB
-    __cio_printf( "** _pcb_add() added %d PCBs\n", SZ_SLICE / sizeof(pcb_t) );
-#endif
-
-    // all done!
-    return( SZ_SLICE / sizeof(pcb_t) );
-}
-
 /*
 ** PUBLIC FUNCTIONS
 */
@@ -93,7 +64,7 @@ static int _pcb_add( void ) {
 /**
 ** _pcb_init() - initialize the process module
 **
-** Allocates an initial set of PCBs, does whatever else is
+** Creates the PCB cache, does whatever else is
 ** needed to make it possible to create processes
 **
 ** Dependencies:
@@ -104,9 +75,9 @@ void _pcb_init( void ) {
 
     __cio_puts( " Process:" );
 
-    // allocate an initial slice of PCBs
-    _pcb_list = NULL;
-    assert( _pcb_add() );   // returns 0 on failure
+    // create the PCB cache
+    _pcb_cache = _slab_create( "pcb", sizeof(pcb_t), NULL );
+    assert( _pcb_cache != NULL );
 
     // reset the "active" variables
     _n_procs = 0;
@@ -135,23 +106,15 @@ void _pcb_init( void ) {
 ** @return a pointer to the allocated PCB, or NULL
 */
 pcb_t *_pcb_alloc( void ) {
-    pcb_t *new;
-
-    // see if there is an available PCB
-    if( _pcb_list == NULL ) {
 
-        // no - see if we can create some
-        if( !_pcb_add() ) {
-            // no!  let's just leave quietly
-            return( NULL );
-        }
+    pcb_t *new = (pcb_t *) _slab_alloc( _pcb_cache );
+    if( new == NULL ) {
+        return( NULL );
     }
 
-    // OK, we know that there is at least one free PCB;
-    // just take the first one from the list
-
-    new = _pcb_list;
-    _pcb_list = (pcb_t *) new->context;
+#if TRACING_PCB
+    __cio_printf( "** _pcb_alloc() returning %08x\n", (uint32_t) new );
+#endif
 
     // clear out the fields in this one just to be safe
     __memclr( new, sizeof(pcb_t) );
@@ -161,11 +124,11 @@ pcb_t *_pcb_alloc( void ) {
 }
 
 /**
-** _pcb_free() - return a PCB to the free list
+** _pcb_free() - return a PCB to its cache
 **
 ** Deallocates the supplied PCB
 **
-** @param pcb   The PCB to be put on the free list
+** @param pcb   The PCB to be freed
 */
 void _pcb_free( pcb_t *pcb ) {
 
@@ -178,9 +141,46 @@ void _pcb_free( pcb_t *pcb ) {
     pcb->state = Free;
     pcb->pid = pcb->ppid = 0;
 
-    // stick it at the front of the list
-    pcb->context = (context_t *) _pcb_list;
-    _pcb_list = pcb;
+    _slab_free( _pcb_cache, pcb );
+}
+
+/**
+** _pcb_word(pcb,addr) - find a word on a process' stack
+**
+** Every process' stack is at the same address in its own address
+** space, so a word on the stack of a process other than the one whose
+** address space is current has to be reached through that process'
+** page tables.  In either case the page is filled in and made private
+** (it may be shared copy-on-write with a parent or child) first, as
+** the caller may be about to write it.
+**
+** @param pcb   The process
+** @param addr  Address of the word in the process' address space
+**
+** @return a pointer the kernel can use to read or write the word
+*/
+uint32_t *_pcb_word( pcb_t *pcb, uint32_t *addr ) {
+    static uint32_t scratch;
+    virt_addr virt = (virt_addr) addr;
+
+    // the kernel half of every address space is the same
+    if( pcb->pg_dir == NULL || virt >= USER_VIRT_LIMIT ) {
+        return( addr );
+    }
+
+    if( _vm_touch(pcb, virt, sizeof(uint32_t), true) ) {
+        if( pcb->pg_dir == get_current_pg_dir() ) {
+            return( addr );
+        }
+        uint32_t *word = (uint32_t *) pg_dir_ptr( pcb->pg_dir, virt );
+        if( word != NULL ) {
+            return( word );
+        }
+    }
+
+    // no stack left (e.g., a zombie):  reads see zero, writes are lost
+    scratch = 0;
+    return( &scratch );
 }
 
 /**
@@ -205,17 +205,19 @@ void _pcb_cleanup( pcb_t *pcb ) {
         }
     }
 
-    // release the stack(en?)
-    if( pcb->stack != NULL ) {
-        _stk_free( pcb->stack );
-    }
-
-    // release the PCB
+    // release the PCB; the stack goes with the address space
     pcb->state = Free;  // just to be sure!
     if(pcb->pg_dir){
-        set_page_directory(get_kernel_pg_dir());
+        // don't pull the address space out from under ourselves, but
+        // leave it alone otherwise, as it holds the running process' stack
+        if(pcb->pg_dir == get_current_pg_dir()){
+            set_page_directory(get_kernel_pg_dir());
+        }
+        release_user_pages(pcb->pg_dir);
+        _vm_free(&pcb->vm);
         delete_pg_dir(pcb->pg_dir);
     }
+    _shm_drop(&pcb->shm);
     _pcb_free( pcb );
 }
 
@@ -329,7 +331,13 @@ void _context_dump_all( const char *msg ) {
         if( pcb != NULL && pcb->state != Free ) {
             ++n;
             __cio_printf( "%2d[%2d]: ", n, i );
-            _context_dump( NULL, pcb->context );
+            // the context may be in another address space
+            context_t ct;
+            for( uint32_t w = 0; w < sizeof(ct) / sizeof(uint32_t); ++w ) {
+                ((uint32_t *) &ct)[w] =
+                        *_pcb_word( pcb, ((uint32_t *) pcb->context) + w );
+            }
+            _context_dump( NULL, &ct );
         }
     }
 }
@@ -378,8 +386,8 @@ void _ptable_dump( const char *msg, bool_t all ) {
             // do we want more info?
             if( all ) {
                 __cio_printf( " stk %08x ESP %08x EIP %08x\n",
-                      (uint32_t) pcb->stack, pcb->context->esp,
-                      pcb->context->eip );
+                      (uint32_t) pcb->stack, REG(pcb,esp),
+                      REG(pcb,eip) );
             }
         }
     }
@@ -11,6 +11,7 @@
 #include "common.h"
 
 #include "queues.h"
+#include "slab.h"
 
 /*
 ** PRIVATE DEFINITIONS
@@ -65,29 +66,9 @@ typedef struct q_s {
 ** PRIVATE GLOBAL VARIABLES
 */
 
-/*
-** The list of free qnodes.
-**
-** Organized as a singly-linked list using the 'next' pointer
-** in the qnode structure.
-*/
-static qnode_t *_qnode_list;
-
-/*
-** The initial set of queues available in the system.
-**
-** If these are all allocated, _queue_alloc() will allocate
-** another slice of memory as needed.
-*/
-static qinfo_t _queues[N_QUEUES];
-
-/*
-** The list of free queues.
-**
-** Organized as a singly-linked list using the 'head' pointer
-** in the q_s structure.
-*/
-static qinfo_t *_queue_list;
+// object caches for qnodes and queues
+static slab_cache_t _qnode_cache;
+static slab_cache_t _queue_cache;
 
 /*
 ** PUBLIC GLOBAL VARIABLES
@@ -101,66 +82,18 @@ static qinfo_t *_queue_list;
 ** Qnode Functions
 */
 
-// forward declarations for some internal functions
-static void _qnode_free( qnode_t *qn );
-void _queue_delete( queue_t q );
-
-/**
-** _qnode_new() - allocate a slice and carve it into qnodes
-**
-** @return the number of qnodes added to the free list
-*/
-static int _qnode_new( void ) {
-
-    // start by carving off a slice of memory
-    qnode_t *new = (qnode_t *) _km_slice_alloc();
-
-    // if we couldn't get one, we're done
-    if( new == NULL ) {
-        return( 0 );
-    }
-
-    // clear out the allocated space
-    __memclr( new, SZ_SLICE );
-
-    // free the qnodes!
-    for( int i = 0; i < (SZ_SLICE / sizeof(qnode_t)); ++i ) {
-        // N.B.: if the slice size is not an integral multiple of
-        // the qnode size, this will leave a small internal fragment
-        // at the end of the allocated block of memory
-        _qnode_free( &new[i] );
-    }
-
-    // all done
-    return( SZ_SLICE / sizeof(qnode_t) );
-}
-
 /**
 ** _qnode_alloc() - allocate a qnode
 **
-** Removes the first qnode from the free list.
-**
 ** @return A pointer to the allocated node, or NULL
 */
 static qnode_t *_qnode_alloc( void ) {
-    qnode_t *new;
-
-    // see if there is an available node
-    if( _qnode_list == NULL ) {
+    qnode_t *new = (qnode_t *) _slab_alloc( _qnode_cache );
 
-        // no - see if we can create some
-        if( !_qnode_new() ) {
-            // no!  let's just leave quietly
-            return( NULL );
-        }
+    if( new == NULL ) {
+        return( NULL );
     }
 
-    // OK, we know that there is at least one free qnode;
-    // just take the first one from the list
-
-    new = _qnode_list;
-    _qnode_list = new->next;
-
     // clear out the fields in this one just to be safe
     new->prev = new->next = new->data = NULL;
     new->key = 0;
@@ -170,46 +103,35 @@ static qnode_t *_qnode_alloc( void ) {
 }
 
 /**
-** _qnode_free() - return a qnode to the free list
+** _qnode_free() - return a qnode to its cache
 **
 ** Deallocates the supplied qnode
 **
-** @param qn   The qnode to be put on the free list
+** @param qn   The qnode to be freed
 */
 static void _qnode_free( qnode_t *qn ) {
     assert( qn != NULL );
 
-    // just stick this one at the front of the list
-    qn->next = _qnode_list;
-    _qnode_list = qn;
+    _slab_free( _qnode_cache, qn );
 }
 
+/*
+** Queue Functions
+*/
+
 /**
-** _queue_new() - allocate a slice and carve it into queues
+** _queue_ctor() - construct a queue
+**
+** Queues are always returned to the cache empty, so this is
+** the only place the list pointers need to be initialized.
 **
-** @return number of queues added to the free list
+** @param obj   The queue to be constructed
 */
-static int _queue_new( void ) {
-    struct q_s *slice;
+static void _queue_ctor( void *obj ) {
+    qinfo_t *q = (qinfo_t *) obj;
 
-    // start by carving off a slice of memory
-    slice = (struct q_s *) _km_slice_alloc();
-
-    // NULL slice is a problem
-    if( slice == NULL ) {
-        return( 0 );
-    }
-
-    // clear out the allocated space
-    __memclr( slice, SZ_SLICE );
-
-    // 
-    for( int i = 0; i < (SZ_SLICE / sizeof(struct q_s)); ++i ) {
-        _queue_delete( slice + i );
-    }
-
-    // all done!
-    return( SZ_SLICE / sizeof(struct q_s) );
+    q->head = q->tail = NULL;
+    q->count = 0;
 }
 
 /*
@@ -226,30 +148,13 @@ static int _queue_new( void ) {
 ** @return a pointer to the allocated queue, or NULL
 */
 queue_t _queue_create( int (*order)(const key_t,const key_t) ) {
-    queue_t new;
 
-    // see if there is an available node
-    if( _queue_list == NULL ) {
-
-        // no - see if we can create some
-        if( !_queue_new() ) {
-            // no!  let's just leave quietly
-            return( NULL );
-        }
+    // queues come out of the cache already empty
+    queue_t new = (queue_t) _slab_alloc( _queue_cache );
+    if( new == NULL ) {
+        return( NULL );
     }
 
-    // OK, we know that there is at least one free qnode;
-    // just take the first one from the list
-
-    new = _queue_list;
-    _queue_list = (queue_t) new->head;
-
-    // sanity check!
-    assert1( new != NULL );
-
-    // clear out the fields in this one just to be safe
-    new->head = new->tail = NULL;
-    new->count = 0;
     new->order = order;
 
     // pass it back to the caller
@@ -257,11 +162,11 @@ queue_t _queue_create( int (*order)(const key_t,const key_t) ) {
 }
 
 /**
-** _queue_delete() - return a queue to the free list
+** _queue_delete() - return a queue to its cache
 **
 ** Deallocates the supplied queue
 **
-** @param q   The queue to be put on the free list
+** @param q   The queue to be freed
 */
 void _queue_delete( queue_t q ) {
 
@@ -269,9 +174,9 @@ void _queue_delete( queue_t q ) {
     assert1( q != NULL );
     assert1( q->count == 0 );
 
-    // just stick this one at the front of the list
-    q->head = (qnode_t *) _queue_list;
-    _queue_list = q;
+    // put it back in its constructed state
+    q->head = q->tail = NULL;
+    _slab_free( _queue_cache, q );
 }
 
 /**
@@ -601,7 +506,7 @@ void _queue_dump( const char *msg, queue_t q ) {
 /**
 ** _queue_init() - initialize the queue module
 **
-** Allocates the initial set of qnodes and set of queues.
+** Creates the object caches for qnodes and queues.
 **
 ** Dependencies:
 **    Cannot be called before kmem is initialized
@@ -611,15 +516,10 @@ void _queue_init( void ) {
 
     __cio_puts( " Queue:" );
 
-    // first, "allocate" our static set of queues
-    for( int i = 0; i < N_QUEUES; ++i ) {
-        _queue_delete( &_queues[i] );
-    }
-
-    // next, the qnodes
-    _qnode_list = NULL;
-    if( _qnode_new() < 1 ) {
-        PANIC( 0, "_qnode_new failed" );
+    _qnode_cache = _slab_create( "qnode", sizeof(qnode_t), NULL );
+    _queue_cache = _slab_create( "queue", sizeof(qinfo_t), _queue_ctor );
+    if( _qnode_cache == NULL || _queue_cache == NULL ) {
+        PANIC( 0, "_queue_init: can't create caches" );
     }
 
     // all done!
@@ -4,39 +4,558 @@
 ** @author CSCI-452 class of 20215
 **
 ** Scheduler implementation
+**
+** The ready queue has one FIFO list per priority level, linked through
+** the PCBs themselves, and a bitmap with a bit set for each level that
+** has something on it.  Adding a process appends it to its level's
+** list; picking the next one finds the lowest set bit with a single
+** 'bsf' and takes the head of that list.  Neither allocates anything,
+** and neither depends on how many levels or processes there are.
+**
+** Priorities change as processes run (a multi-level feedback queue).
+** A process which uses up its time slice is moved down a level, where
+** the slices are longer; one which blocks (reading, or sleeping) is
+** moved back up, but not above the priority it was given ("base").
+** So CPU-bound processes sink and interactive ones stay near the top.
+** To keep anything from starving, processes which have been waiting a
+** long time are moved up a level at a time, even above their base,
+** until they get to run.  Deferred processes are the exception:  they
+** stay where they are, and only run when nothing else can.
+**
+** There is also a "fair" class, used instead of the MLFQ if SCHED_FAIR
+** is defined (or the console shell switches to it).  Each process
+** keeps a virtual runtime, the CPU time it has used (measured with the
+** TSC) scaled by its weight; the runnable process with the smallest
+** virtual runtime runs next, from a min-heap.  The weight comes from
+** the base priority, as a "nice" value:  User is the standard weight,
+** and each level up or down is worth about 25% more or less CPU.  A
+** slice is the process' share of FAIR_LATENCY, so every process gets
+** to run once in that time.  A process which has been blocked starts
+** again at the smallest virtual runtime of those waiting, so it can't
+** use the time it slept to shut the others out.  Deferred processes
+** are kept on the bitmap queue, and still only run when nothing else
+** can.
+**
+** Above both is a real-time class, scheduled earliest deadline first.
+** A process asks (through setrt) for some CPU time ("runtime") within
+** a "deadline" of the start of every "period"; if the promises already
+** made plus this one would add up to more than RT_MAX_UTIL of the CPU,
+** it is refused.  Ready real-time processes are kept in a list sorted
+** by deadline, and always run before anything else.  The clock charges
+** the running one a tick of its budget at a time; one which has used
+** up its budget, or whose deadline has passed, waits on the sleep queue
+** until its next period starts (a deadline passing while it still
+** wanted the CPU is counted as a miss).  So a real-time process can
+** never take more than it was promised, and the others can count on
+** the rest.
+**
+** With more than one CPU (see smp.c), each CPU has a ready queue of its
+** own, with all three classes on it, and a process goes back on the
+** queue of the CPU it last ran on, where its cache may still be warm.
+** A new process goes to the CPU with the least to do.  A CPU with
+** nothing left but Deferred processes takes a process from the CPU
+** with the most waiting; real-time processes are never moved, since
+** their CPU time was promised by the CPU they are on.  A CPU with
+** nothing at all runs its idle process, which is never on a queue.
 */
 
 #define    SP_KERNEL_SRC
 
 #include "common.h"
+#include "scheduler.h"
 #include "syscalls.h"
+#include "clock.h"
 #include "paging.h"
+#include "stacks.h"
+#include "smp.h"
 /*
 ** PRIVATE DEFINITIONS
 */
 
+// the bitmap is a single word, and there is a weight for each level
+#if N_PRIOS != 32
+#error "N_PRIOS must be 32"
+#endif
+
+// the weight of a User process
+#define FAIR_WEIGHT     1024
+
+// a process in the real-time class
+#define IS_RT(pcb)      ((pcb)->rt.runtime != 0)
+
+// a process in the fair class
+#define IS_FAIR(pcb)    (!IS_RT(pcb) && _sched_fair && (pcb)->base != Deferred)
+
+// the ready queue of the CPU running the kernel, and of a process
+#define RQ_HERE         (&_rqs[_cpu->id])
+#define RQ_OF(pcb)      (&_rqs[(pcb)->cpu])
+
+// processes on a ready queue which another CPU may take
+#define RQ_MOVABLE(rq)  ((rq)->count - (rq)->edf_count - \
+                         (rq)->level[Deferred].count)
+
 /*
 ** PRIVATE DATA TYPES
 */
 
+// one level of the ready queue
+typedef struct rq_level_s {
+    pcb_t *head;
+    pcb_t *tail;
+    uint32_t count;
+} rq_level_t;
+
+// one CPU's ready queue
+typedef struct runq_s {
+    // a MLQ with one level per priority value; bit n of the map is
+    // set when level n is not empty
+    rq_level_t level[N_PRIOS];
+    uint32_t map;
+
+    // the fair class:  a min-heap ordered by virtual runtime, the total
+    // weight of the processes in it, and the smallest virtual runtime
+    // handed out so far
+    pcb_t *cfs_heap[N_PROCS];
+    uint32_t cfs_count;
+    uint32_t cfs_weight;
+    uint64_t cfs_min;
+
+    // the real-time class:  ready processes, earliest deadline first;
+    // the CPU promised to them (in thousandths); deadlines missed
+    pcb_t *edf_head;
+    uint32_t edf_count;
+    uint32_t rt_util;
+    uint32_t rt_misses;
+
+    // the process on the CPU, and when (TSC) it got there
+    pcb_t *run_pcb;
+    uint64_t run_start;
+
+    // processes on the queue (all classes), processes taken from
+    // other CPUs, and the idle process (if there is one)
+    uint32_t count;
+    uint32_t steals;
+    pcb_t *idle;
+} runq_t;
+
 /*
 ** PRIVATE GLOBAL VARIABLES
 */
 
+// a ready queue for each CPU
+static runq_t _rqs[N_CPUS];
+
+// fair class weight for each priority level (nice -16 to 15)
+static const uint32_t _weights[N_PRIOS] = {
+    36291, 29154, 23254, 18705, 14949, 11916,  9548,  7620,
+     6100,  4904,  3906,  3121,  2501,  1991,  1586,  1277,
+     1024,   820,   655,   526,   423,   335,   272,   215,
+      172,   137,   110,    87,    70,    56,    45,    36
+};
+
 /*
 ** PUBLIC GLOBAL VARIABLES
 */
 
-// the ready queue:  a MLQ with one level per priority value
-queue_t _ready[N_PRIOS];
-
-// the current user process
+// the current user process (of the CPU running the kernel; see smp.c)
 pcb_t *_current;
 
+// the quantum for each priority level
+uint8_t _quanta[N_PRIOS];
+
+// is the fair class in use?
+bool_t _sched_fair;
+
 /*
 ** PRIVATE FUNCTIONS
 */
 
+/**
+** _rq_first() - find the highest non-empty priority level
+**
+** @param map   The ready queue bitmap, which must not be 0
+**
+** @return the lowest-numbered level in the bitmap
+*/
+static inline uint32_t _rq_first( uint32_t map ) {
+    uint32_t n;
+
+    __asm__( "bsf %1, %0" : "=r" (n) : "rm" (map) );
+    return( n );
+}
+
+/**
+** _rq_link() - add a process to the end of its ready queue level
+**
+** @param rq    The ready queue
+** @param pcb   The process
+*/
+static void _rq_link( runq_t *rq, pcb_t *pcb ) {
+    rq_level_t *lv = &rq->level[pcb->priority];
+
+    pcb->rq_next = NULL;
+    pcb->rq_prev = lv->tail;
+    if( lv->tail != NULL ) {
+        lv->tail->rq_next = pcb;
+    } else {
+        lv->head = pcb;
+    }
+    lv->tail = pcb;
+    pcb->rq_time = _system_time;
+
+    ++lv->count;
+    rq->map |= 1 << pcb->priority;
+}
+
+/**
+** _rq_unlink() - take a process off its ready queue level
+**
+** @param rq    The ready queue
+** @param pcb   The process, which must be on the ready queue
+*/
+static void _rq_unlink( runq_t *rq, pcb_t *pcb ) {
+    rq_level_t *lv = &rq->level[pcb->priority];
+
+    if( pcb->rq_prev != NULL ) {
+        pcb->rq_prev->rq_next = pcb->rq_next;
+    } else {
+        lv->head = pcb->rq_next;
+    }
+
+    if( pcb->rq_next != NULL ) {
+        pcb->rq_next->rq_prev = pcb->rq_prev;
+    } else {
+        lv->tail = pcb->rq_prev;
+    }
+
+    pcb->rq_next = pcb->rq_prev = NULL;
+
+    if( --lv->count == 0 ) {
+        rq->map &= ~(1 << pcb->priority);
+    }
+}
+
+/**
+** _rdtsc() - read the time stamp counter
+**
+** @return the number of CPU cycles since reset
+*/
+static inline uint64_t _rdtsc( void ) {
+    uint64_t t;
+
+    __asm__ __volatile__( "rdtsc" : "=A" (t) );
+    return( t );
+}
+
+/**
+** _cfs_swap() - exchange two fair class heap entries
+**
+** @param rq    The ready queue
+** @param i     One entry
+** @param j     The other
+*/
+static void _cfs_swap( runq_t *rq, uint32_t i, uint32_t j ) {
+    pcb_t **heap = rq->cfs_heap;
+    pcb_t *tmp = heap[i];
+
+    heap[i] = heap[j];
+    heap[j] = tmp;
+    heap[i]->rq_index = i;
+    heap[j]->rq_index = j;
+}
+
+/**
+** _cfs_up() - move a fair class heap entry up to where it belongs
+**
+** @param rq    The ready queue
+** @param i     The entry
+*/
+static void _cfs_up( runq_t *rq, uint32_t i ) {
+    pcb_t **heap = rq->cfs_heap;
+
+    while( i > 0 ) {
+        uint32_t parent = (i - 1) / 2;
+        if( heap[parent]->vruntime <= heap[i]->vruntime ) {
+            break;
+        }
+        _cfs_swap( rq, i, parent );
+        i = parent;
+    }
+}
+
+/**
+** _cfs_down() - move a fair class heap entry down to where it belongs
+**
+** @param rq    The ready queue
+** @param i     The entry
+*/
+static void _cfs_down( runq_t *rq, uint32_t i ) {
+    pcb_t **heap = rq->cfs_heap;
+
+    for( ;; ) {
+        uint32_t min = i;
+        uint32_t kid = 2 * i + 1;
+
+        if( kid < rq->cfs_count &&
+                heap[kid]->vruntime < heap[min]->vruntime ) {
+            min = kid;
+        }
+        ++kid;
+        if( kid < rq->cfs_count &&
+                heap[kid]->vruntime < heap[min]->vruntime ) {
+            min = kid;
+        }
+
+        if( min == i ) {
+            break;
+        }
+        _cfs_swap( rq, i, min );
+        i = min;
+    }
+}
+
+/**
+** _cfs_insert() - add a process to the fair class heap
+**
+** @param rq    The ready queue
+** @param pcb   The process
+*/
+static void _cfs_insert( runq_t *rq, pcb_t *pcb ) {
+
+    assert1( rq->cfs_count < N_PROCS );
+
+    // no credit for time spent blocked
+    if( pcb->vruntime < rq->cfs_min ) {
+        pcb->vruntime = rq->cfs_min;
+    }
+
+    pcb->rq_index = rq->cfs_count;
+    rq->cfs_heap[rq->cfs_count++] = pcb;
+    rq->cfs_weight += _weights[pcb->base];
+    _cfs_up( rq, pcb->rq_index );
+}
+
+/**
+** _cfs_delete() - take a process off the fair class heap
+**
+** @param rq    The ready queue
+** @param pcb   The process, which must be in the heap
+*/
+static void _cfs_delete( runq_t *rq, pcb_t *pcb ) {
+    uint32_t i = pcb->rq_index;
+
+    assert1( i < rq->cfs_count && rq->cfs_heap[i] == pcb );
+
+    rq->cfs_weight -= _weights[pcb->base];
+    if( i != --rq->cfs_count ) {
+        _cfs_swap( rq, i, rq->cfs_count );
+        _cfs_up( rq, i );
+        _cfs_down( rq, i );
+    }
+}
+
+/**
+** _edf_insert() - add a process to the real-time list
+**
+** @param rq    The ready queue
+** @param pcb   The process
+*/
+static void _edf_insert( runq_t *rq, pcb_t *pcb ) {
+    pcb_t *prev = NULL;
+    pcb_t *curr = rq->edf_head;
+
+    // after everything due no later than it
+    while( curr != NULL && curr->rt.due <= pcb->rt.due ) {
+        prev = curr;
+        curr = curr->rq_next;
+    }
+
+    pcb->rq_prev = prev;
+    pcb->rq_next = curr;
+    if( prev != NULL ) {
+        prev->rq_next = pcb;
+    } else {
+        rq->edf_head = pcb;
+    }
+    if( curr != NULL ) {
+        curr->rq_prev = pcb;
+    }
+
+    ++rq->edf_count;
+}
+
+/**
+** _edf_delete() - take a process off the real-time list
+**
+** @param rq    The ready queue
+** @param pcb   The process, which must be on the list
+*/
+static void _edf_delete( runq_t *rq, pcb_t *pcb ) {
+
+    if( pcb->rq_prev != NULL ) {
+        pcb->rq_prev->rq_next = pcb->rq_next;
+    } else {
+        rq->edf_head = pcb->rq_next;
+    }
+    if( pcb->rq_next != NULL ) {
+        pcb->rq_next->rq_prev = pcb->rq_prev;
+    }
+
+    pcb->rq_next = pcb->rq_prev = NULL;
+    --rq->edf_count;
+}
+
+/**
+** _rt_throttle() - make a real-time process wait for its next period
+**
+** @param pcb   The process, which must not be on any queue
+*/
+static void _rt_throttle( pcb_t *pcb ) {
+
+    pcb->state = Sleeping;
+    pcb->wakeup = pcb->rt.release + pcb->rt.period;
+    assert( _queue_add(_sleeping, pcb, pcb->wakeup) == E_SUCCESS );
+}
+
+/**
+** _rq_add() - add a process to its CPU's ready queue
+**
+** @param pcb   The process
+*/
+static void _rq_add( pcb_t *pcb ) {
+    runq_t *rq = RQ_OF(pcb);
+
+    if( IS_RT(pcb) ) {
+        _edf_insert( rq, pcb );
+    } else if( IS_FAIR(pcb) ) {
+        _cfs_insert( rq, pcb );
+    } else {
+        _rq_link( rq, pcb );
+    }
+    ++rq->count;
+}
+
+/**
+** _rq_del() - take a process off its CPU's ready queue
+**
+** @param pcb   The process
+*/
+static void _rq_del( pcb_t *pcb ) {
+    runq_t *rq = RQ_OF(pcb);
+
+    if( IS_RT(pcb) ) {
+        _edf_delete( rq, pcb );
+    } else if( IS_FAIR(pcb) ) {
+        _cfs_delete( rq, pcb );
+    } else {
+        _rq_unlink( rq, pcb );
+    }
+    --rq->count;
+}
+
+/**
+** _rq_stop() - charge the process on a CPU for the time it used
+**
+** @param rq    The CPU's ready queue
+*/
+static void _rq_stop( runq_t *rq ) {
+    pcb_t *pcb = rq->run_pcb;
+
+    if( pcb == NULL ) {
+        return;
+    }
+
+    uint64_t delta = _rdtsc() - rq->run_start;
+    if( delta > 0xffffffff ) {
+        delta = 0xffffffff;
+    }
+
+    // scaled in two parts, to stay within 32-bit division
+    uint32_t d = delta;
+    uint32_t w = _weights[pcb->base];
+    pcb->vruntime += (uint64_t) (d / w) * FAIR_WEIGHT
+                     + (d % w) * FAIR_WEIGHT / w;
+
+    rq->run_pcb = NULL;
+}
+
+/**
+** _rq_load() - how much a CPU has to do
+**
+** @param n     The CPU
+**
+** @return the number of processes it has ready or running
+*/
+static uint32_t _rq_load( uint32_t n ) {
+    runq_t *rq = &_rqs[n];
+    pcb_t *curr = n == _cpu->id ? _current : _cpus[n].current;
+
+    return( rq->count + (curr != NULL && curr != rq->idle) );
+}
+
+/**
+** _rq_place() - choose a CPU for a new process
+**
+** @return the CPU with the least to do (this one, if it is as good)
+*/
+static uint32_t _rq_place( void ) {
+    uint32_t best = _cpu->id;
+    uint32_t least = _rq_load( best );
+
+    for( uint32_t n = 0; n < _n_cpus && least > 0; ++n ) {
+        uint32_t load = _rq_load( n );
+        if( load < least ) {
+            best = n;
+            least = load;
+        }
+    }
+
+    return( best );
+}
+
+/**
+** _rq_steal() - move a process here from the CPU with the most
+**               processes waiting
+**
+** The one taken is one the other CPU would not get to soon:  a leaf
+** of its fair class heap, or the last one on its highest MLQ level.
+** Its place in line in the fair class comes along with it.
+**
+** @param rq    This CPU's ready queue
+*/
+static void _rq_steal( runq_t *rq ) {
+    runq_t *from = NULL;
+    uint32_t most = 0;
+
+    for( uint32_t n = 0; n < _n_cpus; ++n ) {
+        if( &_rqs[n] != rq && RQ_MOVABLE(&_rqs[n]) > most ) {
+            from = &_rqs[n];
+            most = RQ_MOVABLE(from);
+        }
+    }
+
+    if( from == NULL ) {
+        return;
+    }
+
+    pcb_t *pcb;
+    uint64_t lag = 0;
+    if( from->cfs_count > 0 ) {
+        pcb = from->cfs_heap[from->cfs_count - 1];
+        if( pcb->vruntime > from->cfs_min ) {
+            lag = pcb->vruntime - from->cfs_min;
+        }
+    } else {
+        pcb = from->level[_rq_first(from->map & ~(1 << Deferred))].tail;
+    }
+
+    _rq_del( pcb );
+    pcb->cpu = rq - _rqs;
+    pcb->vruntime = rq->cfs_min + lag;
+    _rq_add( pcb );
+    ++rq->steals;
+}
+
 /*
 ** PUBLIC FUNCTIONS
 */
@@ -44,29 +563,47 @@ pcb_t *_current;
 /**
 ** _sched_init() - initialize the scheduler module
 **
-** Allocates the ready queues and resets the "current process" pointer
+** Empties the ready queue and resets the "current process" pointer
 **
 ** Dependencies:
-**    Cannot be called before queues are initialized
 **    Must be called before any process scheduling can be done
 */
 void _sched_init( void ) {
 
     __cio_puts( " Sched:" );
-    
-    // allocate the ready queues
+
+    // empty the ready queues
+    __memclr( _rqs, sizeof(_rqs) );
+#ifdef SCHED_FAIR
+    _sched_fair = true;
+    __cio_puts( " fair" );
+#else
+    _sched_fair = false;
+#endif
+
+    // longer slices for lower levels
     for( int i = 0; i < N_PRIOS; ++i ) {
-        _ready[i] = _queue_create( NULL );
-        // at this point, allocation failure is terminal
-        assert( _ready[i] != NULL );
+        _quanta[i] = Q_DEFAULT << (i / Q_BAND);
     }
-    
+
     // reset the "current process" pointer
     _current = NULL;
-    
+
     __cio_puts( " done" );
 }
 
+/**
+** _sched_cpu_init() - give a CPU its idle process
+**
+** @param id    The CPU
+** @param idle  Its idle process, which is never on the ready queue
+*/
+void _sched_cpu_init( uint32_t id, pcb_t *idle ) {
+
+    assert1( id < N_CPUS && idle != NULL );
+    _rqs[id].idle = idle;
+}
+
 /**
 ** _schedule() - add a process to the ready queue
 **
@@ -87,44 +624,446 @@ void _schedule( pcb_t *pcb ) {
 
     // bad priority value causes a fault
     assert1( pcb->priority < N_PRIOS );
-    
+
+    // an idle process just waits until its CPU has nothing else
+    if( pcb == RQ_OF(pcb)->idle ) {
+        pcb->state = Ready;
+        return;
+    }
+
+    // a new process goes where there is the least to do (a real-time
+    // one stays with the CPU which promised it time)
+    if( pcb->state == New && _n_cpus > 1 && !IS_RT(pcb) ) {
+        pcb->cpu = _rq_place();
+    }
+
+    // if it is coming off the CPU, charge it for the time it used
+    if( pcb == RQ_OF(pcb)->run_pcb ) {
+        _rq_stop( RQ_OF(pcb) );
+    }
+
+    // a real-time process may be starting a new period; if not, and
+    // its deadline has passed, it has to wait for the next one
+    if( IS_RT(pcb) ) {
+        rt_t *rt = &pcb->rt;
+        if( _system_time >= rt->release + rt->period ) {
+            rt->release += (_system_time - rt->release) / rt->period
+                           * rt->period;
+            rt->due = rt->release + rt->deadline;
+            rt->budget = rt->runtime;
+        }
+        if( rt->due <= _system_time ) {
+            _rt_throttle( pcb );
+            return;
+        }
+    }
+
     // mark the process as ready to execute
     pcb->state = Ready;
 
-    // add it to the appropriate queue
-    int status = _queue_add( _ready[pcb->priority], pcb, 0 );
+    // add it to the end of the appropriate level (or the fair heap)
+    _rq_add( pcb );
+}
+
+/**
+** _sched_remove() - take a process off the ready queue
+**
+** @param pcb   The process, which must be in the Ready state
+*/
+void _sched_remove( pcb_t *pcb ) {
+
+    assert1( pcb != NULL && pcb->state == Ready );
+    _rq_del( pcb );
+}
+
+/**
+** _sched_exit() - note that a process is exiting
+**
+** @param pcb   The process
+*/
+void _sched_exit( pcb_t *pcb ) {
+
+    runq_t *rq = RQ_OF(pcb);
+
+    // its PCB may be gone by the time we dispatch
+    if( pcb == rq->run_pcb ) {
+        rq->run_pcb = NULL;
+    }
+
+    // its real-time promise can go to someone else
+    rq->rt_util -= pcb->rt.util;
+    pcb->rt.runtime = pcb->rt.util = 0;
+}
+
+/**
+** _sched_set_rt() - make a process real-time, or not
+**
+** @param pcb       The process, which must not be on the ready queue
+** @param runtime   CPU time wanted in each period
+** @param period    Length of a period
+** @param deadline  When the CPU time is wanted by (0 for the period)
+**
+** @return E_SUCCESS, E_BAD_PARAM, or E_OVERLOAD if the CPU can't
+**         promise that much time
+*/
+status_t _sched_set_rt( pcb_t *pcb, uint32_t runtime, uint32_t period,
+                        uint32_t deadline ) {
+    runq_t *rq = RQ_OF(pcb);
+
+    assert1( pcb != NULL && pcb->state != Ready );
+
+    // back to being an ordinary process
+    if( runtime == 0 ) {
+        rq->rt_util -= pcb->rt.util;
+        __memclr( &pcb->rt, sizeof(rt_t) );
+        return( E_SUCCESS );
+    }
+
+    if( deadline == 0 ) {
+        deadline = period;
+    }
+    if( runtime > deadline || deadline > period || period > RT_MAX_PERIOD ) {
+        return( E_BAD_PARAM );
+    }
+
+    // EDF can keep every promise as long as they don't add up to more
+    // than the whole CPU; we keep some back for everyone else
+    uint32_t util = (runtime * 1000 + deadline - 1) / deadline;
+    if( rq->rt_util - pcb->rt.util + util > RT_MAX_UTIL ) {
+        return( E_OVERLOAD );
+    }
+    rq->rt_util += util - pcb->rt.util;
+
+    // its first period starts now
+    pcb->rt.runtime = runtime;
+    pcb->rt.period = period;
+    pcb->rt.deadline = deadline;
+    pcb->rt.util = util;
+    pcb->rt.release = _system_time;
+    pcb->rt.due = _system_time + deadline;
+    pcb->rt.budget = runtime;
+
+    return( E_SUCCESS );
+}
+
+/**
+** _sched_rt_tick() - enforce real-time budgets and deadlines
+**
+** Called from the clock ISR on every tick.
+**
+** @return true if the current process has lost the CPU
+*/
+bool_t _sched_rt_tick( void ) {
+    runq_t *rq = RQ_HERE;
+    pcb_t *curr = _current;
+
+    // ready processes whose deadlines have passed missed them
+    while( rq->edf_head != NULL && rq->edf_head->rt.due <= _system_time ) {
+        pcb_t *pcb = rq->edf_head;
+        _rq_del( pcb );
+        ++pcb->rt.misses;
+        ++rq->rt_misses;
+        _rt_throttle( pcb );
+    }
+
+    // the current process uses up its budget, or runs out of time
+    if( IS_RT(curr) ) {
+        if( curr->rt.budget > 0 ) {
+            --curr->rt.budget;
+        }
+        if( curr->rt.budget == 0 || curr->rt.due <= _system_time ) {
+            if( curr->rt.budget > 0 ) {
+                ++curr->rt.misses;
+                ++rq->rt_misses;
+            }
+            _rq_stop( rq );
+            _rt_throttle( curr );
+            return( true );
+        }
+    }
+
+    // anything real-time comes before anything else, and an earlier
+    // deadline before a later one
+    if( rq->edf_head != NULL &&
+            (!IS_RT(curr) || rq->edf_head->rt.due < curr->rt.due) ) {
+        _schedule( curr );
+        return( true );
+    }
+
+    return( false );
+}
+
+/**
+** _sched_set_fair() - choose the scheduling class
+**
+** Processes already on the ready queue are moved over.
+**
+** @param fair  true for the fair class, false for the MLFQ
+*/
+void _sched_set_fair( bool_t fair ) {
+
+    if( fair == _sched_fair ) {
+        return;
+    }
+
+    // take everything off the old queue...
+    for( int i = 0; i < N_PROCS; ++i ) {
+        if( _processes[i] != NULL && _processes[i]->state == Ready ) {
+            _rq_del( _processes[i] );
+        }
+    }
+
+    _sched_fair = fair;
+
+    // ...and put it on the new one; the fair class uses the base
+    // priorities, and everyone starts out even
+    for( int i = 0; i < N_PROCS; ++i ) {
+        pcb_t *pcb = _processes[i];
+        if( pcb == NULL ) {
+            continue;
+        }
+        if( fair ) {
+            pcb->priority = pcb->base;
+            pcb->vruntime = RQ_OF(pcb)->cfs_min;
+        }
+        if( pcb->state == Ready ) {
+            _rq_add( pcb );
+        }
+    }
+}
+
+/**
+** _sched_expired() - note that a process used up its time slice
+**
+** It is moved down a level, and will get a longer slice next time.
+**
+** @param pcb   The process
+*/
+void _sched_expired( pcb_t *pcb ) {
+
+    // priorities don't change in the fair class
+    if( _sched_fair ) {
+        return;
+    }
+
+    // the last level above Deferred is as low as anything else goes
+    if( pcb->base != Deferred && pcb->priority < Deferred - 1 ) {
+        ++pcb->priority;
+    }
+}
+
+/**
+** _sched_blocked() - note that a process blocked before its time
+**                    slice was used up
+**
+** It is moved up a level, but not above its base priority.
+**
+** @param pcb   The process
+*/
+void _sched_blocked( pcb_t *pcb ) {
+
+    if( !_sched_fair && pcb->priority > pcb->base ) {
+        --pcb->priority;
+    }
+}
+
+/**
+** _sched_age() - move processes which have waited too long up a level
+**
+** Only this CPU's queue is aged; each CPU does its own.  The levels
+** are done from the top down, so nothing moves twice.
+*/
+void _sched_age( void ) {
+    runq_t *rq = RQ_HERE;
+
+    // level 0 can't go any higher, and Deferred doesn't age
+    uint32_t map = rq->map & ~(1 | (1 << Deferred));
+
+    while( map != 0 ) {
+        uint32_t n = _rq_first( map );
+        map &= ~(1 << n);
+
+        pcb_t *pcb = rq->level[n].head;
+        while( pcb != NULL ) {
+            pcb_t *next = pcb->rq_next;
+
+            // each level is FIFO, so the rest waited less than this one
+            if( _system_time - pcb->rq_time < AGE_WAIT ) {
+                break;
+            }
+
+            _rq_unlink( rq, pcb );
+            --pcb->priority;
+            _rq_link( rq, pcb );
 
-    // failure is not an option!
-    assert( status == E_SUCCESS );
+            pcb = next;
+        }
+    }
+}
+
+/**
+** _sched_length() - number of processes ready at a priority level
+**
+** @param prio  The priority level
+**
+** @return the number of processes
+*/
+uint32_t _sched_length( prio_t prio ) {
+    uint32_t count = 0;
+
+    assert1( prio < N_PRIOS );
+    for( uint32_t n = 0; n < _n_cpus; ++n ) {
+        count += _rqs[n].level[prio].count;
+    }
+
+    return( count );
+}
+
+/**
+** _rq_dump() - dump one CPU's ready queue to the console
+**
+** @param rq    The ready queue
+*/
+static void _rq_dump( runq_t *rq ) {
+
+    if( rq->edf_count > 0 || rq->rt_util > 0 ) {
+        __cio_printf( " rt: %d util %d/1000 misses %d\n",
+                      rq->edf_count, rq->rt_util, rq->rt_misses );
+        pcb_t *pcb = rq->edf_head;
+        for( int i = 0; i < 5 && pcb != NULL; ++i, pcb = pcb->rq_next ) {
+            __cio_printf( "  [%d] due %d budget %d misses %d\n", pcb->pid,
+                          pcb->rt.due, pcb->rt.budget, pcb->rt.misses );
+        }
+    }
+
+    if( _sched_fair ) {
+        __cio_printf( " fair: %d weight %d min %08x%08x\n", rq->cfs_count,
+                      rq->cfs_weight, (uint32_t) (rq->cfs_min >> 32),
+                      (uint32_t) rq->cfs_min );
+        for( uint32_t i = 0; i < 5 && i < rq->cfs_count; ++i ) {
+            pcb_t *pcb = rq->cfs_heap[i];
+            __cio_printf( "  [%d] %08x%08x\n", pcb->pid,
+                          (uint32_t) (pcb->vruntime >> 32),
+                          (uint32_t) pcb->vruntime );
+        }
+    }
+
+    for( uint32_t n = 0; n < N_PRIOS; ++n ) {
+        if( rq->level[n].count == 0 ) {
+            continue;
+        }
+
+        __cio_printf( " [%d] %d:", n, rq->level[n].count );
+
+        // dump the first few PIDs
+        pcb_t *pcb = rq->level[n].head;
+        for( int i = 0; i < 5 && pcb != NULL; ++i, pcb = pcb->rq_next ) {
+            __cio_printf( " %d", pcb->pid );
+        }
+
+        if( pcb != NULL ) {
+            __cio_puts( " ..." );
+        }
+
+        __cio_putchar( '\n' );
+    }
+}
+
+/**
+** _sched_dump() - dump the ready queue to the console
+**
+** Only the non-empty levels are shown.  With more than one CPU, each
+** CPU's queue is shown separately.
+**
+** @param msg  Optional message to print
+*/
+void _sched_dump( const char *msg ) {
+
+    if( _n_cpus == 1 ) {
+        __cio_printf( "%s: map %08x\n", msg, _rqs[0].map );
+        _rq_dump( &_rqs[0] );
+        return;
+    }
+
+    __cio_printf( "%s:\n", msg );
+    for( uint32_t n = 0; n < _n_cpus; ++n ) {
+        runq_t *rq = &_rqs[n];
+        __cio_printf( "cpu %d: map %08x ready %d stolen %d\n", n, rq->map,
+                      rq->count, rq->steals );
+        _rq_dump( rq );
+    }
 }
 
 /**
 ** _dispatch() - select a new "current" process
 **
-** Selects the highest-priority process available
+** Selects the highest-priority process available on this CPU's
+** ready queue, after taking one from another CPU if this one has
+** nothing better than Deferred processes to run
 */
 void _dispatch( void ) {
+    runq_t *rq = RQ_HERE;
     pcb_t *pcb;
-    int n;
-    
+    uint32_t slice = 0;
+
+    // charge whatever was running (if it didn't go back on the queue)
+    _rq_stop( rq );
+
+    if( _n_cpus > 1 && rq->edf_head == NULL && rq->cfs_count == 0 &&
+            (rq->map & ~(1 << Deferred)) == 0 ) {
+        _rq_steal( rq );
+    }
+
     do {
 
-        // find a ready queue that has an available process
-        for( n = 0; n < N_PRIOS; ++n ) {
-            if( _queue_length(_ready[n]) > 0 ) {
-                break;
+        if( rq->edf_head != NULL ) {
+
+            // real-time processes go first, earliest deadline first;
+            // the clock takes them off when their budgets run out
+            pcb = rq->edf_head;
+            _edf_delete( rq, pcb );
+            slice = pcb->rt.budget < 255 ? pcb->rt.budget : 255;
+
+        } else if( rq->cfs_count > 0 ) {
+
+            // then the fair class, least virtual runtime first;
+            // its slice is its share of the latency
+            pcb = rq->cfs_heap[0];
+            slice = FAIR_LATENCY * _weights[pcb->base] / rq->cfs_weight;
+            if( slice < FAIR_MIN_SLICE ) {
+                slice = FAIR_MIN_SLICE;
             }
-        }
+            if( pcb->vruntime > rq->cfs_min ) {
+                rq->cfs_min = pcb->vruntime;
+            }
+            _cfs_delete( rq, pcb );
+
+        } else if( rq->map != 0 ) {
 
-        // this should never happen - if nothing else, the
-        // idle process should be on the "Deferred" queue
-        assert( n < N_PRIOS );
+            // pull the first process from the highest non-empty level
+            pcb = rq->level[_rq_first(rq->map)].head;
+            _rq_unlink( rq, pcb );
+            slice = _quanta[pcb->priority];
 
-        // OK, we found a queue; pull the first process from it
-        status_t status = _queue_remove( _ready[n], (void **) &pcb );
+        } else {
 
-        // failure to deque means something serious has gone wrong
-        assert( status == E_SUCCESS );
+            // this should never happen with one CPU - the idle
+            // process should be on the "Deferred" level; with more,
+            // every CPU has an idle process of its own
+            assert( rq->idle != NULL );
+            pcb = rq->idle;
+            slice = 1;
+            break;
+        }
+
+        --rq->count;
+
+        // a process whose stack can't take an interrupt can't run
+        // (there's no memory to give it one)
+        if( pcb->state != Killed && !_stk_ready(pcb) ) {
+            pcb->state = Killed;
+            pcb->exit_status = E_NO_MEM;
+        }
 
         // if this process has been terminated, clean it up, then
         // loop and pick another process; otherwise, leave the loop
@@ -139,8 +1078,15 @@ void _dispatch( void ) {
 
     // set its state and remaining quantum
     pcb->state = Running;
+    pcb->quantum = slice;
     pcb->ticks = pcb->quantum;
 
+    // start its clock (the idle process doesn't have one)
+    if( pcb != rq->idle ) {
+        rq->run_pcb = pcb;
+        rq->run_start = _rdtsc();
+    }
+
     // make this the current process
     _current = pcb;
     set_page_directory(_current->pg_dir);
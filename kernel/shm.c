@@ -0,0 +1,255 @@
+/**
+** @file shm.c
+**
+** @author CSCI-452 class of 20215
+**
+** Shared memory segment module implementation
+**
+** A segment is a set of frames which every process mapping it sees at
+** once, so processes can pass data through it without copying it
+** through the kernel.  Processes agree on a key; shm_create() with
+** that key gives each of them the same segment, which shm_map() maps
+** as a VM area.  Its pages are mapped shared (MAP_SHARED), so they are
+** not made copy-on-write by fork().  A segment lasts until the last
+** area mapping it goes away (through shm_unmap(), exec or exit) and no
+** process holds its handle any more (they are given up at exec or
+** exit), so one created but never mapped doesn't stay forever.
+*/
+
+#define SP_KERNEL_SRC
+
+#include "common.h"
+
+#include "shm.h"
+#include "phys_alloc.h"
+
+/*
+** PRIVATE DEFINITIONS
+*/
+
+/*
+** PRIVATE DATA TYPES
+*/
+
+/*
+** PRIVATE GLOBAL VARIABLES
+*/
+
+// the segments; a NULL frame array marks an unused entry
+static shm_t _shm_table[N_SHM];
+
+/*
+** PUBLIC GLOBAL VARIABLES
+*/
+
+/*
+** PRIVATE FUNCTIONS
+*/
+
+/**
+** _shm_destroy() - release a segment and its frames
+**
+** @param shm      The segment
+*/
+static void _shm_destroy( shm_t *shm ) {
+
+    for( uint32_t i = 0; i < shm->size / SZ_PAGE; ++i ) {
+        if( shm->frames[i] != 0 ) {
+            unref_frame( shm->frames[i] );
+        }
+    }
+
+    kfree( shm->frames );
+    __memclr( shm, sizeof(*shm) );
+}
+
+/*
+** PUBLIC FUNCTIONS
+*/
+
+/**
+** _shm_init() - initialize the shared memory module
+*/
+void _shm_init( void ) {
+
+    __cio_puts( " Shm:" );
+
+    __memclr( _shm_table, sizeof(_shm_table) );
+
+    __cio_puts( " done" );
+}
+
+/**
+** _shm_create() - find or create the segment with a key
+**
+** If there already is a segment with this key, it must be at least as
+** big as what is asked for.
+**
+** @param key      The segment's key
+** @param size     The size needed, in bytes
+** @param held     The caller's set of held handles, which gets this one
+**
+** @return the segment's handle, or an error code
+*/
+int _shm_create( uint32_t key, uint32_t size, uint32_t *held ) {
+    int free = -1;
+
+    if( size == 0 || size > SHM_MAX ) {
+        return( E_BAD_PARAM );
+    }
+
+    for( int i = 0; i < N_SHM; ++i ) {
+        shm_t *shm = &_shm_table[i];
+        if( shm->frames == NULL ) {
+            if( free < 0 ) {
+                free = i;
+            }
+        } else if( shm->key == key ) {
+            if( size > shm->size ) {
+                return( E_BAD_PARAM );
+            }
+            if( (*held & (1 << i)) == 0 ) {
+                *held |= 1 << i;
+                ++shm->holders;
+            }
+            return( i );
+        }
+    }
+
+    if( free < 0 ) {
+        return( E_NO_MEM );
+    }
+
+    shm_t *shm = &_shm_table[free];
+    uint32_t pages = (size + SZ_PAGE - 1) / SZ_PAGE;
+
+    shm->frames = (phys_addr *) kmalloc( pages * sizeof(phys_addr) );
+    if( shm->frames == NULL ) {
+        return( E_NO_MEM );
+    }
+    __memclr( shm->frames, pages * sizeof(phys_addr) );
+
+    shm->key = key;
+    shm->size = pages * SZ_PAGE;
+    shm->maps = 0;
+    shm->holders = 1;
+    *held |= 1 << free;
+
+    return( free );
+}
+
+/**
+** _shm_get() - find the segment for a handle
+**
+** @param handle   The handle
+**
+** @return the segment, or NULL
+*/
+shm_t *_shm_get( int handle ) {
+
+    if( handle < 0 || handle >= N_SHM || _shm_table[handle].frames == NULL ) {
+        return( NULL );
+    }
+
+    return( &_shm_table[handle] );
+}
+
+/**
+** _shm_dup() - note another process holding a set of handles
+**
+** @param held     The handles (one bit each)
+*/
+void _shm_dup( uint32_t held ) {
+
+    for( int i = 0; i < N_SHM; ++i ) {
+        if( held & (1 << i) ) {
+            ++_shm_table[i].holders;
+        }
+    }
+}
+
+/**
+** _shm_drop() - give up a set of handles
+**
+** @param held     The handles (one bit each); emptied
+*/
+void _shm_drop( uint32_t *held ) {
+
+    for( int i = 0; i < N_SHM; ++i ) {
+        shm_t *shm = &_shm_table[i];
+        if( (*held & (1 << i)) == 0 ) {
+            continue;
+        }
+        assert1( shm->holders > 0 );
+        if( --shm->holders == 0 && shm->maps == 0 ) {
+            _shm_destroy( shm );
+        }
+    }
+
+    *held = 0;
+}
+
+/**
+** _shm_hold() - note another area mapping a segment
+**
+** @param shm      The segment
+*/
+void _shm_hold( shm_t *shm ) {
+    ++shm->maps;
+}
+
+/**
+** _shm_release() - note an area no longer mapping a segment
+**
+** @param shm      The segment
+*/
+void _shm_release( shm_t *shm ) {
+    assert1( shm->maps > 0 );
+
+    if( --shm->maps == 0 && shm->holders == 0 ) {
+        _shm_destroy( shm );
+    }
+}
+
+/**
+** _shm_frame() - find the frame holding a page of a segment
+**
+** @param shm      The segment
+** @param index    Which page of the segment
+**
+** @return the frame, with a reference for the caller, or 0
+*/
+phys_addr _shm_frame( shm_t *shm, uint32_t index ) {
+    assert1( index < shm->size / SZ_PAGE );
+
+    if( shm->frames[index] == 0 ) {
+        shm->frames[index] = alloc_zeroed_frame();
+        if( shm->frames[index] == 0 ) {
+            return( 0 );
+        }
+    }
+
+    ref_frame( shm->frames[index] );
+    return( shm->frames[index] );
+}
+
+/**
+** _shm_dump() - print the segments on the console
+*/
+void _shm_dump( void ) {
+
+    for( int i = 0; i < N_SHM; ++i ) {
+        shm_t *shm = &_shm_table[i];
+        if( shm->frames == NULL ) {
+            continue;
+        }
+        uint32_t present = 0;
+        for( uint32_t j = 0; j < shm->size / SZ_PAGE; ++j ) {
+            if( shm->frames[j] != 0 ) {
+                ++present;
+            }
+        }
+        __cio_printf( "shm %2d: key %08x, %d bytes, %d pages present, %d maps, %d holders\n",
+                      i, shm->key, shm->size, present, shm->maps, shm->holders );
+    }
+}
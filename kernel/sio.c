@@ -62,6 +62,7 @@
 #include "process.h"
 #include "scheduler.h"
 #include "kernel.h"
+#include "vm.h"
 
 #include "lib.h"
 
@@ -164,9 +165,13 @@ static void _sio_isr( int vector, int ecode ) {
                 QDEQUE( READQ, pcb );
                 assert( pcb );
 
-                // return char via arg #2 and count in EAX
-                char *buf = (char *) ARG(pcb,2);
-                *buf = ch & 0xff;
+                // return char via arg #2 and count in EAX; the
+                // buffer is in the reader's address space, which
+                // may not be the current one, and may have been
+                // paged out since the read() call
+                char c = ch & 0xff;
+                (void) _vm_touch( pcb, ARG(pcb,2), 1, true );
+                (void) copy_to_pg_dir( pcb->pg_dir, ARG(pcb,2), &c, 1 );
                 RET(pcb) = 1;
                 SCHED( pcb );
 
@@ -0,0 +1,358 @@
+/**
+** @file slab.c
+**
+** @author CSCI-452 class of 20215
+**
+** Slab allocator implementation
+**
+** Each object cache hands out fixed-size objects of a single type.
+** The objects are carved from one-page "slabs" obtained from the kmem
+** page allocator.  A slab begins with a header describing it, followed
+** by an array of 16-bit free list links (one per object) and then the
+** objects themselves.  Keeping the free list outside the objects means
+** that a constructed object is never disturbed by being freed, so a
+** constructor only runs when its slab is created.
+**
+** Each cache keeps three lists of slabs:  those with some objects in
+** use ("partial"), those with every object in use ("full"), and those
+** with no objects in use ("empty").  Allocations are taken from a
+** partial slab when possible, so that slabs tend to fill up and others
+** become empty.  A cache holds onto at most SLAB_KEEP_EMPTY empty
+** slabs; beyond that, empty slabs go back to the page allocator, so
+** the memory used by a cache follows the number of live objects.
+*/
+
+#define SP_KERNEL_SRC
+
+#include "common.h"
+
+#include "slab.h"
+#include "kmem.h"
+
+/*
+** PRIVATE DEFINITIONS
+*/
+
+// end-of-list marker for the per-slab free lists
+#define SLAB_END    0xffff
+
+// the slab containing an object
+#define SLAB_OF(obj)    ((slab_t *) ((uint32_t) (obj) & ~(SZ_PAGE - 1)))
+
+/*
+** PRIVATE DATA TYPES
+*/
+
+// header at the beginning of every slab
+typedef struct slab_s {
+    struct slab_s *next;        // next slab on this list
+    struct slab_s *prev;        // previous slab on this list
+    struct slab_cache_s *cache; // the cache this slab belongs to
+    uint8_t *objs;              // the first object
+    uint16_t inuse;             // number of objects allocated
+    uint16_t free;              // index of the first free object
+    uint16_t link[];            // free list links, one per object
+} slab_t;
+
+// an object cache
+struct slab_cache_s {
+    const char *name;           // for debugging
+    uint32_t size;              // object size, rounded to a word
+    uint32_t per_slab;          // objects in each slab
+    uint32_t offset;            // offset of the first object in a slab
+    void (*ctor)(void *);       // object constructor, or NULL
+    slab_t *partial;            // slabs with some objects in use
+    slab_t *full;               // slabs with all objects in use
+    slab_t *empty;              // slabs with no objects in use
+    uint32_t n_slabs;           // total number of slabs
+    uint32_t n_empty;           // number of slabs on the empty list
+    uint32_t n_inuse;           // number of objects allocated
+};
+
+/*
+** PRIVATE GLOBAL VARIABLES
+*/
+
+// the caches themselves; a NULL name marks an unused entry
+static struct slab_cache_s _caches[N_SLAB_CACHES];
+
+/*
+** PRIVATE FUNCTIONS
+*/
+
+/**
+** _slab_link() - add a slab to the front of a list
+**
+** @param list   The list
+** @param s      The slab
+*/
+static void _slab_link( slab_t **list, slab_t *s ) {
+    s->prev = NULL;
+    s->next = *list;
+    if( *list != NULL ) {
+        (*list)->prev = s;
+    }
+    *list = s;
+}
+
+/**
+** _slab_unlink() - remove a slab from a list
+**
+** @param list   The list
+** @param s      The slab
+*/
+static void _slab_unlink( slab_t **list, slab_t *s ) {
+    if( s->prev != NULL ) {
+        s->prev->next = s->next;
+    } else {
+        *list = s->next;
+    }
+    if( s->next != NULL ) {
+        s->next->prev = s->prev;
+    }
+    s->next = s->prev = NULL;
+}
+
+/**
+** _slab_grow() - add a new, empty slab to a cache
+**
+** @param c   The cache
+**
+** @return the new slab, or NULL
+*/
+static slab_t *_slab_grow( struct slab_cache_s *c ) {
+
+    void *page = _km_page_alloc( 1 );
+    if( page == NULL ) {
+        return( NULL );
+    }
+
+    __memclr( page, SZ_PAGE );
+
+    slab_t *s = (slab_t *) page;
+    s->cache = c;
+    s->objs = (uint8_t *) page + c->offset;
+    s->inuse = 0;
+    s->free = 0;
+
+    // chain the objects together and construct them
+    for( uint32_t i = 0; i < c->per_slab; ++i ) {
+        s->link[i] = (i + 1 < c->per_slab) ? i + 1 : SLAB_END;
+        if( c->ctor != NULL ) {
+            c->ctor( s->objs + i * c->size );
+        }
+    }
+
+    _slab_link( &c->empty, s );
+    ++c->n_slabs;
+    ++c->n_empty;
+
+    return( s );
+}
+
+/**
+** _slab_release() - give an empty slab back to the page allocator
+**
+** @param c   The cache
+** @param s   The slab, which must be on the empty list
+*/
+static void _slab_release( struct slab_cache_s *c, slab_t *s ) {
+    assert1( s->inuse == 0 );
+
+    _slab_unlink( &c->empty, s );
+    --c->n_slabs;
+    --c->n_empty;
+
+    _km_page_free( (void *) s );
+}
+
+/*
+** PUBLIC FUNCTIONS
+*/
+
+/**
+** _slab_create() - create an object cache
+**
+** @param name   Name of the cache (for debugging)
+** @param size   Size of each object, in bytes
+** @param ctor   Object constructor, or NULL
+**
+** @return the new cache, or NULL
+*/
+slab_cache_t _slab_create( const char *name, uint32_t size,
+                           void (*ctor)(void *) ) {
+    struct slab_cache_s *c = NULL;
+
+    assert( name != NULL );
+
+    for( int i = 0; i < N_SLAB_CACHES; ++i ) {
+        if( _caches[i].name == NULL ) {
+            c = &_caches[i];
+            break;
+        }
+    }
+
+    if( c == NULL ) {
+        WARNING( "no free slab caches" );
+        return( NULL );
+    }
+
+    // keep objects word-aligned
+    size = (size + sizeof(uint32_t) - 1) & MOD4_MASK;
+    if( size == 0 ) {
+        size = sizeof(uint32_t);
+    }
+
+    // figure out how many objects (and their links) fit in a page
+    uint32_t n = (SZ_PAGE - sizeof(slab_t)) / (size + sizeof(uint16_t));
+    uint32_t offset = 0;
+    while( n > 0 ) {
+        offset = (sizeof(slab_t) + n * sizeof(uint16_t) + 3) & MOD4_MASK;
+        if( offset + n * size <= SZ_PAGE && n < SLAB_END ) {
+            break;
+        }
+        --n;
+    }
+
+    if( n == 0 ) {
+        WARNING( "slab object too large" );
+        return( NULL );
+    }
+
+    __memclr( c, sizeof(*c) );
+    c->name = name;
+    c->size = size;
+    c->per_slab = n;
+    c->offset = offset;
+    c->ctor = ctor;
+
+    return( c );
+}
+
+/**
+** _slab_alloc() - allocate an object from a cache
+**
+** @param cache  The cache to allocate from
+**
+** @return a pointer to the object, or NULL
+*/
+void *_slab_alloc( slab_cache_t cache ) {
+    struct slab_cache_s *c = cache;
+    slab_t *s;
+
+    assert1( c != NULL );
+
+    // prefer a partially-used slab; failing that, an empty one
+    if( c->partial != NULL ) {
+        s = c->partial;
+    } else {
+        if( c->empty == NULL && _slab_grow(c) == NULL ) {
+            return( NULL );
+        }
+        s = c->empty;
+        _slab_unlink( &c->empty, s );
+        --c->n_empty;
+        _slab_link( &c->partial, s );
+    }
+
+    // take the first free object
+    uint16_t i = s->free;
+    assert1( i != SLAB_END );
+    s->free = s->link[i];
+    ++s->inuse;
+    ++c->n_inuse;
+
+    if( s->inuse == c->per_slab ) {
+        _slab_unlink( &c->partial, s );
+        _slab_link( &c->full, s );
+    }
+
+    return( (void *) (s->objs + i * c->size) );
+}
+
+/**
+** _slab_free() - return an object to its cache
+**
+** @param cache  The cache the object came from
+** @param obj    The object
+*/
+void _slab_free( slab_cache_t cache, void *obj ) {
+    struct slab_cache_s *c = cache;
+
+    if( obj == NULL ) {
+        return;
+    }
+
+    slab_t *s = SLAB_OF( obj );
+    assert( s->cache == c );
+
+    uint32_t i = ((uint8_t *) obj - s->objs) / c->size;
+    assert1( s->objs + i * c->size == (uint8_t *) obj );
+
+    // a full slab is about to become partial
+    if( s->inuse == c->per_slab ) {
+        _slab_unlink( &c->full, s );
+        _slab_link( &c->partial, s );
+    }
+
+    s->link[i] = s->free;
+    s->free = i;
+    --s->inuse;
+    --c->n_inuse;
+
+    // a partial slab may have become empty
+    if( s->inuse == 0 ) {
+        _slab_unlink( &c->partial, s );
+        _slab_link( &c->empty, s );
+        ++c->n_empty;
+        if( c->n_empty > SLAB_KEEP_EMPTY ) {
+            _slab_release( c, s );
+        }
+    }
+}
+
+/**
+** _slab_cache_of() - find the cache an object belongs to
+**
+** @param obj    The object
+**
+** @return the cache it was allocated from
+*/
+slab_cache_t _slab_cache_of( void *obj ) {
+    return( SLAB_OF(obj)->cache );
+}
+
+/**
+** _slab_reap() - release every empty slab in every cache
+**
+** @return the number of pages returned to the page allocator
+*/
+uint32_t _slab_reap( void ) {
+    uint32_t pages = 0;
+
+    for( int i = 0; i < N_SLAB_CACHES; ++i ) {
+        struct slab_cache_s *c = &_caches[i];
+        while( c->name != NULL && c->empty != NULL ) {
+            _slab_release( c, c->empty );
+            ++pages;
+        }
+    }
+
+    return( pages );
+}
+
+/**
+** _slab_dump() - dump the state of every cache to the console
+*/
+void _slab_dump( void ) {
+
+    for( int i = 0; i < N_SLAB_CACHES; ++i ) {
+        struct slab_cache_s *c = &_caches[i];
+        if( c->name == NULL ) {
+            continue;
+        }
+        __cio_printf( "%-12s size %4d x %3d: %d slabs (%d empty), %d in use\n",
+                      c->name, c->size, c->per_slab,
+                      c->n_slabs, c->n_empty, c->n_inuse );
+    }
+}
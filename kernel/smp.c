@@ -0,0 +1,665 @@
+/**
+** @file smp.c
+**
+** @author CSCI-452 class of 20215
+**
+** Multiprocessor support
+**
+** The other CPUs (the "application processors") are found in the MP
+** configuration table the BIOS leaves in low memory, and started with
+** the INIT / start-up IPI sequence through the local APICs; each one
+** begins in real mode at AP_BOOT_ADDRESS (see smp_boot.S).
+**
+** Only one CPU at a time runs the kernel.  Every way into the kernel
+** (isr_stubs.S, and the page fault task) takes the kernel lock, and
+** the way out releases it, so the process table, the queues, and the
+** allocators need no locks of their own.  The bootstrap CPU holds the
+** lock from the start, and first lets it go when it dispatches init.
+** While a CPU holds the lock, _cpu is that CPU and _current is its
+** current process, so most of the kernel doesn't need to know there
+** is more than one.
+**
+** Each CPU has its own system stack, page fault task, IDT, ready
+** queue (see scheduler.c), and idle process.  The devices (and the
+** PIT) still interrupt only the bootstrap CPU; the others get their
+** clock ticks from their local APIC timers, which are set to tick at
+** the same rate.
+**
+** Kernel mappings are global, and only the CPU holding the lock can
+** change them; instead of interrupting the others to flush their
+** TLBs, each CPU catches up the next time it enters the kernel (see
+** _paging_enter).  A CPU only ever runs with its own process' page
+** directory loaded, and user pages are only changed for the current
+** process or for processes which aren't running.
+*/
+
+#define SP_KERNEL_SRC
+
+#include "common.h"
+
+#include "x86arch.h"
+#include "x86pit.h"
+
+#include "bootstrap.h"
+#include "smp.h"
+#include "support.h"
+#include "clock.h"
+#include "kmem.h"
+#include "process.h"
+#include "scheduler.h"
+#include "stacks.h"
+#include "paging.h"
+
+/*
+** PRIVATE DEFINITIONS
+*/
+
+// MP table signatures ("_MP_" and "PCMP")
+#define MP_FLOAT_SIG    0x5f504d5f
+#define MP_CONFIG_SIG   0x504d4350
+
+// MP configuration table entries
+#define MP_PROC         0       // a processor (the only 20-byte entry)
+#define MP_PROC_ENABLED 0x01
+#define MP_PROC_LEN     20
+#define MP_ENTRY_LEN    8
+
+// where the BIOS keeps the segment of its extended data area
+#define BIOS_EBDA_SEG   0x40e
+
+// local APIC registers (byte offsets)
+#define LAPIC_TPR       0x080
+#define LAPIC_EOI       0x0b0
+#define LAPIC_SVR       0x0f0
+#define LAPIC_ICR_LO    0x300
+#define LAPIC_ICR_HI    0x310
+#define LAPIC_TIMER     0x320
+#define LAPIC_LINT0     0x350
+#define LAPIC_LINT1     0x360
+#define LAPIC_TICR      0x380
+#define LAPIC_TCCR      0x390
+#define LAPIC_TDCR      0x3e0
+
+// ... and their bits
+#define LAPIC_SVR_ENABLE        0x00000100
+#define LAPIC_ICR_PENDING       0x00001000
+#define LAPIC_ICR_INIT          0x00004500      // INIT, asserted
+#define LAPIC_ICR_SIPI          0x00004600      // start-up, asserted
+#define LAPIC_LVT_MASKED        0x00010000
+#define LAPIC_TIMER_PERIODIC    0x00020000
+#define LAPIC_TDCR_DIV16        0x3
+
+// access to a local APIC register
+#define LAPIC(reg)      (_lapic[(reg) / sizeof(uint32_t)])
+
+// the PIT channel 2 gate and output, in the keyboard controller
+#define PIT_GATE_PORT   0x61
+#define PIT_GATE_2      0x01
+#define PIT_SPEAKER     0x02
+#define PIT_OUT_2       0x20
+
+/*
+** PRIVATE DATA TYPES
+*/
+
+// the MP floating pointer structure
+typedef struct mp_float_s {
+    uint32_t signature;     // MP_FLOAT_SIG
+    uint32_t config;        // where the configuration table is
+    uint8_t length;         // in 16-byte units
+    uint8_t version;
+    uint8_t checksum;       // all bytes add up to 0
+    uint8_t features[5];    // a default configuration if features[0]
+} mp_float_t;
+
+// the header of the MP configuration table
+typedef struct mp_config_s {
+    uint32_t signature;     // MP_CONFIG_SIG
+    uint16_t length;        // including the entries
+    uint8_t version;
+    uint8_t checksum;       // all bytes add up to 0
+    char oem[8];
+    char product[12];
+    uint32_t oem_table;
+    uint16_t oem_length;
+    uint16_t entries;       // how many follow the header
+    uint32_t lapic;         // where the local APICs are
+    uint16_t ext_length;
+    uint8_t ext_checksum;
+    uint8_t reserved;
+} mp_config_t;
+
+// a processor entry
+typedef struct mp_proc_s {
+    uint8_t type;           // MP_PROC
+    uint8_t apic_id;
+    uint8_t apic_version;
+    uint8_t flags;          // MP_PROC_ENABLED, etc.
+    uint32_t signature;
+    uint32_t features;
+    uint32_t reserved[2];
+} mp_proc_t;
+
+/*
+** PRIVATE GLOBAL VARIABLES
+*/
+
+// the kernel lock:  the holder's id plus one (0 when free), and how
+// many times over it holds it; the bootstrap CPU starts out holding it
+static volatile uint32_t _klock = 1;
+static uint32_t _klock_depth = 1;
+
+// local APIC timer count for one clock tick
+static uint32_t _lapic_count;
+
+// the AP start-up code, and its parameters (see smp_boot.S)
+extern char __ap_boot[], __ap_boot_end[];
+extern uint32_t __ap_boot_cr3, __ap_boot_esp, __ap_boot_cpu;
+
+/*
+** PUBLIC GLOBAL VARIABLES
+*/
+
+// every CPU, and how many of them are running
+cpu_t _cpus[N_CPUS];
+uint32_t _n_cpus = 1;
+
+// the CPU running the kernel
+cpu_t *_cpu = &_cpus[0];
+
+// CPUs by local APIC ID
+cpu_t *_cpu_map[256];
+
+// local APIC registers, or NULL if only one CPU is in use
+volatile uint32_t *_lapic;
+
+/*
+** PRIVATE FUNCTIONS
+*/
+
+/**
+** _mp_sum() - add up the bytes of an MP table structure
+**
+** @param buf   The structure
+** @param len   Its length
+**
+** @return the (8-bit) sum, which is 0 if the structure is good
+*/
+static uint8_t _mp_sum( const uint8_t *buf, uint32_t len ) {
+    uint8_t sum = 0;
+
+    while( len-- > 0 ) {
+        sum += *buf++;
+    }
+
+    return( sum );
+}
+
+/**
+** _mp_scan() - look for the MP floating pointer in part of memory
+**
+** @param base  Where to start (16-byte aligned)
+** @param len   How far to look
+**
+** @return the floating pointer structure, or NULL
+*/
+static mp_float_t *_mp_scan( uint32_t base, uint32_t len ) {
+
+    for( uint32_t addr = base; addr < base + len; addr += 16 ) {
+        mp_float_t *mp = (mp_float_t *) addr;
+        if( mp->signature == MP_FLOAT_SIG && mp->length > 0 &&
+                _mp_sum( (uint8_t *) mp, mp->length * 16 ) == 0 ) {
+            return( mp );
+        }
+    }
+
+    return( NULL );
+}
+
+/**
+** _mp_config() - find the MP configuration table
+**
+** The floating pointer is in the first KB of the BIOS extended data
+** area, the last KB of base memory, or the BIOS ROM.
+**
+** @return the configuration table, or NULL if there isn't a usable one
+*/
+static mp_config_t *_mp_config( void ) {
+    uint32_t ebda = *(uint16_t *) BIOS_EBDA_SEG << 4;
+    mp_float_t *mp = NULL;
+
+    if( ebda != 0 ) {
+        mp = _mp_scan( ebda, 1024 );
+    }
+    if( mp == NULL ) {
+        mp = _mp_scan( 0x9fc00, 1024 );
+    }
+    if( mp == NULL ) {
+        mp = _mp_scan( 0xf0000, 0x10000 );
+    }
+
+    // a default configuration means just the one processor we know
+    // about; the table has to be where we can read it
+    if( mp == NULL || mp->features[0] != 0 || mp->config == 0 ||
+            mp->config >= IDENT_MAP_LIMIT ) {
+        return( NULL );
+    }
+
+    mp_config_t *cfg = (mp_config_t *) mp->config;
+    if( cfg->signature != MP_CONFIG_SIG ||
+            _mp_sum( (uint8_t *) cfg, cfg->length ) != 0 ) {
+        return( NULL );
+    }
+
+    return( cfg );
+}
+
+/**
+** _klock_try() - try to take the kernel lock
+**
+** @param mine  The value which marks it as ours
+**
+** @return true if we got it
+*/
+static inline bool_t _klock_try( uint32_t mine ) {
+    uint32_t old;
+
+    __asm__ __volatile__( "lock cmpxchgl %2, %1"
+        : "=a" (old), "+m" (_klock)
+        : "r" (mine), "0" (0)
+        : "memory" );
+
+    return( old == 0 );
+}
+
+/**
+** _pit_wait() - busy-wait, timed by PIT channel 2
+**
+** Used before the local APIC timers are running, with interrupts off.
+**
+** @param usec  How long, in microseconds (at most about 50000)
+*/
+static void _pit_wait( uint32_t usec ) {
+    uint32_t count = (TIMER_FREQUENCY / 1000) * usec / 1000;
+
+    // gate the channel on (with the speaker off), and count down once
+    __outb( PIT_GATE_PORT,
+            (__inb(PIT_GATE_PORT) & ~PIT_SPEAKER) | PIT_GATE_2 );
+    __outb( TIMER_CONTROL_PORT, TIMER_2_SELECT | TIMER_2_READ | TIMER_MODE_0 );
+    __outb( TIMER_2_PORT, count & 0xff );
+    __outb( TIMER_2_PORT, (count >> 8) & 0xff );
+
+    while( (__inb(PIT_GATE_PORT) & PIT_OUT_2) == 0 ) {
+        ;
+    }
+}
+
+/**
+** _lapic_ipi() - send an interprocessor interrupt
+**
+** @param apic_id   Local APIC ID of the CPU to send it to
+** @param cmd       The low word of the ICR
+*/
+static void _lapic_ipi( uint32_t apic_id, uint32_t cmd ) {
+
+    LAPIC(LAPIC_ICR_HI) = apic_id << LAPIC_ID_SHIFT;
+    LAPIC(LAPIC_ICR_LO) = cmd;
+
+    while( (LAPIC(LAPIC_ICR_LO) & LAPIC_ICR_PENDING) != 0 ) {
+        ;
+    }
+}
+
+/**
+** _lapic_calibrate() - find the local APIC timer count for a tick
+**
+** Counts down from the top for 10ms, as timed by the PIT.  The timers
+** all run at the same rate, so the bootstrap CPU does this for all.
+*/
+static void _lapic_calibrate( void ) {
+
+    LAPIC(LAPIC_TDCR) = LAPIC_TDCR_DIV16;
+    LAPIC(LAPIC_TIMER) = LAPIC_LVT_MASKED;
+    LAPIC(LAPIC_TICR) = 0xffffffff;
+    _pit_wait( 10000 );
+    uint32_t used = 0xffffffff - LAPIC(LAPIC_TCCR);
+    LAPIC(LAPIC_TICR) = 0;
+
+    _lapic_count = used * 100 / CLOCK_FREQUENCY;
+    if( _lapic_count == 0 ) {
+        _lapic_count = 1;
+    }
+}
+
+/**
+** _lapic_timer_isr() - clock tick on an application processor
+**
+** @param vector    Vector number for the interrupt
+** @param code      Error code (0 for this interrupt)
+*/
+static void _lapic_timer_isr( int vector, int code ) {
+
+    _clk_tick();
+    LAPIC(LAPIC_EOI) = 0;
+}
+
+/**
+** _lapic_spurious_isr() - a local APIC interrupt which went away
+**
+** These need no EOI.
+**
+** @param vector    Vector number for the interrupt
+** @param code      Error code (0 for this interrupt)
+*/
+static void _lapic_spurious_isr( int vector, int code ) {
+}
+
+/**
+** _smp_idle() - what a CPU does when there's nothing to do
+*/
+static void _smp_idle( void ) {
+
+    for( ;; ) {
+        __asm__ __volatile__( "hlt" );
+    }
+}
+
+/**
+** _smp_idle_pcb() - create a CPU's idle process
+**
+** It runs in the kernel's address space, on a stack of its own, and
+** is known only to the scheduler (it isn't in the process table).
+**
+** @param id    The CPU
+**
+** @return the idle process
+*/
+static pcb_t *_smp_idle_pcb( uint32_t id ) {
+    pcb_t *pcb = _pcb_alloc();
+    stack_t *stk = _stk_alloc();
+
+    if( pcb == NULL || stk == NULL ) {
+        PANIC( 0, "no memory for an idle process" );
+    }
+
+    pcb->stack = stk;
+    pcb->pg_dir = get_kernel_pg_dir();
+    pcb->priority = pcb->base = Deferred;
+    pcb->state = Ready;
+    pcb->cpu = id;
+
+    // dispatching it "returns" to the top of _smp_idle()
+    context_t *ct = ((context_t *) (stk + 1)) - 1;
+    ct->eflags = DEFAULT_EFLAGS;
+    ct->eip = (uint32_t) _smp_idle;
+    ct->cs = GDT_CODE;
+    ct->ss = GDT_STACK;
+    ct->ds = ct->es = ct->fs = ct->gs = GDT_DATA;
+    pcb->context = ct;
+
+    _sched_cpu_init( id, pcb );
+
+    return( pcb );
+}
+
+/**
+** _smp_start() - start an application processor
+**
+** The processor gets INIT, then up to two start-up IPIs, as the MP
+** specification asks.
+**
+** @param cpu   The CPU, with its system stack and current process set
+**
+** @return true if it started
+*/
+static bool_t _smp_start( cpu_t *cpu ) {
+
+    // its start-up code, and where it goes from there
+    __memcpy( (void *) AP_BOOT_ADDRESS, __ap_boot, __ap_boot_end - __ap_boot );
+    uint32_t *params = (uint32_t *) (AP_BOOT_ADDRESS +
+                                     ((char *) &__ap_boot_cr3 - __ap_boot));
+    params[0] = (uint32_t) &get_kernel_pg_dir()->entry;
+    params[1] = (uint32_t) cpu->system_esp;
+    params[2] = (uint32_t) cpu;
+
+    _lapic_ipi( cpu->apic_id, LAPIC_ICR_INIT );
+    _pit_wait( 10000 );
+
+    for( int i = 0; i < 2 && !cpu->started; ++i ) {
+        _lapic_ipi( cpu->apic_id, LAPIC_ICR_SIPI | (AP_BOOT_ADDRESS >> 12) );
+        _pit_wait( 200 );
+    }
+
+    // give it up to 100ms to get going
+    for( int i = 0; i < 10 && !cpu->started; ++i ) {
+        _pit_wait( 10000 );
+    }
+
+    return( cpu->started );
+}
+
+/*
+** PUBLIC FUNCTIONS
+*/
+
+/**
+** _smp_init() - find and start the other CPUs
+**
+** Uses the MP configuration table left by the BIOS.  With no table,
+** or only one usable CPU, nothing changes.
+**
+** Dependencies:
+**    Cannot be called before the paging, stack, scheduler, and
+**    process modules are initialized
+*/
+void _smp_init( void ) {
+    uint8_t ids[N_CPUS];
+    uint32_t n_ids = 0;
+
+    __cio_puts( " SMP:" );
+
+    // make a list of the other processors
+    mp_config_t *cfg = _mp_config();
+    if( cfg == NULL || cfg->lapic < USER_VIRT_LIMIT ) {
+        __cio_puts( " no MP table done" );
+        return;
+    }
+
+    uint8_t *entry = (uint8_t *) (cfg + 1);
+    for( uint32_t i = 0; i < cfg->entries; ++i ) {
+        mp_proc_t *proc = (mp_proc_t *) entry;
+        if( *entry != MP_PROC ) {
+            entry += MP_ENTRY_LEN;
+            continue;
+        }
+        if( (proc->flags & MP_PROC_ENABLED) != 0 && n_ids < N_CPUS ) {
+            ids[n_ids++] = proc->apic_id;
+        }
+        entry += MP_PROC_LEN;
+    }
+
+    if( n_ids < 2 ) {
+        __cio_puts( " 1 cpu done" );
+        return;
+    }
+
+    // we will need the local APICs
+    if( !map_range(get_kernel_pg_dir(), cfg->lapic, cfg->lapic, SZ_PAGE,
+                   MAP_WRITE | MAP_NOCACHE) ) {
+        __cio_puts( " no APIC done" );
+        return;
+    }
+    _lapic = (volatile uint32_t *) cfg->lapic;
+
+    // we are the bootstrap CPU; the PIC still interrupts us through
+    // LINT0, so our LVTs stay as the BIOS left them
+    cpu_t *bsp = &_cpus[0];
+    bsp->apic_id = LAPIC(LAPIC_ID) >> LAPIC_ID_SHIFT;
+    bsp->started = true;
+    _cpu_map[bsp->apic_id] = bsp;
+    LAPIC(LAPIC_TPR) = 0;
+    LAPIC(LAPIC_SVR) = LAPIC_SVR_ENABLE | INT_VEC_LAPIC_SPURIOUS;
+
+    _lapic_calibrate();
+    __install_isr( INT_VEC_LAPIC_TIMER, _lapic_timer_isr );
+    __install_isr( INT_VEC_LAPIC_SPURIOUS, _lapic_spurious_isr );
+
+    // start the rest, one at a time
+    for( uint32_t i = 0; i < n_ids && _n_cpus < N_CPUS; ++i ) {
+        if( ids[i] == bsp->apic_id ) {
+            continue;
+        }
+
+        cpu_t *cpu = &_cpus[_n_cpus];
+        cpu->id = _n_cpus;
+        cpu->apic_id = ids[i];
+        cpu->system_stack = _stk_alloc();
+        cpu->idt = _km_page_alloc( 1 );
+        if( cpu->system_stack == NULL || cpu->idt == NULL ) {
+            PANIC( 0, "no memory for another CPU" );
+        }
+        cpu->system_esp = ((uint32_t *) (cpu->system_stack + 1)) - 2;
+        __copy_idt( cpu->idt );
+        cpu->current = _smp_idle_pcb( cpu->id );
+        _cpu_map[cpu->apic_id] = cpu;
+
+        // one which doesn't start may start later, so it keeps its
+        // cpu_t, and we stop here
+        if( !_smp_start(cpu) ) {
+            __cio_printf( " (apic %d didn't start)", cpu->apic_id );
+            break;
+        }
+        ++_n_cpus;
+    }
+
+    if( _n_cpus == 1 ) {
+        _lapic = NULL;
+        __cio_puts( " 1 cpu done" );
+        return;
+    }
+
+    // the bootstrap CPU needs an idle process, too
+    _smp_idle_pcb( 0 );
+
+    __cio_printf( " %d cpus done", _n_cpus );
+}
+
+/**
+** _smp_cpu() - find the CPU we are running on
+**
+** @return its cpu_t
+*/
+cpu_t *_smp_cpu( void ) {
+
+    if( _lapic == NULL ) {
+        return( &_cpus[0] );
+    }
+
+    return( _cpu_map[LAPIC(LAPIC_ID) >> LAPIC_ID_SHIFT] );
+}
+
+/**
+** _smp_enter() - take the kernel lock
+**
+** Called on the way into the kernel (see isr_stubs.S).  A CPU which
+** already holds the lock just goes one level deeper.
+**
+** @param cpu   The CPU we are running on
+*/
+void _smp_enter( cpu_t *cpu ) {
+    uint32_t mine = cpu->id + 1;
+
+    if( _klock == mine ) {
+        ++_klock_depth;
+        return;
+    }
+
+    while( !_klock_try(mine) ) {
+        __asm__ __volatile__( "pause" );
+    }
+    _klock_depth = 1;
+
+    // the kernel is now running for this CPU
+    _cpu = cpu;
+    _current = cpu->current;
+    _paging_enter();
+}
+
+/**
+** _smp_leave() - release the kernel lock
+**
+** Called on the way out of the kernel (see isr_stubs.S).
+**
+** @return the process this CPU is going back to
+*/
+pcb_t *_smp_leave( void ) {
+    pcb_t *pcb = _current;
+
+    if( --_klock_depth == 0 ) {
+        _cpu->current = pcb;
+        // stores aren't reordered with other stores on x86, so only
+        // the compiler needs to be told
+        __asm__ __volatile__( "" ::: "memory" );
+        _klock = 0;
+    }
+
+    return( pcb );
+}
+
+/**
+** _smp_ap_main() - where an application processor goes once it has
+**                  paging and a stack (see smp_boot.S)
+**
+** @param cpu   The CPU
+*/
+void _smp_ap_main( cpu_t *cpu ) {
+
+    // the bootstrap CPU is waiting for this
+    cpu->started = true;
+
+    // and this waits for the bootstrap CPU to finish starting up
+    _smp_enter( cpu );
+
+    // its own page fault task and interrupt table
+    stack_t *pf_stack = _stk_alloc();
+    if( pf_stack == NULL ) {
+        PANIC( 0, "no memory for a page fault stack" );
+    }
+    _paging_cpu_init( (uint32_t *) (pf_stack + 1), cpu->idt );
+
+    struct {
+        uint16_t limit;
+        uint32_t base;
+    } __attribute__((packed)) idtr = { 256 * 8 - 1, (uint32_t) cpu->idt };
+    __asm__ __volatile__( "lidt %0" :: "m" (idtr) );
+
+    // its local APIC takes no interrupts from the PIC, and ticks
+    LAPIC(LAPIC_TPR) = 0;
+    LAPIC(LAPIC_SVR) = LAPIC_SVR_ENABLE | INT_VEC_LAPIC_SPURIOUS;
+    LAPIC(LAPIC_LINT0) = LAPIC_LVT_MASKED;
+    LAPIC(LAPIC_LINT1) = LAPIC_LVT_MASKED;
+    LAPIC(LAPIC_TDCR) = LAPIC_TDCR_DIV16;
+    LAPIC(LAPIC_TIMER) = LAPIC_TIMER_PERIODIC | INT_VEC_LAPIC_TIMER;
+    LAPIC(LAPIC_TICR) = _lapic_count;
+
+    // find it something to do
+    _dispatch();
+}
+
+/**
+** _smp_dump() - dump the CPUs to the console
+*/
+void _smp_dump( void ) {
+
+    if( _n_cpus == 1 ) {
+        return;
+    }
+
+    __cio_printf( "CPUs: %d, %d APIC counts/tick\n", _n_cpus, _lapic_count );
+    for( uint32_t n = 0; n < _n_cpus; ++n ) {
+        cpu_t *cpu = &_cpus[n];
+        pcb_t *curr = cpu == _cpu ? _current : cpu->current;
+        __cio_printf( " [%d] apic %d ticks %d pid %d\n", n, cpu->apic_id,
+                      cpu->ticks, curr != NULL ? curr->pid : 0 );
+    }
+}
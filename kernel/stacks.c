@@ -15,6 +15,8 @@
 #include "kernel.h"
 #include "scheduler.h"
 #include "paging.h"
+#include "vm.h"
+#include "smp.h"
 // also need the exit_helper() entry point
 void exit_helper( void );
 
@@ -22,6 +24,18 @@ void exit_helper( void );
 ** PRIVATE DEFINITIONS
 */
 
+// Kernel stacks live in a window in the kernel half of the address
+// space.  Each one has a slot of its own, with an unmapped guard page
+// below the stack itself, so running off the end of a stack faults
+// instead of trampling whatever is below it.
+#define STACK_WINDOW    0xdf000000
+#define STACK_SLOT      (SZ_STACK + SZ_PAGE)
+#define STACK_SLOTS     (0x10000000 / STACK_SLOT)
+
+// the word just below the top of a stack; free stacks use it to link
+// themselves together
+#define TOP_WORD(stk)   (((uint32_t *) ((stk) + 1))[-1])
+
 /*
 ** PRIVATE DATA TYPES
 */
@@ -32,11 +46,14 @@ void exit_helper( void );
 
 // stack management
 //
-// our "free list" uses the first word in the stack
+// our "free list" uses the top word in the stack
 // as a pointer to the next free stack
 
 static stack_t *_stack_list;
 
+// number of stack slots handed out so far
+static uint32_t _n_slots;
+
 /*
 ** PUBLIC GLOBAL VARIABLES
 */
@@ -66,9 +83,12 @@ void _stk_init( void ) {
     // no preallocation here, so the initial free list is empty
     _stack_list = NULL;
 
-    // allocate the first stack for the OS
-    _system_stack = _stk_alloc(NULL);
-    assert( _system_stack != NULL );
+    // allocate the first stack for the OS; ISRs run on it, so all
+    // of it must be present
+    _system_stack = _stk_alloc();
+    if( _system_stack == NULL ) {
+        PANIC( 0, "no memory for the system stack" );
+    }
 
     // set the initial ESP for the OS - it should point to the
     // next-to-last uint32 in the stack, so that when the code
@@ -77,32 +97,43 @@ void _stk_init( void ) {
     // of 16 address.
     _system_esp = ((uint32_t *) (_system_stack + 1)) - 2;
 
+    // it belongs to the bootstrap CPU (see smp.c)
+    _cpus[0].system_stack = _system_stack;
+    _cpus[0].system_esp = _system_esp;
+
     // all done!
     __cio_puts( " done" );
 }
 
 /**
-** _stk_alloc() - allocate a stack
+** _stk_alloc() - allocate a kernel stack
+**
+** Kernel stacks are mapped into the stack window at 0xdf000000 when
+** they are created.  The kernel's page tables are shared by every
+** address space, so a stack is visible in all of them and stays
+** mapped while it sits on the free list.  Interrupts run on these
+** stacks, so they are entirely present from the start.
 **
 ** @return a pointer to the allocated stack, or NULL
 */
-stack_t *_stk_alloc( struct page_directory * pg_dir ) {
+stack_t *_stk_alloc( void ) {
     stack_t *new;
 
     // see if there is an available stack
     if( _stack_list == NULL ) {
 
-        // none available - create a new one
-        char * val = _km_page_alloc( STACK_PAGES*2 );
-        for(int i = 0; i < STACK_PAGES*2; i++){
-            if(!pg_dir){
-                map_virt_page_to_phys((virt_addr) (0xdf000000 + val + i * 4096), (phys_addr) (val + i * 4096));
-            }else{
-                map_virt_page_to_phys_pg_dir(pg_dir, (virt_addr) (0xdf000000 + val + i * 4096), (phys_addr) (val + i * 4096));    
-            }
+        // none available - create a new one in the next slot
+        if( _n_slots >= STACK_SLOTS ) {
+            return( NULL );
+        }
+        new = (stack_t *) (STACK_WINDOW + _n_slots * STACK_SLOT + SZ_PAGE);
+        // (if this fails, whatever did get mapped is used the next
+        // time this slot is tried)
+        if( !alloc_range(get_current_pg_dir(), (virt_addr) new,
+                         SZ_STACK, MAP_WRITE) ) {
+            return( NULL );
         }
-        val += 0xdf000000;
-        new = (stack_t *) val;
+        ++_n_slots;
     } else {
 
         // OK, we know that there is at least one free stack;
@@ -110,42 +141,13 @@ stack_t *_stk_alloc( struct page_directory * pg_dir ) {
 
         new = _stack_list;
 
-
-
-        // Map the page for the relevant process
-        char * val = (char *) new;
-        val -= 0xdf000000;
-
-        for(int i = 0; i < STACK_PAGES*2; i++){
-            if(!pg_dir){
-                map_virt_page_to_phys((virt_addr) (0xdf000000 + val + i * 4096), (phys_addr)(val + i * 4096));
-            }else{
-                map_virt_page_to_phys_pg_dir(pg_dir, (virt_addr) (0xdf000000 + val + i * 4096), (phys_addr)(val + i * 4096));    
-            }
-        }
-
-        // Map the pages for us!
-        if(pg_dir){
-            for(int i = 0; i < STACK_PAGES*2; i++){
-                map_virt_page_to_phys((virt_addr) (0xdf000000 + val + i * 4096), (phys_addr)(val + i * 4096));
-            }
-        }
         // unlink it by making its successor the new head of
-        // the list.  this is strange, because GCC is weird
-        // about doing something like
-        //     _stack_list = (stack_t *) new[0];
+        // the list.  TOP_WORD() works around GCC's dislike of
+        // doing something like
+        //     _stack_list = (stack_t *) new[STACK_WORDS-1];
         // because 'new' is an array type
         //
-        _stack_list = (stack_t *) ((uint32_t *)new)[0];
-        
-        // clear out the fields in this one just to be safe
-        __memclr( new, sizeof(stack_t) );
-        //Unmap the pages for us
-        if(pg_dir){
-            for(int i = 0; i < STACK_PAGES*2; i++){
-                unmap_virt(_current->pg_dir, (virt_addr) (0xdf000000 + val + i * 4096));
-            }
-        }
+        _stack_list = (stack_t *) TOP_WORD( new );
     }
 
 #if TRACING_STACKS
@@ -156,7 +158,7 @@ stack_t *_stk_alloc( struct page_directory * pg_dir ) {
 }
 
 /**
-** _stk_free() - return a stack to the free list
+** _stk_free() - return a kernel stack to the free list
 **
 ** Deallocates the supplied stack
 **
@@ -174,41 +176,132 @@ void _stk_free( stack_t *stk ) {
 
     // just stick this one at the front of the list
 
-    // start by making its first word point to the
+    // start by making its top word point to the
     // current head of the free list.  again, we have
     // to work around the "array type" issue here
 
-    ((uint32_t *)stk)[0] = (uint32_t) _stack_list;
+    TOP_WORD( stk ) = (uint32_t) _stack_list;
 
     // now, this one is the new head of the list
 
     _stack_list = stk;
 }
 
+/**
+** _stk_area() - give a process its stack
+**
+** A process' stack is an ordinary area in its address space, at the
+** same place in every address space; fork() shares it copy-on-write
+** like the rest of the address space, and it grows as it is touched.
+** Nothing in the area's range covers the page below it, so running off
+** the bottom of the stack faults.
+**
+** @param pcb    The process
+**
+** @return status of the operation
+*/
+status_t _stk_area( pcb_t *pcb ) {
+
+    pcb->stack = (stack_t *) USER_STACK;
+
+    return( _vm_add(&pcb->vm, USER_STACK, SZ_STACK, 0, 0, VM_WRITE) );
+}
+
+/**
+** _stk_ready() - make sure a process can take an interrupt
+**
+** Processes run in ring 0, so an interrupt's frame goes on the
+** process' own stack, right where its saved context is now (once that
+** has been restored).  If that page isn't present, or is shared
+** copy-on-write after a fork, pushing the frame faults after the
+** interrupt has been acknowledged, and the interrupt is lost.  So the
+** pages under the context are filled in and made the process' own
+** before it runs.  Deeper in the stack, the process' own pushes get
+** there first.
+**
+** @param pcb    The process
+**
+** @return true if the process can be run
+*/
+bool_t _stk_ready( pcb_t *pcb ) {
+
+    return( _vm_touch(pcb, (virt_addr) pcb->context, sizeof(context_t),
+                      true) );
+}
+
+/**
+** _stk_contains() - test whether an address is in a stack or its
+**                   guard page
+**
+** @param stk    The stack
+** @param virt   The address
+**
+** @return true if the address belongs to the stack
+*/
+bool_t _stk_contains( stack_t *stk, uint32_t virt ) {
+    virt_addr base = (virt_addr) stk - SZ_PAGE;
+
+    return( stk != NULL && virt >= base && virt <= (virt_addr) (stk + 1) );
+}
+
 /*
 ** Process management/control
 */
 
+/**
+** _stk_args() - duplicate an argument vector
+**
+** _sys_execp() needs this, because the vector it is given lives in the
+** address space that is about to be replaced.  The copy is a single
+** block holding the argv array followed by the strings it points to.
+**
+** @param args   The vector to copy
+**
+** @return the copy (free it with kfree()), or NULL
+*/
+char **_stk_args( char *args[] ) {
+    int argbytes = 0;
+    int argc;
+
+    for( argc = 0; args[argc] != NULL; ++argc ) {
+        argbytes += __strlen( args[argc] ) + 1;
+    }
+
+    char **argv = (char **) kmalloc( (argc + 1) * sizeof(char *) + argbytes );
+    if( argv == NULL ) {
+        return( NULL );
+    }
+
+    // the strings go right after the trailing NULL pointer
+    char *tmp = (char *) (argv + argc + 1);
+    for( int i = 0; i < argc; ++i ) {
+        __strcpy( tmp, args[i] );
+        argv[i] = tmp;
+        tmp += __strlen( tmp ) + 1;
+    }
+    argv[argc] = NULL;
+
+    return( argv );
+}
+
 /**
 ** _stk_setup - set up the stack for a new process
 **
-** @param stk    - The stack to be set up
+** The process' address space must be the current one, and must not
+** have a stack yet, so the argument vector can't be on it.
+**
+** @param pcb    - The process whose stack is to be set up
 ** @param entry  - Entry point for the new process
 ** @param args   - Argument vector to be put in place
 **
 ** @return A pointer to the context_t on the stack, or NULL
 */
-context_t *_stk_setup( stack_t *stk, uint32_t entry, char *args[] ) {
+context_t *_stk_setup( pcb_t *pcb, uint32_t entry, char *args[] ) {
+    stack_t *stk = pcb->stack;
 
-    /*
-    ** We must duplicate the argv array here, because the first
-    ** thing we do before setting up the new stack for the user
-    ** is to clear out the old contents.  This is a potential
-    ** problem if we are called via the _sys_execp() system call,
-    ** because "args" is actually on the user stack.
-    **
-    ** Figure out how many arguments & argument chars there are.
-    */
+    assert1( pcb->pg_dir == get_current_pg_dir() );
+
+    // Figure out how many arguments & argument chars there are.
 
     int argbytes = 0;
     int argc = 0;
@@ -229,68 +322,15 @@ context_t *_stk_setup( stack_t *stk, uint32_t entry, char *args[] ) {
     __cio_putchar( '\n' );
 #endif
 
-    /*
-    ** Allocate the arrays.  We are safe using dynamic arrays here
-    ** because we're using the OS stack, not the user stack.  Once
-    ** we have copied the strings, it's safe to clear the stack.
-    **
-    ** We want the argstrings and argv arrays to contain all zeroes.
-    ** The C standard states, in section 6.7.8, that
-    **
-    **   "21 If there are fewer initializers in a brace-enclosed list
-    **       than there are elements or members of an aggregate, or
-    **       fewer characters in a string literal used to initialize an
-    **       array of known size than there are elements in the array,
-    **       the remainder of the aggregate shall be initialized
-    **       implicitly the same as objects that have static storage
-    **       duration."
-    **
-    ** Sadly, because we're using variable-sized arrays, we can't
-    ** rely on this, so we have to call __memclr() instead. :-(  In
-    ** truth, it doesn't really cost us much more time, but it's an
-    ** annoyance.
-    */
-
-    char argstrings[ argbytes ];
-    char *argv[ argc + 1 ];
-
-    __memclr( argstrings, argbytes );
-    __memclr( argv, (argc + 1) * sizeof(char *) );
-
-    // Next, duplicate the argument strings, and create pointers to
-    // each one in our argv.
-    char *tmp = argstrings;
-    for( int i = 0; i < argc; ++i ) {
-        int nb = __strlen(args[i]) + 1; // bytes (incl. NUL) in this string
-        __strcpy( tmp, args[i] );   // add to our buffer
-        argv[i] = tmp;              // remember where it was
-        tmp += nb;                  // move on
-    }
-
-    // trailing NULL pointer
-    argv[argc] = NULL;
-
-#if TRACING_STACK
-    __cio_puts( "=== buffer: '" );
-    for( int i = 0; i < argbytes; ++i ) {
-        __put_char_or_code( argstrings[i] );
-    }
-    __cio_printf( "'\n=== _stk_setup, temp %d args (%d bytes):",
-            argc, argbytes );
-    for( int i = 0; i <= argc; ++i ) {
-        __cio_printf( " [%d] ", i );
-        if( argv[i] ) {
-            __cio_printf( "'%s'", argv[i] );
-        } else {
-            __cio_puts( "NULL" );
-        }
+    // The new program gets the pages it needs for its arguments and
+    // initial context now, and grows from there.
+    uint32_t need = argbytes + (argc + 8) * sizeof(uint32_t) + sizeof(context_t);
+    need = (need + SZ_PAGE - 1) & ~(SZ_PAGE - 1);
+    virt_addr top = (virt_addr) (stk + 1);
+    if( need > SZ_STACK || !_vm_touch(pcb, top - need, need, true) ) {
+        return( NULL );
     }
-    __cio_putchar( '\n' );
-#endif
-
-    // Now that we have duplicated the strings, we can clear out the
-    // old contents of the stack.
-    __memclr( stk, sizeof(stack_t) );
+    __memclr( (void *) (top - need), need );
 
     /*
     ** Set up the initial stack contents for a (new) user process.
@@ -328,10 +368,7 @@ context_t *_stk_setup( stack_t *stk, uint32_t entry, char *args[] ) {
     // Pointer to where the arg strings should be filled in.
     uint32_t *fill = (uint32_t *) ( (uint32_t) ptr - argbytes );
 
-    // Copy over the argv strings.
-    __memcpy( (void *)fill, argstrings, argbytes );
-
-    // Remember where the strings are (for later)
+    // Remember where the strings go (for later)
     char *strings = (char *) fill;
   
     /*
@@ -380,25 +417,16 @@ context_t *_stk_setup( stack_t *stk, uint32_t entry, char *args[] ) {
     *ptr = *(argcptr + 1) = (uint32_t) fill;
 
     /*
-    ** Next, we copy in all argc+1 pointers.  This is complicated slightly
-    ** by the need to adjust the pointers; they currently point into the
-    ** local argstrings array.  We do this by adding the distance between
-    ** the start of the argstrings array and the duplicate of that data on
-    ** the stack.
+    ** Next, we copy in the strings, and all argc+1 pointers to them.
     */
 
-    // Calculate the distance between the two argstring arrays.
-    int32_t distance = strings - &argstrings[0];
-
-    // Adjust and copy the string pointers.
-    for( int i = 0; i <= argc; ++i ) {
-        if( argv[i] != NULL ) {
-            *fill = ((uint32_t) argv[i]) + distance;
-        } else {
-            *fill = NULL;
-        }
-        ++fill;
+    char *tmp = strings;
+    for( int i = 0; i < argc; ++i ) {
+        __strcpy( tmp, args[i] );
+        *fill++ = (uint32_t) tmp;
+        tmp += __strlen( tmp ) + 1;
     }
+    *fill = NULL;
 
     // reset 'fill' to where argc was placed
     fill = argcptr;
@@ -432,7 +460,7 @@ context_t *_stk_setup( stack_t *stk, uint32_t entry, char *args[] ) {
     context_t *ct = ((context_t *) fill) - 1;
 
     /*
-    ** We cleared the entire stack earlier, so all the context
+    ** We cleared the top of the stack earlier, so all the context
     ** fields currently contain zeroes.  We now need to fill in
     ** all the important fields.
     */
@@ -245,6 +245,50 @@ void ( *__install_isr( int vector, void ( *handler )( int vector, int code ) ) )
 	return old_handler;
 }
 
+/*
+** Name:	__install_tss
+*/
+void __install_tss( int selector, tss_t *tss ){
+	unsigned char *d = (unsigned char *)GDT_ADDRESS + (selector & SEG_SEL_IX);
+	unsigned int base = (unsigned int)tss;
+	unsigned int limit = sizeof(tss_t) - 1;
+
+	d[0] = limit & 0xff;
+	d[1] = limit >> 8 & 0xff;
+	d[2] = base & 0xff;
+	d[3] = base >> 8 & 0xff;
+	d[4] = base >> 16 & 0xff;
+	d[5] = SEG_ACCESS_P_BIT | SEG_DPL_0 | SEG_S_SYSTEM | SEG_SYS_32BIT_TSS_AVAIL;
+	d[6] = limit >> 16 & SEG_SIZE_LIM_19_16;
+	d[7] = base >> 24 & 0xff;
+}
+
+/*
+** Name:	__install_task_gate
+*/
+void __install_task_gate( int vector, int selector ){
+	__install_task_gate_in( (void *)IDT_ADDRESS, vector, selector );
+}
+
+/*
+** Name:	__install_task_gate_in
+*/
+void __install_task_gate_in( void *idt, int vector, int selector ){
+	IDT_Gate *g = (IDT_Gate *)idt + vector;
+
+	g->offset_15_0 = 0;
+	g->segment_selector = selector;
+	g->flags = IDT_PRESENT | IDT_DPL_0 | IDT_TASK_GATE;
+	g->offset_31_16 = 0;
+}
+
+/*
+** Name:	__copy_idt
+*/
+void __copy_idt( void *idt ){
+	__memcpy( idt, (void *)IDT_ADDRESS, 256 * sizeof(IDT_Gate) );
+}
+
 /*
 ** Name:	__delay
 **
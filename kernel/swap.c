@@ -0,0 +1,521 @@
+/**
+** @file swap.c
+**
+** @author CSCI-452 class of 20215
+**
+** Swap module implementation
+**
+** When alloc_frame() finds no memory, it asks this module to page
+** something out.  Pages are compressed and kept in memory if they
+** can be (see zswap.c); otherwise they go to "slots" (one page each)
+** on a disk used for nothing else, the primary slave; the boot disk is
+** never touched.  Compressed pages have slot numbers too, from ZS_SLOT.
+** A paged-out page's pte is left not present, holding its slot number
+** (see SWAP_PTE), so the next touch of the page faults, and the fault
+** handler (via _vm_populate) reads it back in.
+**
+** Victims are chosen by a clock that sweeps over the user pages of
+** every process in turn.  A page whose accessed bit is set gets a
+** second chance:  the bit is cleared, and the page is only taken if
+** it hasn't been used by the time the clock comes around again.  Only
+** private pages are taken (a single reference, not shared memory), so
+** there is only one pte to change.  Stacks are never paged out; every
+** dispatch uses them, and the kernel reaches into other processes'
+** contexts there.
+**
+** A page read back in keeps its slot for as long as its frame lives
+** (the "swap cache"), so if its dirty bit is still clear when it is
+** chosen again, it can be dropped without being written.
+**
+** When a process forks, a paged-out pte is copied along with the rest,
+** so slots have reference counts, like frames.
+*/
+
+#define SP_KERNEL_SRC
+
+#include "common.h"
+
+#include "swap.h"
+#include "zswap.h"
+#include "pgcache.h"
+#include "ata.h"
+#include "slab.h"
+#include "phys_alloc.h"
+#include "clock.h"
+#include "scheduler.h"
+
+/*
+** PRIVATE DEFINITIONS
+*/
+
+// disk sectors in a slot
+#define SLOT_SECTORS    (SZ_PAGE / ATA_SECTOR_SIZE)
+
+// number of swap cache hash chains (a power of two)
+#define SWC_BUCKETS     64
+
+// hash of a frame
+#define SWC_HASH(f)     (((f) / SZ_PAGE) & (SWC_BUCKETS - 1))
+
+// results of _swap_out()
+#define OUT_FAILED      0
+#define OUT_FREED       1
+#define OUT_KEPT        2
+
+/*
+** PRIVATE DATA TYPES
+*/
+
+// a frame whose contents are also in a slot
+typedef struct swc_entry_s {
+    struct swc_entry_s *next;   // next entry on this hash chain
+    phys_addr frame;            // the frame
+    uint32_t slot;              // the slot
+} swc_entry_t;
+
+/*
+** PRIVATE GLOBAL VARIABLES
+*/
+
+// the swap disk
+static ata_device_t _swap_dev = {.io_register = 0x1F0, .ctl_register = 0x3F6, .slavebit = 1};
+
+// number of slots on it (0 if there is no swap)
+static uint32_t _swap_slots;
+
+// references to each slot (0 if free), and where to look for a free one
+static uint8_t _slot_refs[SWAP_SLOTS];
+static uint32_t _slot_hint;
+static uint32_t _slots_used;
+
+// the swap cache
+static slab_cache_t _swc_cache;
+static swc_entry_t *_swc_table[SWC_BUCKETS];
+static uint32_t _swc_count;
+
+// the clock hand: a process table slot, and an address in it
+static uint32_t _hand_proc;
+static virt_addr _hand_virt = USER_VIRT_BASE;
+
+// set while paging out, so we don't go around again from alloc_frame()
+static bool_t _swap_busy;
+
+// statistics
+static uint32_t _swap_outs;
+static uint32_t _swap_ins;
+static uint32_t _swap_clean;
+static uint32_t _swap_fails;
+
+/*
+** PUBLIC GLOBAL VARIABLES
+*/
+
+/*
+** PRIVATE FUNCTIONS
+*/
+
+/**
+** _slot_alloc() - allocate a swap slot
+**
+** @return the slot, or SWAP_NONE
+*/
+static uint32_t _slot_alloc( void ) {
+
+    for( uint32_t i = 0; i < _swap_slots; ++i ) {
+        uint32_t slot = (_slot_hint + i) % _swap_slots;
+        if( _slot_refs[slot] == 0 ) {
+            _slot_refs[slot] = 1;
+            _slot_hint = slot + 1;
+            ++_slots_used;
+            return( slot );
+        }
+    }
+
+    return( SWAP_NONE );
+}
+
+/**
+** _slot_put() - drop a reference to a swap slot
+**
+** @param slot   The slot
+*/
+static void _slot_put( uint32_t slot ) {
+    assert1( slot < _swap_slots && _slot_refs[slot] > 0 );
+
+    if( --_slot_refs[slot] == 0 ) {
+        --_slots_used;
+    }
+}
+
+/**
+** _slot_io() - move a page between a frame and a swap slot
+**
+** @param slot   The slot
+** @param frame  The frame
+** @param write  Whether to write the frame to the slot
+**
+** @return true if the transfer worked
+*/
+static bool_t _slot_io( uint32_t slot, phys_addr frame, bool_t write ) {
+    uint8_t *page = (uint8_t *) kmap( frame );
+    int32_t status;
+
+    if( write ) {
+        status = write_disk_ATA_PIO( slot * SLOT_SECTORS, SLOT_SECTORS,
+                                     page, &_swap_dev );
+    } else {
+        status = read_disk_ATA_PIO( slot * SLOT_SECTORS, SLOT_SECTORS,
+                                    page, &_swap_dev );
+    }
+
+    kunmap( page );
+    return( status >= 0 );
+}
+
+/**
+** _swc_take() - remove a frame from the swap cache
+**
+** @param frame  The frame
+**
+** @return the slot holding a copy of the frame, or SWAP_NONE
+*/
+static uint32_t _swc_take( phys_addr frame ) {
+    swc_entry_t **pp = &_swc_table[SWC_HASH(frame)];
+
+    for( ; *pp != NULL; pp = &(*pp)->next ) {
+        if( (*pp)->frame == frame ) {
+            swc_entry_t *e = *pp;
+            uint32_t slot = e->slot;
+            *pp = e->next;
+            _slab_free( _swc_cache, e );
+            --_swc_count;
+            return( slot );
+        }
+    }
+
+    return( SWAP_NONE );
+}
+
+/**
+** _swc_put() - remember that a slot holds a copy of a frame
+**
+** The cache takes over the caller's reference to the slot.
+**
+** @param frame  The frame
+** @param slot   The slot
+*/
+static void _swc_put( phys_addr frame, uint32_t slot ) {
+    swc_entry_t *e = (swc_entry_t *) _slab_alloc( _swc_cache );
+
+    // not worth failing over; the page will just be written again
+    if( e == NULL ) {
+        _slot_put( slot );
+        return;
+    }
+
+    swc_entry_t **chain = &_swc_table[SWC_HASH(frame)];
+    e->frame = frame;
+    e->slot = slot;
+    e->next = *chain;
+    *chain = e;
+    ++_swc_count;
+}
+
+/**
+** _swap_out() - page out one page
+**
+** A clean page with a copy in the swap cache is just dropped; any
+** other is compressed if it can be, and written to disk if not.
+**
+** @param pg_dir   The page directory
+** @param virt     The (page-aligned) address
+** @param pte      Its pte, which is present and private
+**
+** @return OUT_FREED if the page was paged out and its frame freed,
+**         OUT_KEPT if it was paged out but its frame now holds
+**         compressed pages, or OUT_FAILED
+*/
+static uint32_t _swap_out( struct page_directory *pg_dir, virt_addr virt,
+                           pte_t *pte ) {
+    phys_addr frame = pte_get_frame( pte );
+    uint32_t slot = _swc_take( frame );
+    bool_t kept = false;
+
+    if( slot != SWAP_NONE && !(*pte & I86_PTE_DIRTY) ) {
+        // the copy in the slot is still good
+        ++_swap_clean;
+    } else {
+        uint32_t z = _zs_store( frame, &kept );
+        if( z != SWAP_NONE ) {
+            // the copy on disk (if any) is out of date
+            if( slot != SWAP_NONE ) {
+                _slot_put( slot );
+            }
+            slot = z;
+        } else {
+            if( slot == SWAP_NONE ) {
+                slot = _slot_alloc();
+                if( slot == SWAP_NONE ) {
+                    return( OUT_FAILED );
+                }
+            }
+            if( !_slot_io(slot, frame, true) ) {
+                _slot_put( slot );
+                ++_swap_fails;
+                return( OUT_FAILED );
+            }
+        }
+    }
+
+    *pte = SWAP_PTE( slot );
+    flush_page( pg_dir, virt );
+    ++_swap_outs;
+
+    if( kept ) {
+        return( OUT_KEPT );
+    }
+
+    unref_frame( frame );
+    return( OUT_FREED );
+}
+
+/*
+** PUBLIC FUNCTIONS
+*/
+
+/**
+** _swap_init() - initialize the swap module
+**
+** Dependencies:
+**    Cannot be called before kmem is initialized
+*/
+void _swap_init( void ) {
+
+    __cio_puts( " Swap:" );
+
+    if( detect_device_ATA(&_swap_dev) == ATA_DEV_ATA ) {
+        _swap_slots = size_ATA( &_swap_dev ) / SLOT_SECTORS;
+        if( _swap_slots > SWAP_SLOTS ) {
+            _swap_slots = SWAP_SLOTS;
+        }
+    }
+
+    if( _swap_slots > 0 ) {
+        _swc_cache = _slab_create( "swapcache", sizeof(swc_entry_t), NULL );
+        assert( _swc_cache != NULL );
+        __cio_printf( " %d slots", _swap_slots );
+    } else {
+        __cio_puts( " no disk" );
+    }
+
+    __cio_puts( " done" );
+}
+
+/**
+** _swap_reclaim() - page out one page to free a frame
+**
+** The clock goes around at most twice:  once to clear accessed bits,
+** and once more to find a page which hasn't been used since.  A page
+** compressed into its own frame frees nothing, so the clock keeps
+** going after one.  Before any of that, the page cache gives up a page
+** if it can.
+**
+** @return true if a frame was freed
+*/
+bool_t _swap_reclaim( void ) {
+    uint32_t wraps = 0;
+    uint32_t result = OUT_FAILED;
+
+    // file pages nobody maps can simply be dropped; they are read in
+    // again if they're wanted
+    if( _pgc_reclaim() ) {
+        return( true );
+    }
+
+    if( (_swap_slots == 0 && !_zs_enabled()) || _swap_busy ) {
+        return( false );
+    }
+    _swap_busy = true;
+
+    // the hand may start partway around, hence three wraps
+    while( result != OUT_FREED && wraps < 3 ) {
+        pcb_t *pcb = _processes[_hand_proc];
+
+        // stacks are not paged out, so stop below them; a process
+        // running on another CPU may have our pages in its TLB
+        if( pcb == NULL || pcb->pg_dir == NULL || _hand_virt >= USER_STACK ||
+                (pcb->state == Running && pcb != _current) ) {
+            _hand_virt = USER_VIRT_BASE;
+            if( ++_hand_proc >= N_PROCS ) {
+                _hand_proc = 0;
+                ++wraps;
+            }
+            continue;
+        }
+
+        virt_addr virt = _hand_virt;
+        pte_t *pte = find_pte( pcb->pg_dir, virt );
+        if( pte == NULL ) {
+            // no page table, so skip all of it
+            _hand_virt = (virt + SZ_LARGE_PAGE) & ~(SZ_LARGE_PAGE - 1);
+            continue;
+        }
+        _hand_virt += SZ_PAGE;
+
+        // only private pages can be taken
+        if( !(*pte & I86_PTE_PRESENT) || (*pte & I86_PTE_SHARED) ||
+                frame_refs(pte_get_frame(pte)) != 1 ) {
+            continue;
+        }
+
+        // second chance for a page used since we last came by
+        if( *pte & I86_PTE_ACCESSED ) {
+            pte_del_attr( pte, I86_PTE_ACCESSED );
+            flush_page( pcb->pg_dir, virt );
+            continue;
+        }
+
+        result = _swap_out( pcb->pg_dir, virt, pte );
+    }
+
+    _swap_busy = false;
+    return( result == OUT_FREED );
+}
+
+/**
+** _swap_has() - check for a paged-out page
+**
+** @param pg_dir   The page directory
+** @param virt     The (page-aligned) address
+**
+** @return true if the page is in swap
+*/
+bool_t _swap_has( struct page_directory *pg_dir, virt_addr virt ) {
+    pte_t *pte = find_pte( pg_dir, virt );
+
+    return( pte != NULL && PTE_IS_SWAPPED(*pte) );
+}
+
+/**
+** _swap_in() - bring a paged-out page back into memory
+**
+** If nothing else refers to a disk slot, it is kept in the swap cache
+** along with the new frame.  Compressed pages are not kept; they
+** cost memory, which is what we are short of.
+**
+** @param pg_dir   The page directory
+** @param virt     The (page-aligned) address
+** @param writable Whether the page may be written
+**
+** @return true if the page is now present
+*/
+bool_t _swap_in( struct page_directory *pg_dir, virt_addr virt,
+                 bool_t writable ) {
+    pte_t *pte = find_pte( pg_dir, virt );
+
+    if( pte == NULL || !PTE_IS_SWAPPED(*pte) ) {
+        return( false );
+    }
+    uint32_t slot = PTE_SWAP_SLOT( *pte );
+
+    // this may page others out, but never this one (it's not present)
+    phys_addr frame = alloc_frame();
+    if( frame == 0 ) {
+        return( false );
+    }
+
+    bool_t ok;
+    if( slot >= ZS_SLOT ) {
+        ok = _zs_load( slot, frame );
+    } else {
+        ok = _slot_io( slot, frame, false );
+    }
+    if( !ok ) {
+        free_frame( frame );
+        ++_swap_fails;
+        return( false );
+    }
+
+    // the page table is already there, so this can't fail
+    *pte = 0;
+    if( !map_range(pg_dir, virt, frame, SZ_PAGE, writable ? MAP_WRITE : 0) ) {
+        PANIC( 0, "swap-in could not map page" );
+    }
+
+    if( slot >= ZS_SLOT ) {
+        _zs_put( slot );
+    } else if( _slot_refs[slot] == 1 ) {
+        _swc_put( frame, slot );
+    } else {
+        _slot_put( slot );
+    }
+
+    ++_swap_ins;
+    return( true );
+}
+
+/**
+** _swap_dup() - note another pte referring to a swap slot
+**
+** @param pte      The (paged-out) pte being copied
+*/
+void _swap_dup( pte_t pte ) {
+    uint32_t slot = PTE_SWAP_SLOT( pte );
+
+    if( slot >= ZS_SLOT ) {
+        _zs_dup( slot );
+        return;
+    }
+
+    assert1( slot < _swap_slots && _slot_refs[slot] > 0 );
+    ++_slot_refs[slot];
+}
+
+/**
+** _swap_free() - note a pte no longer referring to a swap slot
+**
+** @param pte      The (paged-out) pte being discarded
+*/
+void _swap_free( pte_t pte ) {
+    uint32_t slot = PTE_SWAP_SLOT( pte );
+
+    if( slot >= ZS_SLOT ) {
+        _zs_put( slot );
+    } else {
+        _slot_put( slot );
+    }
+}
+
+/**
+** _swap_forget() - note that a frame is being freed
+**
+** Its copy in the swap cache (if any) is no longer needed.
+**
+** @param frame    The frame
+*/
+void _swap_forget( phys_addr frame ) {
+
+    if( _swc_count == 0 ) {
+        return;
+    }
+
+    uint32_t slot = _swc_take( frame );
+    if( slot != SWAP_NONE ) {
+        _slot_put( slot );
+    }
+}
+
+/**
+** _swap_dump() - print the swap statistics on the console
+*/
+void _swap_dump( void ) {
+    uint32_t secs = TICKS_TO_SEC( _system_time );
+    if( secs == 0 ) {
+        secs = 1;
+    }
+
+    __cio_printf( "swap: %d/%d slots, %d cached; out %d (%d/s), %d clean; in %d (%d/s); %d errors\n",
+                  _slots_used, _swap_slots, _swc_count,
+                  _swap_outs, _swap_outs / secs, _swap_clean,
+                  _swap_ins, _swap_ins / secs, _swap_fails );
+}
@@ -25,12 +25,19 @@
 #include "cio.h"
 #include "sio.h"
 #include "paging.h"
+#include "phys_alloc.h"
 #include "elf_loader.h"
+#include "vm.h"
+#include "shm.h"
+#include "smp.h"
 
 /*
 ** PRIVATE DEFINITIONS
 */
 
+// number of frames cleared by each prezero() call
+#define PREZERO_BATCH   4
+
 /*
 ** PRIVATE DATA TYPES
 */
@@ -74,6 +81,13 @@ static void _sys_isr( int vector, int code ) {
     // Much less likely to occur, but still potentially problematic.
     assert2( _current->context != NULL );
 
+    // Another CPU may have killed us while we were running.
+    if( _current->state == Killed ) {
+        _schedule( _current );
+        _dispatch();
+        return;
+    }
+
     // Retrieve the system call code.
     uint32_t syscode = REG( _current, eax );
 
@@ -90,8 +104,10 @@ static void _sys_isr( int vector, int code ) {
     // Handle the system call.
     _syscalls[syscode]( _current );
 
-    // Tell the PIC we're done.
-    __outb( PIC_PRI_CMD_PORT, PIC_EOI );
+    // Tell the PIC we're done (it only talks to the bootstrap CPU).
+    if( _cpu->id == 0 ) {
+        __outb( PIC_PRI_CMD_PORT, PIC_EOI );
+    }
 }
 
 /**
@@ -161,7 +177,6 @@ static void _sys_fork( pcb_t *curr ) {
 
     // First, allocate a PCB.
     pcb_t *new = _pcb_alloc();
-    new->pg_dir = copy_pg_dir(curr->pg_dir);
     if( new == NULL ) {
         RET(curr) = E_NO_PROCS;
 #if TRACING_SYSRET
@@ -170,65 +185,54 @@ static void _sys_fork( pcb_t *curr ) {
         return;
     }
 
-    // Create the stack for the child.
-    new->stack = _stk_alloc(new->pg_dir);
-    if( new->stack == NULL ) {
+    // The child shares the parent's pages (including its stack)
+    // copy-on-write.
+    new->pg_dir = copy_pg_dir(curr->pg_dir);
+    if( new->pg_dir == NULL ) {
         _pcb_free( new );
-        RET(curr) = E_NO_PROCS;
+        RET(curr) = E_NO_MEM;
 #if TRACING_SYSRET
-        __cio_printf( "<-- %08x\n", E_NO_PROCS );
+        __cio_printf( "<-- %08x\n", E_NO_MEM );
 #endif
         return;
     }
 
-    // Duplicate the parent's stack.
-    for(int i = 0; i < STACK_PAGES*2; i++){
-        char * val = (char *) new->stack;
-        val -= 0xdf000000;
-        map_virt_page_to_phys((virt_addr)(0xdf000000 + val + i * 4096), (phys_addr)(val + i * 4096));    
-    }
-    __memcpy( (void *)new->stack, (void *)curr->stack, sizeof(stack_t) );
-    for(int i = 0; i < STACK_PAGES*2; i++){
-        char * val = (char *) new->stack;
-        val -= 0xdf000000;
-        unmap_virt(_current->pg_dir, (virt_addr)(0xdf000000 + val + i * 4096));    
+    // Pages the parent hasn't touched yet are filled in on demand
+    // in the child, too.  The parent goes straight back to running,
+    // so it needs its own copy of the stack under its context now
+    // (see _stk_ready); the child gets one when it is dispatched.
+    if( _vm_copy( curr->vm, &new->vm ) != E_SUCCESS || !_stk_ready(curr) ) {
+        _vm_free( &new->vm );
+        release_user_pages( new->pg_dir );
+        delete_pg_dir( new->pg_dir );
+        _pcb_free( new );
+        RET(curr) = E_NO_MEM;
+#if TRACING_SYSRET
+        __cio_printf( "<-- %08x\n", E_NO_MEM );
+#endif
+        return;
     }
+
     // Set the child's identity.
     new->pid = _next_pid++;
     new->ppid = curr->pid;
     new->state = New;
     new->quantum = Q_DEFAULT;
+    new->priority = new->base = curr->base;
 
     /*
-    ** Now, we need to update the ESP and EBP values in the child's
-    ** stack.  The problem is that because we duplicated the parent's
-    ** stack, these pointers are still pointing back into that stack,
-    ** which will cause problems as the two processes continue to execute.
+    ** The child's stack is at the same address as the parent's, and
+    ** came along with the rest of the address space, so its context
+    ** is where the parent's is, and every pointer into the stack is
+    ** still good.
     */
-
-    // Figure out the byte offset from one stack to the other.
-    int32_t offset = (void *) new->stack - (void *) curr->stack;
-
-    // Add this to the child's context pointer.
-    new->context = (context_t *) (((void *)curr->context) + offset);
-
-    // Fix the child's ESP and EBP values IFF they're non-zero.
-    if( REG(new,ebp) != 0 ) {
-        REG(new,ebp) += offset;
-    }
-    if( REG(new,esp) != 0 ) {
-        REG(new,esp) += offset;
-    }
-
-    // Follow the EBP chain through the child's stack.
-    uint32_t *bp = (uint32_t *) REG(new,ebp);
-    while( bp && *bp ) {
-        *bp += offset;
-        bp = (uint32_t *) *bp;
-    }
-    // char dst[32];
-    // __sprint(dst, "bp %llx\n", bp);
-    // swrites(dst);
+    new->stack = curr->stack;
+    new->context = curr->context;
+    new->heap = curr->heap;
+    new->brk = curr->brk;
+    __memcpy( new->files, curr->files, sizeof(new->files) );
+    new->shm = curr->shm;
+    _shm_dup( new->shm );
 
     // Set the return values for the two processes.
     RET(curr) = new->pid;
@@ -282,7 +286,49 @@ static void _sys_execp( pcb_t *curr ) {
     __cio_printf( "--> _sys_execp, pid %d\n", curr->pid );
 #endif
 
-    uint32_t elf_entry = _elf_load_program(entry);
+    // the scheduler would fault on a priority it doesn't have
+    if( ARG(curr,2) >= N_PRIOS ) {
+        RET(curr) = E_BAD_PARAM;
+#if TRACING_SYSRET
+        __cio_printf( "<-- %08x\n", E_BAD_PARAM );
+#endif
+        return;
+    }
+
+    // The kernel can't take page faults, so make sure all of the
+    // arguments are present before _stk_args() reads them.
+    for( int i = 0; ; ++i ) {
+        if( !_vm_touch( curr, (virt_addr) &args[i], sizeof(char *), false )
+                || (args[i] != NULL && !_vm_touch_str( curr, args[i] )) ) {
+            RET(curr) = E_BAD_PARAM;
+#if TRACING_SYSRET
+            __cio_printf( "<-- %08x\n", E_BAD_PARAM );
+#endif
+            return;
+        }
+        if( args[i] == NULL ) {
+            break;
+        }
+    }
+
+    // The arguments live in the image we're about to drop, so they
+    // have to be copied out first.
+    char **kargs = _stk_args( args );
+    if( kargs == NULL ) {
+        RET(curr) = E_NO_MEM;
+#if TRACING_SYSRET
+        __cio_printf( "<-- %08x\n", E_NO_MEM );
+#endif
+        return;
+    }
+
+    // Drop the old program image and stack (which may still be shared
+    // with our parent) so that the new ones are built in fresh pages.
+    release_user_pages( curr->pg_dir );
+    _vm_free( &curr->vm );
+    _shm_drop( &curr->shm );
+
+    uint32_t elf_entry = _elf_load_program( entry, &curr->vm );
 
     if (!elf_entry) {
         __sprint( b256, "*** execp(): could not load binary at address: %x\n",
@@ -290,9 +336,23 @@ static void _sys_execp( pcb_t *curr ) {
         PANIC( 0, b256 );
     }
 
+    // The new program starts with an empty heap above its image.
+    _vm_heap( curr );
+
     // Set up the new stack for the user.
-    context_t *ct = _stk_setup( curr->stack, elf_entry, args );
-    assert( ct != NULL );
+    context_t *ct = NULL;
+    if( _stk_area(curr) == E_SUCCESS ) {
+        ct = _stk_setup( curr, elf_entry, kargs );
+    }
+    kfree( kargs );
+
+    if( ct == NULL ) {
+        // there's no longer anything to return to
+        curr->exit_status = E_NO_MEM;
+        _perform_exit( curr );
+        _dispatch();
+        return;
+    }
 
     // Copy the context pointer into the current PCB.
     curr->context = ct;
@@ -301,7 +361,7 @@ static void _sys_execp( pcb_t *curr ) {
     curr->context->esp = (uint32_t) ct;
 
     // Assign the specified priority.
-    curr->priority = prio;
+    curr->priority = curr->base = prio;
 
     /*
     ** Decision:  (A) schedule this process and dispatch another,
@@ -371,9 +431,7 @@ static void _sys_kill( pcb_t *curr ) {
 
     case Ready:
         // remove it from the ready queue
-        tmp = _queue_remove_specific( _ready[pcb->priority], pcb );
-        // verify that we got the correct PCB
-        assert( tmp == pcb );
+        _sched_remove( pcb );
         // mark it as killed and clean it up
         pcb->exit_status = E_KILLED;
         _perform_exit( pcb );
@@ -400,8 +458,16 @@ static void _sys_kill( pcb_t *curr ) {
         RET(curr) = E_SUCCESS;
         break;
 
-    case Running:  // current process
-        // we have met the enemy, and he is us!
+    case Running:
+        // running on another CPU, which will clean it up on its
+        // next clock tick or system call
+        if( pcb != curr ) {
+            pcb->state = Killed;
+            pcb->exit_status = E_KILLED;
+            RET(curr) = E_SUCCESS;
+            break;
+        }
+        // otherwise, we have met the enemy, and he is us!
         curr->exit_status = E_KILLED;
         _perform_exit( curr );
         // need a new 'current process"
@@ -493,6 +559,17 @@ static void _sys_wait( pcb_t *curr ) {
         return;
     }
 
+    // the status may be stored after we block, when this process
+    // isn't the one running, so make sure it is writable now
+    if( ARG(curr,1) != 0 &&
+            !_vm_touch( curr, ARG(curr,1), sizeof(int32_t), true ) ) {
+        RET(curr) = E_BAD_PARAM;
+#if TRACING_SYSRET
+        __cio_printf( "<-- %08x\n", E_BAD_PARAM );
+#endif
+        return;
+    }
+
     // at least one child; did we find one to collect?
     if( child == NULL ) {
 
@@ -537,6 +614,7 @@ static void _sys_sleep( pcb_t *curr ) {
     } else {
         curr->wakeup = _system_time + MS_TO_TICKS(ms);
         curr->state = Sleeping;
+        _sched_blocked( curr );
         status_t status = _queue_add( _sleeping,
                             (void *) curr, curr->wakeup );
         if( status != E_SUCCESS ) {
@@ -568,6 +646,15 @@ static void _sys_read( pcb_t *curr ) {
     __cio_printf( "--> _sys_read, pid %d\n", curr->pid );
 #endif
 
+    // the kernel can't take page faults, so get the buffer ready first
+    if( !_vm_touch( curr, (virt_addr) buf, length, true ) ) {
+        RET(curr) = E_BAD_PARAM;
+#if TRACING_SYSRET
+        __cio_printf( "<-- %08x\n", E_BAD_PARAM );
+#endif
+        return;
+    }
+
     // try to get the next character(s)
     switch( ARG(curr,1) ) {
     case CHAN_CIO:
@@ -611,6 +698,7 @@ static void _sys_read( pcb_t *curr ) {
 
         // mark it as blocked
         curr->state = Blocked;
+        _sched_blocked( curr );
 
         // put it on the SIO input queue
         assert( _queue_add(_reading,curr,0) == E_SUCCESS );
@@ -638,6 +726,15 @@ static void _sys_write( pcb_t *curr ) {
     __cio_printf( "--> _sys_write, pid %d\n", curr->pid );
 #endif
 
+    // the kernel can't take page faults, so get the buffer ready first
+    if( !_vm_touch( curr, (virt_addr) buf, length, false ) ) {
+        RET(curr) = E_BAD_PARAM;
+#if TRACING_SYSRET
+        __cio_printf( "<-- %08x\n", E_BAD_PARAM );
+#endif
+        return;
+    }
+
     // this is almost insanely simple, but it does separate the
     // low-level device access fromm the higher-level syscall implementation
 
@@ -687,6 +784,16 @@ static void _sys_sysstat( pcb_t *curr ) {
         return;
     }
 
+    // the kernel can't take page faults, so get the array ready first
+    if( !_vm_touch( curr, (virt_addr) counts,
+                    N_STATES * sizeof(uint32_t), true ) ) {
+        RET(curr) = E_BAD_PARAM;
+#if TRACING_SYSRET
+        __cio_printf( "<-- %08x\n", E_BAD_PARAM );
+#endif
+        return;
+    }
+
     // collect the information
     int32_t n = _pcount( counts );
 
@@ -770,9 +877,368 @@ static void _sys_getprio( pcb_t *curr ) {
 #if TRACING_SYSCALLS
     __cio_printf( "--> _sys_getprio, pid %d\n", curr->pid );
 #endif
-    RET(curr) = curr->priority;
+    RET(curr) = curr->base;
+#if TRACING_SYSRET
+        __cio_printf( "<-- %08x\n", curr->base );
+#endif
+}
+
+/**
+** _sys_prezero - clear a batch of frames for later allocation
+**
+** implements:
+**      int32_t prezero( void );
+**
+** returns:
+**      the number of frames the zeroed-frame stock is still short
+*/
+static void _sys_prezero( pcb_t *curr ) {
+
+#if TRACING_SYSCALLS
+    __cio_printf( "--> _sys_prezero, pid %d\n", curr->pid );
+#endif
+    uint32_t short_by = _phys_zero_fill( PREZERO_BATCH );
+    RET(curr) = short_by;
+#if TRACING_SYSRET
+        __cio_printf( "<-- %08x\n", short_by );
+#endif
+}
+
+/**
+** _sys_brk - move the end of the heap
+**
+** implements:
+**      void *brk( void *addr );
+**
+** returns:
+**      the new break; the old one if it couldn't be moved (or if
+**      addr is NULL)
+*/
+static void _sys_brk( pcb_t *curr ) {
+    virt_addr addr = ARG(curr,1);
+
+#if TRACING_SYSCALLS
+    __cio_printf( "--> _sys_brk, pid %d, %08x\n", curr->pid, addr );
+#endif
+
+    if( addr != 0 ) {
+        (void) _vm_brk( curr, addr );
+    }
+
+    RET(curr) = curr->brk;
+#if TRACING_SYSRET
+    __cio_printf( "<-- %08x\n", curr->brk );
+#endif
+}
+
+/**
+** _sys_open - open a file
+**
+** implements:
+**      int open( const char *name );
+**
+** returns:
+**      a file descriptor, or an error code
+*/
+static void _sys_open( pcb_t *curr ) {
+    const char *name = (const char *) ARG(curr,1);
+    int fd;
+    file_t file;
+
+#if TRACING_SYSCALLS
+    __cio_printf( "--> _sys_open, pid %d\n", curr->pid );
+#endif
+
+    for( fd = 0; fd < N_FILES; ++fd ) {
+        if( curr->files[fd].cluster == 0 ) {
+            break;
+        }
+    }
+
+    if( fd >= N_FILES ) {
+        fd = E_NO_MEM;
+    } else if( !_vm_touch_str(curr, name) ) {
+        fd = E_BAD_PARAM;
+    } else if( _filesystem == NULL ||
+            file_lookup(_filesystem, name, &file) < 0 ) {
+        fd = E_NOT_FOUND;
+    } else if( file.cluster == 0 ) {
+        // empty files have no clusters, and nothing to map
+        fd = E_EMPTY;
+    } else {
+        curr->files[fd] = file;
+    }
+
+    RET(curr) = fd;
 #if TRACING_SYSRET
-        __cio_printf( "<-- %08x\n", curr->priority );
+    __cio_printf( "<-- %08x\n", fd );
+#endif
+}
+
+/**
+** _sys_close - close a file
+**
+** Mappings of the file stay valid.
+**
+** implements:
+**      int close( int fd );
+**
+** returns:
+**      status of the operation
+*/
+static void _sys_close( pcb_t *curr ) {
+    uint32_t fd = ARG(curr,1);
+    status_t status = E_SUCCESS;
+
+#if TRACING_SYSCALLS
+    __cio_printf( "--> _sys_close, pid %d, %d\n", curr->pid, fd );
+#endif
+
+    if( fd >= N_FILES || curr->files[fd].cluster == 0 ) {
+        status = E_BAD_PARAM;
+    } else {
+        curr->files[fd].cluster = 0;
+    }
+
+    RET(curr) = status;
+#if TRACING_SYSRET
+    __cio_printf( "<-- %08x\n", status );
+#endif
+}
+
+/**
+** _sys_mmap - map part of an open file into memory
+**
+** Pages are read when first touched, and come from a page cache
+** shared by every process.  With PROT_WRITE the mapping is private:
+** writes go to the process' own copy, and never to the file.
+**
+** implements:
+**      void *mmap( int fd, uint32_t offset, uint32_t len, int prot );
+**
+** returns:
+**      the address of the mapping, or NULL
+*/
+static void _sys_mmap( pcb_t *curr ) {
+    uint32_t fd = ARG(curr,1);
+    uint32_t offset = ARG(curr,2);
+    uint32_t len = ARG(curr,3);
+    uint32_t prot = ARG(curr,4);
+    virt_addr addr = 0;
+
+#if TRACING_SYSCALLS
+    __cio_printf( "--> _sys_mmap, pid %d, %d %08x %08x\n",
+                  curr->pid, fd, offset, len );
+#endif
+
+    if( fd < N_FILES && curr->files[fd].cluster != 0 ) {
+        addr = _vm_map( curr, &curr->files[fd], offset, len,
+                        (prot & PROT_WRITE) ? VM_WRITE : 0 );
+    }
+
+    RET(curr) = addr;
+#if TRACING_SYSRET
+    __cio_printf( "<-- %08x\n", addr );
+#endif
+}
+
+/**
+** _sys_munmap - remove a mapping made by mmap()
+**
+** implements:
+**      int munmap( void *addr );
+**
+** returns:
+**      status of the operation
+*/
+static void _sys_munmap( pcb_t *curr ) {
+    virt_addr addr = ARG(curr,1);
+    status_t status = E_BAD_PARAM;
+
+#if TRACING_SYSCALLS
+    __cio_printf( "--> _sys_munmap, pid %d, %08x\n", curr->pid, addr );
+#endif
+
+    // only mappings can be removed this way
+    if( addr >= VM_MAP_BASE && addr < USER_STACK ) {
+        status = _vm_remove( curr, addr );
+    }
+
+    RET(curr) = status;
+#if TRACING_SYSRET
+    __cio_printf( "<-- %08x\n", status );
+#endif
+}
+
+/**
+** _sys_shm_create - find or create a shared memory segment
+**
+** implements:
+**      int shm_create( uint32_t key, uint32_t size );
+**
+** returns:
+**      a handle for the segment, or an error code
+*/
+static void _sys_shm_create( pcb_t *curr ) {
+    uint32_t key = ARG(curr,1);
+    uint32_t size = ARG(curr,2);
+
+#if TRACING_SYSCALLS
+    __cio_printf( "--> _sys_shm_create, pid %d, %08x %08x\n",
+                  curr->pid, key, size );
+#endif
+
+    int handle = _shm_create( key, size, &curr->shm );
+
+    RET(curr) = handle;
+#if TRACING_SYSRET
+    __cio_printf( "<-- %08x\n", handle );
+#endif
+}
+
+/**
+** _sys_shm_map - map a shared memory segment into memory
+**
+** implements:
+**      void *shm_map( int handle );
+**
+** returns:
+**      the address of the mapping, or NULL
+*/
+static void _sys_shm_map( pcb_t *curr ) {
+    int handle = ARG(curr,1);
+    shm_t *shm = _shm_get( handle );
+    virt_addr addr = 0;
+
+#if TRACING_SYSCALLS
+    __cio_printf( "--> _sys_shm_map, pid %d, %d\n", curr->pid, handle );
+#endif
+
+    // only a handle this process got from shm_create() (or inherited)
+    if( shm != NULL && (curr->shm & (1 << handle)) != 0 ) {
+        addr = _vm_map_shm( curr, shm );
+    }
+
+    RET(curr) = addr;
+#if TRACING_SYSRET
+    __cio_printf( "<-- %08x\n", addr );
+#endif
+}
+
+/**
+** _sys_setrt - make this process real-time, or not
+**
+** implements:
+**      int setrt( uint32_t runtime, uint32_t period, uint32_t deadline );
+**
+** returns:
+**      E_SUCCESS, or an error code
+*/
+static void _sys_setrt( pcb_t *curr ) {
+    uint32_t runtime = ARG(curr,1);
+    uint32_t period = ARG(curr,2);
+    uint32_t deadline = ARG(curr,3);
+
+#if TRACING_SYSCALLS
+    __cio_printf( "--> _sys_setrt, pid %d, %d %d %d\n",
+                  curr->pid, runtime, period, deadline );
+#endif
+
+    status_t status = _sched_set_rt( curr, MS_TO_TICKS(runtime),
+                          MS_TO_TICKS(period), MS_TO_TICKS(deadline) );
+
+    RET(curr) = status;
+#if TRACING_SYSRET
+    __cio_printf( "<-- %08x\n", status );
+#endif
+}
+
+/**
+** _sys_rtmisses - retrieve the number of deadlines this process missed
+**
+** implements:
+**      uint32_t rtmisses( void );
+**
+** returns:
+**      the number of deadlines missed
+*/
+static void _sys_rtmisses( pcb_t *curr ) {
+
+#if TRACING_SYSCALLS
+    __cio_printf( "--> _sys_rtmisses, pid %d\n", curr->pid );
+#endif
+
+    RET(curr) = curr->rt.misses;
+#if TRACING_SYSRET
+    __cio_printf( "<-- %08x\n", curr->rt.misses );
+#endif
+}
+
+/**
+** _sys_pread - read part of an open file into a buffer
+**
+** The file is read a page at a time straight from the disk, not
+** through the page cache, so what mmap() shows can be checked
+** against it.
+**
+** implements:
+**      int32_t pread( int fd, void *buf, uint32_t len, uint32_t offset );
+**
+** returns:
+**      the number of bytes read (0 at the end of the file), or an
+**      error code
+*/
+static void _sys_pread( pcb_t *curr ) {
+    uint32_t fd = ARG(curr,1);
+    uint8_t *buf = (uint8_t *) ARG(curr,2);
+    uint32_t len = ARG(curr,3);
+    uint32_t offset = ARG(curr,4);
+    int32_t n = 0;
+
+#if TRACING_SYSCALLS
+    __cio_printf( "--> _sys_pread, pid %d, %d %08x %08x\n",
+                  curr->pid, fd, len, offset );
+#endif
+
+    if( fd >= N_FILES || curr->files[fd].cluster == 0 ) {
+        n = E_BAD_PARAM;
+    } else {
+        file_t *file = &curr->files[fd];
+        if( offset >= file->size ) {
+            len = 0;
+        } else if( len > file->size - offset ) {
+            len = file->size - offset;
+        }
+
+        // the kernel can't take page faults, so get the buffer ready first
+        uint8_t *page = NULL;
+        if( len > 0 && !_vm_touch( curr, (virt_addr) buf, len, true ) ) {
+            n = E_BAD_PARAM;
+        } else if( len > 0 && (page = (uint8_t *) kmalloc( SZ_PAGE )) == NULL ) {
+            n = E_NO_MEM;
+        }
+
+        while( n >= 0 && (uint32_t) n < len ) {
+            uint32_t pos = offset + n;
+            uint32_t in_page = pos % SZ_PAGE;
+            uint32_t count = SZ_PAGE - in_page;
+            if( count > len - n ) {
+                count = len - n;
+            }
+            if( file_read_page( _filesystem, file, pos / SZ_PAGE, page ) < 0 ) {
+                n = E_FAILURE;
+                break;
+            }
+            __memcpy( buf + n, page + in_page, count );
+            n += count;
+        }
+
+        kfree( page );
+    }
+
+    RET(curr) = n;
+#if TRACING_SYSRET
+    __cio_printf( "<-- %08x\n", n );
 #endif
 }
 
@@ -812,6 +1278,17 @@ void _sys_init( void ) {
     _syscalls[ SYS_getppid ]  = _sys_getppid;
     _syscalls[ SYS_gettime ]  = _sys_gettime;
     _syscalls[ SYS_getprio ]  = _sys_getprio;
+    _syscalls[ SYS_prezero ]  = _sys_prezero;
+    _syscalls[ SYS_brk ]      = _sys_brk;
+    _syscalls[ SYS_open ]     = _sys_open;
+    _syscalls[ SYS_close ]    = _sys_close;
+    _syscalls[ SYS_mmap ]     = _sys_mmap;
+    _syscalls[ SYS_munmap ]   = _sys_munmap;
+    _syscalls[ SYS_shm_create ] = _sys_shm_create;
+    _syscalls[ SYS_shm_map ]  = _sys_shm_map;
+    _syscalls[ SYS_setrt ]    = _sys_setrt;
+    _syscalls[ SYS_rtmisses ] = _sys_rtmisses;
+    _syscalls[ SYS_pread ]    = _sys_pread;
 
     // install the second-stage ISR
     __install_isr( INT_VEC_SYSCALL, _sys_isr );
@@ -836,6 +1313,15 @@ void _perform_exit( pcb_t *victim ) {
 
     // set its state
     victim->state = Zombie;
+    _sched_exit( victim );
+
+    // a zombie only needs its PCB, so give back its memory now
+    // rather than when it is collected
+    if( victim->pg_dir != NULL ) {
+        release_user_pages( victim->pg_dir );
+        _vm_free( &victim->vm );
+    }
+    _shm_drop( &victim->shm );
 
     /*
     ** We need to locate the parent of this process.  We also need
@@ -911,15 +1397,12 @@ void _perform_exit( pcb_t *victim ) {
         // may also want to return the exit status
         int32_t *ptr = (int32_t *) ARG(_init_pcb,1);
         if( ptr != NULL ) {
-            // *****************************************************
-            // Potential VM issue here!  This code assigns the exit
-            // status into a variable in the parent's address space.
-            // This works in the baseline because we aren't using
-            // any type of memory protection.  If address space
-            // separation is implemented, this code will very likely
-            // STOP WORKING, and will need to be fixed.
-            // *****************************************************
-            *ptr = zombie->exit_status;
+            // the status goes into the parent's address space, which
+            // may not be the current one; _sys_wait() made it writable,
+            // but it may have been paged out since
+            (void) _vm_touch( _init_pcb, (virt_addr) ptr, sizeof(int32_t), true );
+            (void) copy_to_pg_dir( _init_pcb->pg_dir, (virt_addr) ptr,
+                                   &zombie->exit_status, sizeof(int32_t) );
         }
 #if TRACING_EXIT
     __cio_printf( "--> perform exit, first zombie %d given to init\n",
@@ -940,15 +1423,12 @@ void _perform_exit( pcb_t *victim ) {
         // may also want to return the exit status
         int32_t *ptr = (int32_t *) ARG(parent,1);
         if( ptr != NULL ) {
-            // *****************************************************
-            // Potential VM issue here!  This code assigns the exit
-            // status into a variable in the parent's address space.
-            // This works in the baseline because we aren't using
-            // any type of memory protection.  If address space
-            // separation is implemented, this code will very likely
-            // STOP WORKING, and will need to be fixed.
-            // *****************************************************
-            *ptr = victim->exit_status;
+            // the status goes into the parent's address space, which
+            // may not be the current one; _sys_wait() made it writable,
+            // but it may have been paged out since
+            (void) _vm_touch( parent, (virt_addr) ptr, sizeof(int32_t), true );
+            (void) copy_to_pg_dir( parent->pg_dir, (virt_addr) ptr,
+                                   &victim->exit_status, sizeof(int32_t) );
         }
 #if TRACING_EXIT
     __cio_printf( "--> perform exit, victim %d given to parent %d\n",
@@ -12,14 +12,39 @@
 ** PRIVATE DEFINITIONS
 */
 
+// malloc() size classes:  blocks of 16, 32, ..., MALLOC_MAX bytes
+// (including the block header)
+#define MALLOC_MIN_SHIFT    4
+#define MALLOC_CLASSES      8
+#define MALLOC_MAX          (1 << (MALLOC_MIN_SHIFT + MALLOC_CLASSES - 1))
+
+// the heap is grown this much at a time for small blocks
+#define MALLOC_CHUNK        4096
+
 /*
 ** PRIVATE DATA TYPES
 */
 
+// header at the beginning of every malloc() block
+typedef struct mblock_s {
+    uint32_t size;              // bytes in the block, including this
+    struct mblock_s *next;      // next free block (only while free)
+} mblock_t;
+
 /*
 ** PRIVATE GLOBAL VARIABLES
 */
 
+// free small blocks, one list per size class
+//
+// every program image has its own copy of these; code linked into the
+// kernel image (e.g., init) would share them among all the processes
+// running it, so it mustn't use malloc()
+static mblock_t *_mfree[MALLOC_CLASSES];
+
+// free large blocks
+static mblock_t *_mbig;
+
 /*
 ** PUBLIC GLOBAL VARIABLES
 */
@@ -28,6 +53,32 @@
 ** PRIVATE FUNCTIONS
 */
 
+/**
+** _mrefill(c) - grow the heap and carve the new memory into blocks
+**               of one size class
+**
+** @param c  The size class
+**
+** @returns true on success
+*/
+static int _mrefill( int c ) {
+    uint32_t size = 1 << (MALLOC_MIN_SHIFT + c);
+
+    char *chunk = (char *) sbrk( MALLOC_CHUNK );
+    if( chunk == NULL ) {
+        return( 0 );
+    }
+
+    for( uint32_t off = 0; off + size <= MALLOC_CHUNK; off += size ) {
+        mblock_t *b = (mblock_t *) (chunk + off);
+        b->size = size;
+        b->next = _mfree[c];
+        _mfree[c] = b;
+    }
+
+    return( 1 );
+}
+
 /*
 ** PUBLIC FUNCTIONS
 */
@@ -160,6 +211,142 @@ int32_t swrite( const char *buf, uint32_t size ) {
    return( write(CHAN_SIO,buf,size) );
 }
 
+/**
+** shm_unmap(addr) - remove a mapping made by shm_map()
+**
+** Segments are ordinary mappings as far as the kernel is concerned.
+**
+** @param addr  The address shm_map() returned
+**
+** @returns The return value from calling munmap()
+*/
+int shm_unmap( void *addr ) {
+   return( munmap(addr) );
+}
+
+/*
+**********************************************
+** MEMORY ALLOCATION
+**********************************************
+*/
+
+/**
+** sbrk(incr) - grow (or shrink) the heap
+**
+** @param incr  Number of bytes to add to the heap (may be negative)
+**
+** @returns The old end of the heap (i.e., the start of the new
+**          memory), or NULL on failure
+*/
+void *sbrk( int32_t incr ) {
+    char *old = (char *) brk( NULL );
+    uint32_t top = (uint32_t) old + (uint32_t) incr;
+
+    // the break can't wrap around either end of the address space
+    if( (incr > 0 && top < (uint32_t) old) ||
+        (incr < 0 && top > (uint32_t) old) ) {
+        return( NULL );
+    }
+
+    if( incr != 0 && brk((void *) top) != (void *) top ) {
+        return( NULL );
+    }
+
+    return( old );
+}
+
+/**
+** malloc(size) - allocate memory from the heap
+**
+** Small requests are rounded up to a power-of-two size class, and
+** each class keeps its own free list, so both malloc() and free() are
+** a handful of instructions.  Large requests are rounded up to whole
+** pages; freed large blocks are reused (first fit, unsplit) before the
+** heap is grown for more.  Memory is never given back to the kernel.
+**
+** @param size  Number of bytes wanted
+**
+** @returns A pointer to the memory (8-byte aligned), or NULL
+*/
+void *malloc( uint32_t size ) {
+    uint32_t need = size + sizeof(mblock_t);
+    mblock_t *b;
+
+    if( size == 0 || need < size ) {
+        return( NULL );
+    }
+
+    if( need <= MALLOC_MAX ) {
+
+        // find the smallest class that fits
+        int c = 0;
+        while( (1U << (MALLOC_MIN_SHIFT + c)) < need ) {
+            ++c;
+        }
+
+        if( _mfree[c] == NULL && !_mrefill(c) ) {
+            return( NULL );
+        }
+        b = _mfree[c];
+        _mfree[c] = b->next;
+
+    } else {
+
+        // sbrk() takes a signed increment; anything bigger would
+        // shrink the heap instead
+        need = (need + MALLOC_CHUNK - 1) & ~(MALLOC_CHUNK - 1);
+        if( need < size || need > 0x7fffffff ) {
+            return( NULL );
+        }
+
+        mblock_t **pp = &_mbig;
+        while( *pp != NULL && (*pp)->size < need ) {
+            pp = &(*pp)->next;
+        }
+
+        if( *pp != NULL ) {
+            b = *pp;
+            *pp = b->next;
+        } else {
+            b = (mblock_t *) sbrk( (int32_t) need );
+            if( b == NULL ) {
+                return( NULL );
+            }
+            b->size = need;
+        }
+    }
+
+    b->next = NULL;
+    return( (void *) (b + 1) );
+}
+
+/**
+** free(ptr) - give back memory obtained from malloc()
+**
+** @param ptr   The memory to free (may be NULL)
+*/
+void free( void *ptr ) {
+
+    if( ptr == NULL ) {
+        return;
+    }
+
+    mblock_t *b = ((mblock_t *) ptr) - 1;
+
+    if( b->size > MALLOC_MAX ) {
+        b->next = _mbig;
+        _mbig = b;
+        return;
+    }
+
+    int c = 0;
+    while( (1U << (MALLOC_MIN_SHIFT + c)) < b->size ) {
+        ++c;
+    }
+    b->next = _mfree[c];
+    _mfree[c] = b;
+}
+
 /*
 **********************************************
 ** STRING MANIPULATION FUNCTIONS
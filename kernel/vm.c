@@ -0,0 +1,657 @@
+/**
+** @file vm.c
+**
+** @author CSCI-452 class of 20215
+**
+** Virtual memory area module implementation
+**
+** Each process has a list of areas describing the parts of its address
+** space which are filled in on demand.  Setting up an area costs no
+** memory at all; the first touch of a page in it causes a page fault,
+** and the fault handler asks this module to allocate a zeroed frame,
+** copy in whatever initial contents belong in that page, and map it.
+** Pages which are never touched (e.g., most of a large bss) are never
+** allocated.
+**
+** The kernel itself must never take a page fault (the ISR stubs are
+** not reentrant), so system calls use _vm_touch() to fill in any user
+** pages they are about to access before accessing them.
+*/
+
+#define SP_KERNEL_SRC
+
+#include "common.h"
+
+#include "bootstrap.h"
+#include "vm.h"
+#include "pgcache.h"
+#include "shm.h"
+#include "swap.h"
+#include "slab.h"
+#include "phys_alloc.h"
+#include "scheduler.h"
+
+/*
+** PRIVATE DEFINITIONS
+*/
+
+// the page containing an address
+#define PAGE_OF(a)  ((a) & ~(SZ_PAGE - 1))
+
+// the first page boundary at or above an address
+#define PAGE_UP(a)  PAGE_OF((a) + SZ_PAGE - 1)
+
+// the heap can grow up to where files are mapped
+#define HEAP_LIMIT  VM_MAP_BASE
+
+// and files are mapped up to the guard page below the stack
+#define MAP_LIMIT   (USER_STACK - SZ_PAGE)
+
+/*
+** PRIVATE DATA TYPES
+*/
+
+/*
+** PRIVATE GLOBAL VARIABLES
+*/
+
+// where area descriptors come from
+static slab_cache_t _vm_cache;
+
+// end of the kernel image - provided by the linker
+extern int _end;
+
+/*
+** PUBLIC GLOBAL VARIABLES
+*/
+
+/*
+** PRIVATE FUNCTIONS
+*/
+
+/**
+** _vm_populate_file(pcb,a,page) - fill in one page of a mapped file
+**
+** The page cache's frame is mapped directly, so every process mapping
+** the page shares it.  Writable mappings are private:  the frame is
+** mapped copy-on-write, and the first write gives the process its own
+** copy, leaving the cached page untouched.
+**
+** @param pcb    The process
+** @param a      The area mapping the file
+** @param page   The (page-aligned) address to fill in
+**
+** @return true if the page was filled in and mapped
+*/
+static bool_t _vm_populate_file( pcb_t *pcb, vm_area_t *a, virt_addr page ) {
+    uint32_t index = (a->offset + (page - a->start)) / SZ_PAGE;
+
+    phys_addr frame = _pgc_get( &a->file, index );
+    if( frame == 0 ) {
+        return( false );
+    }
+
+    uint32_t flags = (a->flags & VM_WRITE) ? MAP_COW : 0;
+    if( !map_range(pcb->pg_dir, page, frame, SZ_PAGE, flags) ) {
+        unref_frame( frame );
+        return( false );
+    }
+
+    return( true );
+}
+
+/**
+** _vm_populate_shm(pcb,a,page) - fill in one page of a shared memory
+**                                segment
+**
+** @param pcb    The process
+** @param a      The area mapping the segment
+** @param page   The (page-aligned) address to fill in
+**
+** @return true if the page was filled in and mapped
+*/
+static bool_t _vm_populate_shm( pcb_t *pcb, vm_area_t *a, virt_addr page ) {
+
+    phys_addr frame = _shm_frame( a->shm, (page - a->start) / SZ_PAGE );
+    if( frame == 0 ) {
+        return( false );
+    }
+
+    if( !map_range(pcb->pg_dir, page, frame, SZ_PAGE, MAP_WRITE | MAP_SHARED) ) {
+        unref_frame( frame );
+        return( false );
+    }
+
+    return( true );
+}
+
+/**
+** _vm_gap(pcb,size) - find room for a mapping
+**
+** First fit, between VM_MAP_BASE and the guard page below the stack.
+**
+** @param pcb    The process
+** @param size   Size of the mapping (a multiple of SZ_PAGE)
+**
+** @return the address of the gap, or 0
+*/
+static virt_addr _vm_gap( pcb_t *pcb, uint32_t size ) {
+    virt_addr addr = VM_MAP_BASE;
+
+    if( size == 0 || size > MAP_LIMIT - VM_MAP_BASE ) {
+        return( 0 );
+    }
+
+    // move past any area in the way until none is
+    vm_area_t *a = pcb->vm;
+    while( a != NULL ) {
+        if( addr > MAP_LIMIT - size ) {
+            return( 0 );
+        }
+        if( a->start < addr + size && a->end > addr ) {
+            addr = PAGE_UP( a->end );
+            a = pcb->vm;
+        } else {
+            a = a->next;
+        }
+    }
+
+    return( addr > MAP_LIMIT - size ? 0 : addr );
+}
+
+/**
+** _vm_populate(pcb,page) - fill in one page of an address space
+**
+** More than one area may share a page (e.g., the end of one program
+** segment and the start of the next), so every area overlapping the
+** page contributes its part of the contents.  A page which was paged
+** out is read back from swap.
+**
+** @param pcb    The process
+** @param page   The (page-aligned) address to fill in
+**
+** @return true if the page was filled in and mapped
+*/
+static bool_t _vm_populate( pcb_t *pcb, virt_addr page ) {
+    phys_addr frame = 0;
+    uint8_t *dst = NULL;
+    bool_t writable = false;
+
+    // a page that was paged out comes back from swap instead
+    if( _swap_has(pcb->pg_dir, page) ) {
+        for( vm_area_t *a = pcb->vm; a != NULL; a = a->next ) {
+            if( a->start < page + SZ_PAGE && a->end > page &&
+                    (a->flags & VM_WRITE) ) {
+                writable = true;
+            }
+        }
+        return( _swap_in(pcb->pg_dir, page, writable) );
+    }
+
+    for( vm_area_t *a = pcb->vm; a != NULL; a = a->next ) {
+
+        // skip areas which don't overlap this page
+        if( a->end <= page || a->start >= page + SZ_PAGE ) {
+            continue;
+        }
+
+        // mappings are page-aligned, so they have the page to themselves
+        if( a->file.cluster != 0 ) {
+            assert1( frame == 0 );
+            return( _vm_populate_file(pcb, a, page) );
+        }
+        if( a->shm != NULL ) {
+            assert1( frame == 0 );
+            return( _vm_populate_shm(pcb, a, page) );
+        }
+
+        if( frame == 0 ) {
+            frame = alloc_zeroed_frame();
+            if( frame == 0 ) {
+                return( false );
+            }
+            dst = (uint8_t *) kmap( frame );
+        }
+
+        if( a->flags & VM_WRITE ) {
+            writable = true;
+        }
+
+        // copy whatever part of the initial contents lies in this page;
+        // the source (the loaded program image) is identity mapped
+        virt_addr from = a->start > page ? a->start : page;
+        virt_addr to = a->start + a->src_len;
+        if( to > page + SZ_PAGE ) {
+            to = page + SZ_PAGE;
+        }
+        if( from < to ) {
+            __memcpy( dst + (from - page),
+                      (void *) (a->src + (from - a->start)), to - from );
+        }
+    }
+
+    // not part of any area
+    if( frame == 0 ) {
+        return( false );
+    }
+    kunmap( dst );
+
+    if( !map_page(pcb->pg_dir, page, frame, writable) ) {
+        free_frame( frame );
+        return( false );
+    }
+
+    return( true );
+}
+
+/*
+** PUBLIC FUNCTIONS
+*/
+
+/**
+** _vm_init() - initialize the VM area module
+**
+** Dependencies:
+**    Cannot be called before kmem is initialized
+**    Must be called before any process creation can be done
+*/
+void _vm_init( void ) {
+
+    __cio_puts( " VM:" );
+
+    _vm_cache = _slab_create( "vm_area", sizeof(vm_area_t), NULL );
+    assert( _vm_cache != NULL );
+
+    __cio_puts( " done" );
+}
+
+/**
+** _vm_add() - add a lazily populated area to an address space
+**
+** @param list     The address space's area list
+** @param start    First byte of the area
+** @param size     Size of the area, in bytes
+** @param src      Initial contents of the area, or 0
+** @param src_len  Bytes of initial contents (the rest is zero-filled)
+** @param flags    VM_* flags
+**
+** @return status of the operation
+*/
+status_t _vm_add( vm_area_t **list, virt_addr start, uint32_t size,
+                  phys_addr src, uint32_t src_len, uint32_t flags ) {
+
+    // areas must lie entirely within the user part of the address space
+    if( size == 0 || src_len > size || start < USER_VIRT_BASE ||
+            start >= USER_VIRT_LIMIT || size > USER_VIRT_LIMIT - start ) {
+        return( E_BAD_PARAM );
+    }
+
+    vm_area_t *a = (vm_area_t *) _slab_alloc( _vm_cache );
+    if( a == NULL ) {
+        return( E_NO_MEM );
+    }
+
+    a->start = start;
+    a->end = start + size;
+    a->src = src;
+    a->src_len = src_len;
+    a->flags = flags;
+    a->file.cluster = 0;
+    a->file.size = 0;
+    a->offset = 0;
+    a->shm = NULL;
+
+    a->next = *list;
+    *list = a;
+
+    return( E_SUCCESS );
+}
+
+/**
+** _vm_copy() - duplicate an area list (e.g., for fork)
+**
+** @param list     The list to copy
+** @param copy     The new list is returned here
+**
+** @return status of the operation
+*/
+status_t _vm_copy( vm_area_t *list, vm_area_t **copy ) {
+    vm_area_t **tail = copy;
+
+    *copy = NULL;
+
+    for( vm_area_t *a = list; a != NULL; a = a->next ) {
+        vm_area_t *n = (vm_area_t *) _slab_alloc( _vm_cache );
+        if( n == NULL ) {
+            _vm_free( copy );
+            return( E_NO_MEM );
+        }
+        *n = *a;
+        n->next = NULL;
+        if( n->shm != NULL ) {
+            _shm_hold( n->shm );
+        }
+        *tail = n;
+        tail = &n->next;
+    }
+
+    return( E_SUCCESS );
+}
+
+/**
+** _vm_free() - release every area in a list
+**
+** @param list     The list to release; it is left empty
+*/
+void _vm_free( vm_area_t **list ) {
+    vm_area_t *a = *list;
+
+    while( a != NULL ) {
+        vm_area_t *next = a->next;
+        if( a->shm != NULL ) {
+            _shm_release( a->shm );
+        }
+        _slab_free( _vm_cache, a );
+        a = next;
+    }
+
+    *list = NULL;
+}
+
+/**
+** _vm_heap() - set up an empty heap for a process
+**
+** The heap starts at the first page boundary above all of the areas
+** the process has so far (i.e., its program image), and is empty.
+**
+** @param pcb      The process
+*/
+void _vm_heap( pcb_t *pcb ) {
+    virt_addr top = USER_VIRT_BASE;
+
+    for( vm_area_t *a = pcb->vm; a != NULL; a = a->next ) {
+        if( a->end > top ) {
+            top = a->end;
+        }
+    }
+
+    pcb->heap = pcb->brk = PAGE_UP( top );
+}
+
+/**
+** _vm_brk() - move the end of a process' heap
+**
+** The heap is a single zero-filled area from the start of the heap
+** up to the page containing the break.  Growing it just makes the
+** area bigger; its pages are filled in as they are touched.  Pages
+** given up by shrinking it are released right away.
+**
+** @param pcb      The process
+** @param brk      The new break
+**
+** @return status of the operation
+*/
+status_t _vm_brk( pcb_t *pcb, virt_addr brk ) {
+
+    if( brk < pcb->heap || brk > HEAP_LIMIT ) {
+        return( E_BAD_PARAM );
+    }
+
+    virt_addr old_end = PAGE_UP( pcb->brk );
+    virt_addr new_end = PAGE_UP( brk );
+
+    if( new_end != old_end ) {
+
+        // find the heap's area, if it has one
+        vm_area_t **pp = &pcb->vm;
+        while( *pp != NULL && (*pp)->start != pcb->heap ) {
+            pp = &(*pp)->next;
+        }
+
+        if( new_end == pcb->heap ) {
+            // empty heaps have no area
+            if( *pp != NULL ) {
+                vm_area_t *a = *pp;
+                *pp = a->next;
+                _slab_free( _vm_cache, a );
+            }
+        } else if( *pp == NULL ) {
+            status_t status = _vm_add( &pcb->vm, pcb->heap,
+                                       new_end - pcb->heap, 0, 0, VM_WRITE );
+            if( status != E_SUCCESS ) {
+                return( status );
+            }
+        } else {
+            (*pp)->end = new_end;
+        }
+
+        if( new_end < old_end ) {
+            release_range( pcb->pg_dir, new_end, old_end - new_end );
+        }
+    }
+
+    pcb->brk = brk;
+
+    return( E_SUCCESS );
+}
+
+/**
+** _vm_map() - map part of a file into a process' address space
+**
+** The mapping goes in the first gap big enough for it between
+** VM_MAP_BASE and the guard page below the stack.  Nothing is read
+** until the pages are touched.
+**
+** @param pcb      The process
+** @param file     The file
+** @param offset   Where in the file to start (page-aligned)
+** @param len      How many bytes to map
+** @param flags    VM_* flags
+**
+** @return the address of the mapping, or 0
+*/
+virt_addr _vm_map( pcb_t *pcb, file_t *file, uint32_t offset,
+                   uint32_t len, uint32_t flags ) {
+
+    if( PAGE_OF(offset) != offset || len > MAP_LIMIT ) {
+        return( 0 );
+    }
+
+    uint32_t size = PAGE_UP( len );
+    virt_addr addr = _vm_gap( pcb, size );
+    if( addr == 0 ) {
+        return( 0 );
+    }
+
+    if( _vm_add(&pcb->vm, addr, size, 0, 0, flags) != E_SUCCESS ) {
+        return( 0 );
+    }
+    pcb->vm->file = *file;
+    pcb->vm->offset = offset;
+
+    return( addr );
+}
+
+/**
+** _vm_map_shm() - map a shared memory segment into a process'
+**                 address space
+**
+** The mapping goes in the first gap big enough for it, like a file
+** mapping, and its pages are filled in as they are touched.
+**
+** @param pcb      The process
+** @param shm      The segment
+**
+** @return the address of the mapping, or 0
+*/
+virt_addr _vm_map_shm( pcb_t *pcb, shm_t *shm ) {
+
+    virt_addr addr = _vm_gap( pcb, shm->size );
+    if( addr == 0 ) {
+        return( 0 );
+    }
+
+    if( _vm_add(&pcb->vm, addr, shm->size, 0, 0, VM_WRITE) != E_SUCCESS ) {
+        return( 0 );
+    }
+    pcb->vm->shm = shm;
+    _shm_hold( shm );
+
+    return( addr );
+}
+
+/**
+** _vm_remove() - remove an area from a process' address space
+**
+** Only for areas which don't share pages with any other (e.g., mapped
+** files and shared memory); the area's pages are released right away.
+**
+** @param pcb      The process
+** @param start    First byte of the area
+**
+** @return status of the operation
+*/
+status_t _vm_remove( pcb_t *pcb, virt_addr start ) {
+    vm_area_t **pp = &pcb->vm;
+
+    while( *pp != NULL && (*pp)->start != start ) {
+        pp = &(*pp)->next;
+    }
+
+    if( *pp == NULL ) {
+        return( E_NOT_FOUND );
+    }
+
+    vm_area_t *a = *pp;
+    *pp = a->next;
+    release_range( pcb->pg_dir, a->start, a->end - a->start );
+    if( a->shm != NULL ) {
+        _shm_release( a->shm );
+    }
+    _slab_free( _vm_cache, a );
+
+    return( E_SUCCESS );
+}
+
+/**
+** _vm_fault() - fill in a not-present page of the current process
+**
+** Called from the page fault handler.
+**
+** @param virt     The faulting address
+**
+** @return true if the page is now present
+*/
+bool_t _vm_fault( virt_addr virt ) {
+
+    // only the running process' areas describe this address space
+    if( _current == NULL || _current->pg_dir != get_current_pg_dir() ) {
+        return( false );
+    }
+
+    return( _vm_populate(_current, PAGE_OF(virt)) );
+}
+
+/**
+** _vm_user_range() - check that a range is one a process may hand to
+**                    the kernel
+**
+** Only the user part of the address space qualifies.  The one program
+** linked into the kernel (init, and its children until they exec) has
+** its strings and buffers in the kernel image, so it may use those;
+** it is the only one running code there.
+**
+** @param pcb      The process
+** @param first    Start of the range
+** @param last     Last byte of the range
+**
+** @return true if the range is acceptable
+*/
+static bool_t _vm_user_range( pcb_t *pcb, virt_addr first, virt_addr last ) {
+
+    if( first >= USER_VIRT_BASE && last < USER_VIRT_LIMIT ) {
+        return( true );
+    }
+
+    return( REG(pcb,eip) < USER_VIRT_BASE && first >= TARGET_ADDRESS &&
+            last < (virt_addr) &_end );
+}
+
+/**
+** _vm_touch() - make a range of a process' memory safe for the
+**               kernel to access
+**
+** Ranges outside the process' own memory (see _vm_user_range) are
+** refused.
+**
+** @param pcb      The process
+** @param virt     Start of the range
+** @param len      Length of the range, in bytes
+** @param write    Whether the kernel will be writing to the range
+**
+** @return true if the whole range is accessible
+*/
+bool_t _vm_touch( pcb_t *pcb, virt_addr virt, uint32_t len, bool_t write ) {
+
+    if( len == 0 ) {
+        return( true );
+    }
+
+    virt_addr page = PAGE_OF( virt );
+    virt_addr last = PAGE_OF( virt + len - 1 );
+
+    // the range can't wrap around the end of memory, or reach into
+    // the kernel
+    if( last < page || !_vm_user_range(pcb, virt, virt + len - 1) ) {
+        return( false );
+    }
+
+    for(;;) {
+        if( !is_mapped(pcb->pg_dir, page) && !_vm_populate(pcb, page) ) {
+            return( false );
+        }
+        if( write ) {
+            if( !cow_break(pcb->pg_dir, page) ||
+                    !is_writable(pcb->pg_dir, page) ) {
+                return( false );
+            }
+        }
+        if( page == last ) {
+            return( true );
+        }
+        page += SZ_PAGE;
+    }
+}
+
+/**
+** _vm_touch_str() - _vm_touch() a NUL-terminated string for reading
+**
+** @param pcb      The process
+** @param str      The string
+**
+** @return true if the whole string is accessible
+*/
+bool_t _vm_touch_str( pcb_t *pcb, const char *str ) {
+    virt_addr p = (virt_addr) str;
+
+    for(;;) {
+        // the rest of this page is searched, so all of it must pass
+        virt_addr end = PAGE_OF( p ) + SZ_PAGE;
+        if( !_vm_touch(pcb, p, end - p, false) ) {
+            return( false );
+        }
+
+        // look for the end of the string in this page
+        while( p != end ) {
+            if( *(const char *) p == '\0' ) {
+                return( true );
+            }
+            ++p;
+        }
+
+        // ran off the end of memory
+        if( end == 0 ) {
+            return( false );
+        }
+    }
+}
@@ -0,0 +1,504 @@
+/**
+** @file zswap.c
+**
+** @author CSCI-452 class of 20215
+**
+** Compressed swap module implementation
+**
+** The swap code tries this before going to disk:  a page being paged
+** out is compressed and kept in memory, and decompressed when it is
+** touched again.  The pages of our programs are small and mostly
+** zeroes, so they shrink a lot, and no disk is needed at all.
+**
+** Pages which are a single repeated word (most often, all zeroes) are
+** recorded as just that word.  Others are compressed with a small
+** LZ77 coder (see _lz_compress), and pages which don't shrink to
+** ZS_MAX_LEN bytes are left for the disk.
+**
+** Compressed pages are packed one after another into frames of their
+** own ("zpages"); a zpage is freed when every page in it is gone.
+** Reclaim only runs when memory has run out, so there is nowhere to
+** get a new zpage from; instead, the frame being paged out becomes the
+** new zpage, holding its own compressed contents, and the next page
+** paged out is packed in after it.  The swap code just keeps going
+** until a frame has actually been freed.
+**
+** A compressed page is named by a swap slot number (ZS_SLOT and up),
+** so the swap code treats it like any other paged-out page, and has
+** a reference count, because fork() copies paged-out ptes.
+*/
+
+#define SP_KERNEL_SRC
+
+#include "common.h"
+
+#include "zswap.h"
+#include "swap.h"
+#include "phys_alloc.h"
+#include "kmem.h"
+
+/*
+** PRIVATE DEFINITIONS
+*/
+
+// pages which don't compress to this size are not worth keeping
+#define ZS_MAX_LEN      (SZ_PAGE * 3 / 4)
+
+// no zpage / no object
+#define ZS_NONE         0xffff
+
+// the coder: matches are 3..LZ_MAX_LEN bytes, up to LZ_MAX_OFF back
+#define LZ_MIN_LEN      3
+#define LZ_MAX_LEN      (LZ_MIN_LEN + 15 + 255)
+#define LZ_MAX_OFF      4096
+#define LZ_HASH_BITS    12
+#define LZ_HASH(p)      (((((uint32_t) (p)[0]) | ((p)[1] << 8) | ((p)[2] << 16)) \
+                            * 2654435761U) >> (32 - LZ_HASH_BITS))
+
+/*
+** PRIVATE DATA TYPES
+*/
+
+// a compressed page
+typedef struct zobj_s {
+    uint32_t where;             // zpage << 16 | offset, or the fill word
+    uint16_t len;               // compressed length (0: a single word)
+    uint8_t refs;               // references (0: a free entry)
+    uint8_t filler;
+} zobj_t;
+
+// a frame holding compressed pages
+typedef struct zpage_s {
+    phys_addr frame;            // the frame (0: a free entry)
+    uint16_t used;              // bytes handed out so far
+    uint16_t live;              // compressed pages still in it
+} zpage_t;
+
+/*
+** PRIVATE GLOBAL VARIABLES
+*/
+
+// the compressed pages, and where to look for a free entry
+static zobj_t *_zobjs;
+static uint32_t _zobj_hint;
+
+// the frames holding them
+static zpage_t _zpages[ZS_PAGES];
+
+// compressor work space
+static uint16_t _lz_table[1 << LZ_HASH_BITS];
+static uint8_t _lz_buf[ZS_MAX_LEN];
+
+// statistics
+static uint32_t _zs_pages;      // compressed pages held
+static uint32_t _zs_frames;     // zpages in use
+static uint32_t _zs_bytes;      // compressed bytes held
+static uint32_t _zs_stores;
+static uint32_t _zs_loads;
+static uint32_t _zs_filled;     // single-word pages stored
+static uint32_t _zs_rejects;    // pages which wouldn't compress
+
+/*
+** PUBLIC GLOBAL VARIABLES
+*/
+
+/*
+** PRIVATE FUNCTIONS
+*/
+
+/**
+** _lz_compress() - compress a buffer
+**
+** The output is a series of groups:  a control byte, then eight items,
+** each a literal byte (control bit 0) or a match (control bit 1).  A
+** match is two bytes, the offset back (less 1) in the top 12 bits and
+** the length (less LZ_MIN_LEN) in the bottom 4; a length field of 15
+** is followed by a byte to add to it.  Matches are found through a
+** hash table of the last position each three-byte sequence was seen.
+**
+** @param src    The data
+** @param n      Its length
+** @param dst    Where to put the compressed data
+** @param limit  The most compressed data wanted
+**
+** @return the compressed length, or 0 if it would be over the limit
+*/
+static uint32_t _lz_compress( const uint8_t *src, uint32_t n,
+                              uint8_t *dst, uint32_t limit ) {
+    uint32_t i = 0, o = 0;
+    uint32_t ctl = 0, bits = 8;
+
+    __memclr( _lz_table, sizeof(_lz_table) );
+
+    while( i < n ) {
+
+        // start a new group
+        if( bits == 8 ) {
+            if( o >= limit ) {
+                return( 0 );
+            }
+            ctl = o++;
+            dst[ctl] = 0;
+            bits = 0;
+        }
+
+        // look for an earlier copy of what's here
+        uint32_t len = 0, off = 0;
+        if( i + LZ_MIN_LEN <= n ) {
+            uint32_t h = LZ_HASH( src + i );
+            uint32_t c = _lz_table[h];      // position + 1, or 0
+            _lz_table[h] = i + 1;
+            if( c != 0 && i - (c - 1) <= LZ_MAX_OFF ) {
+                uint32_t max = n - i < LZ_MAX_LEN ? n - i : LZ_MAX_LEN;
+                c -= 1;
+                while( len < max && src[c + len] == src[i + len] ) {
+                    ++len;
+                }
+                off = i - c;
+            }
+        }
+
+        if( len >= LZ_MIN_LEN ) {
+            uint32_t extra = len - LZ_MIN_LEN;
+            uint32_t code = ((off - 1) << 4) | (extra < 15 ? extra : 15);
+            if( o + (extra < 15 ? 2 : 3) > limit ) {
+                return( 0 );
+            }
+            dst[ctl] |= 1 << bits;
+            dst[o++] = code >> 8;
+            dst[o++] = code & 0xff;
+            if( extra >= 15 ) {
+                dst[o++] = extra - 15;
+            }
+            i += len;
+        } else {
+            if( o >= limit ) {
+                return( 0 );
+            }
+            dst[o++] = src[i++];
+        }
+        ++bits;
+    }
+
+    return( o );
+}
+
+/**
+** _lz_decompress() - decompress a buffer made by _lz_compress()
+**
+** @param src    The compressed data
+** @param len    Its length
+** @param dst    Where to put the data
+** @param n      The length of the data
+**
+** @return true if the compressed data was good
+*/
+static bool_t _lz_decompress( const uint8_t *src, uint32_t len,
+                              uint8_t *dst, uint32_t n ) {
+    uint32_t i = 0, o = 0;
+    uint32_t ctl = 0, bits = 8;
+
+    while( o < n ) {
+
+        if( bits == 8 ) {
+            if( i >= len ) {
+                return( false );
+            }
+            ctl = src[i++];
+            bits = 0;
+        }
+
+        if( ctl & (1 << bits) ) {
+            if( i + 2 > len ) {
+                return( false );
+            }
+            uint32_t code = (src[i] << 8) | src[i + 1];
+            i += 2;
+            uint32_t off = (code >> 4) + 1;
+            uint32_t m = (code & 15) + LZ_MIN_LEN;
+            if( (code & 15) == 15 ) {
+                if( i >= len ) {
+                    return( false );
+                }
+                m += src[i++];
+            }
+            if( off > o || m > n - o ) {
+                return( false );
+            }
+            // byte by byte, as the copy may overlap itself
+            for( ; m > 0; --m, ++o ) {
+                dst[o] = dst[o - off];
+            }
+        } else {
+            if( i >= len ) {
+                return( false );
+            }
+            dst[o++] = src[i++];
+        }
+        ++bits;
+    }
+
+    return( true );
+}
+
+/**
+** _zobj_alloc() - allocate a compressed page entry
+**
+** @return the entry's index, or ZS_NONE
+*/
+static uint32_t _zobj_alloc( void ) {
+
+    for( uint32_t i = 0; i < ZS_OBJS; ++i ) {
+        uint32_t n = (_zobj_hint + i) % ZS_OBJS;
+        if( _zobjs[n].refs == 0 ) {
+            _zobj_hint = n + 1;
+            return( n );
+        }
+    }
+
+    return( ZS_NONE );
+}
+
+/**
+** _zpage_find() - find room for some compressed data
+**
+** @param len    Bytes needed
+**
+** @return the index of a zpage with room, or ZS_NONE
+*/
+static uint32_t _zpage_find( uint32_t len ) {
+
+    for( uint32_t i = 0; i < ZS_PAGES; ++i ) {
+        if( _zpages[i].frame != 0 && SZ_PAGE - _zpages[i].used >= len ) {
+            return( i );
+        }
+    }
+
+    return( ZS_NONE );
+}
+
+/**
+** _zpage_add() - start a new zpage
+**
+** @param frame  The frame to use
+**
+** @return the index of the new zpage, or ZS_NONE
+*/
+static uint32_t _zpage_add( phys_addr frame ) {
+
+    for( uint32_t i = 0; i < ZS_PAGES; ++i ) {
+        if( _zpages[i].frame == 0 ) {
+            _zpages[i].frame = frame;
+            _zpages[i].used = 0;
+            _zpages[i].live = 0;
+            ++_zs_frames;
+            return( i );
+        }
+    }
+
+    return( ZS_NONE );
+}
+
+/*
+** PUBLIC FUNCTIONS
+*/
+
+/**
+** _zs_init() - initialize the compressed swap module
+**
+** Dependencies:
+**    Cannot be called before kmem is initialized
+*/
+void _zs_init( void ) {
+
+    __cio_puts( " Zswap:" );
+
+    _zobjs = (zobj_t *) kmalloc( ZS_OBJS * sizeof(zobj_t) );
+    if( _zobjs == NULL ) {
+        WARNING( "no memory for compressed swap" );
+        return;
+    }
+    __memclr( _zobjs, ZS_OBJS * sizeof(zobj_t) );
+
+    __cio_puts( " done" );
+}
+
+/**
+** _zs_enabled() - check whether compressed swap can be used
+**
+** @return true if it can
+*/
+bool_t _zs_enabled( void ) {
+    return( _zobjs != NULL );
+}
+
+/**
+** _zs_store() - compress a page
+**
+** @param frame    The frame holding the page
+** @param kept     Set to true if the frame was kept to hold the data
+**
+** @return the swap slot number for the page, or SWAP_NONE
+*/
+uint32_t _zs_store( phys_addr frame, bool_t *kept ) {
+
+    *kept = false;
+
+    if( _zobjs == NULL ) {
+        return( SWAP_NONE );
+    }
+
+    uint32_t n = _zobj_alloc();
+    if( n == ZS_NONE ) {
+        return( SWAP_NONE );
+    }
+    zobj_t *z = &_zobjs[n];
+
+    uint8_t *src = (uint8_t *) kmap( frame );
+
+    // a page of a single repeated word needs no space at all
+    uint32_t *w = (uint32_t *) src;
+    uint32_t i = 1;
+    while( i < SZ_PAGE / sizeof(uint32_t) && w[i] == w[0] ) {
+        ++i;
+    }
+    if( i == SZ_PAGE / sizeof(uint32_t) ) {
+        z->where = w[0];
+        z->len = 0;
+        z->refs = 1;
+        kunmap( src );
+        ++_zs_pages;
+        ++_zs_stores;
+        ++_zs_filled;
+        return( ZS_SLOT + n );
+    }
+
+    uint32_t len = _lz_compress( src, SZ_PAGE, _lz_buf, ZS_MAX_LEN );
+    kunmap( src );
+
+    if( len == 0 ) {
+        ++_zs_rejects;
+        return( SWAP_NONE );
+    }
+
+    // no room anywhere, so this frame becomes a zpage
+    uint32_t p = _zpage_find( len );
+    if( p == ZS_NONE ) {
+        p = _zpage_add( frame );
+        if( p == ZS_NONE ) {
+            return( SWAP_NONE );
+        }
+        *kept = true;
+    }
+    zpage_t *zp = &_zpages[p];
+
+    uint8_t *dst = (uint8_t *) kmap( zp->frame );
+    __memcpy( dst + zp->used, _lz_buf, len );
+    kunmap( dst );
+
+    z->where = (p << 16) | zp->used;
+    z->len = len;
+    z->refs = 1;
+
+    // keep the pieces word-aligned
+    zp->used += (len + 3) & ~3;
+    if( zp->used > SZ_PAGE ) {
+        zp->used = SZ_PAGE;
+    }
+    ++zp->live;
+
+    ++_zs_pages;
+    ++_zs_stores;
+    _zs_bytes += len;
+
+    return( ZS_SLOT + n );
+}
+
+/**
+** _zs_load() - decompress a page
+**
+** @param slot     The page's swap slot number
+** @param frame    The frame to decompress it into
+**
+** @return true if the page was decompressed
+*/
+bool_t _zs_load( uint32_t slot, phys_addr frame ) {
+    zobj_t *z = &_zobjs[slot - ZS_SLOT];
+    bool_t ok = true;
+
+    assert1( slot - ZS_SLOT < ZS_OBJS && z->refs > 0 );
+
+    uint8_t *dst = (uint8_t *) kmap( frame );
+
+    if( z->len == 0 ) {
+        uint32_t *w = (uint32_t *) dst;
+        for( uint32_t i = 0; i < SZ_PAGE / sizeof(uint32_t); ++i ) {
+            w[i] = z->where;
+        }
+    } else {
+        zpage_t *zp = &_zpages[z->where >> 16];
+        uint8_t *src = (uint8_t *) kmap( zp->frame );
+        ok = _lz_decompress( src + (z->where & 0xffff), z->len, dst, SZ_PAGE );
+        kunmap( src );
+    }
+
+    kunmap( dst );
+
+    if( !ok ) {
+        WARNING( "bad compressed page" );
+        return( false );
+    }
+
+    ++_zs_loads;
+    return( true );
+}
+
+/**
+** _zs_dup() - add a reference to a compressed page
+**
+** @param slot     The page's swap slot number
+*/
+void _zs_dup( uint32_t slot ) {
+    zobj_t *z = &_zobjs[slot - ZS_SLOT];
+
+    assert1( slot - ZS_SLOT < ZS_OBJS && z->refs > 0 );
+    ++z->refs;
+}
+
+/**
+** _zs_put() - drop a reference to a compressed page
+**
+** @param slot     The page's swap slot number
+*/
+void _zs_put( uint32_t slot ) {
+    zobj_t *z = &_zobjs[slot - ZS_SLOT];
+
+    assert1( slot - ZS_SLOT < ZS_OBJS && z->refs > 0 );
+
+    if( --z->refs > 0 ) {
+        return;
+    }
+
+    --_zs_pages;
+    if( z->len == 0 ) {
+        return;
+    }
+    _zs_bytes -= z->len;
+
+    // the last page in a zpage frees it
+    zpage_t *zp = &_zpages[z->where >> 16];
+    if( --zp->live == 0 ) {
+        free_frame( zp->frame );
+        zp->frame = 0;
+        --_zs_frames;
+    }
+}
+
+/**
+** _zs_dump() - print the compressed swap statistics on the console
+*/
+void _zs_dump( void ) {
+    __cio_printf( "zswap: %d pages (%d bytes) in %d frames; stored %d (%d filled, %d rejected), loaded %d\n",
+                  _zs_pages, _zs_bytes, _zs_frames,
+                  _zs_stores, _zs_filled, _zs_rejects, _zs_loads );
+}
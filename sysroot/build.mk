@@ -12,8 +12,10 @@ $(BUILD_DIR)/sysroot/%.o: sysroot/%.c
 	@mkdir -p $(@D)
 	$(CC) $(CFLAGS) -o $(@D)/$(*F).o -c sysroot/$(*F).c
 
+# the images are loaded whole (see usb.img in the Makefile), so the
+# symbols are left out
 $(BUILD_DIR)/sysroot/%.elf: $(BUILD_DIR)/sysroot/%.o $(USER_OBJECTS)
-	$(LD) -melf_i386 -pie -o $(@D)/$(*F).elf -Ttext 0x12345000 $(USER_OBJECTS) $(BUILD_DIR)/sysroot/$(*F).o
+	$(LD) -melf_i386 -pie -s -o $(@D)/$(*F).elf -Ttext 0x12345000 $(USER_OBJECTS) $(BUILD_DIR)/sysroot/$(*F).o
 
 idle: $(BUILD_DIR)/sysroot/idle.elf
 main1: $(BUILD_DIR)/sysroot/main1.elf
@@ -34,5 +36,9 @@ userW: $(BUILD_DIR)/sysroot/userW.elf
 userX: $(BUILD_DIR)/sysroot/userX.elf
 userY: $(BUILD_DIR)/sysroot/userY.elf
 userZ: $(BUILD_DIR)/sysroot/userZ.elf
+tmalloc: $(BUILD_DIR)/sysroot/tmalloc.elf
+tmmap: $(BUILD_DIR)/sysroot/tmmap.elf
+tshm: $(BUILD_DIR)/sysroot/tshm.elf
+trt: $(BUILD_DIR)/sysroot/trt.elf
 
-user: idle main1 main2 main3 main4 main5 main6 userH userI userJ userP userQ userR userS userV userW userX userY userZ
\ No newline at end of file
+user: idle main1 main2 main3 main4 main5 main6 userH userI userJ userP userQ userR userS userV userW userX userY userZ tmalloc tmmap tshm trt
\ No newline at end of file
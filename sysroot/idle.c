@@ -6,9 +6,12 @@
 #include "ulib.h"
 
 /**
-** Idle process:  write, getpid, gettime, exit
+** Idle process:  write, getpid, gettime, prezero, exit
 **
 ** Reports itself, then loops forever delaying and printing a character.
+** Between characters, it clears frames for the kernel's stock of zeroed
+** pages a batch at a time, halting until the next interrupt after each
+** batch so that it never holds the CPU for long.
 **
 ** Invoked as:  idle
 */
@@ -37,6 +40,9 @@ int32_t main( int argc, char *argv[] ) {
     // for dispatching when we need to pick a new current process
 
     for(;;) {
+        while( prezero() > 0 ) {
+            __asm__ __volatile__( "hlt" );
+        }
         DELAY(LONG);
         write( CHAN_SIO, &ch, 1 );
     }
@@ -0,0 +1,171 @@
+#ifndef T_MALLOC_H_
+#define T_MALLOC_H_
+
+#include "users.h"
+#include "ulib.h"
+
+/**
+** Test tmalloc:  exit, write, brk (through sbrk, malloc and free)
+**
+** Checks sbrk(), then allocates and frees blocks of many sizes over
+** and over, filling each one and checking it is intact when it is
+** freed; reports PASS or FAIL
+**
+** Invoked as:  tmalloc  x  [ n ]
+**   where x is the ID character
+**         n is the number of rounds (defaults to 20)
+*/
+
+// how many blocks are held at once
+#define N_BLOCKS    64
+
+// largest block asked for (well past the biggest size class)
+#define BIG_BLOCK   6000
+
+static uint32_t seed = 12345;
+
+// a little pseudo-random number generator, so the runs repeat
+static uint32_t next( void ) {
+    seed = seed * 1103515245 + 12345;
+    return( (seed >> 16) & 0x7fff );
+}
+
+int32_t main( int argc, char *argv[] ) {
+    int count = 20;   // default round count
+    char ch = 'm';    // default character to print
+    char buf[128];
+    char *blocks[N_BLOCKS];
+    uint32_t sizes[N_BLOCKS];
+    int fails = 0;
+
+    // process the command-line arguments
+    if( argc < 2 ) {
+        bad_args( "tmalloc", 2, argc, argv );
+    } else {
+        ch = argv[1][0];
+        if( argc > 2 ) {
+            count = str2int( argv[2], 10 );
+        }
+    }
+
+    // announce our presence
+    write( CHAN_SIO, &ch, 1 );
+
+    // sbrk() hands out zero-filled memory at the old break, and
+    // takes it back again
+    char *end = (char *) sbrk( 0 );
+    char *mem = (char *) sbrk( 8192 );
+    if( mem == NULL || mem != end || sbrk( 0 ) != end + 8192 ) {
+        sprint( buf, "!! %c: sbrk(8192) gave %x, break was %x\n",
+                ch, (uint32_t) mem, (uint32_t) end );
+        cwrites( buf );
+        ++fails;
+    } else {
+        for( int i = 0; i < 8192; ++i ) {
+            if( mem[i] != 0 ) {
+                sprint( buf, "!! %c: sbrk() memory not zero at %x\n",
+                        ch, (uint32_t) &mem[i] );
+                cwrites( buf );
+                ++fails;
+                break;
+            }
+        }
+        if( sbrk( -8192 ) != end + 8192 || sbrk( 0 ) != end ) {
+            sprint( buf, "!! %c: sbrk(-8192) didn't restore the break\n", ch );
+            cwrites( buf );
+            ++fails;
+        }
+    }
+
+    // the stress loop:  each round, every slot's block is checked
+    // and freed, and a new one of a random size put in its place
+    for( int i = 0; i < N_BLOCKS; ++i ) {
+        blocks[i] = NULL;
+    }
+
+    for( int r = 0; r <= count && fails == 0; ++r ) {
+        for( int i = 0; i < N_BLOCKS && fails == 0; ++i ) {
+            if( blocks[i] != NULL ) {
+                char fill = (char) (i * 7 + sizes[i]);
+                for( uint32_t j = 0; j < sizes[i]; ++j ) {
+                    if( blocks[i][j] != fill ) {
+                        sprint( buf, "!! %c: block %d (%d bytes) overwritten at %d\n",
+                                ch, i, sizes[i], j );
+                        cwrites( buf );
+                        ++fails;
+                        break;
+                    }
+                }
+                free( blocks[i] );
+                blocks[i] = NULL;
+            }
+
+            // the last round only frees
+            if( r == count ) {
+                continue;
+            }
+
+            sizes[i] = 1 + next() % BIG_BLOCK;
+            blocks[i] = (char *) malloc( sizes[i] );
+            if( blocks[i] == NULL || ((uint32_t) blocks[i] & 7) != 0 ) {
+                sprint( buf, "!! %c: malloc(%d) gave %x\n",
+                        ch, sizes[i], (uint32_t) blocks[i] );
+                cwrites( buf );
+                ++fails;
+                blocks[i] = NULL;
+                break;
+            }
+            char fill = (char) (i * 7 + sizes[i]);
+            for( uint32_t j = 0; j < sizes[i]; ++j ) {
+                blocks[i][j] = fill;
+            }
+        }
+        write( CHAN_SIO, &ch, 1 );
+    }
+
+    // requests which can't be met, now that there is a heap to lose
+    // (2GB or more would be a negative increment to sbrk(), which
+    // would shrink the heap instead)
+    end = (char *) sbrk( 0 );
+    if( malloc( 0 ) != NULL || malloc( 0xfffffff0 ) != NULL ||
+        malloc( 0xffffe000 ) != NULL || malloc( 0x80000000 ) != NULL ||
+        sbrk( 0 ) != end ) {
+        sprint( buf, "!! %c: malloc() of 0 or 2GB+ succeeded, or moved the break\n",
+                ch );
+        cwrites( buf );
+        ++fails;
+    }
+    if( sbrk( -(int32_t) ((uint32_t) end + 4096) ) != NULL || sbrk( 0 ) != end ) {
+        sprint( buf, "!! %c: sbrk() moved the break below 0\n", ch );
+        cwrites( buf );
+        ++fails;
+    }
+    free( NULL );
+
+    // freed blocks are used again rather than growing the heap
+    // (once there is one of each size to use)
+    for( int i = 0; i < 100; ++i ) {
+        free( malloc( 1 + i ) );
+    }
+    free( malloc( BIG_BLOCK ) );
+    end = (char *) sbrk( 0 );
+    for( int i = 0; i < 1000 && fails == 0; ++i ) {
+        free( malloc( 1 + i % 100 ) );
+        free( malloc( BIG_BLOCK ) );
+    }
+    if( sbrk( 0 ) != end ) {
+        sprint( buf, "!! %c: malloc/free loop moved the break %x -> %x\n",
+                ch, (uint32_t) end, (uint32_t) sbrk( 0 ) );
+        cwrites( buf );
+        ++fails;
+    }
+
+    sprint( buf, "== %c: malloc test %s\n", ch, fails ? "FAIL" : "PASS" );
+    cwrites( buf );
+
+    exit( fails ? FAILURE : 0 );
+
+    return( 42 );  // shut the compiler up!
+}
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef T_MMAP_H_
+#define T_MMAP_H_
+
+#include "users.h"
+#include "ulib.h"
+
+/**
+** Test tmmap:  exit, write, open, close, pread, mmap, munmap
+**
+** Maps a file from the filesystem and checks every page of the
+** mapping against what pread() reads from the disk, last page first;
+** then checks that writing a private mapping changes neither the file
+** nor another mapping of it; reports PASS or FAIL
+**
+** Invoked as:  tmmap  x  name
+**   where x is the ID character
+**         name is the file to map (e.g., "DATA.TXT")
+*/
+
+// mmap() works in pages of this size
+#define PAGE        4096
+
+// the file as read from the disk, one page at a time
+static char disk[PAGE];
+
+int32_t main( int argc, char *argv[] ) {
+    char ch = 'f';    // default character to print
+    char *name = "";
+    char buf[128];
+    int fails = 0;
+
+    // process the command-line arguments
+    if( argc < 3 ) {
+        bad_args( "tmmap", 3, argc, argv );
+    } else {
+        ch = argv[1][0];
+        name = argv[2];
+    }
+
+    // announce our presence
+    write( CHAN_SIO, &ch, 1 );
+
+    int fd = open( name );
+    if( fd < 0 ) {
+        sprint( buf, "!! %c: open(%s) status %d\n", ch, name, fd );
+        cwrites( buf );
+        sprint( buf, "== %c: mmap test FAIL\n", ch );
+        cwrites( buf );
+        exit( FAILURE );
+    }
+
+    // find the size of the file
+    uint32_t size = 0;
+    int32_t n;
+    while( (n = pread( fd, disk, PAGE, size )) > 0 ) {
+        size += n;
+    }
+    if( n < 0 || size == 0 ) {
+        sprint( buf, "!! %c: pread() of %s status %d after %d bytes\n",
+                ch, name, n, size );
+        cwrites( buf );
+        ++fails;
+    }
+    uint32_t pages = (size + PAGE - 1) / PAGE;
+
+    char *map = NULL;
+    if( fails == 0 ) {
+        map = (char *) mmap( fd, 0, size, PROT_READ );
+        if( map == NULL ) {
+            sprint( buf, "!! %c: mmap(%s, 0, %d) failed\n", ch, name, size );
+            cwrites( buf );
+            ++fails;
+        }
+    }
+
+    // every page, backwards so that no page is found by carrying on
+    // from the one before; past the end of the file there are zeroes
+    for( uint32_t p = pages; p > 0 && fails == 0; --p ) {
+        uint32_t off = (p - 1) * PAGE;
+        n = pread( fd, disk, PAGE, off );
+        if( n <= 0 ) {
+            sprint( buf, "!! %c: pread() at %d status %d\n", ch, off, n );
+            cwrites( buf );
+            ++fails;
+            break;
+        }
+        for( uint32_t i = 0; i < PAGE; ++i ) {
+            char want = (i < (uint32_t) n) ? disk[i] : 0;
+            if( map[off + i] != want ) {
+                sprint( buf, "!! %c: byte %d is %x in the mapping, %x on disk\n",
+                        ch, off + i, map[off + i] & 0xff, want & 0xff );
+                cwrites( buf );
+                ++fails;
+                break;
+            }
+        }
+        write( CHAN_SIO, &ch, 1 );
+    }
+
+    // a private mapping of the last page:  writes go to our own copy
+    if( fails == 0 ) {
+        uint32_t off = (pages - 1) * PAGE;
+        char *copy = (char *) mmap( fd, off, size - off, PROT_READ | PROT_WRITE );
+        if( copy == NULL ) {
+            sprint( buf, "!! %c: mmap(%s, %d, %d) failed\n",
+                    ch, name, off, size - off );
+            cwrites( buf );
+            ++fails;
+        } else {
+            char old = copy[0];
+            copy[0] = ~old;
+            n = pread( fd, disk, 1, off );
+            if( copy[0] != (char) ~old || map[off] != old ||
+                    n != 1 || disk[0] != old ) {
+                sprint( buf, "!! %c: write to a private mapping was seen\n", ch );
+                cwrites( buf );
+                ++fails;
+            }
+            if( munmap( copy ) != E_SUCCESS ) {
+                sprint( buf, "!! %c: munmap() of the private mapping failed\n", ch );
+                cwrites( buf );
+                ++fails;
+            }
+        }
+    }
+
+    if( map != NULL && munmap( map ) != E_SUCCESS ) {
+        sprint( buf, "!! %c: munmap() failed\n", ch );
+        cwrites( buf );
+        ++fails;
+    }
+    close( fd );
+
+    sprint( buf, "== %c: mmap test of %s (%d bytes) %s\n",
+            ch, name, size, fails ? "FAIL" : "PASS" );
+    cwrites( buf );
+
+    exit( fails ? FAILURE : 0 );
+
+    return( 42 );  // shut the compiler up!
+}
+
+#endif
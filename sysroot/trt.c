@@ -0,0 +1,149 @@
+#ifndef T_RT_H_
+#define T_RT_H_
+
+#include "users.h"
+#include "ulib.h"
+
+/**
+** Test trt:  exit, fork, wait, write, gettime, setrt, rtmisses
+**
+** Checks that setrt() refuses bad and unaffordable requests, then runs
+** two periodic real-time tasks next to an ordinary CPU-bound one; each
+** real-time task must be held back at the end of its budget in every
+** period, and must not miss a deadline.  Reports PASS or FAIL
+**
+** Invoked as:  trt  x  [ s ]
+**   where x is the ID character
+**         s is how long to run, in seconds (defaults to 3)
+*/
+
+/**
+** periodic - spin as a real-time task for a while
+**
+** Once the budget for a period is used up, the task doesn't run again
+** until the next period starts; each such wait shows up as a jump in
+** the time.
+**
+** @param runtime   CPU time wanted in each period, in ms
+** @param period    Length of a period, in ms
+** @param ms        How long to run
+** @param misses    Where to put the number of deadlines missed
+**
+** @returns the number of waits seen, or an error code from setrt()
+*/
+static int periodic( uint32_t runtime, uint32_t period, uint32_t ms,
+                     uint32_t *misses ) {
+    int status = setrt( runtime, period, 0 );
+    if( status != E_SUCCESS ) {
+        return( status );
+    }
+
+    int waits = 0;
+    time_t start = gettime();
+    time_t last = start;
+    while( last - start < ms ) {
+        time_t now = gettime();
+        if( now - last > (period - runtime) / 2 ) {
+            ++waits;
+        }
+        last = now;
+    }
+
+    // going back to being ordinary forgets the misses
+    *misses = rtmisses();
+    setrt( 0, 0, 0 );
+    return( waits );
+}
+
+int32_t main( int argc, char *argv[] ) {
+    int secs = 3;     // default run time
+    char ch = 't';    // default character to print
+    char buf[128];
+    int fails = 0;
+
+    // process the command-line arguments
+    if( argc < 2 ) {
+        bad_args( "trt", 2, argc, argv );
+    } else {
+        ch = argv[1][0];
+        if( argc > 2 ) {
+            secs = str2int( argv[2], 10 );
+        }
+    }
+
+    // announce our presence
+    write( CHAN_SIO, &ch, 1 );
+
+    // more time than the deadline allows, and more of the CPU than
+    // can be promised
+    int s1 = setrt( 50, 100, 40 );
+    int s2 = setrt( 950, 1000, 0 );
+    if( s1 != E_BAD_PARAM || s2 != E_OVERLOAD ) {
+        sprint( buf, "!! %c: setrt() of bad/too much time gave %d/%d\n",
+                ch, s1, s2 );
+        cwrites( buf );
+        ++fails;
+        setrt( 0, 0, 0 );
+    }
+
+    // an ordinary process which wants the whole CPU
+    pid_t hog = fork();
+    if( hog == 0 ) {
+        time_t end = gettime() + SEC_TO_MS(secs + 1);
+        while( gettime() < end ) {
+            continue;
+        }
+        exit( 0 );
+    }
+
+    // a second real-time task, with a different period; it reports
+    // its waits and misses through its exit status
+    pid_t other = fork();
+    if( other == 0 ) {
+        uint32_t misses;
+        int waits = periodic( 30, 150, SEC_TO_MS(secs), &misses );
+        exit( waits < 0 ? waits : waits * 1000 + (int) misses );
+    }
+
+    if( hog < 0 || other < 0 ) {
+        sprint( buf, "!! %c: fork() status %d/%d\n", ch, hog, other );
+        cwrites( buf );
+        ++fails;
+    }
+
+    // the task:  20ms out of every 100ms
+    uint32_t misses = 0;
+    int waits = periodic( 20, 100, SEC_TO_MS(secs), &misses );
+    write( CHAN_SIO, &ch, 1 );
+
+    // it waited about once per period
+    if( waits < secs * 1000 / 100 / 2 || misses != 0 ) {
+        sprint( buf, "!! %c: 20/100 task waited %d times, missed %d\n",
+                ch, waits, misses );
+        cwrites( buf );
+        ++fails;
+    }
+
+    // collect the children
+    int32_t status;
+    pid_t whom;
+    while( (whom = wait( &status )) > 0 ) {
+        if( whom == other && (status < 0 ||
+                status / 1000 < secs * 1000 / 150 / 2 || status % 1000 != 0) ) {
+            sprint( buf, "!! %c: 30/150 task status %d (waits*1000 + misses)\n",
+                    ch, status );
+            cwrites( buf );
+            ++fails;
+        }
+    }
+
+    sprint( buf, "== %c: rt test %s (%d waits, %d misses)\n",
+            ch, fails ? "FAIL" : "PASS", waits, misses );
+    cwrites( buf );
+
+    exit( fails ? FAILURE : 0 );
+
+    return( 42 );  // shut the compiler up!
+}
+
+#endif
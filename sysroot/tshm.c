@@ -0,0 +1,177 @@
+#ifndef T_SHM_H_
+#define T_SHM_H_
+
+#include "users.h"
+#include "ulib.h"
+
+/**
+** Test tshm:  exit, fork, wait, sleep, write, shm_create, shm_map
+**
+** A producer and a consumer each find a shared memory segment by its
+** key and map it, then pass numbers through a ring buffer in it; the
+** consumer checks that it gets all of them, in order.  Then checks
+** that the segments a process creates without mapping them go away
+** when it exits.  Reports PASS or FAIL
+**
+** Invoked as:  tshm  x  [ n ]
+**   where x is the ID character
+**         n is how many numbers to pass (defaults to 10000)
+*/
+
+// slots in the ring buffer
+#define RING_SIZE   64
+
+// what is in the segment
+typedef struct ring_s {
+    volatile uint32_t head;     // next slot the producer fills
+    volatile uint32_t tail;     // next slot the consumer empties
+    volatile uint32_t data[RING_SIZE];
+} ring_t;
+
+// the numbers passed are this sequence, so a lost or repeated
+// one is noticed
+#define VALUE(i)    ((i) * 2654435761U)
+
+// how long (in 10ms naps) the producer waits for room in the ring
+// before deciding the consumer is gone
+#define STALL       1000
+
+int32_t main( int argc, char *argv[] ) {
+    int count = 10000;  // default number count
+    char ch = 's';      // default character to print
+    char buf[128];
+    int fails = 0;
+
+    // process the command-line arguments
+    if( argc < 2 ) {
+        bad_args( "tshm", 2, argc, argv );
+    } else {
+        ch = argv[1][0];
+        if( argc > 2 ) {
+            count = str2int( argv[2], 10 );
+        }
+    }
+
+    // announce our presence
+    write( CHAN_SIO, &ch, 1 );
+
+    // different copies of this program use different segments
+    uint32_t key = 0x73686d00 | (uint8_t) ch;
+
+    int handle = shm_create( key, sizeof(ring_t) );
+    if( handle < 0 ) {
+        sprint( buf, "!! %c: shm_create(%x) status %d\n", ch, key, handle );
+        cwrites( buf );
+        sprint( buf, "== %c: shm test FAIL\n", ch );
+        cwrites( buf );
+        exit( FAILURE );
+    }
+
+    // the consumer finds the segment by its key, and maps it itself
+    pid_t consumer = fork();
+    if( consumer < 0 ) {
+        sprint( buf, "!! %c: fork() status %d\n", ch, consumer );
+        cwrites( buf );
+        ++fails;
+    } else if( consumer == 0 ) {
+        int mine = shm_create( key, sizeof(ring_t) );
+        ring_t *ring = (ring_t *) shm_map( mine );
+        if( mine != handle || ring == NULL ) {
+            exit( FAILURE );
+        }
+        // keep taking numbers after a bad one, so the producer finishes
+        int bad = 0;
+        for( int i = 0; i < count; ++i ) {
+            while( ring->tail == ring->head ) {
+                sleep( 10 );
+            }
+            if( ring->data[ring->tail % RING_SIZE] != VALUE(i) && bad == 0 ) {
+                bad = i + 1;
+            }
+            ++ring->tail;
+        }
+        exit( bad );
+    }
+
+    // the producer
+    ring_t *ring = NULL;
+    if( fails == 0 ) {
+        ring = (ring_t *) shm_map( handle );
+        if( ring == NULL ) {
+            sprint( buf, "!! %c: shm_map(%d) failed\n", ch, handle );
+            cwrites( buf );
+            ++fails;
+        } else {
+            for( int i = 0; i < count && fails == 0; ++i ) {
+                for( int n = 0; ring->head - ring->tail == RING_SIZE; ++n ) {
+                    if( n == STALL ) {
+                        sprint( buf, "!! %c: consumer stopped after %d\n",
+                                ch, ring->tail );
+                        cwrites( buf );
+                        ++fails;
+                        break;
+                    }
+                    sleep( 10 );
+                }
+                if( fails != 0 ) {
+                    break;
+                }
+                ring->data[ring->head % RING_SIZE] = VALUE(i);
+                ++ring->head;
+                if( (i + 1) % (count / 10 + 1) == 0 ) {
+                    write( CHAN_SIO, &ch, 1 );
+                }
+            }
+        }
+    }
+
+    // if the producer couldn't finish, the consumer is killed
+    if( consumer > 0 ) {
+        int32_t status;
+        if( fails != 0 ) {
+            kill( consumer );
+        }
+        pid_t whom = wait( &status );
+        if( fails == 0 && (whom != consumer || status != 0) ) {
+            sprint( buf, "!! %c: consumer %d status %d (number %d bad)\n",
+                    ch, whom, status, status > 0 ? status - 1 : -1 );
+            cwrites( buf );
+            ++fails;
+        }
+    }
+
+    // segments which are created but never mapped must not outlive
+    // their creator:  two children in a row can each create as many
+    // as there is room for
+    int32_t made[2];
+    for( int c = 0; c < 2 && fails == 0; ++c ) {
+        pid_t whom = fork();
+        if( whom == 0 ) {
+            int n = 0;
+            while( shm_create( key + 0x100 * (n + 1), 4096 ) >= 0 ) {
+                ++n;
+            }
+            exit( n );
+        }
+        if( whom < 0 || wait( &made[c] ) != whom ) {
+            sprint( buf, "!! %c: fork()/wait() for creator %d failed\n", ch, c );
+            cwrites( buf );
+            ++fails;
+        }
+    }
+    if( fails == 0 && (made[0] <= 0 || made[1] != made[0]) ) {
+        sprint( buf, "!! %c: creators got %d then %d segments\n",
+                ch, made[0], made[1] );
+        cwrites( buf );
+        ++fails;
+    }
+
+    sprint( buf, "== %c: shm test %s\n", ch, fails ? "FAIL" : "PASS" );
+    cwrites( buf );
+
+    exit( fails ? FAILURE : 0 );
+
+    return( 42 );  // shut the compiler up!
+}
+
+#endif
@@ -334,6 +334,52 @@ int32_t init( int argc, char *argv[] ) {
     swritech( 'v' );
 #endif
 
+    // The tests each check one feature and report PASS or FAIL
+
+#ifdef SPAWN_TMALLOC
+    // malloc/free stress, 20 rounds
+    ARGS2( tmalloc, "tmalloc", "m", "20" );
+    whom = spawn( BIN_TMALLOC, argv_tmalloc );
+    if( whom < 0 ) {
+        cwrites( "init, spawn() tmalloc failed\n" );
+    }
+    swritech( ch );
+    swritech( 'm' );
+#endif
+
+#ifdef SPAWN_TMMAP
+    // mmap() against pread(), of a file which must be on the disk
+    ARGS2( tmmap, "tmmap", "f", "DATA.TXT" );
+    whom = spawn( BIN_TMMAP, argv_tmmap );
+    if( whom < 0 ) {
+        cwrites( "init, spawn() tmmap failed\n" );
+    }
+    swritech( ch );
+    swritech( 'f' );
+#endif
+
+#ifdef SPAWN_TSHM
+    // shm producer/consumer, passing 10000 numbers
+    ARGS2( tshm, "tshm", "s", "10000" );
+    whom = spawn( BIN_TSHM, argv_tshm );
+    if( whom < 0 ) {
+        cwrites( "init, spawn() tshm failed\n" );
+    }
+    swritech( ch );
+    swritech( 's' );
+#endif
+
+#ifdef SPAWN_TRT
+    // periodic real-time tasks next to a CPU hog, for 3 seconds
+    ARGS2( trt, "trt", "t", "3" );
+    whom = spawn( BIN_TRT, argv_trt );
+    if( whom < 0 ) {
+        cwrites( "init, spawn() trt failed\n" );
+    }
+    swritech( ch );
+    swritech( 't' );
+#endif
+
     // Users W through Z are spawned elsewhere
 
     swrites( " !!!\r\n\n" );